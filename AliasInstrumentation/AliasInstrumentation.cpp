@@ -10,6 +10,7 @@
 #include <llvm/Support/CommandLine.h>
 #include <llvm/Transforms/Utils/BasicBlockUtils.h>
 
+#include <algorithm>
 #include <iostream>
 #include <iterator>
 
@@ -26,10 +27,33 @@ static cl::opt<bool> RunFunctionAliasInstrumentation(
     "function-alias-checks", cl::desc("Insert function-scoped alias checks"),
     cl::init(false), cl::ZeroOrMore);
 
+static cl::opt<bool> RunAutoAliasInstrumentation(
+    "auto-alias-checks",
+    cl::desc("Choose the scope of alias checks for each function"),
+    cl::init(false), cl::ZeroOrMore);
+
+static cl::opt<bool> AliasChecksReport(
+    "alias-checks-report",
+    cl::desc("Show the scope chosen for each function by -auto-alias-checks"),
+    cl::init(false), cl::ZeroOrMore);
+
+static cl::opt<unsigned> AliasChecksTripCount(
+    "alias-checks-trip-count",
+    cl::desc("Trip count assumed for loops whose trip count is unknown"),
+    cl::init(100), cl::ZeroOrMore);
+
 static cl::opt<bool> AliasInstrumentationStats(
     "alias-checks-stats", cl::desc("Show DBG stats for alias instrumentation"),
     cl::init(false), cl::ZeroOrMore);
 
+// Instructions inserted to check one pair of pointers: four casts, two
+// comparisons and two logic operations.
+static const uint64_t PairCheckCost = 8;
+
+// Bound of the estimated check executions, so products of trip counts do not
+// overflow.
+static const uint64_t MaxExecutions = 1ULL << 40;
+
 template <typename T>
 std::pair<T, T> makeOrderedPair(const T &t1, const T &t2) {
   return (t1 < t2) ? std::make_pair(t1, t2) : std::make_pair(t2, t1);
@@ -62,57 +86,65 @@ static bool regionHasLoop(Region *R, LoopInfo *LI) {
 }
 
 void AliasInstrumentation::fixAliasInfo(Region *R) {
-  MDBuilder MDB(CurrentFn->getContext());
+  LLVMContext &Ctx = CurrentFn->getContext();
+  MDBuilder MDB(Ctx);
   if (!MDDomain)
     MDDomain = MDB.createAnonymousAliasScopeDomain(CurrentFn->getName());
-  DenseMap<const Value *, MDNode *> Scopes;
+  auto &BasePtrsData = PtrRA->RegionsRangeData[R].BasePtrsData;
+  std::vector<std::pair<const Value *, MDNode *>> Scopes;
   unsigned PtrCount = 0;
 
   // Create a different alias scope for each base pointer in the region.
-  for (auto &Pair : PtrRA->RegionsRangeData[R].BasePtrsData) {
+  for (auto &Pair : BasePtrsData) {
     const Value *BasePtr = Pair.first;
     std::string Name = CurrentFn->getName();
 
     Name += (BasePtr->hasName()) ? (": %" + BasePtr->getName().str())
                                  : (": ptr " + utostr(PtrCount++));
     MDNode *Scope = MDB.createAnonymousAliasScope(MDDomain, Name);
-    Scopes.insert(std::make_pair(BasePtr, Scope));
+    Scopes.push_back(std::make_pair(BasePtr, Scope));
   }
 
-  // Set the actual scoped alias tags for each memory instruction in the region.
-  // A memory instruction always aliases its base pointer and never aliases
-  // other pointers in the region.
-  for (auto &Pair : PtrRA->RegionsRangeData[R].BasePtrsData) {
-    const Value *BasePtr = Pair.first;
+  // Build the scope and noalias lists of each base pointer only once. A memory
+  // instruction always aliases its base pointer and never aliases other
+  // pointers in the region, so every instruction with the same base pointer
+  // shares the same pair of lists.
+  DenseMap<const Value *, std::pair<MDNode *, MDNode *>> ScopeLists;
+
+  for (unsigned I = 0, E = Scopes.size(); I != E; I++) {
+    SmallVector<Metadata *, 8> NoAliasScopes;
+
+    for (unsigned J = 0; J != E; J++)
+      if (J != I)
+        NoAliasScopes.push_back(Scopes[J].second);
+
+    MDNode *ScopeList = MDNode::get(Ctx, Scopes[I].second);
+    MDNode *NoAliasList =
+        NoAliasScopes.empty() ? nullptr : MDNode::get(Ctx, NoAliasScopes);
+    ScopeLists[Scopes[I].first] = std::make_pair(ScopeList, NoAliasList);
+    AliasMDNodes += NoAliasList ? 2 : 1;
+  }
+
+  // Set the actual scoped alias tags for each memory instruction in the region
+  // for which we have range info.
+  for (auto &Pair : BasePtrsData) {
+    std::pair<MDNode *, MDNode *> &Lists = ScopeLists[Pair.first];
 
-    // Set the alias metadata for each memory access instruction in the region
-    // for which we have range info.
     for (auto MemInst : Pair.second.AccessInstructions) {
       // Check that the instruction was not removed from the region.
       if (!MemInst->getParent())
         continue;
 
-      // A memory instruction always aliases its base pointer.
       MemInst->setMetadata(
           LLVMContext::MD_alias_scope,
-          MDNode::concatenate(
-              MemInst->getMetadata(LLVMContext::MD_alias_scope),
-              MDNode::get(CurrentFn->getContext(), Scopes[BasePtr])));
-
-      // The instruction never aliases other pointers in the region.
-      for (auto &OtherPair : PtrRA->RegionsRangeData[R].BasePtrsData) {
-        const Value *OtherBasePtr = OtherPair.first;
-
-        // Slip the instruction's own base pointer.
-        if (OtherBasePtr == BasePtr)
-          continue;
+          MDNode::concatenate(MemInst->getMetadata(LLVMContext::MD_alias_scope),
+                              Lists.first));
 
+      if (Lists.second)
         MemInst->setMetadata(
             LLVMContext::MD_noalias,
-            MDNode::concatenate(
-                MemInst->getMetadata(LLVMContext::MD_noalias),
-                MDNode::get(CurrentFn->getContext(), Scopes[OtherBasePtr])));
-      }
+            MDNode::concatenate(MemInst->getMetadata(LLVMContext::MD_noalias),
+                                Lists.second));
     }
   }
 }
@@ -429,13 +461,160 @@ bool AliasInstrumentation::canInstrument(Region *R) {
   return true;
 }
 
+void AliasInstrumentation::collectScopeRegions(Region *R, bool InRegionScope,
+                                               std::vector<Region *> &Regions) {
+  if (!InRegionScope) {
+    if (canInstrument(R))
+      Regions.push_back(R);
+
+    return;
+  }
+
+  if (!canInstrument(R) || !PtrRA->RegionsRangeData[R].HasFullSideEffectInfo) {
+    for (auto SubRegion = R->end(); SubRegion != R->begin();) {
+      --SubRegion;
+      collectScopeRegions(&(**SubRegion), InRegionScope, Regions);
+    }
+
+    return;
+  }
+
+  Regions.push_back(R);
+}
+
+uint64_t AliasInstrumentation::getCheckExecutions(Region *R) {
+  uint64_t Executions = 1;
+
+  // The checks are inserted before the entry of the region, so they run in
+  // every iteration of the loops that contain the region.
+  Loop *L = LI->getLoopFor(R->getEntry());
+
+  while (L && R->contains(L))
+    L = L->getParentLoop();
+
+  for (; L; L = L->getParentLoop()) {
+    uint64_t TripCount = SE->getSmallConstantTripCount(L);
+
+    if (TripCount == 0)
+      TripCount = AliasChecksTripCount;
+    TripCount = std::max(TripCount, (uint64_t)1);
+
+    // Saturate before multiplying, so deep nests cannot overflow.
+    if (Executions > MaxExecutions / TripCount)
+      return MaxExecutions;
+    Executions *= TripCount;
+  }
+
+  return Executions;
+}
+
+void AliasInstrumentation::evaluateScope(bool InRegionScope,
+                                         std::vector<Loop *> &HotLoops,
+                                         ScopePlan &Plan) {
+  std::vector<Region *> Regions;
+  collectScopeRegions(RI->getTopLevelRegion(), InRegionScope, Regions);
+
+  Plan.Pairs = Plan.Executions = Plan.CloneSize = Plan.Cost = 0;
+  Plan.CoveredLoops = 0;
+
+  for (Region *R : Regions) {
+    ValuePairSet PtrPairsToCheck;
+    computePtrsDependence(R, &PtrPairsToCheck);
+
+    // Regions without conflicting pointers are neither checked nor cloned.
+    if (PtrPairsToCheck.size() == 0)
+      continue;
+
+    uint64_t Executions = getCheckExecutions(R);
+    uint64_t Size = 0;
+
+    for (BasicBlock *BB : R->blocks())
+      Size += BB->size();
+
+    Plan.Regions.push_back(R);
+    Plan.Pairs += PtrPairsToCheck.size();
+    uint64_t Pairs = PtrPairsToCheck.size();
+    if (Executions > (MaxExecutions - Plan.Executions) / Pairs)
+      Plan.Executions = MaxExecutions;
+    else
+      Plan.Executions += Pairs * Executions;
+    Plan.CloneSize += Size;
+  }
+
+  for (Loop *L : HotLoops)
+    for (Region *R : Plan.Regions)
+      if (R->contains(L)) {
+        Plan.CoveredLoops++;
+        break;
+      }
+
+  // The checks run every time, while the clone is only paid once in code size.
+  Plan.Cost = Plan.Executions * PairCheckCost + Plan.CloneSize;
+}
+
+void AliasInstrumentation::planScope() {
+  std::vector<Loop *> HotLoops;
+
+  // Innermost loops that write memory are the ones alias checks pay off for.
+  for (auto BBIt = CurrentFn->begin(), BE = CurrentFn->end(); BBIt != BE;
+       ++BBIt) {
+    BasicBlock *Header = BBIt;
+    Loop *L = LI->getLoopFor(Header);
+
+    if (!L || L->getHeader() != Header || !L->empty())
+      continue;
+
+    bool HasStore = false;
+
+    for (BasicBlock *BB : L->blocks())
+      for (Instruction &I : *BB)
+        HasStore |= isa<StoreInst>(I);
+
+    if (HasStore)
+      HotLoops.push_back(L);
+  }
+
+  ScopePlan FunctionPlan, RegionPlan;
+  evaluateScope(false, HotLoops, FunctionPlan);
+  evaluateScope(true, HotLoops, RegionPlan);
+
+  // Prefer the scope that covers more hot loops, and then the cheapest one.
+  bool ChooseRegion;
+
+  if (FunctionPlan.CoveredLoops != RegionPlan.CoveredLoops)
+    ChooseRegion = RegionPlan.CoveredLoops > FunctionPlan.CoveredLoops;
+  else
+    ChooseRegion = RegionPlan.Cost < FunctionPlan.Cost;
+
+  FunctionScope = !ChooseRegion;
+  RegionScope = ChooseRegion;
+
+  if (!AliasChecksReport || HotLoops.empty())
+    return;
+
+  auto printPlan = [&](const char *Scope, ScopePlan &Plan) {
+    std::cerr << ", " << Scope << ": {pairs: " << Plan.Pairs
+              << ", executions: " << Plan.Executions
+              << ", clone-size: " << Plan.CloneSize
+              << ", covered-loops: " << Plan.CoveredLoops
+              << ", cost: " << Plan.Cost << "}";
+  };
+
+  std::cerr << "[ALIAS-SCOPE] function: " << std::string(CurrentFn->getName())
+            << ", hot-loops: " << HotLoops.size();
+  printPlan("function-scope", FunctionPlan);
+  printPlan("region-scope", RegionPlan);
+  std::cerr << ", choice: " << (ChooseRegion ? "region" : "function")
+            << std::endl;
+}
+
 void AliasInstrumentation::instrumentRegion(Region *R) {
-  if (RunFunctionAliasInstrumentation && !canInstrument(R))
+  if (FunctionScope && !canInstrument(R))
     return;
 
   // In region-scoped mode, if a given region can't be instrumented, we try its
   // children (only instrument regions for which full range info is available).
-  if (RunRegionAliasInstrumentation &&
+  if (RegionScope &&
      (!canInstrument(R) || !PtrRA->RegionsRangeData[R].HasFullSideEffectInfo)) {
 
     // Traverse children in reverse order, so we reach dominated regions first.
@@ -464,6 +643,12 @@ bool AliasInstrumentation::runOnFunction(llvm::Function &F) {
   CurrentFn = &F;
 
   releaseMemory();
+  FunctionScope = RunFunctionAliasInstrumentation;
+  RegionScope = RunRegionAliasInstrumentation;
+
+  if (RunAutoAliasInstrumentation)
+    planScope();
+
   instrumentRegion(RI->getTopLevelRegion());
 
   // Print final stats.
@@ -481,7 +666,7 @@ bool AliasInstrumentation::runOnFunction(llvm::Function &F) {
     if (TotalLoops > 0)
       std::cerr << "[RESTRICTIFICATION] function: " << std::string(F.getName()) <<
         ", total-loops: " << TotalLoops << ", restrictified-loops: " <<
-        ClonedLoops << std::endl;
+        ClonedLoops << ", alias-md-nodes: " << AliasMDNodes << std::endl;
   }
 
   return true;
@@ -503,7 +688,8 @@ char AliasInstrumentation::ID = 0;
 
 static void registerAliasInstrumentation(const PassManagerBuilder &Builder,
                                          legacy::PassManagerBase &PM) {
-  if (!RunRegionAliasInstrumentation && !RunFunctionAliasInstrumentation)
+  if (!RunRegionAliasInstrumentation && !RunFunctionAliasInstrumentation &&
+      !RunAutoAliasInstrumentation)
     return;
 
   PM.add(new AliasInstrumentation());
@@ -41,6 +41,7 @@
 #include <functional>
 #include <map>
 #include <set>
+#include <vector>
 
 using namespace llvm;
 
@@ -68,12 +69,49 @@ class AliasInstrumentation : public FunctionPass {
 
   std::set<BasicBlock*> ClonedBlocks;
 
+  // Scope used in the current function. With -auto-alias-checks, it is chosen
+  // by planScope, otherwise it is given by the command line.
+  bool FunctionScope;
+  bool RegionScope;
+
+  // Estimated costs of instrumenting a function with a given scope.
+  typedef struct ScopePlan {
+    std::vector<Region *> Regions; // Regions that get checks and clones.
+    uint64_t Pairs;                // Pointer pairs checked.
+    uint64_t Executions;           // Pair checks run, weighted by loop trips.
+    uint64_t CloneSize;            // Instructions cloned.
+    unsigned CoveredLoops;         // Hot loops inside a cloned region.
+    uint64_t Cost;
+  } ScopePlan;
+
   // [DBG]
   size_t ClonedLoops;
+  size_t AliasMDNodes; // Alias scope lists built by fixAliasInfo.
 
   // Walks the region tree, instrumenting the greatest possible regions.
   void instrumentRegion(Region *R);
 
+  // Collects the regions that instrumentRegion would instrument in the given
+  // scope, without changing the function.
+  void collectScopeRegions(Region *R, bool InRegionScope,
+                           std::vector<Region *> &Regions);
+
+  // Estimates how many times the checks of a region run: the product of the
+  // trip counts of the loops around it (a default count is used for the loops
+  // whose trip count is unknown).
+  uint64_t getCheckExecutions(Region *R);
+
+  // Computes the number of pairs, check executions, clone size and covered hot
+  // loops of instrumenting the current function in the given scope. Hot loops
+  // are the innermost loops that write memory.
+  void evaluateScope(bool InRegionScope, std::vector<Loop *> &HotLoops,
+                     ScopePlan &Plan);
+
+  // Chooses between function and region scope for the current function: the
+  // cheapest one that covers all hot loops, or the one that covers the most
+  // loops if neither covers them all.
+  void planScope();
+
   // Checks if there are basic properties that prevent us from instrumenting
   // this region, e.g., no exit block or absence of loops.
   bool canInstrument(Region *R);
@@ -166,6 +204,7 @@ public:
   {
     ClonedBlocks.clear();
     ClonedLoops = 0;
+    AliasMDNodes = 0;
   }
 };
 
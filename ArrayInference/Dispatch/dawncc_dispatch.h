@@ -0,0 +1,55 @@
+// Runtime dispatcher of the loops written with -Runtime-Dispatch.
+//
+// Each loop is written in three versions: offloaded, OpenMP "parallel for"
+// and serial. Before each execution, dawncc_dispatch_begin chooses the
+// version to run, by the number of iterations of the execution, and
+// dawncc_dispatch_end records how long it took (see dispatchRT.c).
+
+#ifndef DAWNCC_DISPATCH_H
+#define DAWNCC_DISPATCH_H
+
+#define DAWNCC_SERIAL 0
+#define DAWNCC_PARALLEL 1
+#define DAWNCC_OFFLOAD 2
+#define DAWNCC_VARIANTS 3
+
+// Executions are grouped by their number of iterations, in powers of two.
+#define DAWNCC_BUCKETS 64
+
+typedef struct {
+  int state;
+  int variant;
+  unsigned probes[DAWNCC_VARIANTS];
+  double best[DAWNCC_VARIANTS];
+  unsigned long long runs;
+} DawnCCBucket;
+
+// One loop of the source. The line is the line of the loop in the original
+// file.
+typedef struct DawnCCSite {
+  const char *file;
+  int line;
+  int registered;
+  double start;
+  struct DawnCCSite *next;
+  DawnCCBucket buckets[DAWNCC_BUCKETS];
+} DawnCCSite;
+
+#define DAWNCC_SITE(line) {__FILE__, line}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Returns the version of the loop to run: DAWNCC_SERIAL, DAWNCC_PARALLEL or
+// DAWNCC_OFFLOAD.
+int dawncc_dispatch_begin(DawnCCSite *site, long long size);
+
+// Records the end of an execution that started dawncc_dispatch_begin.
+void dawncc_dispatch_end(DawnCCSite *site, long long size, int variant);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,236 @@
+// Runtime of the loops dispatched by -Runtime-Dispatch (see
+// dawncc_dispatch.h).
+//
+// Executions of a loop are grouped in buckets by their number of iterations,
+// in powers of two. In each bucket, the first executions probe the versions
+// of the loop in turn, until each one ran DAWNCC_DISPATCH_PROBES times (3 by
+// default). The version with the shortest run is then used for the bucket,
+// and after DAWNCC_DISPATCH_REPROBE executions (1000 by default, 0 never
+// probes again) the versions are probed again, as the input may change.
+//
+// When the environment variable DAWNCC_DISPATCH_OUTPUT names a file, the
+// decisions are written to it when the program ends, one line per bucket:
+//
+//   file:line bucket version serial-time parallel-time offload-time
+//
+// where "bucket" is the smallest number of iterations of the bucket, and the
+// times are the shortest runs of each version, in seconds ("-" if it was not
+// probed). The file may be passed in DAWNCC_DISPATCH_INPUT to later runs,
+// which then use the versions listed for those buckets without probing.
+// Lines starting with "#" are ignored.
+//
+// The runtime is not thread safe: dispatched loops must run in serial code.
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "dawncc_dispatch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define DD_PROBING 0
+#define DD_CHOSEN 1
+#define DD_FROZEN 2
+
+typedef struct {
+  char *file;
+  int line;
+  int bucket;
+  int variant;
+} DDDecision;
+
+static const char *VariantNames[DAWNCC_VARIANTS] = {"serial", "parallel",
+                                                    "offload"};
+
+static DawnCCSite *Sites;
+static DawnCCSite **SitesEnd = &Sites;
+
+static DDDecision *Decisions;
+static unsigned NumDecisions;
+
+static unsigned Probes = 3;
+static unsigned long long Reprobe = 1000;
+static int Initialized;
+
+static double dd_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int dd_bucket(long long size) {
+  int bucket = 0;
+
+  while ((size > 0) && (bucket < DAWNCC_BUCKETS - 1)) {
+    size >>= 1;
+    bucket++;
+  }
+  return bucket;
+}
+
+static long long dd_bucket_size(int bucket) {
+  return bucket ? (1LL << (bucket - 1)) : 0;
+}
+
+static void dd_write_decisions(void) {
+  const char *name = getenv("DAWNCC_DISPATCH_OUTPUT");
+  DawnCCSite *site;
+  FILE *out;
+  int b, v;
+
+  if (!name || !*name)
+    return;
+  out = fopen(name, "w");
+  if (!out) {
+    fprintf(stderr, "[DISPATCH] ERROR: cannot write %s\n", name);
+    return;
+  }
+
+  fprintf(out, "# file:line bucket version serial-time parallel-time "
+               "offload-time\n");
+  for (site = Sites; site; site = site->next)
+    for (b = 0; b < DAWNCC_BUCKETS; b++) {
+      DawnCCBucket *bucket = &site->buckets[b];
+      if (bucket->state == DD_PROBING)
+        continue;
+      fprintf(out, "%s:%d %lld %s", site->file, site->line, dd_bucket_size(b),
+              VariantNames[bucket->variant]);
+      for (v = 0; v < DAWNCC_VARIANTS; v++)
+        if (bucket->probes[v])
+          fprintf(out, " %.9f", bucket->best[v]);
+        else
+          fprintf(out, " -");
+      fprintf(out, "\n");
+    }
+  fclose(out);
+}
+
+static void dd_read_decisions(const char *name) {
+  char line[4096];
+  FILE *in = fopen(name, "r");
+
+  if (!in) {
+    fprintf(stderr, "[DISPATCH] ERROR: cannot read %s\n", name);
+    return;
+  }
+
+  while (fgets(line, sizeof(line), in)) {
+    char variant[16];
+    char *colon, *space;
+    long long size;
+    int loopLine, v;
+    DDDecision *decision;
+
+    if ((line[0] == '#') || !(space = strchr(line, ' ')))
+      continue;
+    *space = '\0';
+    colon = strrchr(line, ':');
+    if (!colon || (sscanf(colon + 1, "%d", &loopLine) != 1) ||
+        (sscanf(space + 1, "%lld %15s", &size, variant) != 2))
+      continue;
+    for (v = 0; v < DAWNCC_VARIANTS; v++)
+      if (!strcmp(variant, VariantNames[v]))
+        break;
+    if (v == DAWNCC_VARIANTS)
+      continue;
+
+    decision = (DDDecision *)realloc(Decisions,
+                                     (NumDecisions + 1) * sizeof(DDDecision));
+    if (!decision) {
+      fprintf(stderr, "[DISPATCH] ERROR: out of memory\n");
+      exit(1);
+    }
+    Decisions = decision;
+    decision = &Decisions[NumDecisions++];
+    *colon = '\0';
+    decision->file = strdup(line);
+    decision->line = loopLine;
+    decision->bucket = dd_bucket(size);
+    decision->variant = v;
+  }
+  fclose(in);
+}
+
+static void dd_initialize(void) {
+  const char *value;
+
+  Initialized = 1;
+  if ((value = getenv("DAWNCC_DISPATCH_PROBES")) && (atoi(value) > 0))
+    Probes = (unsigned)atoi(value);
+  if ((value = getenv("DAWNCC_DISPATCH_REPROBE")))
+    Reprobe = strtoull(value, NULL, 10);
+  if ((value = getenv("DAWNCC_DISPATCH_INPUT")) && *value)
+    dd_read_decisions(value);
+  atexit(dd_write_decisions);
+}
+
+static void dd_register(DawnCCSite *site) {
+  unsigned i;
+
+  site->registered = 1;
+  *SitesEnd = site;
+  SitesEnd = &site->next;
+
+  // Frozen decisions are never probed again.
+  for (i = 0; i < NumDecisions; i++)
+    if ((Decisions[i].line == site->line) &&
+        !strcmp(Decisions[i].file, site->file)) {
+      DawnCCBucket *bucket = &site->buckets[Decisions[i].bucket];
+      bucket->state = DD_FROZEN;
+      bucket->variant = Decisions[i].variant;
+    }
+}
+
+int dawncc_dispatch_begin(DawnCCSite *site, long long size) {
+  DawnCCBucket *bucket;
+  int v, next = 0;
+
+  if (!Initialized)
+    dd_initialize();
+  if (!site->registered)
+    dd_register(site);
+
+  bucket = &site->buckets[dd_bucket(size)];
+  if (bucket->state == DD_FROZEN)
+    return bucket->variant;
+  if (bucket->state == DD_CHOSEN) {
+    if (!Reprobe || (++bucket->runs < Reprobe))
+      return bucket->variant;
+    memset(bucket->probes, 0, sizeof(bucket->probes));
+    bucket->state = DD_PROBING;
+  }
+
+  // Probe the version that ran the fewest times.
+  for (v = 1; v < DAWNCC_VARIANTS; v++)
+    if (bucket->probes[v] < bucket->probes[next])
+      next = v;
+  site->start = dd_now();
+  return next;
+}
+
+void dawncc_dispatch_end(DawnCCSite *site, long long size, int variant) {
+  DawnCCBucket *bucket = &site->buckets[dd_bucket(size)];
+  double elapsed;
+  int v;
+
+  if (bucket->state != DD_PROBING)
+    return;
+  elapsed = dd_now() - site->start;
+  if (!bucket->probes[variant] || (elapsed < bucket->best[variant]))
+    bucket->best[variant] = elapsed;
+  bucket->probes[variant]++;
+
+  for (v = 0; v < DAWNCC_VARIANTS; v++)
+    if (bucket->probes[v] < Probes)
+      return;
+
+  // The shortest run discards the cost of starting the device or the threads.
+  bucket->variant = DAWNCC_SERIAL;
+  for (v = 1; v < DAWNCC_VARIANTS; v++)
+    if (bucket->best[v] < bucket->best[bucket->variant])
+      bucket->variant = v;
+  bucket->state = DD_CHOSEN;
+  bucket->runs = 0;
+}
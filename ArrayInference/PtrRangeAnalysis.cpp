@@ -3,9 +3,13 @@
 #include "PtrRangeAnalysis.h"
 
 #include <llvm/Analysis/AliasAnalysis.h>
+#include <llvm/IR/DIBuilder.h>
+#include <llvm/IR/DebugInfo.h>
+#include <llvm/IR/IntrinsicInst.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Type.h>
 #include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Dwarf.h>
 #include <llvm/Transforms/Scalar.h>
 #include "llvm/ADT/Statistic.h"
 
@@ -21,6 +25,8 @@ STATISTIC(numMA , "Number of memory access");
 STATISTIC(numAMA , "Number of memory analyzed access");
 STATISTIC(numAA , "Number of arrays"); 
 STATISTIC(numAAA , "Number of analyzed arrays");
+STATISTIC(numHL , "Number of invariant loads moved before their loops");
+STATISTIC(numWI , "Number of induction variables widened");
 
 static cl::opt<bool> Cllicm("Ptr-licm",                      
     cl::desc("Use loop invariant code motion in Pointer Range Analysis.")); 
@@ -31,6 +37,10 @@ static cl::opt<bool> Clptru("Ptr-Unsafe",
 static cl::opt<bool> Clregion("Ptr-region",                      
     cl::desc("Rebuild regions in Pointer Range Analysis")); 
 
+static cl::opt<bool> Clwiden("Ptr-widen",
+    cl::desc("Widen the induction variables extended in address arithmetic "
+             "in Pointer Range Analysis."));
+
 Value *lge::getPointerOperand(Instruction *Inst) {
   if (LoadInst *Load = dyn_cast<LoadInst>(Inst))
     return Load->getPointerOperand();
@@ -352,168 +362,383 @@ bool lge::isPresentOnLoop (Instruction *Inst, Loop *L) {
   return false;
 }
 
-bool lge::insertOperandsRec(Instruction *I, Loop *L,
-                            std::vector<Instruction*> & instVec) {
-  if (isa<PHINode>(I))
+DIType *lge::resolveType(DITypeRef Ref, const DITypeIdentifierMap & Map) {
+  Metadata *MD = Ref;
+  if (MDString *S = dyn_cast_or_null<MDString>(MD)) {
+    auto I = Map.find(S);
+    return (I == Map.end()) ? nullptr : dyn_cast<DIType>(I->second);
+  }
+  return Ref.resolve(Map);
+}
+
+bool lge::getTypeName(DIType *Ty, const DITypeIdentifierMap & Map,
+                      std::string & name) {
+  if (!Ty)
     return false;
-  if (isa<AllocaInst>(I) && isPresentOnLoop(I, L)) {
-    instVec.push_back(I);
+  if (isa<DIBasicType>(Ty)) {
+    name = Ty->getName().str();
+    return !name.empty();
+  }
+  if (DICompositeType *CT = dyn_cast<DICompositeType>(Ty)) {
+    if (CT->getName().empty())
+      return false;
+    if (CT->getTag() == dwarf::DW_TAG_structure_type)
+      name = "struct " + CT->getName().str();
+    else if (CT->getTag() == dwarf::DW_TAG_union_type)
+      name = "union " + CT->getName().str();
+    else
+      return false;
     return true;
   }
-  for (int i = 0, ie = I->getNumOperands(); i != ie; i++) {
-    if (isa<PHINode>(I->getOperand(i)))
+  DIDerivedType *DT = dyn_cast<DIDerivedType>(Ty);
+  if (!DT)
+    return false;
+  if (DT->getTag() == dwarf::DW_TAG_typedef) {
+    name = DT->getName().str();
+    return !name.empty();
+  }
+  DIType *Base = resolveType(DT->getBaseType(), Map);
+  std::string base = "void";
+  if (Base && !getTypeName(Base, Map, base))
+    return false;
+  switch (DT->getTag()) {
+    case dwarf::DW_TAG_pointer_type:
+      name = base + " *";
+      return true;
+    case dwarf::DW_TAG_const_type:
+      name = "const " + base;
+      return Base != nullptr;
+    case dwarf::DW_TAG_volatile_type:
+      name = "volatile " + base;
+      return Base != nullptr;
+    default:
       return false;
-    if (Instruction *Inst = dyn_cast<Instruction>(I->getOperand(i))) {
-      if (isPresentOnLoop(Inst, L))
-        if (!insertOperandsRec(Inst, L, instVec))
-          return false;
-    }
   }
-  if (!isa<AllocaInst>(I))
-    instVec.push_back(I);
-  return true;
 }
 
-void PtrRangeAnalysis::promoteTypeandRemoveUsesSext (SExtInst *SI, Value *V,
-                                                std::map<Value*,Type*> & used) {
-  if (used.count(V))
-    return;
-  if (!used.count(SI)) {
-    if (SI->getNumOperands() != 1) 
-      return;
-    used[SI->getOperand(0)] = SI->getOperand(0)->getType();
-    promoteTypeandRemoveUsesSext(SI, SI->getOperand(0), used);
-    SI->replaceAllUsesWith(SI->getOperand(0));
+bool PtrRangeAnalysis::canWidenInductionVariable (Loop *L, PHINode *PN,
+                                                  bool isSigned, bool & next) {
+  const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(SE->getSCEV(PN));
+  if (!AR || (AR->getLoop() != L) || !AR->isAffine())
+    return false;
+  const SCEVConstant *Step = dyn_cast<SCEVConstant>(
+                               AR->getStepRecurrence(*SE));
+  if (!Step)
+    return false;
+  int64_t step = Step->getValue()->getSExtValue();
+  if ((step != 1) && ((step != -1) || !isSigned))
+    return false;
+
+  // The latch is the only exit, and it keeps the loop running while
+  // "iv pred bound".
+  BasicBlock *Latch = L->getLoopLatch();
+  if (!Latch || (L->getExitingBlock() != Latch))
+    return false;
+  BranchInst *BI = dyn_cast<BranchInst>(Latch->getTerminator());
+  if (!BI || !BI->isConditional())
+    return false;
+  ICmpInst *Cmp = dyn_cast<ICmpInst>(BI->getCondition());
+  if (!Cmp)
+    return false;
+  ICmpInst::Predicate Pred = Cmp->getPredicate();
+  if (BI->getSuccessor(0) != L->getHeader())
+    Pred = CmpInst::getInversePredicate(Pred);
+  Value *Next = PN->getIncomingValueForBlock(Latch);
+  Value *IV = Cmp->getOperand(0), *Bound = Cmp->getOperand(1);
+  if ((Bound == PN) || (Bound == Next)) {
+    std::swap(IV, Bound);
+    Pred = CmpInst::getSwappedPredicate(Pred);
   }
-  if (V) {
-    if (!isa<Instruction>(V))
-      return;
-    Instruction *I = cast<Instruction>(V);
-    for (unsigned int i = 0; i < I->getNumOperands(); i++) {
-      used[I->getOperand(i)] = I->getOperand(i)->getType();
-      I->getOperand(i)->mutateType(SI->getDestTy());
-      promoteTypeandRemoveUsesSext(SI, I->getOperand(i), used);
-    }
-  } 
-}
+  if (((IV != PN) && (IV != Next)) || !L->isLoopInvariant(Bound))
+    return false;
+  ICmpInst::Predicate Strict = isSigned ? ICmpInst::ICMP_SLT :
+                                          ICmpInst::ICMP_ULT;
+  if (step == -1)
+    Strict = ICmpInst::ICMP_SGT;
+  if (Pred != Strict)
+    return false;
 
-void PtrRangeAnalysis::promoteTypeandRemoveUsesZext (ZExtInst *ZI,
-                                                std::map<Value*,Type*> & used) {
+  // The values tested stay between the start and the bound, which the guard
+  // of the loop compares before the first iteration. When the loop tests its
+  // variable before the increment, the last increment may still wrap.
+  next = (IV == Next);
+  return SE->isLoopEntryGuardedByCond(L, Pred, AR->getStart(),
+                                      SE->getSCEV(Bound));
 }
 
-void PtrRangeAnalysis::promoteTypeandReturnSext (SExtInst *SI,
-                                                std::map<Value*,Type*> & used) {
-}
+bool PtrRangeAnalysis::widenInductionVariable (Loop *L, PHINode *PN,
+                                               bool isSigned, bool next) {
+  BasicBlock *Preheader = L->getLoopPreheader();
+  BasicBlock *Latch = L->getLoopLatch();
+  Instruction *Next = dyn_cast<Instruction>(
+                        PN->getIncomingValueForBlock(Latch));
+  if (!Preheader || !Next)
+    return false;
 
-void PtrRangeAnalysis::promoteTypeandReturnZext (ZExtInst *ZI,
-                                                std::map<Value*,Type*> & used) {
-}
+  Instruction::CastOps Op = isSigned ? Instruction::SExt : Instruction::ZExt;
+  std::vector<CastInst*> exts;
+  for (User *U : PN->users())
+    if (CastInst *CI = dyn_cast<CastInst>(U))
+      if ((CI->getOpcode() == Op) && L->contains(CI))
+        exts.push_back(CI);
+  for (User *U : Next->users())
+    if (CastInst *CI = dyn_cast<CastInst>(U))
+      if (next && (CI->getOpcode() == Op) && L->contains(CI))
+        exts.push_back(CI);
+  if (exts.empty())
+    return false;
+  Type *WideTy = exts[0]->getType();
+  for (unsigned int i = 0, ie = exts.size(); i != ie; i++)
+    if (exts[i]->getType() != WideTy)
+      return false;
 
-void PtrRangeAnalysis::tryOptimizeLoop(Loop *L) {
-  analyzeLoopPointers(L);
-  std::vector<Instruction*> instVec;
-  BasicBlock *BB = L->getLoopPreheader();
-  if (!BB)
-    return;
-  bool stats = true;
-  // Find invariant Loads and GetElementPtrs to try change its location.
-  // We need to do several modifications in IR, to try remove some
-  // alias of the code, trying create a better code to try estimate the
-  // bounds of pointers insite this loop.
-  for (Loop::block_iterator B = L->block_begin(), BE = L->block_end();
-       B != BE; B++) {
-    for (auto I = (*B)->begin(), IE = (*B)->end(); I != IE; I++) {
-      if (!L->hasLoopInvariantOperands(I))
-        continue;
-      if (!isa<LoadInst>(I) && !isa<GetElementPtrInst>(I))
-        continue;
-      if (isa<LoadInst>(I) && !insertInvariantLoadRange(I))
-        continue;
-      stats = (insertOperandsRec(I, L, instVec) & stats);
-    }
+  const SCEVAddRecExpr *AR = cast<SCEVAddRecExpr>(SE->getSCEV(PN));
+  int64_t step = cast<SCEVConstant>(AR->getStepRecurrence(*SE))->getValue()->
+                 getSExtValue();
+  Value *Start = CastInst::Create(Op, PN->getIncomingValueForBlock(Preheader),
+                                  WideTy, PN->getName() + ".start",
+                                  Preheader->getTerminator());
+  PHINode *Wide = PHINode::Create(WideTy, 2, PN->getName() + ".wide",
+                                  &L->getHeader()->front());
+  BinaryOperator *WideNext = BinaryOperator::Create(Instruction::Add, Wide,
+                               ConstantInt::get(WideTy, step, true),
+                               Wide->getName() + ".next");
+  WideNext->insertAfter(Next);
+  if (isSigned)
+    WideNext->setHasNoSignedWrap(true);
+  else
+    WideNext->setHasNoUnsignedWrap(true);
+  Wide->addIncoming(Start, Preheader);
+  Wide->addIncoming(WideNext, Latch);
+
+  for (unsigned int i = 0, ie = exts.size(); i != ie; i++) {
+    SE->forgetValue(exts[i]);
+    exts[i]->replaceAllUsesWith((exts[i]->getOperand(0) == PN) ? Wide :
+                                WideNext);
+    exts[i]->eraseFromParent();
   }
-  Instruction *Inst = BB->getTerminator();
-  if (stats) {
-    bool MoveInsertPt = false;
-    for (int i = 0, ie = instVec.size(); i < ie; i++) {
-      if (instVec[i] == Inst)
-        MoveInsertPt = true;
-      instVec[i]->moveBefore(Inst);
-    }
-    if (MoveInsertPt) {
-       Instruction *InstTmp = BB->getFirstInsertionPt();
-       Inst->moveBefore(InstTmp);
+  return true;
+}
+
+void PtrRangeAnalysis::widenInductionVariables (Function *F, LoopInfo *LI) {
+  std::vector<Loop*> loops(LI->begin(), LI->end());
+  for (unsigned int i = 0; i != loops.size(); i++)
+    for (Loop *SubLoop : loops[i]->getSubLoops())
+      loops.push_back(SubLoop);
+
+  for (unsigned int i = 0, ie = loops.size(); i != ie; i++) {
+    Loop *L = loops[i];
+    if (!L->getLoopPreheader() || !L->getLoopLatch())
+      continue;
+    std::vector<PHINode*> phis;
+    for (auto I = L->getHeader()->begin(); isa<PHINode>(I); I++)
+      if (I->getType()->isIntegerTy())
+        phis.push_back(cast<PHINode>(I));
+    bool changed = false;
+    for (unsigned int j = 0, je = phis.size(); j != je; j++) {
+      bool next = false;
+      if (canWidenInductionVariable(L, phis[j], true, next) &&
+          widenInductionVariable(L, phis[j], true, next)) {
+        changed = true;
+        numWI++;
+      }
+      if (canWidenInductionVariable(L, phis[j], false, next) &&
+          widenInductionVariable(L, phis[j], false, next)) {
+        changed = true;
+        numWI++;
+      }
     }
+    if (changed)
+      SE->forgetLoop(L);
   }
 }
 
-void PtrRangeAnalysis::tryOptimizeFunction(Function *F, LoopInfo *LI) {
-  std::map <Loop*, bool> loops;
-  // Collect all Loops present in the function "F".
-  for (auto B = F->begin(), BE = F->end(); B != BE; B++) {
-    Loop *L = LI->getLoopFor(B);
-    if (L)
-      loops[L] = true;
-  }
-  // try optimize the collected loops
-  auto I = loops.end(), IE = loops.begin();
-  while(I != IE) {
-    I--;
-    tryOptimizeLoop(I->first);
-  }
+// Returns the variable of the source kept in V, if any.
+static const DILocalVariable *findVariable (Value *V, Function *F) {
+  for (auto B = F->begin(), BE = F->end(); B != BE; B++)
+    for (auto I = B->begin(), IE = B->end(); I != IE; I++) {
+      if (DbgDeclareInst *DD = dyn_cast<DbgDeclareInst>(I))
+        if (DD->getAddress() == V)
+          return DD->getVariable();
+      if (DbgValueInst *DV = dyn_cast<DbgValueInst>(I))
+        if (DV->getValue() == V)
+          return DV->getVariable();
+    }
+  return nullptr;
 }
 
-bool PtrRangeAnalysis::insertInvariantLoadRange (Instruction *Inst) {
-  if (!isa<LoadInst>(Inst))
+bool PtrRangeAnalysis::isHoistableLoad (LoadInst *LD, Loop *L) {
+  if (!LD->isSimple())
     return false;
 
-  BasicBlock *BB = Inst->getParent();
-  Region *R = RI->getRegionFor(BB); 
-  RegionRangeInfo RegionData(R);
+  // Moved before the loop, the load also runs when the loop is entered, so
+  // it must already run in the first iteration.
+  SmallVector<BasicBlock*, 8> Exiting;
+  L->getExitingBlocks(Exiting);
+  if (Exiting.empty())
+    return false;
+  for (unsigned int i = 0, ie = Exiting.size(); i != ie; i++)
+    if (!DT->dominates(LD->getParent(), Exiting[i]))
+      return false;
 
-  // All bounds are computed regarding the region entry.
-  Instruction *InsertPt = R->getEntry()->getFirstNonPHI();
-  
-  SCEVRangeBuilder RangeBuilder(SE, CurrentFn->getParent()->getDataLayout(), AA,
-                                LI, DT, R, InsertPt);
+  MemoryLocation Loc = MemoryLocation::get(LD);
+  for (Loop::block_iterator B = L->block_begin(), BE = L->block_end();
+       B != BE; B++)
+    if (AA->canBasicBlockModify(**B, Loc))
+      return false;
+  return true;
+}
 
-  // At this point we have a load or a store.
-  Value *BasePtrValue = getPointerOperand(Inst);
+bool PtrRangeAnalysis::getSourceExpression (Value *V, std::string & expr,
+                                            DIType *& Ty) {
+  if (LoadInst *LD = dyn_cast<LoadInst>(V))
+    if (HoistedLoads.count(LD)) {
+      expr = HoistedLoads[LD].expression;
+      Ty = HoistedLoads[LD].Ty;
+      return true;
+    }
+  if (const DILocalVariable *Var = findVariable(V, CurrentFn)) {
+    expr = Var->getName().str();
+    Ty = resolveType(Var->getType(), TypeIdentifierMap);
+    return !expr.empty() && Ty;
+  }
 
-  // We need full type size info.
-  if (!BasePtrValue || !hasKnownElementSize(BasePtrValue))
+  // A field, "base->field" or "base.field", is loaded from "gep base, 0, f".
+  LoadInst *LD = dyn_cast<LoadInst>(V);
+  if (!LD)
+    return false;
+  GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(LD->getPointerOperand());
+  if (!GEP || (GEP->getNumIndices() != 2) ||
+      !isa<ConstantInt>(GEP->getOperand(1)) ||
+      !cast<ConstantInt>(GEP->getOperand(1))->isZero() ||
+      !isa<ConstantInt>(GEP->getOperand(2)))
+    return false;
+  Value *Base = GEP->getPointerOperand();
+  StructType *ST = dyn_cast<StructType>(Base->getType()->
+                                        getPointerElementType());
+  std::string base;
+  DIType *BaseTy = nullptr;
+  if (!ST || !getSourceExpression(Base, base, BaseTy))
     return false;
 
-  // Extract the access expression.
-  Value *Ptr = getPointerOperand(Inst);
-  Loop *L = LI->getLoopFor(Inst->getParent());
-  const SCEV *AccessFunction = SE->getSCEVAtScope(Ptr, L);
+  // Variables in memory (allocas) hold the struct, the others point to it.
+  bool pointer = !isa<AllocaInst>(Base);
+  DIType *T = BaseTy;
+  while (DIDerivedType *Derived = dyn_cast_or_null<DIDerivedType>(T)) {
+    unsigned tag = Derived->getTag();
+    if ((tag == dwarf::DW_TAG_pointer_type) && pointer)
+      pointer = false;
+    else if ((tag != dwarf::DW_TAG_typedef) &&
+             (tag != dwarf::DW_TAG_const_type) &&
+             (tag != dwarf::DW_TAG_volatile_type) &&
+             (tag != dwarf::DW_TAG_restrict_type))
+      return false;
+    T = resolveType(Derived->getBaseType(), TypeIdentifierMap);
+  }
+  DICompositeType *CT = dyn_cast_or_null<DICompositeType>(T);
+  if (pointer || !CT || (CT->getTag() != dwarf::DW_TAG_structure_type))
+    return false;
 
-  if (!RangeBuilder.canComputeBoundsFor(AccessFunction))
+  const DataLayout & DL = CurrentFn->getParent()->getDataLayout();
+  unsigned int field = cast<ConstantInt>(GEP->getOperand(2))->getZExtValue();
+  if (field >= ST->getNumElements())
     return false;
+  uint64_t offset = DL.getStructLayout(ST)->getElementOffsetInBits(field);
+  uint64_t size = DL.getTypeSizeInBits(ST->getElementType(field));
+  for (DINode *N : CT->getElements()) {
+    DIDerivedType *M = dyn_cast_or_null<DIDerivedType>(N);
+    if (!M || (M->getTag() != dwarf::DW_TAG_member) ||
+        (M->getOffsetInBits() != offset) || (M->getSizeInBits() != size) ||
+        M->getName().empty())
+      continue;
+    expr = base + (isa<AllocaInst>(Base) ? "." : "->") + M->getName().str();
+    Ty = resolveType(M->getBaseType(), TypeIdentifierMap);
+    return Ty != nullptr;
+  }
+  return false;
+}
 
-  Value *BasePtrV = BasePtrValue;
-  while (isa<LoadInst>(BasePtrV) || isa<GetElementPtrInst>(BasePtrV)) {
-    if (LoadInst *LD = dyn_cast<LoadInst>(BasePtrV))
-      BasePtrV = LD->getPointerOperand();
-    if (GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(BasePtrV))
-      BasePtrV = GEP->getPointerOperand();
+void PtrRangeAnalysis::nameHoistedLoad (LoadInst *LD) {
+  DISubprogram *SP = getDISubprogram(CurrentFn);
+  DILocation *Loc = LD->getDebugLoc().get();
+  std::string expression, type;
+  DIType *Ty = nullptr;
+  if (!SP || !Loc || findVariable(LD, CurrentFn) ||
+      !getSourceExpression(LD, expression, Ty) ||
+      !getTypeName(Ty, TypeIdentifierMap, type))
+    return;
+
+  // "s->data" is kept in "s_data".
+  std::string name = std::string();
+  for (unsigned int i = 0, ie = expression.size(); i != ie; i++) {
+    if ((expression[i] == '-') && ((i + 1) != ie) && (expression[i+1] == '>'))
+      continue;
+    name += ((expression[i] == '.') || (expression[i] == '>')) ? '_' :
+            expression[i];
   }
-  
-  if (!BasePtrV)
-    return false;
 
-  // Store data for this access.
-  if (!RegionData.BasePtrsData.count(BasePtrV))
-    RegionData.BasePtrsData[BasePtrV] =
-        RegionRangeInfo::PtrRangeInfo(BasePtrV);
+  DIBuilder DIB(*CurrentFn->getParent());
+  DILocalVariable *Var = DIB.createLocalVariable(dwarf::DW_TAG_auto_variable,
+                                                 SP, name, SP->getFile(),
+                                                 Loc->getLine(), Ty);
+  DIB.insertDbgValueIntrinsic(LD, 0, Var, DIB.createExpression(), Loc,
+                              LD->getNextNode());
+  HoistedLoad Hoisted;
+  Hoisted.name = name;
+  Hoisted.expression = expression;
+  Hoisted.type = type;
+  Hoisted.Ty = Ty;
+  HoistedLoads[LD] = Hoisted;
+}
 
-  RegionData.BasePtrsData[BasePtrV].AccessInstructions.push_back(Inst);
-  RegionData.BasePtrsData[BasePtrV].AccessFunctions.push_back(
-      AccessFunction);
-  
-  numAMA++;
-  return true;
+void PtrRangeAnalysis::tryOptimizeLoop(Loop *L) {
+  analyzeLoopPointers(L);
+  BasicBlock *BB = L->getLoopPreheader();
+  if (!BB)
+    return;
+  // Find invariant Loads, GetElementPtrs and casts to change their location.
+  // Each round moves the values whose operands were moved in the previous
+  // one, e.g. "s->a" and then "s->a->b", so base pointers loaded from
+  // structs become invariant in the regions of the loop.
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    std::vector<Instruction*> instVec;
+    for (Loop::block_iterator B = L->block_begin(), BE = L->block_end();
+         B != BE; B++) {
+      for (auto I = (*B)->begin(), IE = (*B)->end(); I != IE; I++) {
+        if (!L->hasLoopInvariantOperands(I))
+          continue;
+        if (!isa<LoadInst>(I) && !isa<GetElementPtrInst>(I) &&
+            !isa<CastInst>(I))
+          continue;
+        if (isa<LoadInst>(I) && !isHoistableLoad(cast<LoadInst>(I), L))
+          continue;
+        instVec.push_back(I);
+      }
+    }
+    for (unsigned int i = 0, ie = instVec.size(); i != ie; i++) {
+      instVec[i]->moveBefore(BB->getTerminator());
+      SE->forgetValue(instVec[i]);
+      if (LoadInst *LD = dyn_cast<LoadInst>(instVec[i])) {
+        nameHoistedLoad(LD);
+        numHL++;
+      }
+      changed = true;
+    }
+  }
+  SE->forgetLoop(L);
+}
+
+void PtrRangeAnalysis::tryOptimizeFunction(Function *F, LoopInfo *LI) {
+  // Inner loops come first, so a value invariant in a whole nest moves out of
+  // each loop in turn.
+  std::vector<Loop*> loops(LI->begin(), LI->end());
+  for (unsigned int i = 0; i != loops.size(); i++)
+    for (Loop *SubLoop : loops[i]->getSubLoops())
+      loops.push_back(SubLoop);
+  for (unsigned int i = loops.size(); i != 0; i--)
+    tryOptimizeLoop(loops[i - 1]);
 }
 
 bool PtrRangeAnalysis::hasPHIRec(Value *V) {
@@ -700,6 +925,13 @@ void PtrRangeAnalysis::collectRangeInfo(Region *R) {
     collectRangeInfo(&(*SubRegion));
 }
 
+bool PtrRangeAnalysis::doInitialization(Module &M) {
+  TypeIdentifierMap.clear();
+  if (NamedMDNode *CUNodes = M.getNamedMetadata("llvm.dbg.cu"))
+    TypeIdentifierMap = generateDITypeIdentifierMap(CUNodes);
+  return false;
+}
+
 bool PtrRangeAnalysis::runOnFunction(llvm::Function &F) {
   LI = &getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
   RI = &getAnalysis<RegionInfoPass>().getRegionInfo();
@@ -710,8 +942,14 @@ bool PtrRangeAnalysis::runOnFunction(llvm::Function &F) {
 
   CurrentFn = &F;
 
-  if (Cllicm)
+  if (Cllicm) {
+    HoistedLoads.clear();
     tryOptimizeFunction(&F, LI);
+  }
+
+  // Loop guards may only compare invariant bounds after licm.
+  if (Clwiden)
+    widenInductionVariables(&F, LI);
 
   releaseMemory();
   collectRangeInfo(RI->getTopLevelRegion());
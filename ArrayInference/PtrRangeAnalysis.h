@@ -48,6 +48,7 @@
 #include "regionReconstructor.h"
 
 #include <llvm/Analysis/RegionInfo.h>
+#include <llvm/IR/DebugInfoMetadata.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/Transforms/IPO/PassManagerBuilder.h>
 #include <map>
@@ -122,8 +123,18 @@ class PtrRangeAnalysis : public FunctionPass {
   // For Region R, find the pointers and the access memory model.
   void analyzeRegionPointers (Region *R);
 
-  // Insert the expression for invariant load instruction.
-  bool insertInvariantLoadRange (Instruction *Inst);
+  // Returns true if the load LD can run once before the loop L: it runs in
+  // every iteration of L, and no instruction of L may write its location.
+  bool isHoistableLoad (LoadInst *LD, Loop *L);
+
+  // Write in "expr" the source expression of the value V, e.g. "s->data",
+  // and in "Ty" its debug type. Returns false if V is not a variable, nor a
+  // field of a struct reached from one.
+  bool getSourceExpression (Value *V, std::string & expr, DIType *& Ty);
+
+  // Give the load LD, moved before its loop, a variable of the source, so the
+  // value it loads can be used as a base pointer or in bounds.
+  void nameHoistedLoad (LoadInst *LD);
 
   // Find a PHINode in all dependences of a single instruction.
   bool hasPHIRec(Value *V);
@@ -144,23 +155,27 @@ class PtrRangeAnalysis : public FunctionPass {
   // Return if the CallInst is safe to try do the analysis.
   bool isSafeCallInst (CallInst *CI);
 
-  // Change the type of all instructions and remove the uses of sext of IR.
-  void promoteTypeandRemoveUsesSext (SExtInst *SI, Value *V,
-                                     std::map<Value*,Type*> & used);
+  // Returns true if the induction variable PN of L, extended with sext
+  // ("isSigned") or zext, cannot wrap: it moves by one towards a bound that
+  // the loop guard checks before the first iteration. "next" is set if the
+  // value of PN in the next iteration cannot wrap either.
+  bool canWidenInductionVariable (Loop *L, PHINode *PN, bool isSigned,
+                                  bool & next);
 
-  // Change the type of all instructions and remove the uses of zext of IR.
-  void promoteTypeandRemoveUsesZext (ZExtInst *ZI, std::map<Value*,Type*> & used);
+  // Replace the extensions of the induction variable PN of L (and of its
+  // value in the next iteration, if "next") by a new induction variable of
+  // the wider type. Returns true if any extension is replaced.
+  bool widenInductionVariable (Loop *L, PHINode *PN, bool isSigned,
+                               bool next);
 
-  // Change the type of all instructions and return the uses of sext of IR.
-  void promoteTypeandReturnSext (SExtInst *SI, std::map<Value*,Type*> & used);
-
-  // Change the type of all instructions and return the uses of zext of IR.
-  void promoteTypeandReturnZext (ZExtInst *ZI, std::map<Value*,Type*> & used);
+  // Widen the induction variables of the loops of F whose extensions would
+  // hide their access functions from the range analysis.
+  void widenInductionVariables (Function *F, LoopInfo *LI);
 
   // Modify the loop, when some Instruction present in this loop is not
   // affected by tripcount, this funciton move the instruction before
-  // the loop.
-  // Return true if the loop is optimized.
+  // the loop. Loads are moved when alias analysis proves that the loop does
+  // not write their locations.
   void tryOptimizeLoop(Loop *L);
 
   // Find loops and try optimize them.
@@ -188,7 +203,23 @@ public:
   // Set of regions in the function and their respective range data.
   std::map<Region *, RegionRangeInfo> RegionsRangeData;
 
+  // A load moved before its loop, with the variable "name" that keeps its
+  // value in the source, declared with "type" and set to "expression".
+  struct HoistedLoad {
+    std::string name;
+    std::string expression;
+    std::string type;
+    DIType *Ty;
+  };
+
+  // Loads moved before their loops with -Ptr-licm.
+  std::map<LoadInst *, HoistedLoad> HoistedLoads;
+
+  // Debug types of the module identified by strings (C++ programs).
+  DITypeIdentifierMap TypeIdentifierMap;
+
   // FunctionPass interface.
+  virtual bool doInitialization(Module &M);
   virtual bool runOnFunction(Function &F);
   virtual void getAnalysisUsage(AnalysisUsage &AU) const;
   void releaseMemory() { RegionsRangeData.clear(); }
@@ -202,9 +233,16 @@ Value *getBasePtrValue(Instruction *Inst, const Region *R, LoopInfo *LI,
 // Return true if the instruction is present on loop L.
 bool isPresentOnLoop(Instruction *Inst, Loop *L);
 
-// Insert the instructions to optimizations.
-bool insertOperandsRec(Instruction *I, Loop *L,
-                       std::vector<Instruction*> & instVec);
+// Returns the debug type referenced by "Ref", looking up the types of C++
+// programs, identified by strings as "_ZTS1S", in "Map" (built for the module
+// by generateDITypeIdentifierMap). Returns nullptr if it is not found.
+DIType *resolveType(DITypeRef Ref, const DITypeIdentifierMap & Map);
+
+// Write in "name" the C declaration of the debug type "Ty", e.g. "double *",
+// resolving the types it references with "Map". Returns false for types
+// without a simple name, as function pointers.
+bool getTypeName(DIType *Ty, const DITypeIdentifierMap & Map,
+                 std::string & name);
 
 // Determines if the elements referenced by a pointer have known offset size
 // in memory. This will return false for things like function pointers.
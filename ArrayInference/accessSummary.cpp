@@ -0,0 +1,560 @@
+//===-------------------------- accessSummary.cpp -------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the Universidade Federal de Minas Gerais -
+// UFMG Open Source License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// AccessSummary describes the memory touched by a call of a function as a
+// function of its arguments, and proves that sibling recursive calls touch
+// disjoint memory.
+//
+//===----------------------------------------------------------------------===//
+
+#include <algorithm>
+
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+
+#include "accessSummary.h"
+
+using namespace llvm;
+
+LinearExpr AccessSummary::addLinear (const LinearExpr & A,
+                                     const LinearExpr & B, int64_t k) {
+  LinearExpr result = A;
+  result.constant += k * B.constant;
+  for (auto I = B.terms.begin(), IE = B.terms.end(); I != IE; I++) {
+    result.terms[I->first] += k * I->second;
+    if (result.terms[I->first] == 0)
+      result.terms.erase(I->first);
+  }
+  return result;
+}
+
+bool AccessSummary::toLinear (const SCEV *S, LinearExpr & expr) {
+  expr.terms.clear();
+  expr.constant = 0;
+
+  if (const SCEVConstant *C = dyn_cast<SCEVConstant>(S)) {
+    if (C->getValue()->getValue().getMinSignedBits() > 64)
+      return false;
+    expr.constant = C->getValue()->getSExtValue();
+    return true;
+  }
+  if (const SCEVUnknown *U = dyn_cast<SCEVUnknown>(S)) {
+    if (!U->getType()->isIntegerTy())
+      return false;
+    expr.terms[U->getValue()] = 1;
+    return true;
+  }
+  if (const SCEVCastExpr *Cast = dyn_cast<SCEVCastExpr>(S))
+    return toLinear(Cast->getOperand(), expr);
+  if (const SCEVAddExpr *Add = dyn_cast<SCEVAddExpr>(S)) {
+    for (unsigned int i = 0, ie = Add->getNumOperands(); i != ie; i++) {
+      LinearExpr op;
+      if (!toLinear(Add->getOperand(i), op))
+        return false;
+      expr = addLinear(expr, op, 1);
+    }
+    return true;
+  }
+  if (const SCEVMulExpr *Mul = dyn_cast<SCEVMulExpr>(S)) {
+    // Only a constant times one linear expression.
+    int64_t k = 1;
+    const SCEV *Other = nullptr;
+    for (unsigned int i = 0, ie = Mul->getNumOperands(); i != ie; i++) {
+      if (const SCEVConstant *C = dyn_cast<SCEVConstant>(Mul->getOperand(i)))
+        k *= C->getValue()->getSExtValue();
+      else if (Other)
+        return false;
+      else
+        Other = Mul->getOperand(i);
+    }
+    LinearExpr op;
+    if (!Other || !toLinear(Other, op))
+      return false;
+    LinearExpr zero;
+    zero.constant = 0;
+    expr = addLinear(zero, op, k);
+    return true;
+  }
+  return false;
+}
+
+bool AccessSummary::substitute (const LinearExpr & expr,
+                                std::map<Value*, LinearExpr> & values,
+                                LinearExpr & result) {
+  result.terms.clear();
+  result.constant = expr.constant;
+  for (auto I = expr.terms.begin(), IE = expr.terms.end(); I != IE; I++) {
+    if (!values.count(I->first))
+      return false;
+    result = addLinear(result, values[I->first], I->second);
+  }
+  return true;
+}
+
+void AccessSummary::getFacts (BasicBlock *BB, std::vector<LinearExpr> & facts) {
+  Function *F = BB->getParent();
+  for (auto P = F->begin(), PE = F->end(); P != PE; P++) {
+    BranchInst *BI = dyn_cast<BranchInst>(P->getTerminator());
+    if (!BI || !BI->isConditional() ||
+        (BI->getSuccessor(0) == BI->getSuccessor(1)))
+      continue;
+    ICmpInst *Cmp = dyn_cast<ICmpInst>(BI->getCondition());
+    if (!Cmp || !Cmp->getOperand(0)->getType()->isIntegerTy())
+      continue;
+    LinearExpr A, B;
+    if (!toLinear(se->getSCEV(Cmp->getOperand(0)), A) ||
+        !toLinear(se->getSCEV(Cmp->getOperand(1)), B))
+      continue;
+
+    for (unsigned int i = 0; i != 2; i++) {
+      BasicBlockEdge Edge(&(*P), BI->getSuccessor(i));
+      if (!dt->dominates(Edge, BB))
+        continue;
+      CmpInst::Predicate Pred = Cmp->getPredicate();
+      if (i == 1)
+        Pred = CmpInst::getInversePredicate(Pred);
+      LinearExpr AminusB = addLinear(A, B, -1);
+      LinearExpr BminusA = addLinear(B, A, -1);
+      switch (Pred) {
+        case CmpInst::ICMP_SLT:
+        case CmpInst::ICMP_ULT:
+          BminusA.constant -= 1;
+          facts.push_back(BminusA);
+          break;
+        case CmpInst::ICMP_SLE:
+        case CmpInst::ICMP_ULE:
+          facts.push_back(BminusA);
+          break;
+        case CmpInst::ICMP_SGT:
+        case CmpInst::ICMP_UGT:
+          AminusB.constant -= 1;
+          facts.push_back(AminusB);
+          break;
+        case CmpInst::ICMP_SGE:
+        case CmpInst::ICMP_UGE:
+          facts.push_back(AminusB);
+          break;
+        case CmpInst::ICMP_EQ:
+          facts.push_back(AminusB);
+          facts.push_back(BminusA);
+          break;
+        default:
+          break;
+      }
+    }
+  }
+}
+
+bool AccessSummary::getHalf (Value *V, LinearExpr & S) {
+  BinaryOperator *BO = dyn_cast<BinaryOperator>(V);
+  if (!BO)
+    return false;
+  ConstantInt *C = dyn_cast<ConstantInt>(BO->getOperand(1));
+  if (!C)
+    return false;
+  unsigned int Op = BO->getOpcode();
+  if (((Op == Instruction::SDiv) || (Op == Instruction::UDiv)) &&
+      (C->getZExtValue() != 2))
+    return false;
+  if (((Op == Instruction::AShr) || (Op == Instruction::LShr)) &&
+      (C->getZExtValue() != 1))
+    return false;
+  if ((Op != Instruction::SDiv) && (Op != Instruction::UDiv) &&
+      (Op != Instruction::AShr) && (Op != Instruction::LShr))
+    return false;
+  return toLinear(se->getSCEV(BO->getOperand(0)), S);
+}
+
+int64_t AccessSummary::getMultiple (const LinearExpr & expr,
+                                    const LinearExpr & fact) {
+  if (fact.terms.empty())
+    return 0;
+  auto T = fact.terms.begin();
+  auto E = expr.terms.find(T->first);
+  if ((E == expr.terms.end()) || (E->second % T->second))
+    return 0;
+  return E->second / T->second;
+}
+
+bool AccessSummary::proveNonNegative (const LinearExpr & expr,
+                                      std::vector<LinearExpr> & facts,
+                                      unsigned depth) {
+  if (expr.terms.empty())
+    return (expr.constant >= 0);
+
+  // "expr" is a known non-negative combination of one or two facts, plus a
+  // non-negative constant.
+  for (unsigned int i = 0, ie = facts.size(); i != ie; i++) {
+    int64_t k = getMultiple(expr, facts[i]);
+    if (k <= 0)
+      continue;
+    LinearExpr rest = addLinear(expr, facts[i], -k);
+    if (rest.terms.empty() && (rest.constant >= 0))
+      return true;
+    for (unsigned int j = i + 1; j != ie; j++) {
+      int64_t m = getMultiple(rest, facts[j]);
+      if (m <= 0)
+        continue;
+      LinearExpr pair = addLinear(rest, facts[j], -m);
+      if (pair.terms.empty() && (pair.constant >= 0))
+        return true;
+    }
+  }
+  if (depth == 0)
+    return false;
+
+  // "V = S / 2" rounds, so "S - 1 <= 2 * V <= S + 1". Prove "2 * expr >= 0"
+  // with the bound of "V" that makes it smaller.
+  for (auto I = expr.terms.begin(), IE = expr.terms.end(); I != IE; I++) {
+    LinearExpr S;
+    if (!getHalf(I->first, S))
+      continue;
+    int64_t c = I->second;
+    LinearExpr rest = expr;
+    rest.terms.erase(I->first);
+    LinearExpr zero;
+    zero.constant = 0;
+    LinearExpr twice = addLinear(zero, rest, 2);
+    twice = addLinear(twice, S, c);
+    twice.constant -= (c > 0) ? c : -c;
+    if (proveNonNegative(twice, facts, depth - 1))
+      return true;
+  }
+  return false;
+}
+
+bool AccessSummary::getLastIteration (Loop *L, LinearExpr & last) {
+  BasicBlock *Latch = L->getLoopLatch();
+  if (!Latch || (L->getExitingBlock() != Latch) || !L->getLoopPreheader())
+    return false;
+  BranchInst *BI = dyn_cast<BranchInst>(Latch->getTerminator());
+  if (!BI || !BI->isConditional())
+    return false;
+  ICmpInst *Cmp = dyn_cast<ICmpInst>(BI->getCondition());
+  if (!Cmp)
+    return false;
+
+  // The predicate that keeps the loop running.
+  CmpInst::Predicate Pred = Cmp->getPredicate();
+  if (BI->getSuccessor(0) != L->getHeader())
+    Pred = CmpInst::getInversePredicate(Pred);
+  const SCEV *X = se->getSCEV(Cmp->getOperand(0));
+  const SCEV *B = se->getSCEV(Cmp->getOperand(1));
+  if (!isa<SCEVAddRecExpr>(X)) {
+    std::swap(X, B);
+    Pred = CmpInst::getSwappedPredicate(Pred);
+  }
+  const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(X);
+  if (!AR || (AR->getLoop() != L) || !AR->isAffine() ||
+      !se->isLoopInvariant(B, L))
+    return false;
+  const SCEVConstant *Step =
+    dyn_cast<SCEVConstant>(AR->getStepRecurrence(*se));
+  if (!Step)
+    return false;
+  int64_t step = Step->getValue()->getSExtValue();
+
+  LinearExpr start, bound;
+  if (!toLinear(AR->getStart(), start) || !toLinear(B, bound))
+    return false;
+  // Iteration k tests "start + step * k"; the last one is the first that
+  // fails the test.
+  if ((step == 1) && ((Pred == CmpInst::ICMP_SLT) ||
+      (Pred == CmpInst::ICMP_ULT) || (Pred == CmpInst::ICMP_NE)))
+    last = addLinear(bound, start, -1);
+  else if ((step == 1) && ((Pred == CmpInst::ICMP_SLE) ||
+           (Pred == CmpInst::ICMP_ULE))) {
+    last = addLinear(bound, start, -1);
+    last.constant += 1;
+  }
+  else if ((step == -1) && ((Pred == CmpInst::ICMP_SGT) ||
+           (Pred == CmpInst::ICMP_UGT) || (Pred == CmpInst::ICMP_NE)))
+    last = addLinear(start, bound, -1);
+  else if ((step == -1) && ((Pred == CmpInst::ICMP_SGE) ||
+           (Pred == CmpInst::ICMP_UGE))) {
+    last = addLinear(start, bound, -1);
+    last.constant += 1;
+  }
+  else
+    return false;
+
+  // A loop entered with the test already false still runs one iteration:
+  // the conditions before the loop must rule it out.
+  std::vector<LinearExpr> facts;
+  getFacts(L->getLoopPreheader(), facts);
+  return proveNonNegative(last, facts, 1);
+}
+
+bool AccessSummary::getValueRange (const SCEV *S, LinearExpr & low,
+                                   LinearExpr & high) {
+  const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(S);
+  if (!AR) {
+    if (!toLinear(S, low))
+      return false;
+    high = low;
+    return true;
+  }
+
+  const SCEVConstant *Step =
+    dyn_cast<SCEVConstant>(AR->getStepRecurrence(*se));
+  LinearExpr last;
+  if (!AR->isAffine() || !Step ||
+      !getLastIteration(const_cast<Loop*>(AR->getLoop()), last))
+    return false;
+  if (!getValueRange(AR->getStart(), low, high))
+    return false;
+  int64_t step = Step->getValue()->getSExtValue();
+  if (step >= 0)
+    high = addLinear(high, last, step);
+  else
+    low = addLinear(low, last, step);
+  return true;
+}
+
+bool AccessSummary::getPointerOffset (Value *Ptr, Value *& base,
+                                      const SCEV *& offset) {
+  const SCEV *S = se->getSCEV(Ptr);
+  const SCEVUnknown *Base = dyn_cast<SCEVUnknown>(se->getPointerBase(S));
+  if (!Base)
+    return false;
+  base = Base->getValue()->stripPointerCasts();
+  offset = se->getMinusSCEV(S, Base);
+  return !isa<SCEVCouldNotCompute>(offset);
+}
+
+bool AccessSummary::instantiate (CallInst *CI,
+                                 std::vector<MemoryRange> & ranges) {
+  Function *G = CI->getCalledFunction();
+  if (!G || !Summaries.count(G))
+    return false;
+
+  // The integer arguments of the callee, written with the caller values.
+  std::map<Value*, LinearExpr> values;
+  for (auto A = G->arg_begin(), AE = G->arg_end(); A != AE; A++) {
+    LinearExpr expr;
+    Value *Actual = CI->getArgOperand(A->getArgNo());
+    if (A->getType()->isIntegerTy() && toLinear(se->getSCEV(Actual), expr))
+      values[&(*A)] = expr;
+  }
+
+  std::vector<MemoryRange> & summary = Summaries[G];
+  for (unsigned int i = 0, ie = summary.size(); i != ie; i++) {
+    Argument *Arg = cast<Argument>(summary[i].base);
+    Value *Actual = CI->getArgOperand(Arg->getArgNo());
+    MemoryRange range;
+    const SCEV *offset = nullptr;
+    LinearExpr offLow, offHigh, low, high;
+    if (!getPointerOffset(Actual, range.base, offset) ||
+        !getValueRange(offset, offLow, offHigh) ||
+        !substitute(summary[i].low, values, low) ||
+        !substitute(summary[i].high, values, high))
+      return false;
+    range.low = addLinear(offLow, low, 1);
+    range.high = addLinear(offHigh, high, 1);
+    ranges.push_back(range);
+  }
+  return true;
+}
+
+bool AccessSummary::areDistinctObjects (Value *A, Value *B) {
+  if (A == B)
+    return false;
+  // Local variables and globals are distinct objects, and no argument points
+  // to the variables created by the function.
+  bool objA = isa<AllocaInst>(A) || isa<GlobalVariable>(A);
+  bool objB = isa<AllocaInst>(B) || isa<GlobalVariable>(B);
+  if (objA && objB)
+    return true;
+  if ((isa<AllocaInst>(A) && isa<Argument>(B)) ||
+      (isa<AllocaInst>(B) && isa<Argument>(A)))
+    return true;
+  if (Argument *Arg = dyn_cast<Argument>(A))
+    if (Arg->hasNoAliasAttr())
+      return true;
+  if (Argument *Arg = dyn_cast<Argument>(B))
+    if (Arg->hasNoAliasAttr())
+      return true;
+  return false;
+}
+
+void AccessSummary::setAnalyses (ScalarEvolution *se, DominatorTree *dt,
+                                 LoopInfo *li) {
+  this->se = se;
+  this->dt = dt;
+  this->li = li;
+}
+
+bool AccessSummary::summarize (Function *F) {
+  const DataLayout & DL = F->getParent()->getDataLayout();
+  std::vector<std::pair<MemoryRange, BasicBlock*> > accesses;
+  std::vector<CallInst*> recursive;
+
+  for (auto BB = F->begin(), BE = F->end(); BB != BE; BB++)
+    for (auto I = BB->begin(), IE = BB->end(); I != IE; I++) {
+      if (isa<DbgInfoIntrinsic>(I))
+        continue;
+      if (CallInst *CI = dyn_cast<CallInst>(I)) {
+        if (CI->getCalledFunction() == F) {
+          recursive.push_back(CI);
+          continue;
+        }
+        if (!CI->mayReadOrWriteMemory())
+          continue;
+        std::vector<MemoryRange> ranges;
+        if (!instantiate(CI, ranges))
+          return false;
+        for (unsigned int i = 0, ie = ranges.size(); i != ie; i++)
+          accesses.push_back(std::make_pair(ranges[i], &(*BB)));
+        continue;
+      }
+
+      Value *Ptr = nullptr;
+      uint64_t size = 0;
+      if (LoadInst *LD = dyn_cast<LoadInst>(I)) {
+        Ptr = LD->getPointerOperand();
+        size = DL.getTypeStoreSize(LD->getType());
+      }
+      else if (StoreInst *ST = dyn_cast<StoreInst>(I)) {
+        Ptr = ST->getPointerOperand();
+        size = DL.getTypeStoreSize(ST->getValueOperand()->getType());
+      }
+      else if (I->mayReadOrWriteMemory())
+        return false;
+      if (!Ptr)
+        continue;
+
+      MemoryRange range;
+      const SCEV *offset = nullptr;
+      if (!getPointerOffset(Ptr, range.base, offset) ||
+          !getValueRange(offset, range.low, range.high))
+        return false;
+      range.high.constant += size;
+      accesses.push_back(std::make_pair(range, &(*BB)));
+    }
+
+  // Local variables of each call are not shared with any other call. The
+  // memory of the callers is only reached through the arguments.
+  std::map<Value*, std::vector<unsigned int> > bases;
+  for (unsigned int i = 0, ie = accesses.size(); i != ie; i++) {
+    Value *base = accesses[i].first.base;
+    if (isa<AllocaInst>(base))
+      continue;
+    if (!isa<Argument>(base))
+      return false;
+    bases[base].push_back(i);
+  }
+
+  // For each argument, the range that holds every other one.
+  std::vector<MemoryRange> summary;
+  for (auto B = bases.begin(), BE = bases.end(); B != BE; B++) {
+    std::vector<unsigned int> & list = B->second;
+    MemoryRange hull;
+    hull.base = B->first;
+    bool foundLow = false, foundHigh = false;
+    for (unsigned int i = 0, ie = list.size(); i != ie; i++) {
+      MemoryRange & candidate = accesses[list[i]].first;
+      bool isLow = !foundLow, isHigh = !foundHigh;
+      for (auto T = candidate.low.terms.begin(),
+           TE = candidate.low.terms.end(); T != TE; T++)
+        isLow &= isa<Argument>(T->first);
+      for (auto T = candidate.high.terms.begin(),
+           TE = candidate.high.terms.end(); T != TE; T++)
+        isHigh &= isa<Argument>(T->first);
+      for (unsigned int j = 0, je = list.size(); j != je; j++) {
+        std::vector<LinearExpr> facts;
+        getFacts(accesses[list[j]].second, facts);
+        MemoryRange & other = accesses[list[j]].first;
+        isLow = isLow && proveNonNegative(addLinear(other.low, candidate.low,
+                                          -1), facts, 1);
+        isHigh = isHigh && proveNonNegative(addLinear(candidate.high,
+                                            other.high, -1), facts, 1);
+      }
+      if (isLow) {
+        hull.low = candidate.low;
+        foundLow = true;
+      }
+      if (isHigh) {
+        hull.high = candidate.high;
+        foundHigh = true;
+      }
+    }
+    if (!foundLow || !foundHigh)
+      return false;
+    summary.push_back(hull);
+  }
+
+  // Each recursive call must stay inside the memory of its caller.
+  Summaries[F] = summary;
+  for (unsigned int i = 0, ie = recursive.size(); i != ie; i++) {
+    std::vector<MemoryRange> ranges;
+    std::vector<LinearExpr> facts;
+    getFacts(recursive[i]->getParent(), facts);
+    bool inside = instantiate(recursive[i], ranges);
+    for (unsigned int j = 0, je = ranges.size(); inside && (j != je); j++) {
+      inside = false;
+      for (unsigned int k = 0, ke = summary.size(); k != ke; k++)
+        if ((summary[k].base == ranges[j].base) &&
+            proveNonNegative(addLinear(ranges[j].low, summary[k].low, -1),
+                             facts, 1) &&
+            proveNonNegative(addLinear(summary[k].high, ranges[j].high, -1),
+                             facts, 1))
+          inside = true;
+    }
+    if (!inside) {
+      Summaries.erase(F);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool AccessSummary::getCallRanges (CallInst *CI,
+                                   std::vector<MemoryRange> & ranges) {
+  return instantiate(CI, ranges);
+}
+
+bool AccessSummary::areDisjoint (CallInst *A, CallInst *B) {
+  std::vector<MemoryRange> rangesA, rangesB;
+  if (!getCallRanges(A, rangesA) || !getCallRanges(B, rangesB))
+    return false;
+
+  std::vector<LinearExpr> facts;
+  getFacts(A->getParent(), facts);
+  for (unsigned int i = 0, ie = rangesA.size(); i != ie; i++)
+    for (unsigned int j = 0, je = rangesB.size(); j != je; j++) {
+      MemoryRange & RA = rangesA[i];
+      MemoryRange & RB = rangesB[j];
+      if (RA.base != RB.base) {
+        if (!areDistinctObjects(RA.base, RB.base))
+          return false;
+        continue;
+      }
+      if (!proveNonNegative(addLinear(RB.low, RA.high, -1), facts, 1) &&
+          !proveNonNegative(addLinear(RA.low, RB.high, -1), facts, 1))
+        return false;
+    }
+  return true;
+}
+
+bool AccessSummary::getCallSize (CallInst *CI, LinearExpr & bytes) {
+  std::vector<MemoryRange> ranges;
+  if (!getCallRanges(CI, ranges))
+    return false;
+  bytes.terms.clear();
+  bytes.constant = 0;
+  for (unsigned int i = 0, ie = ranges.size(); i != ie; i++) {
+    bytes = addLinear(bytes, ranges[i].high, 1);
+    bytes = addLinear(bytes, ranges[i].low, -1);
+  }
+  return true;
+}
+
+//===-------------------------- accessSummary.cpp -------------------------===//
@@ -0,0 +1,139 @@
+//===--------------------------- accessSummary.h --------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the Universidade Federal de Minas Gerais -
+// UFMG Open Source License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// AccessSummary describes the memory touched by a call of a function as a
+// function of its arguments: for each pointer argument "p", the bytes in
+// [p + low, p + high), where "low" and "high" are linear expressions of the
+// integer arguments. A summary covers the loads and stores of the function,
+// and the summaries of the functions it calls. For recursive functions, it is
+// checked by induction: every recursive call must touch a part of the memory
+// of the call that runs it.
+//
+// Summaries are used to prove that sibling recursive calls, as in
+// "solve(a, lo, mid); solve(a, mid, hi);", touch disjoint memory. Values are
+// handled as integers that never overflow, and casts between them are
+// ignored. Functions are summarized in the order they are analyzed, so a
+// callee must be analyzed before its callers.
+//
+//===----------------------------------------------------------------------===//
+#ifndef ACCESS_SUMMARY_H
+#define ACCESS_SUMMARY_H
+
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Instructions.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace llvm {
+
+// The linear expression "constant + sum(coefficient * value)".
+typedef struct LinearExpr {
+  std::map<Value*, int64_t> terms;
+  int64_t constant;
+} LinearExpr;
+
+// The bytes [base + low, base + high).
+typedef struct MemoryRange {
+  Value *base;
+  LinearExpr low;
+  LinearExpr high;
+} MemoryRange;
+
+class AccessSummary {
+
+  protected:
+
+  //===---------------------------------------------------------------------===
+  //                              Data Structs
+  //===---------------------------------------------------------------------===
+  // Summaries of the functions analyzed, around their pointer arguments.
+  std::map<Function*, std::vector<MemoryRange> > Summaries;
+
+  ScalarEvolution *se;
+  DominatorTree *dt;
+  LoopInfo *li;
+  //===---------------------------------------------------------------------===
+
+  // Returns "A + k * B".
+  LinearExpr addLinear (const LinearExpr & A, const LinearExpr & B,
+                        int64_t k);
+
+  // Write "S" as a linear expression. Returns false if it is not linear.
+  bool toLinear (const SCEV *S, LinearExpr & expr);
+
+  // Replace the values of "expr" by the expressions in "values". Returns
+  // false if a value of "expr" has no replacement.
+  bool substitute (const LinearExpr & expr,
+                   std::map<Value*, LinearExpr> & values, LinearExpr & result);
+
+  // Collect, as "fact >= 0", the conditions of the branches that lead to BB.
+  void getFacts (BasicBlock *BB, std::vector<LinearExpr> & facts);
+
+  // Returns true if V is "S / 2", setting "S".
+  bool getHalf (Value *V, LinearExpr & S);
+
+  // Returns the multiple of "fact" that cancels one of the values of
+  // "expr", or 0.
+  int64_t getMultiple (const LinearExpr & expr, const LinearExpr & fact);
+
+  // Returns true if "expr >= 0" follows from "facts".
+  bool proveNonNegative (const LinearExpr & expr,
+                         std::vector<LinearExpr> & facts, unsigned depth);
+
+  // Returns, in "last", the number of the last iteration of L (counting from
+  // 0), if it runs a known number of iterations.
+  bool getLastIteration (Loop *L, LinearExpr & last);
+
+  // Returns the smallest and the largest values of "S" in its loops.
+  bool getValueRange (const SCEV *S, LinearExpr & low, LinearExpr & high);
+
+  // Split the pointer "Ptr" in its base object and the offset from it.
+  bool getPointerOffset (Value *Ptr, Value *& base, const SCEV *& offset);
+
+  // Returns, in "ranges", the summary of the callee of CI in terms of the
+  // values of the caller.
+  bool instantiate (CallInst *CI, std::vector<MemoryRange> & ranges);
+
+  // Returns true if the objects "A" and "B" cannot overlap.
+  bool areDistinctObjects (Value *A, Value *B);
+
+  public:
+
+  AccessSummary () {
+    this->se = nullptr;
+    this->dt = nullptr;
+    this->li = nullptr;
+  }
+
+  // Set the analyses of the function being analyzed.
+  void setAnalyses (ScalarEvolution *se, DominatorTree *dt, LoopInfo *li);
+
+  // Build the summary of F. Returns false if its memory cannot be described.
+  bool summarize (Function *F);
+
+  // Returns, in "ranges", the memory touched by the call CI.
+  bool getCallRanges (CallInst *CI, std::vector<MemoryRange> & ranges);
+
+  // Returns true if the calls A and B, in the same block, touch disjoint
+  // memory.
+  bool areDisjoint (CallInst *A, CallInst *B);
+
+  // Returns, in "bytes", the number of bytes touched by the call CI.
+  bool getCallSize (CallInst *CI, LinearExpr & bytes);
+};
+
+}
+
+#endif
+
+//===--------------------------- accessSummary.h --------------------------===//
@@ -8,7 +8,13 @@
 //===----------------------------------------------------------------------===//
 //
 // Find a file named "out_pl.log" and try to insert metadata in all loop,
-// when the file identify loops as parallel.
+// when the file identify loops as parallel. Loops listed in "out_peel.log"
+// are parallel once their first and/or last iteration is peeled; they are
+// marked as parallel and also receive a "peelIterations" metadata. Loops
+// listed in "out_rt.log" are parallel depending on a runtime check; they
+// receive a "runtimeCheck" metadata. Loops listed in "out_split.log" are
+// parallel once their iteration space is split; they receive a "splitLoop"
+// metadata.
 //
 // To use this pass please use the flag "-annotateParallel", see the example
 // available below:
@@ -60,10 +66,82 @@ void AnnotateParallel::setMetadataParallelLoop (Loop *L) {
   BB->getTerminator()->setMetadata("isParallel", N);
 }
 
+void AnnotateParallel::setMetadataPeeledLoop (Loop *L, int Peel) {
+  // Mark loop 'L' as parallel, and record the iterations to be peeled.
+  setMetadataParallelLoop(L);
+  BasicBlock *BB = L->getHeader();
+  if (BB == nullptr)
+    return;
+  LLVMContext& C = BB->getTerminator()->getContext();
+  MDNode* N = MDNode::get(C, MDString::get(C, std::to_string(Peel)));
+  BB->getTerminator()->setMetadata("peelIterations", N);
+}
+
+void AnnotateParallel::setMetadataRuntimeLoop (Loop *L) {
+  // Mark loop 'L' as parallel, when its dependence distances allow it.
+  setMetadataParallelLoop(L);
+  BasicBlock *BB = L->getHeader();
+  if (BB == nullptr)
+    return;
+  LLVMContext& C = BB->getTerminator()->getContext();
+  MDNode* N = MDNode::get(C, MDString::get(C, "Runtime Check Metadata"));
+  BB->getTerminator()->setMetadata("runtimeCheck", N);
+}
+
+void AnnotateParallel::setMetadataSplitLoop (Loop *L) {
+  // Mark loop 'L' as parallel, once its iteration space is split.
+  setMetadataParallelLoop(L);
+  BasicBlock *BB = L->getHeader();
+  if (BB == nullptr)
+    return;
+  LLVMContext& C = BB->getTerminator()->getContext();
+  MDNode* N = MDNode::get(C, MDString::get(C, "Split Loop Metadata"));
+  BB->getTerminator()->setMetadata("splitLoop", N);
+}
+
+void AnnotateParallel::readPeelFile() {
+  // Read file "out_peel" with entries in the format "func;line;peel;...".
+  std::ifstream InFile;
+  InFile.open("out_peel.log", std::ios_base::in);
+  if (!InFile.is_open())
+    return;
+
+  std::string Line = std::string(), name = std::string();
+  while (std::getline(InFile, Line)) {
+    name = std::string();
+    unsigned int i = 0, ie = Line.length();
+    for (;(i != ie) && (Line[i] != ';'); i++)
+      name += Line[i];
+    if (i == ie)
+      continue;
+    i++;
+    if (((i + 1) < ie) && (Line[i] == '-') && (Line[i+1] == '1'))
+      continue;
+    std::vector<int> values;
+    while (i < ie) {
+      int tmp  = 0;
+      for (;(i!=ie) && (Line[i] != ';'); i++) {
+        tmp = (tmp * 10);
+        tmp += (Line[i] - '0');
+      }
+      values.push_back(tmp);
+      i++;
+    }
+    for (unsigned int j = 0; (j + 1) < values.size(); j += 2)
+      PeeledLoops[name].push_back(std::make_pair(values[j], values[j+1]));
+  }
+  InFile.close();
+}
+
 void AnnotateParallel::readFile() {   
   // Read file "out_pl" and try to infer parallel loops.
+  readLoopsFile("out_pl.log", Functions);
+}
+
+void AnnotateParallel::readLoopsFile(std::string Name,
+  std::map<std::string, std::vector<int> > & Loops) {
   std::ifstream InFile;
-  InFile.open("out_pl.log", std::ios_base::in);
+  InFile.open(Name.c_str(), std::ios_base::in);
   if (!InFile.is_open())
     return;
   
@@ -73,17 +151,18 @@ void AnnotateParallel::readFile() {
     unsigned int i = 0, ie = Line.length();
     for (;(i != ie) && (Line[i] != ';'); i++) 
       name += Line[i];
+    if (i == ie)
+      continue;
     i++;
-    if (Line[i] == '-' && Line[(i+1)] == '1') {
+    if (((i + 1) < ie) && (Line[i] == '-') && (Line[i+1] == '1'))
       continue;
-    }
     while (i != ie) {
       int tmp  = 0;
       for (;(i!=ie) && (Line[i] != ';'); i++) {
         tmp = (tmp * 10);
         tmp += (Line[i] - '0');
       }
-      Functions[name].push_back(tmp);
+      Loops[name].push_back(tmp);
       i++;
     }
   }
@@ -143,6 +222,20 @@ StringRef FileNameFromPath(StringRef FileName) {
 
 } // namespace
 
+void AnnotateParallel::annotateLoops (Function *F, std::vector<int> & Lines,
+  void (AnnotateParallel::*setMetadata)(Loop *)) {
+  std::map<Loop*, bool> Loops;
+  for (auto B = F->begin(), BE = F->end(); B != BE; B++) {
+    Loop *l = li->getLoopFor(B);
+    if (l && Loops.count(l) == 0) {
+      for (int i = 0, ie = Lines.size(); i != ie; i++)
+        if (Lines[i] == l->getStartLoc()->getLine())
+          (this->*setMetadata)(l);
+      Loops[l] = true;
+    }
+  }
+}
+
 void AnnotateParallel::functionIdentify (Function *F) {
   // Write annotations from the output of CanParallelize.
   if (Functions.count(F->getName())) {
@@ -160,6 +253,29 @@ void AnnotateParallel::functionIdentify (Function *F) {
     }
   }
 
+  // Write annotations for loops that are parallel after peeling.
+  if (PeeledLoops.count(F->getName())) {
+    std::map<Loop*, bool> Loops;
+    for (auto B = F->begin(), BE = F->end(); B != BE; B++) {
+      Loop *l = li->getLoopFor(B);
+      if (l && Loops.count(l) == 0) {
+        for (auto &Peeled : PeeledLoops[F->getName()])
+          if (Peeled.first == l->getStartLoc()->getLine())
+            setMetadataPeeledLoop(l, Peeled.second);
+        Loops[l] = true;
+      }
+    }
+  }
+
+  // Write annotations for loops that are parallel after a runtime check, or
+  // after splitting their iteration space.
+  if (RuntimeLoops.count(F->getName()))
+    annotateLoops(F, RuntimeLoops[F->getName()],
+                  &AnnotateParallel::setMetadataRuntimeLoop);
+  if (SplitLoops.count(F->getName()))
+    annotateLoops(F, SplitLoops[F->getName()],
+                  &AnnotateParallel::setMetadataSplitLoop);
+
   // Write annotations from the file passed by command-line argument.
   const std::set<int> *ParallelLoops = nullptr;
   auto Subprogram = FunctionDebugInfo[F];
@@ -221,6 +337,9 @@ void AnnotateParallel::readFunctionDebugInfo(Module &M) {
 bool AnnotateParallel::runOnModule(Module &M) {
   // Read file and denotate loops as parallel or not.
   readFile();
+  readPeelFile();
+  readLoopsFile("out_rt.log", RuntimeLoops);
+  readLoopsFile("out_split.log", SplitLoops);
   readIndexesFile();
   readFunctionDebugInfo(M);
 
@@ -233,6 +352,9 @@ bool AnnotateParallel::runOnModule(Module &M) {
   }
   // Clear used functions.
   Functions.erase(Functions.begin(), Functions.end());
+  PeeledLoops.erase(PeeledLoops.begin(), PeeledLoops.end());
+  RuntimeLoops.erase(RuntimeLoops.begin(), RuntimeLoops.end());
+  SplitLoops.erase(SplitLoops.begin(), SplitLoops.end());
   return true;
 }
 
@@ -8,7 +8,13 @@
 //===----------------------------------------------------------------------===//
 //
 // Find a file named "out_pl.log" and try to insert metadata in all loop,
-// when the file identify loops as parallel.
+// when the file identify loops as parallel. Loops listed in "out_peel.log"
+// are parallel once their first and/or last iteration is peeled; they are
+// marked as parallel and also receive a "peelIterations" metadata. Loops
+// listed in "out_rt.log" are parallel depending on a runtime check; they
+// receive a "runtimeCheck" metadata. Loops listed in "out_split.log" are
+// parallel once their iteration space is split; they receive a "splitLoop"
+// metadata.
 //
 // To use this pass please use the flag "-annotateParallel", see the example
 // available below:
@@ -40,6 +46,18 @@ class AnnotateParallel : public ModulePass {
   // parallel loops.
   std::map<std::string, std::vector<int> > Functions;
 
+  // Maps a function name to a list of pairs <line, iterations to peel> of
+  // loops that are parallel after peeling.
+  std::map<std::string, std::vector<std::pair<int, int> > > PeeledLoops;
+
+  // Maps a function name to the lines of the loops that are parallel
+  // depending on a runtime check of their dependence distances.
+  std::map<std::string, std::vector<int> > RuntimeLoops;
+
+  // Maps a function name to the lines of the loops that are parallel once
+  // their iteration space is split.
+  std::map<std::string, std::vector<int> > SplitLoops;
+
   // Maps a file name to a mapping between a function name suffix to a set
   // of indexes of loops in functions with that suffix which are parallel.
   // These indexes reflect the order in which the loops
@@ -68,9 +86,17 @@ class AnnotateParallel : public ModulePass {
 
   //===---------------------------------------------------------------------===
 
+  // Read a file with entries in the format "func;line;line;...", adding the
+  // lines of each function to "Loops".
+  void readLoopsFile(std::string Name,
+                     std::map<std::string, std::vector<int> > & Loops);
+
   // Find the lines to parallelize in standard input file.
   void readFile();
 
+  // Find the loops that are parallel after peeling, in file "out_peel.log".
+  void readPeelFile();
+
   // Read parallel loop annotations from a file passed by a command-line
   // argument.
   void readIndexesFile();
@@ -81,6 +107,20 @@ class AnnotateParallel : public ModulePass {
   // Set Loop 'L' as parallel in the bytecode.
   void setMetadataParallelLoop(Loop *L);
 
+  // Set which iterations must be peeled from loop 'L' in the bytecode.
+  void setMetadataPeeledLoop(Loop *L, int Peel);
+
+  // Set loop 'L' as parallel, depending on a runtime check.
+  void setMetadataRuntimeLoop(Loop *L);
+
+  // Set loop 'L' as parallel, once its iteration space is split.
+  void setMetadataSplitLoop(Loop *L);
+
+  // Call "setMetadata" for the loops of function F whose lines are in
+  // "Lines".
+  void annotateLoops(Function *F, std::vector<int> & Lines,
+                     void (AnnotateParallel::*setMetadata)(Loop *));
+
   // This void calls regionIdentify for the top level region in function F.
   void functionIdentify(Function *F);
 
@@ -0,0 +1,1269 @@
+//===-------------------------- loopRewriter.cpp --------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the Universidade Federal de Minas Gerais -
+// UFMG Open Source License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// LoopRewriter is a class created to rewrite "for" statements of the original
+// source file. It uses the source range of a loop (provided by ScopeTree) to
+// split the statement in its pieces:
+//
+//   for (decl iv = start; iv op bound; inc) body
+//
+// and generates new versions of the statement, e.g. peeling the first or the
+// last iteration of the loop, splitting its iteration space, or tiling a
+// perfect nest of loops. The result is a SourceRewrite, which replaces the
+// original lines of the loop in the output file. "while" and "do ... while"
+// loops with a canonical induction variable are written as "for" loops.
+//
+//===----------------------------------------------------------------------===//
+
+#include <algorithm>
+#include <fstream>
+#include <cstdlib>
+
+#include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "loopRewriter.h"
+
+#define CarriageReturn 13
+
+using namespace llvm;
+using namespace std;
+
+std::string LoopRewriter::trim (std::string str) {
+  size_t first = str.find_first_not_of(" \t\n\r");
+  if (first == std::string::npos)
+    return std::string();
+  size_t last = str.find_last_not_of(" \t\n\r");
+  return str.substr(first, (last - first + 1));
+}
+
+bool LoopRewriter::isIdentifier (std::string str) {
+  if (str.empty() || isdigit(str[0]))
+    return false;
+  for (unsigned int i = 0, ie = str.size(); i != ie; i++)
+    if (!isalnum(str[i]) && (str[i] != '_'))
+      return false;
+  return true;
+}
+
+bool LoopRewriter::isSideEffectFree (std::string str) {
+  if ((str.find("++") != std::string::npos) ||
+      (str.find("--") != std::string::npos))
+    return false;
+  for (unsigned int i = 0, ie = str.size(); i != ie; i++) {
+    // Assignments (but not comparisons).
+    if (str[i] == '=') {
+      bool cmp = ((i + 1) != ie) && (str[i+1] == '=');
+      cmp = cmp || ((i > 0) && ((str[i-1] == '=') || (str[i-1] == '<') ||
+                                (str[i-1] == '>') || (str[i-1] == '!')));
+      if (!cmp)
+        return false;
+      if (((i + 1) != ie) && (str[i+1] == '='))
+        i++;
+    }
+    // Function calls: an identifier followed by "(", except "sizeof".
+    if (str[i] == '(') {
+      int j = i - 1;
+      while ((j >= 0) && ((str[j] == ' ') || (str[j] == '\t')))
+        j--;
+      int end = j;
+      while ((j >= 0) && (isalnum(str[j]) || (str[j] == '_')))
+        j--;
+      std::string name = str.substr(j + 1, end - j);
+      if (!name.empty() && !isdigit(name[0]) && (name != "sizeof"))
+        return false;
+    }
+  }
+  return true;
+}
+
+size_t LoopRewriter::findClosing (std::string & str, size_t pos) {
+  char open = str[pos];
+  char close = (open == '(') ? ')' : ((open == '[') ? ']' : '}');
+  int depth = 0;
+  for (size_t i = pos, ie = str.size(); i != ie; i++) {
+    // Skip string and char literals.
+    if ((str[i] == '\"') || (str[i] == '\'')) {
+      char delim = str[i];
+      for (i++; (i != ie) && (str[i] != delim); i++)
+        if (str[i] == '\\')
+          i++;
+      if (i == ie)
+        return std::string::npos;
+      continue;
+    }
+    if (str[i] == open)
+      depth++;
+    if (str[i] == close) {
+      depth--;
+      if (depth == 0)
+        return i;
+    }
+  }
+  return std::string::npos;
+}
+
+bool LoopRewriter::loadSource (Loop *L) {
+  DebugLoc DL = L->getStartLoc();
+  if (!DL)
+    return false;
+  std::string file = DL->getFilename();
+  std::string dir = DL->getDirectory();
+  if (!file.empty() && (file[0] != '/') && !dir.empty())
+    file = dir + "/" + file;
+
+  if (!Files.count(file)) {
+    std::ifstream Infile(file.c_str());
+    if (!Infile)
+      return false;
+    std::vector<std::string> & content = Files[file];
+    std::string Line;
+    while (std::getline(Infile, Line)) {
+      if (!Line.empty() && (Line[Line.size() - 1] == CarriageReturn))
+        Line.erase(Line.end() - 1, Line.end());
+      content.push_back(Line);
+    }
+  }
+  Lines = &Files[file];
+  return true;
+}
+
+bool LoopRewriter::parseInit () {
+  size_t pos = std::string::npos;
+  for (size_t i = 0, ie = init.size(); i != ie; i++)
+    if ((init[i] == '=') && (((i + 1) == ie) || (init[i+1] != '='))) {
+      pos = i;
+      break;
+    }
+  if (pos == std::string::npos)
+    return false;
+
+  std::string lhs = trim(init.substr(0, pos));
+  start = trim(init.substr(pos + 1));
+  if (lhs.empty() || start.empty() || (start.find(',') != std::string::npos))
+    return false;
+
+  size_t ivStart = lhs.size();
+  while ((ivStart > 0) && (isalnum(lhs[ivStart - 1]) ||
+         (lhs[ivStart - 1] == '_')))
+    ivStart--;
+  iv = lhs.substr(ivStart);
+  decl = lhs.substr(0, ivStart);
+
+  // Only plain scalar declarations, such as "int i" or "long i".
+  if (!isIdentifier(iv) || (decl.find_first_of("*[(,&") != std::string::npos))
+    return false;
+  return isSideEffectFree(start);
+}
+
+bool LoopRewriter::parseInc () {
+  std::string str = std::string();
+  for (unsigned int i = 0, ie = inc.size(); i != ie; i++)
+    if ((inc[i] != ' ') && (inc[i] != '\t'))
+      str += inc[i];
+
+  step = 0;
+  if ((str == iv + "++") || (str == "++" + iv))
+    step = 1;
+  else if ((str == iv + "--") || (str == "--" + iv))
+    step = -1;
+  else {
+    std::string value = std::string();
+    long long int sign = 1;
+    if (str.compare(0, iv.size() + 2, iv + "+=") == 0)
+      value = str.substr(iv.size() + 2);
+    else if (str.compare(0, iv.size() + 2, iv + "-=") == 0) {
+      value = str.substr(iv.size() + 2);
+      sign = -1;
+    }
+    else if (str.compare(0, (2 * iv.size()) + 2, iv + "=" + iv + "+") == 0)
+      value = str.substr((2 * iv.size()) + 2);
+    else if (str.compare(0, (2 * iv.size()) + 2, iv + "=" + iv + "-") == 0) {
+      value = str.substr((2 * iv.size()) + 2);
+      sign = -1;
+    }
+    if (value.empty() || (value.find_first_not_of("0123456789") !=
+                          std::string::npos))
+      return false;
+    step = sign * std::atoll(value.c_str());
+  }
+  return (step != 0);
+}
+
+bool LoopRewriter::parseCond () {
+  size_t pos = std::string::npos;
+  unsigned int numOps = 0;
+  int depth = 0;
+  op = std::string();
+
+  for (size_t i = 0, ie = cond.size(); i != ie; i++) {
+    char c = cond[i];
+    char next = ((i + 1) != ie) ? cond[i+1] : ' ';
+    if (c == '(' || c == '[')
+      depth++;
+    if (c == ')' || c == ']')
+      depth--;
+    if (depth != 0)
+      continue;
+    // Compound conditions are not canonical.
+    if (((c == '&') && (next == '&')) || ((c == '|') && (next == '|')))
+      return false;
+    // Skip shifts and "->".
+    if (((c == '<') || (c == '>')) && (next == c)) {
+      i++;
+      continue;
+    }
+    if ((c == '>') && (i > 0) && (cond[i-1] == '-'))
+      continue;
+    if ((c == '<') || (c == '>') || ((c == '!') && (next == '='))) {
+      pos = i;
+      op = std::string(1, c);
+      if (next == '=') {
+        op += '=';
+        i++;
+      }
+      numOps++;
+    }
+  }
+  if (numOps != 1)
+    return false;
+
+  std::string lhs = trim(cond.substr(0, pos));
+  std::string rhs = trim(cond.substr(pos + op.size()));
+  if (rhs == iv) {
+    std::swap(lhs, rhs);
+    if (op[0] == '<')
+      op[0] = '>';
+    else if (op[0] == '>')
+      op[0] = '<';
+  }
+  if ((lhs != iv) || rhs.empty() || !isSideEffectFree(rhs))
+    return false;
+  bound = rhs;
+
+  if (op == "!=") {
+    if ((step != 1) && (step != -1))
+      return false;
+    op = (step > 0) ? "<" : ">";
+  }
+
+  // The loop must move the induction variable towards the bound.
+  if (step > 0)
+    return (op[0] == '<');
+  return (op[0] == '>');
+}
+
+bool LoopRewriter::parseFor (std::string text) {
+  if (text.compare(0, 3, "for") != 0)
+    return false;
+  size_t open = text.find_first_not_of(" \t\n", 3);
+  if ((open == std::string::npos) || (text[open] != '('))
+    return false;
+  size_t close = findClosing(text, open);
+  if (close == std::string::npos)
+    return false;
+
+  // Split the header in "init; cond; inc".
+  std::string header = text.substr(open + 1, close - open - 1);
+  std::vector<std::string> pieces;
+  std::string piece = std::string();
+  int depth = 0;
+  for (unsigned int i = 0, ie = header.size(); i != ie; i++) {
+    if (header[i] == '(' || header[i] == '[' || header[i] == '{')
+      depth++;
+    if (header[i] == ')' || header[i] == ']' || header[i] == '}')
+      depth--;
+    if ((header[i] == ';') && (depth == 0)) {
+      pieces.push_back(trim(piece));
+      piece = std::string();
+      continue;
+    }
+    piece += header[i];
+  }
+  pieces.push_back(trim(piece));
+  if (pieces.size() != 3)
+    return false;
+  init = pieces[0];
+  cond = pieces[1];
+  inc = pieces[2];
+
+  // The body is a compound statement, a nested loop, or a single statement
+  // in one line.
+  size_t bodyStart = text.find_first_not_of(" \t\n", close + 1);
+  if (bodyStart == std::string::npos)
+    return false;
+  headerEndPos = close;
+  bodyPos = bodyStart;
+  if (text[bodyStart] == '{') {
+    size_t bodyEnd = findClosing(text, bodyStart);
+    if ((bodyEnd == std::string::npos) ||
+        !trim(text.substr(bodyEnd + 1)).empty())
+      return false;
+    body = text.substr(bodyStart, bodyEnd - bodyStart + 1);
+  }
+  else if ((text.compare(bodyStart, 3, "for") == 0) &&
+           !isalnum(text[bodyStart + 3]) && (text[bodyStart + 3] != '_')) {
+    body = trim(text.substr(bodyStart));
+    char last = body[body.size() - 1];
+    if ((last != ';') && (last != '}'))
+      return false;
+  }
+  else {
+    body = trim(text.substr(bodyStart));
+    if ((body.find('\n') != std::string::npos) ||
+        (body.find(';') != (body.size() - 1)))
+      return false;
+  }
+
+  return parseInit() && parseInc() && parseCond();
+}
+
+bool LoopRewriter::isModified (std::string str, std::string name) {
+  for (size_t i = 0, ie = str.size(); i != ie;) {
+    // Skip string and char literals.
+    if ((str[i] == '\"') || (str[i] == '\'')) {
+      char delim = str[i];
+      for (i++; (i != ie) && (str[i] != delim); i++)
+        if (str[i] == '\\')
+          i++;
+      i = (i == ie) ? ie : (i + 1);
+      continue;
+    }
+    if (!isalpha(str[i]) && (str[i] != '_')) {
+      i++;
+      continue;
+    }
+    size_t j = i;
+    while ((j != ie) && (isalnum(str[j]) || (str[j] == '_')))
+      j++;
+    if (str.substr(i, j - i) != name) {
+      i = j;
+      continue;
+    }
+    std::string before = trim(str.substr(0, i));
+    std::string after = trim(str.substr(j));
+    i = j;
+    // Members of structs are other variables.
+    if (!before.empty() && ((before[before.size() - 1] == '.') ||
+        ((before.size() > 1) &&
+         (before.compare(before.size() - 2, 2, "->") == 0))))
+      continue;
+    if ((before.size() > 1) &&
+        ((before.compare(before.size() - 2, 2, "++") == 0) ||
+         (before.compare(before.size() - 2, 2, "--") == 0)))
+      return true;
+    if (!before.empty() && (before[before.size() - 1] == '&') &&
+        ((before.size() == 1) || (before[before.size() - 2] != '&')))
+      return true;
+    if ((after.compare(0, 2, "++") == 0) || (after.compare(0, 2, "--") == 0))
+      return true;
+    // Assignments, but not comparisons.
+    size_t eq = after.find('=');
+    if ((eq == std::string::npos) || (eq > 3) ||
+        (after.find_first_not_of("+-*/%&|^<>", 0) != eq) ||
+        (((eq + 1) < after.size()) && (after[eq + 1] == '=')))
+      continue;
+    std::string assign = after.substr(0, eq + 1);
+    if ((assign == "=") || (assign == "<<=") || (assign == ">>=") ||
+        ((assign.size() == 2) && (assign[0] != '<') && (assign[0] != '>')))
+      return true;
+  }
+  return false;
+}
+
+bool LoopRewriter::isDeclared (std::string str, std::string name) {
+  for (size_t i = 0, ie = str.size(); i != ie;) {
+    // Skip string and char literals.
+    if ((str[i] == '\"') || (str[i] == '\'')) {
+      char delim = str[i];
+      for (i++; (i != ie) && (str[i] != delim); i++)
+        if (str[i] == '\\')
+          i++;
+      i = (i == ie) ? ie : (i + 1);
+      continue;
+    }
+    if (!isalpha(str[i]) && (str[i] != '_')) {
+      i++;
+      continue;
+    }
+    size_t j = i;
+    while ((j != ie) && (isalnum(str[j]) || (str[j] == '_')))
+      j++;
+    if (str.substr(i, j - i) != name) {
+      i = j;
+      continue;
+    }
+    // In expressions, two identifiers are only adjacent after keywords.
+    size_t k = i;
+    while ((k > 0) && (isspace(str[k - 1]) || (str[k - 1] == '*')))
+      k--;
+    size_t t = k;
+    while ((t > 0) && (isalnum(str[t - 1]) || (str[t - 1] == '_')))
+      t--;
+    std::string type = str.substr(t, k - t);
+    i = j;
+    if (!type.empty() && !isdigit(type[0]) && (type != "return") &&
+        (type != "sizeof") && (type != "case") && (type != "else") &&
+        (type != "goto"))
+      return true;
+  }
+  return false;
+}
+
+bool LoopRewriter::parseWhile (std::string text) {
+  size_t open = std::string::npos;
+  size_t bodyStart = std::string::npos;
+  isDoWhile = false;
+
+  if ((text.compare(0, 5, "while") == 0) && !isalnum(text[5]) &&
+      (text[5] != '_')) {
+    open = text.find_first_not_of(" \t\n", 5);
+    if ((open == std::string::npos) || (text[open] != '('))
+      return false;
+    size_t close = findClosing(text, open);
+    if (close == std::string::npos)
+      return false;
+    cond = trim(text.substr(open + 1, close - open - 1));
+    bodyStart = text.find_first_not_of(" \t\n", close + 1);
+    headerEndPos = close;
+  }
+  else if ((text.compare(0, 2, "do") == 0) && !isalnum(text[2]) &&
+           (text[2] != '_')) {
+    isDoWhile = true;
+    bodyStart = text.find_first_not_of(" \t\n", 2);
+    headerEndPos = 1;
+  }
+  if ((bodyStart == std::string::npos) || (text[bodyStart] != '{'))
+    return false;
+  size_t bodyEnd = findClosing(text, bodyStart);
+  if (bodyEnd == std::string::npos)
+    return false;
+  std::string rest = trim(text.substr(bodyEnd + 1));
+
+  // "do { ... } while (cond);"
+  if (isDoWhile) {
+    if ((rest.compare(0, 5, "while") != 0) ||
+        (rest[rest.size() - 1] != ';'))
+      return false;
+    open = rest.find_first_not_of(" \t\n", 5);
+    if ((open == std::string::npos) || (rest[open] != '('))
+      return false;
+    size_t close = findClosing(rest, open);
+    if ((close == std::string::npos) ||
+        (trim(rest.substr(close + 1)) != ";"))
+      return false;
+    cond = trim(rest.substr(open + 1, close - open - 1));
+  }
+  else if (!rest.empty())
+    return false;
+  bodyPos = bodyStart;
+
+  // Find the last statement of the body.
+  std::string inner = text.substr(bodyStart + 1, bodyEnd - bodyStart - 1);
+  size_t prevEnd = std::string::npos;
+  size_t lastEnd = std::string::npos;
+  int depth = 0;
+  for (size_t i = 0, ie = inner.size(); i != ie; i++) {
+    char c = inner[i];
+    if ((c == '\"') || (c == '\'')) {
+      for (i++; (i != ie) && (inner[i] != c); i++)
+        if (inner[i] == '\\')
+          i++;
+      if (i == ie)
+        return false;
+      continue;
+    }
+    if ((c == '(') || (c == '[') || (c == '{'))
+      depth++;
+    if ((c == ')') || (c == ']') || (c == '}'))
+      depth--;
+    if ((depth == 0) && ((c == ';') || (c == '}'))) {
+      prevEnd = lastEnd;
+      lastEnd = i;
+    }
+  }
+  if ((lastEnd == std::string::npos) || (inner[lastEnd] != ';') ||
+      !trim(inner.substr(lastEnd + 1)).empty())
+    return false;
+  size_t incStart = (prevEnd == std::string::npos) ? 0 : (prevEnd + 1);
+  inc = trim(inner.substr(incStart, lastEnd - incStart));
+  body = "{" + inner.substr(0, incStart) + "\n}";
+
+  // The increment gives the induction variable.
+  std::string name = inc;
+  if ((name.compare(0, 2, "++") == 0) || (name.compare(0, 2, "--") == 0))
+    name = trim(name.substr(2));
+  size_t nameEnd = 0;
+  while ((nameEnd != name.size()) && (isalnum(name[nameEnd]) ||
+         (name[nameEnd] == '_')))
+    nameEnd++;
+  iv = name.substr(0, nameEnd);
+  if (!isIdentifier(iv) || !parseInc() || !parseCond())
+    return false;
+
+  // The increment must be the only change of the induction variable, and
+  // must run in every iteration.
+  std::string others = inner.substr(0, incStart);
+  if (isModified(others, iv) ||
+      (replaceIdentifier(others, "continue", "") != others) ||
+      (replaceIdentifier(others, "break", "") != others) ||
+      (replaceIdentifier(others, "goto", "") != others) ||
+      (replaceIdentifier(others, "return", "") != others))
+    return false;
+
+  original = text;
+  decl = std::string();
+  start = iv + "_start";
+  init = iv + " = " + start;
+  return true;
+}
+
+bool LoopRewriter::getStatementText (int startLine, int startColumn,
+                                     int lastLine, std::string & text) {
+  if (!Lines || (startLine < 1) || (startColumn < 1) ||
+      (lastLine < startLine) || ((unsigned int)lastLine > Lines->size()))
+    return false;
+
+  // The statement must start its line, as the output is written by lines.
+  std::string first = (*Lines)[startLine - 1];
+  if (((unsigned int)startColumn > first.size()) ||
+      !trim(first.substr(0, startColumn - 1)).empty())
+    return false;
+
+  text = first.substr(startColumn - 1);
+  for (int i = startLine; i < lastLine; i++)
+    text += "\n" + (*Lines)[i];
+  return true;
+}
+
+bool LoopRewriter::parseWhileLoop (int startLine, int startColumn,
+                                   int lastLine, int lastColumn) {
+  std::string text;
+  if (!getStatementText(startLine, startColumn, lastLine, text))
+    return false;
+  endLine = lastLine;
+  return parseWhile(text);
+}
+
+bool LoopRewriter::rewriteAsFor (std::string pragma, SourceRewrite & rewrite) {
+  if (original.find(start) != std::string::npos)
+    return false;
+
+  std::string header = "for (" + init + "; " + iv + " " + op + " " + bound +
+                       "; " + inc + ")\n";
+  rewrite.endLine = endLine;
+  rewrite.prologue = "{\nlong long int " + start + " = " + iv + ";\n";
+  if (!isDoWhile) {
+    rewrite.text = pragma + header + body + "\n}";
+    return true;
+  }
+  rewrite.prologue += "if (" + iv + " " + op + " (" + bound + ")) {\n";
+  rewrite.text = pragma + header + body + "\n} else\n" + original + "\n}";
+  return true;
+}
+
+bool LoopRewriter::parseLoop (int startLine, int startColumn, int lastLine,
+                              int lastColumn) {
+  std::string text;
+  if (!getStatementText(startLine, startColumn, lastLine, text))
+    return false;
+
+  endLine = lastLine;
+  if (!parseFor(text))
+    return false;
+  original = text;
+  headerEndLine = startLine + std::count(text.begin(),
+                                         text.begin() + headerEndPos, '\n');
+  bodyLine = startLine + std::count(text.begin(), text.begin() + bodyPos,
+                                    '\n');
+  return true;
+}
+
+std::string LoopRewriter::getLastValue () {
+  std::string st = "(" + start + ")";
+  std::string bd = "(" + bound + ")";
+  long long int absStep = (step > 0) ? step : -step;
+  std::string sz = std::to_string(absStep);
+
+  if (step == 1)
+    return (op == "<") ? (bd + " - 1") : bd;
+  if (step == -1)
+    return (op == ">") ? (bd + " + 1") : bd;
+  if (step > 0) {
+    std::string dist = (op == "<") ? (bd + " - " + st + " - 1") :
+                                     (bd + " - " + st);
+    return st + " + ((" + dist + ") / " + sz + ") * " + sz;
+  }
+  std::string dist = (op == ">") ? (st + " - " + bd + " - 1") :
+                                   (st + " - " + bd);
+  return st + " - ((" + dist + ") / " + sz + ") * " + sz;
+}
+
+std::string LoopRewriter::getTripCount () {
+  long long int absStep = (step > 0) ? step : -step;
+  std::string dist = (step > 0) ? ("(" + getLastValue() + ") - (" + start + ")")
+                                : ("(" + start + ") - (" + getLastValue() + ")");
+  std::string count = (absStep == 1) ? ("(" + dist + ") + 1") :
+                      ("(" + dist + ") / " + std::to_string(absStep) + " + 1");
+  // The last value wraps around when the loop does not run and the bound is
+  // unsigned, e.g. "bound - 1" with a bound of 0.
+  return "((" + start + ") " + op + " (" + bound + ") ? " + count + " : 0)";
+}
+
+bool LoopRewriter::peelLoop (int peel, std::string pragma,
+                             SourceRewrite & rewrite) {
+  if (!(peel & (PEEL_FIRST | PEEL_LAST)))
+    return false;
+
+  std::string first = "(" + start + ")";
+  std::string mainStart = first;
+  std::string mainInit = init;
+  std::string mainCond = cond;
+  std::string last = getLastValue();
+
+  rewrite.prologue = std::string();
+  rewrite.endLine = endLine;
+
+  // The first iteration runs alone before the parallel loop.
+  if (peel & PEEL_FIRST) {
+    rewrite.prologue = "for (" + init + "; (" + cond + ") && (" + iv + " == " +
+                       first + "); " + inc + ")\n" + body + "\n";
+    mainStart = first + " + (" + std::to_string(step) + ")";
+    mainInit = decl + iv + " = " + mainStart;
+  }
+
+  // The parallel loop stops one iteration earlier, keeping the canonical
+  // form "iv op limit". The limit "bound - step" would wrap around for an
+  // unsigned bound smaller than the step, so the loop only runs when its
+  // first iteration is followed by another one.
+  std::string guard;
+  if (peel & PEEL_LAST) {
+    std::string dist = std::to_string((step > 0) ? step : -step);
+    mainCond = iv + " " + op + " ((" + bound + ")" +
+               ((step > 0) ? " - " : " + ") + dist + ")";
+    guard = "if ((" + mainStart + ")" + ((step > 0) ? " + " : " - ") + dist +
+            " " + op + " (" + bound + ")) {\n";
+  }
+
+  rewrite.text = guard + pragma + "for (" + mainInit + "; " + mainCond + "; " +
+                 inc + ")\n" + body;
+  if (!guard.empty())
+    rewrite.text += "\n}";
+
+  // The last iteration runs alone after the parallel loop, if it was not
+  // already executed as the first one.
+  if (peel & PEEL_LAST) {
+    rewrite.text += "\nif ((" + mainStart + ") " + op + " (" + bound + "))\n";
+    rewrite.text += "for (" + decl + iv + " = (" + last + "); " + cond + "; " +
+                    inc + ")\n" + body;
+  }
+
+  // Keep the rewrite a single statement, as the loop may be the body of
+  // another statement.
+  rewrite.prologue = "{\n" + rewrite.prologue;
+  rewrite.text += "\n}";
+  return true;
+}
+
+std::string LoopRewriter::getIterationValue (std::string iteration) {
+  if (step == 1)
+    return "(" + start + ") + (" + iteration + ")";
+  if (step == -1)
+    return "(" + start + ") - (" + iteration + ")";
+  return "(" + start + ") + (" + std::to_string(step) + ") * (" + iteration +
+         ")";
+}
+
+std::string LoopRewriter::getPieceHeader (std::string first,
+                                          std::string last) {
+  std::string pieceInit = init;
+  std::string pieceCond = cond;
+  if (!first.empty())
+    pieceInit = decl + iv + " = " + getIterationValue(first);
+
+  // The piece stops at the first of the original bound and "last", keeping
+  // the canonical form "iv op bound".
+  if (!last.empty()) {
+    std::string cmp = (step > 0) ? "<" : ">";
+    std::string bd = "(" + bound + ")";
+    if (op == "<=")
+      bd = "(" + bound + " + 1)";
+    else if (op == ">=")
+      bd = "(" + bound + " - 1)";
+    std::string limit = "(" + getIterationValue(last) + ")";
+    pieceCond = iv + " " + cmp + " (" + bd + " " + cmp + " " + limit + " ? " +
+                bd + " : " + limit + ")";
+  }
+  return "for (" + pieceInit + "; " + pieceCond + "; " + inc + ")\n";
+}
+
+bool LoopRewriter::splitLoop (std::string point, bool isolate,
+                              std::string pragma, SourceRewrite & rewrite) {
+  // The split point is computed once, in a new variable.
+  std::string split = iv + "_split";
+  if ((body.find(split) != std::string::npos) ||
+      (bound.find(split) != std::string::npos) ||
+      (start.find(split) != std::string::npos) || !isSideEffectFree(point))
+    return false;
+
+  rewrite.prologue = std::string();
+  rewrite.endLine = endLine;
+
+  // Iterations before the split point are not run again by the next piece.
+  rewrite.text = "{\nlong long int " + split + " = (" + point + ") > 0 ? (" +
+                 point + ") : 0;\n";
+  rewrite.text += pragma + getPieceHeader(std::string(), split) + body + "\n";
+  if (isolate) {
+    rewrite.text += getPieceHeader(split, split + " + 1") + body + "\n";
+    split += " + 1";
+  }
+  rewrite.text += pragma + getPieceHeader(split, std::string()) + body +
+                  "\n}";
+  return true;
+}
+
+bool LoopRewriter::tileLoop (unsigned int depth, long long int tile,
+                             std::string pragma, SourceRewrite & rewrite) {
+  if ((depth < 2) || (tile < 2))
+    return false;
+
+  // Collect the headers of the perfect nest. Each loop body must be exactly
+  // the next loop of the nest.
+  std::vector<LoopHeader> nest;
+  for (unsigned int i = 0; i < depth; i++) {
+    if (i > 0) {
+      std::string text = body;
+      if (text[0] == '{')
+        text = trim(text.substr(1, text.size() - 2));
+      if (!parseFor(text))
+        return false;
+    }
+    // Only unit-step loops counting up, declaring their own induction
+    // variables.
+    if ((step != 1) || trim(decl).empty())
+      return false;
+    LoopHeader header;
+    header.decl = decl;
+    header.iv = iv;
+    header.start = start;
+    header.op = op;
+    header.bound = bound;
+    header.cond = cond;
+    header.inc = inc;
+    nest.push_back(header);
+  }
+
+  // The tile induction variables must not collide with names in the nest.
+  for (unsigned int i = 0; i < depth; i++) {
+    std::string name = nest[i].iv + "_tile";
+    if (body.find(name) != std::string::npos)
+      return false;
+    for (unsigned int j = 0; j < depth; j++)
+      if ((nest[j].bound.find(name) != std::string::npos) ||
+          (nest[j].start.find(name) != std::string::npos))
+        return false;
+  }
+
+  std::string size = std::to_string(tile);
+  rewrite.prologue = std::string();
+  rewrite.endLine = endLine;
+  rewrite.text = pragma;
+
+  // Loops that iterate over the tiles. The first one is the parallel loop.
+  for (unsigned int i = 0; i < depth; i++) {
+    std::string name = nest[i].iv + "_tile";
+    rewrite.text += "for (" + nest[i].decl + name + " = " + nest[i].start +
+                    "; " + name + " " + nest[i].op + " (" + nest[i].bound +
+                    "); " + name + " += " + size + ")\n";
+  }
+
+  // Loops that iterate inside one tile, in the original order.
+  for (unsigned int i = 0; i < depth; i++) {
+    std::string name = nest[i].iv + "_tile";
+    rewrite.text += "for (" + nest[i].decl + nest[i].iv + " = " + name +
+                    "; (" + nest[i].iv + " < " + name + " + " + size +
+                    ") && (" + nest[i].cond + "); " + nest[i].inc + ")\n";
+  }
+  rewrite.text += body;
+  return true;
+}
+
+std::string LoopRewriter::replaceIdentifier (std::string str,
+                                             std::string name,
+                                             std::string value) {
+  std::string result = std::string();
+  for (size_t i = 0, ie = str.size(); i != ie;) {
+    // Copy string and char literals.
+    if ((str[i] == '\"') || (str[i] == '\'')) {
+      char delim = str[i];
+      size_t j = i + 1;
+      for (; (j != ie) && (str[j] != delim); j++)
+        if (str[j] == '\\')
+          j++;
+      j = (j == ie) ? ie : (j + 1);
+      result += str.substr(i, j - i);
+      i = j;
+      continue;
+    }
+    if (!isalpha(str[i]) && (str[i] != '_')) {
+      result += str[i++];
+      continue;
+    }
+    size_t j = i;
+    while ((j != ie) && (isalnum(str[j]) || (str[j] == '_')))
+      j++;
+    std::string token = str.substr(i, j - i);
+    // Members of structs are not variables.
+    std::string before = trim(result);
+    bool member = !before.empty() && ((before[before.size() - 1] == '.') ||
+                  ((before.size() > 1) &&
+                   (before.compare(before.size() - 2, 2, "->") == 0)));
+    result += ((token == name) && !member) ? value : token;
+    i = j;
+  }
+  return result;
+}
+
+bool LoopRewriter::splitBody (std::vector<std::pair<unsigned int,
+                                          unsigned int> > & lines) {
+  statements.clear();
+  lines.clear();
+  std::string text = body;
+  unsigned int line = bodyLine;
+  if (text[0] == '{')
+    text = text.substr(1, text.size() - 2);
+
+  // Comments and preprocessor directives are not moved around.
+  if ((text.find("//") != std::string::npos) ||
+      (text.find("/*") != std::string::npos) ||
+      (text.find('#') != std::string::npos))
+    return false;
+
+  size_t stmtStart = 0;
+  unsigned int firstLine = 0;
+  bool inStatement = false;
+  int depth = 0;
+  for (size_t i = 0, ie = text.size(); i != ie; i++) {
+    char c = text[i];
+    if (c == '\n')
+      line++;
+    if (!inStatement) {
+      if ((c == ' ') || (c == '\t') || (c == '\n') || (c == '\r'))
+        continue;
+      inStatement = true;
+      stmtStart = i;
+      firstLine = line;
+    }
+    // Skip string and char literals.
+    if ((c == '\"') || (c == '\'')) {
+      for (i++; (i != ie) && (text[i] != c); i++)
+        if (text[i] == '\\')
+          i++;
+      if (i == ie)
+        return false;
+      continue;
+    }
+    // Only plain statements: no compound statements or initializer lists.
+    if ((c == '{') || (c == '}'))
+      return false;
+    if ((c == '(') || (c == '['))
+      depth++;
+    if ((c == ')') || (c == ']'))
+      depth--;
+    if ((c != ';') || (depth != 0))
+      continue;
+
+    std::string statement = trim(text.substr(stmtStart, i - stmtStart + 1));
+    inStatement = false;
+    if (statement == ";")
+      continue;
+    size_t end = 0;
+    while ((end != statement.size()) && (isalnum(statement[end]) ||
+           (statement[end] == '_')))
+      end++;
+    std::string keyword = statement.substr(0, end);
+    if ((keyword == "if") || (keyword == "else") || (keyword == "for") ||
+        (keyword == "while") || (keyword == "do") || (keyword == "switch") ||
+        (keyword == "case") || (keyword == "default") ||
+        (keyword == "return") || (keyword == "break") ||
+        (keyword == "continue") || (keyword == "goto"))
+      return false;
+    statements.push_back(statement);
+    lines.push_back(std::make_pair(firstLine, line));
+  }
+  return !inStatement && !statements.empty();
+}
+
+bool LoopRewriter::getScalarDeclaration (unsigned int stmt, std::string & type,
+                                         std::string & name,
+                                         std::string & value) {
+  if (stmt >= statements.size())
+    return false;
+  std::string str = statements[stmt];
+  str = trim(str.substr(0, str.size() - 1));
+
+  size_t pos = std::string::npos;
+  for (size_t i = 0, ie = str.size(); i != ie; i++)
+    if (str[i] == '=') {
+      pos = i;
+      break;
+    }
+  if ((pos == std::string::npos) || (pos == 0) ||
+      (((pos + 1) != str.size()) && (str[pos + 1] == '=')) ||
+      (std::string("+-*/%&|^<>!").find(str[pos - 1]) != std::string::npos))
+    return false;
+
+  std::string lhs = trim(str.substr(0, pos));
+  value = trim(str.substr(pos + 1));
+  size_t nameStart = lhs.size();
+  while ((nameStart > 0) && (isalnum(lhs[nameStart - 1]) ||
+         (lhs[nameStart - 1] == '_')))
+    nameStart--;
+  name = lhs.substr(nameStart);
+  type = trim(lhs.substr(0, nameStart));
+
+  // Only declarations of one scalar, that can be assigned later.
+  if (type.empty() || !isIdentifier(name) || value.empty() ||
+      (type.find_first_of("[(,&") != std::string::npos) ||
+      (value.find(',') != std::string::npos) ||
+      (replaceIdentifier(type, "const", "") != type) ||
+      (replaceIdentifier(type, "static", "") != type))
+    return false;
+  return isSideEffectFree(value);
+}
+
+bool LoopRewriter::distributeLoop (
+                   std::vector<std::vector<unsigned int> > & groups,
+                   std::vector<bool> & parallel,
+                   std::set<unsigned int> & expand, std::string pragma,
+                   SourceRewrite & rewrite) {
+  if ((groups.size() < 2) || (groups.size() != parallel.size()))
+    return false;
+
+  std::string first = "(" + start + ")";
+  std::string index = "(" + iv + ") - " + first;
+  if (step != 1)
+    index = "((" + index + ") / (" + std::to_string(step) + "))";
+  std::string count = getTripCount();
+
+  // Scalars that flow from one loop to another get one temporary element per
+  // iteration, allocated in the heap: the loop runs as it was if any of them
+  // cannot be allocated.
+  std::vector<std::string> stmts = statements;
+  std::string allocated = std::string();
+  std::string release = std::string();
+  rewrite.prologue = "{\n";
+  for (auto I = expand.begin(), IE = expand.end(); I != IE; I++) {
+    std::string type, name, value;
+    if (!getScalarDeclaration(*I, type, name, value))
+      return false;
+    std::string tmp = name + "_dist";
+    if (body.find(tmp) != std::string::npos)
+      return false;
+    rewrite.prologue += type + " *" + tmp + " = (" + type + " *) malloc(" +
+                        "sizeof(" + type + ") * (" + count + "));\n";
+    allocated += (allocated.empty() ? "" : " && ") + tmp;
+    release += "free(" + tmp + ");\n";
+    stmts[*I] = name + " = " + value + ";";
+    for (unsigned int i = 0, ie = stmts.size(); i != ie; i++)
+      stmts[i] = replaceIdentifier(stmts[i], name, tmp + "[" + index + "]");
+  }
+
+  rewrite.endLine = endLine;
+  rewrite.text = std::string();
+  if (!allocated.empty())
+    rewrite.text = "if (" + allocated + ") {\n";
+  for (unsigned int i = 0, ie = groups.size(); i != ie; i++) {
+    if (parallel[i])
+      rewrite.text += pragma;
+    rewrite.text += "for (" + init + "; " + cond + "; " + inc + ") {\n";
+    std::vector<unsigned int> group = groups[i];
+    std::sort(group.begin(), group.end());
+    for (unsigned int j = 0, je = group.size(); j != je; j++)
+      rewrite.text += stmts[group[j]] + "\n";
+    rewrite.text += "}\n";
+  }
+  if (!allocated.empty())
+    rewrite.text += "} else\n" + original + "\n" + release;
+  rewrite.text += "}";
+  return true;
+}
+
+bool LoopRewriter::replaceFieldAccesses (std::string str, std::string name,
+                                         std::set<std::string> & fields,
+                                         std::string & result) {
+  std::string text = std::string();
+  for (size_t i = 0, ie = str.size(); i != ie;) {
+    // Copy string and char literals.
+    if ((str[i] == '\"') || (str[i] == '\'')) {
+      char delim = str[i];
+      size_t j = i + 1;
+      for (; (j != ie) && (str[j] != delim); j++)
+        if (str[j] == '\\')
+          j++;
+      j = (j == ie) ? ie : (j + 1);
+      text += str.substr(i, j - i);
+      i = j;
+      continue;
+    }
+    if (!isalpha(str[i]) && (str[i] != '_')) {
+      text += str[i++];
+      continue;
+    }
+    size_t j = i;
+    while ((j != ie) && (isalnum(str[j]) || (str[j] == '_')))
+      j++;
+    std::string token = str.substr(i, j - i);
+    std::string before = trim(text);
+    bool member = !before.empty() && ((before[before.size() - 1] == '.') ||
+                  ((before.size() > 1) &&
+                   (before.compare(before.size() - 2, 2, "->") == 0)));
+    if ((token != name) || member) {
+      text += token;
+      i = j;
+      continue;
+    }
+
+    // Only "name[index].field", where "field" is not an aggregate.
+    while ((j != ie) && isspace(str[j]))
+      j++;
+    if ((j == ie) || (str[j] != '['))
+      return false;
+    size_t close = findClosing(str, j);
+    if (close == std::string::npos)
+      return false;
+    std::string index = str.substr(j + 1, close - j - 1);
+    if (replaceIdentifier(index, name, "") != index)
+      return false;
+    j = close + 1;
+    while ((j != ie) && isspace(str[j]))
+      j++;
+    if ((j == ie) || (str[j] != '.'))
+      return false;
+    j++;
+    while ((j != ie) && isspace(str[j]))
+      j++;
+    size_t fieldStart = j;
+    while ((j != ie) && (isalnum(str[j]) || (str[j] == '_')))
+      j++;
+    std::string field = str.substr(fieldStart, j - fieldStart);
+    size_t next = j;
+    while ((next != ie) && isspace(str[next]))
+      next++;
+    if (!isIdentifier(field) || ((next != ie) && ((str[next] == '.') ||
+        (str[next] == '[') || (str.compare(next, 2, "->") == 0))))
+      return false;
+    std::string array = name + "_" + field + "_soa";
+    if (replaceIdentifier(str, array, "") != str)
+      return false;
+    fields.insert(field);
+    text += array + "[" + index + "]";
+    i = j;
+  }
+  result = text;
+  return true;
+}
+
+bool LoopRewriter::replaceExpression (std::string str, std::string expr,
+                                      std::string value,
+                                      std::string & result) {
+  // Split the expression in identifiers and operators.
+  std::vector<std::string> tokens;
+  for (size_t i = 0, ie = expr.size(); i != ie;) {
+    if (isspace(expr[i])) {
+      i++;
+      continue;
+    }
+    size_t j = i + 1;
+    if (isalpha(expr[i]) || (expr[i] == '_'))
+      while ((j != ie) && (isalnum(expr[j]) || (expr[j] == '_')))
+        j++;
+    else if ((expr[i] == '-') && (j != ie) && (expr[j] == '>'))
+      j++;
+    tokens.push_back(expr.substr(i, j - i));
+    i = j;
+  }
+  if (tokens.empty() || !isIdentifier(tokens[0]))
+    return false;
+
+  std::string text = std::string();
+  for (size_t i = 0, ie = str.size(); i != ie;) {
+    // Copy string and char literals.
+    if ((str[i] == '\"') || (str[i] == '\'')) {
+      char delim = str[i];
+      size_t j = i + 1;
+      for (; (j != ie) && (str[j] != delim); j++)
+        if (str[j] == '\\')
+          j++;
+      j = (j == ie) ? ie : (j + 1);
+      text += str.substr(i, j - i);
+      i = j;
+      continue;
+    }
+    if (!isalpha(str[i]) && (str[i] != '_')) {
+      text += str[i++];
+      continue;
+    }
+    size_t j = i;
+    while ((j != ie) && (isalnum(str[j]) || (str[j] == '_')))
+      j++;
+    std::string before = trim(text);
+    bool member = !before.empty() && ((before[before.size() - 1] == '.') ||
+                  ((before.size() > 1) &&
+                   (before.compare(before.size() - 2, 2, "->") == 0)));
+    if (member || (str.substr(i, j - i) != tokens[0])) {
+      text += str.substr(i, j - i);
+      i = j;
+      continue;
+    }
+
+    // Match the remaining tokens, allowing blanks between them.
+    size_t k = j;
+    bool match = true;
+    for (unsigned int t = 1, te = tokens.size(); (t != te) && match; t++) {
+      while ((k != ie) && isspace(str[k]))
+        k++;
+      match = (str.compare(k, tokens[t].size(), tokens[t]) == 0);
+      k += match ? tokens[t].size() : 0;
+      if (match && isIdentifier(tokens[t]) && (k != ie) &&
+          (isalnum(str[k]) || (str[k] == '_')))
+        match = false;
+    }
+    if (!match) {
+      text += str.substr(i, j - i);
+      i = j;
+      continue;
+    }
+    bool address = !before.empty() && (before[before.size() - 1] == '&') &&
+                   ((before.size() == 1) || (before[before.size() - 2] != '&'));
+    if (address)
+      return false;
+    text += value;
+    i = k;
+  }
+  result = text;
+  return true;
+}
+
+bool LoopRewriter::prefetchGathers (std::vector<std::pair<std::string,
+                                    std::string> > & gathers,
+                                    long long int distance,
+                                    SourceRewrite & rewrite) {
+  if (isDoWhile || (distance < 1) || body.empty())
+    return false;
+
+  // The induction variable "distance" iterations ahead, and the condition
+  // that keeps that iteration in the loop.
+  long long int ahead = distance * step;
+  std::string next = "(" + iv + ((ahead > 0) ? " + " : " - ") +
+                     std::to_string((ahead > 0) ? ahead : -ahead) + ")";
+  std::string guard = next + " " + op + " (" + bound + ")";
+
+  std::vector<std::string> prefetches;
+  for (size_t i = 0, ie = body.size(); i != ie;) {
+    // Skip string and char literals.
+    if ((body[i] == '\"') || (body[i] == '\'')) {
+      char delim = body[i];
+      for (i++; (i != ie) && (body[i] != delim); i++)
+        if (body[i] == '\\')
+          i++;
+      i = (i == ie) ? ie : (i + 1);
+      continue;
+    }
+    if (!isalpha(body[i]) && (body[i] != '_')) {
+      i++;
+      continue;
+    }
+    size_t j = i;
+    while ((j != ie) && (isalnum(body[j]) || (body[j] == '_')))
+      j++;
+    std::string before = trim(body.substr(0, i));
+    bool member = !before.empty() && ((before[before.size() - 1] == '.') ||
+                  ((before.size() > 1) &&
+                   (before.compare(before.size() - 2, 2, "->") == 0)));
+    std::string array = body.substr(i, j - i);
+    i = j;
+    if (member)
+      continue;
+
+    // Match "array[index[expr]]", allowing blanks between the tokens.
+    size_t open = body.find_first_not_of(" \t\n", j);
+    if ((open == std::string::npos) || (body[open] != '['))
+      continue;
+    size_t close = findClosing(body, open);
+    if (close == std::string::npos)
+      continue;
+    std::string subscript = trim(body.substr(open + 1, close - open - 1));
+    size_t inner = subscript.find('[');
+    if ((inner == std::string::npos) ||
+        (findClosing(subscript, inner) != (subscript.size() - 1)))
+      continue;
+    std::string index = trim(subscript.substr(0, inner));
+    std::string expr = subscript.substr(inner + 1,
+                                        subscript.size() - inner - 2);
+    bool isGather = false;
+    for (auto & G : gathers)
+      isGather |= ((G.first == array) && (G.second == index));
+    if (!isGather || !isSideEffectFree(expr))
+      continue;
+
+    // The prefetch runs before the body, so it may only use the induction
+    // variable and variables of the enclosing code that the body keeps.
+    std::set<std::string> names;
+    names.insert(array);
+    names.insert(index);
+    for (size_t k = 0, ke = expr.size(); k != ke;) {
+      if (!isalpha(expr[k]) && (expr[k] != '_')) {
+        k++;
+        continue;
+      }
+      size_t l = k;
+      while ((l != ke) && (isalnum(expr[l]) || (expr[l] == '_')))
+        l++;
+      std::string prev = trim(expr.substr(0, k));
+      bool field = !prev.empty() && ((prev[prev.size() - 1] == '.') ||
+                   ((prev.size() > 1) &&
+                    (prev.compare(prev.size() - 2, 2, "->") == 0)));
+      if (!field && (expr.substr(k, l - k) != iv))
+        names.insert(expr.substr(k, l - k));
+      k = l;
+    }
+    bool local = false;
+    for (auto & N : names)
+      local |= (isModified(body, N) || isDeclared(body, N));
+    if (local)
+      continue;
+
+    // The position of the gather must move with the induction variable.
+    std::string aheadExpr = replaceIdentifier(expr, iv, next);
+    if (aheadExpr == expr)
+      continue;
+    std::string prefetch = "if (" + guard + ") __builtin_prefetch(&" + array +
+                           "[" + index + "[" + aheadExpr + "]]);";
+    if (std::find(prefetches.begin(), prefetches.end(), prefetch) ==
+        prefetches.end())
+      prefetches.push_back(prefetch);
+  }
+  if (prefetches.empty())
+    return false;
+
+  std::string code = std::string();
+  for (auto & P : prefetches)
+    code += "\n" + P;
+  rewrite.prologue = std::string();
+  rewrite.endLine = endLine;
+  if (body[0] == '{')
+    rewrite.text = original.substr(0, bodyPos) + "{" + code + body.substr(1);
+  else
+    rewrite.text = original.substr(0, headerEndPos + 1) + " {" + code + "\n" +
+                   body + "\n}";
+  return true;
+}
+
+//===-------------------------- loopRewriter.cpp --------------------------===//
@@ -0,0 +1,286 @@
+//===--------------------------- loopRewriter.h ---------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the Universidade Federal de Minas Gerais -
+// UFMG Open Source License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// LoopRewriter is a class created to rewrite "for" statements of the original
+// source file. It uses the source range of a loop (provided by ScopeTree) to
+// split the statement in its pieces:
+//
+//   for (decl iv = start; iv op bound; inc) body
+//
+// and generates new versions of the statement, e.g. peeling the first or the
+// last iteration of the loop, splitting its iteration space, tiling a perfect
+// nest of loops, or distributing the statements of the body in several loops. The result is a SourceRewrite,
+// which replaces the original lines of the loop in the output file.
+//
+// "while" and "do ... while" statements whose body ends by the increment of
+// the induction variable can also be written as an equivalent "for".
+//
+// The accesses to an array of structs in a loop can also be written as
+// accesses to one array per field, and indirect accesses can be prefetched
+// some iterations ahead.
+//
+//===----------------------------------------------------------------------===//
+#ifndef LOOP_REWRITER_H
+#define LOOP_REWRITER_H
+
+#include "llvm/Analysis/LoopInfo.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+// Boundary iterations that must be peeled so a loop becomes parallel.
+#ifndef PEEL_FIRST
+#define PEEL_FIRST 1
+#define PEEL_LAST 2
+#endif
+
+namespace llvm {
+class Loop;
+
+// A rewrite of the source lines [line, endLine]: "prologue" is written before
+// the annotations of the first line, and "text" replaces the original lines.
+typedef struct SourceRewrite {
+  unsigned int endLine;
+  std::string prologue;
+  std::string text;
+} SourceRewrite;
+
+class LoopRewriter {
+
+  protected:
+
+  //===---------------------------------------------------------------------===
+  //                              Data Structs
+  //===---------------------------------------------------------------------===
+  // Lines of each source file already read.
+  std::map<std::string, std::vector<std::string> > Files;
+
+  // Lines of the file of the loop being rewritten.
+  std::vector<std::string> *Lines;
+
+  // Pieces of the statement "for (init; cond; inc) body".
+  std::string init;
+  std::string cond;
+  std::string inc;
+  std::string body;
+
+  // "init" is split in "decl iv = start", and "cond" in "iv op bound".
+  std::string decl;
+  std::string iv;
+  std::string start;
+  std::string op;
+  std::string bound;
+  long long int step;
+
+  unsigned int endLine;
+
+  // Positions in the statement, and lines in the file, where the header
+  // "for (...)" ends and the body starts.
+  size_t headerEndPos;
+  size_t bodyPos;
+  unsigned int headerEndLine;
+  unsigned int bodyLine;
+
+  // Statements of the body, filled by splitBody.
+  std::vector<std::string> statements;
+
+  // Text of the parsed statement, and whether it is a "do ... while".
+  std::string original;
+  bool isDoWhile;
+
+  // Header of one loop in a nest: "for (decl iv = start; cond; inc)", where
+  // "cond" is "iv op bound".
+  typedef struct LoopHeader {
+    std::string decl;
+    std::string iv;
+    std::string start;
+    std::string op;
+    std::string bound;
+    std::string cond;
+    std::string inc;
+  } LoopHeader;
+  //===---------------------------------------------------------------------===
+
+  // Remove blanks in both sides of the string.
+  std::string trim (std::string str);
+
+  // Return true if the string is a valid C identifier.
+  bool isIdentifier (std::string str);
+
+  // Return true if the expression does not have side effects, i.e. it has
+  // no assignments, increments or function calls.
+  bool isSideEffectFree (std::string str);
+
+  // Return the position of the character that closes the one in position
+  // "pos" (a parenthesis, a bracket or a brace), skipping literals. Returns
+  // std::string::npos if not found.
+  size_t findClosing (std::string & str, size_t pos);
+
+  // Split "init" in "decl iv = start".
+  bool parseInit ();
+
+  // Find the constant step of the loop, using "inc".
+  bool parseInc ();
+
+  // Split "cond" in "iv op bound".
+  bool parseCond ();
+
+  // Split the statement "text" in its pieces. Returns false if it is not a
+  // canonical "for" statement.
+  bool parseFor (std::string text);
+
+  // Split the "while" or "do ... while" statement "text" in the pieces of the
+  // equivalent "for": the last statement of the body is the increment. The
+  // induction variable keeps its value before the loop, copied to
+  // "iv_start". Returns false if the loop is not canonical.
+  bool parseWhile (std::string text);
+
+  // Return true if the variable "name" is assigned, incremented or has its
+  // address taken in "str".
+  bool isModified (std::string str, std::string name);
+
+  // Return true if the variable "name" is declared in "str", as in
+  // "type name" or "type *name".
+  bool isDeclared (std::string str, std::string name);
+
+  // Gather in "text" the source range of a statement. Returns false if the
+  // statement does not start its line.
+  bool getStatementText (int startLine, int startColumn, int lastLine,
+                         std::string & text);
+
+  // Return the value of the induction variable in the iteration "iteration"
+  // (counting from 0).
+  std::string getIterationValue (std::string iteration);
+
+  // Return the header "for (...)" of a copy of the parsed loop that only
+  // runs the iterations from "first" up to, but excluding, "last". An empty
+  // string leaves that end as in the original loop.
+  std::string getPieceHeader (std::string first, std::string last);
+
+  // Replace the variable "name" in "str" with "value".
+  std::string replaceIdentifier (std::string str, std::string name,
+                                 std::string value);
+
+  public:
+
+  LoopRewriter () {
+    this->Lines = nullptr;
+    this->step = 0;
+    this->endLine = 0;
+    this->headerEndPos = 0;
+    this->bodyPos = 0;
+    this->headerEndLine = 0;
+    this->bodyLine = 0;
+    this->isDoWhile = false;
+  }
+
+  // Read the source file of loop L. Returns false if it is not available.
+  bool loadSource (Loop *L);
+
+  // Split the "for" statement in the source range. Returns false if the
+  // statement is not a canonical loop that we can rewrite.
+  bool parseLoop (int startLine, int startColumn, int lastLine,
+                  int lastColumn);
+
+  // Split the "while" or "do ... while" statement in the source range.
+  // Returns false if it cannot be written as a canonical "for" loop.
+  bool parseWhileLoop (int startLine, int startColumn, int lastLine,
+                       int lastColumn);
+
+  // Returns the text of the parsed loop.
+  std::string getLoopText () { return original; }
+
+  // Returns the induction variable of the parsed loop.
+  std::string getInductionVariable () { return iv; }
+
+  // Returns true if the parsed loop is a "do ... while".
+  bool isDoWhileLoop () { return isDoWhile; }
+
+  // Write the parsed "while" or "do ... while" loop as a "for" loop annotated
+  // with "pragma". A "do ... while" whose condition does not hold before the
+  // loop keeps its original code, as it runs one iteration anyway.
+  bool rewriteAsFor (std::string pragma, SourceRewrite & rewrite);
+
+  // Return the expression of the value of the induction variable in the last
+  // iteration of the loop.
+  std::string getLastValue ();
+
+  // Return the expression of the number of iterations of the loop, or 0 if
+  // it does not run.
+  std::string getTripCount ();
+
+  // Peel the first and/or the last iteration (PEEL_FIRST | PEEL_LAST) out of
+  // the parsed loop. "pragma" annotates the remaining loop.
+  bool peelLoop (int peel, std::string pragma, SourceRewrite & rewrite);
+
+  // Split the iteration space of the parsed loop at the iteration "point"
+  // (counting from 0), running the pieces one after the other. If "isolate"
+  // is true, the iteration "point" runs alone between the other two pieces.
+  // "pragma" annotates every piece but the isolated iteration.
+  bool splitLoop (std::string point, bool isolate, std::string pragma,
+                  SourceRewrite & rewrite);
+
+  // Tile the perfect nest of "depth" loops that starts with the parsed loop,
+  // using tiles of "tile" iterations in every loop. "pragma" annotates the
+  // outermost loop over the tiles.
+  bool tileLoop (unsigned int depth, long long int tile, std::string pragma,
+                 SourceRewrite & rewrite);
+
+  // Returns the line where the header "for (...)" of the parsed loop ends.
+  unsigned int getHeaderEndLine () { return headerEndLine; }
+
+  // Split the body of the parsed loop in its statements, giving the first
+  // and the last line of each one. Returns false if the body has anything
+  // other than plain statements.
+  bool splitBody (std::vector<std::pair<unsigned int, unsigned int> > & lines);
+
+  // Returns true if the statement "stmt" of the body declares one scalar, as
+  // in "type name = value;".
+  bool getScalarDeclaration (unsigned int stmt, std::string & type,
+                             std::string & name, std::string & value);
+
+  // Write the parsed loop as one loop for each group of statements, in the
+  // given order. Loops marked in "parallel" are annotated with "pragma". The
+  // scalars declared by the statements in "expand" are stored in temporary
+  // arrays allocated with "malloc", so they can flow from one loop to
+  // another; the original loop runs if they cannot be allocated.
+  bool distributeLoop (std::vector<std::vector<unsigned int> > & groups,
+                       std::vector<bool> & parallel,
+                       std::set<unsigned int> & expand, std::string pragma,
+                       SourceRewrite & rewrite);
+
+  // Write in "result" the code "str" with every access "name[index].field"
+  // replaced by "name_field_soa[index]", an element of the array that keeps
+  // "field" for every struct. The fields accessed are added to "fields".
+  // Returns false if "name" is used in any other way.
+  bool replaceFieldAccesses (std::string str, std::string name,
+                             std::set<std::string> & fields,
+                             std::string & result);
+
+  // Write in "result" the code "str" with every use of the expression
+  // "expr", e.g. "s->data", replaced by "value". Returns false if the
+  // address of the expression is taken.
+  bool replaceExpression (std::string str, std::string expr,
+                          std::string value, std::string & result);
+
+  // Insert at the start of the body of the parsed loop a prefetch of each
+  // access "array[index[expr]]" of the pairs (array, index) in "gathers",
+  // "distance" iterations ahead. Returns false if the body has none of them.
+  bool prefetchGathers (std::vector<std::pair<std::string, std::string> > &
+                        gathers, long long int distance,
+                        SourceRewrite & rewrite);
+};
+
+}
+
+#endif
+
+//===--------------------------- loopRewriter.h ---------------------------===//
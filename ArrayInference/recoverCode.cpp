@@ -60,6 +60,10 @@ void RecoverCode::setOMP (char omp) {
   OMPF = omp;
 }
 
+void RecoverCode::setPresentVars (std::set<std::string> & vars) {
+  PresentVars = vars;
+}
+
 char RecoverCode::OMPType() {
   return OMPF;
 }
@@ -1180,6 +1184,8 @@ std::string RecoverCode::getDataPragma (
   std::vector<std::string> loads;
   std::vector<std::string> stores;
   std::vector<std::string> ldnsts; 
+  unsigned int arrays = vctPtMA.size();
+  std::string present = getPresentClause(vctLower, vctUpper, vctPtMA);
   for (auto I = vctPtMA.begin(), IE = vctPtMA.end(); I != IE; I++) {
     if (I->second == 2)
       stores.push_back(I->first);
@@ -1188,6 +1194,9 @@ std::string RecoverCode::getDataPragma (
     if (I->second == 3)
       ldnsts.push_back(I->first); 
   }
+  // Every array is already on the device, there is nothing to map.
+  if ((vctPtMA.size() < arrays) && vctPtMA.empty() && present.empty())
+    return (OMPF == ACC) ? "#pragma acc kernels\n" : std::string();
   // Create data copies - Host to Devide
   if ((OMPF == OMP_GPU) || (OMPF == OMP_CPU)) {
     result += "#pragma omp target data ";
@@ -1239,12 +1248,33 @@ std::string RecoverCode::getDataPragma (
   }
   if (ldnsts.size() != 0)
     result += ")";
+  result += present;
   result += "\n";
   if (OMPF == ACC)
     result += "#pragma acc kernels\n";
   return result;
 }
 
+std::string RecoverCode::getPresentClause (
+                           std::map<std::string, std::string> & vctLower,
+                           std::map<std::string, std::string> & vctUpper,
+                           std::map<std::string, char> & vctPtMA) {
+  std::string result = std::string();
+  for (auto I = PresentVars.begin(), IE = PresentVars.end(); I != IE; I++) {
+    if (!vctPtMA.count(*I))
+      continue;
+    vctPtMA.erase(*I);
+    if (OMPF != ACC)
+      continue;
+    if (!result.empty())
+      result += ",";
+    result += *I + "[" + vctLower[*I] + ":" + vctUpper[*I] + "]";
+  }
+  if (!result.empty())
+    result = " present(" + result + ")";
+  return result;
+}
+
 std::string RecoverCode::getDataPragmaRegion (
                            std::map<std::string, std::string> & vctLower,
                            std::map<std::string, std::string> & vctUpper,
@@ -1253,6 +1283,8 @@ std::string RecoverCode::getDataPragmaRegion (
   std::vector<std::string> loads;
   std::vector<std::string> stores;
   std::vector<std::string> ldnsts; 
+  unsigned int arrays = vctPtMA.size();
+  std::string present = getPresentClause(vctLower, vctUpper, vctPtMA);
   for (auto I = vctPtMA.begin(), IE = vctPtMA.end(); I != IE; I++) {
     if (I->second == 2)
       stores.push_back(I->first);
@@ -1262,6 +1294,9 @@ std::string RecoverCode::getDataPragmaRegion (
     if (I->second == 3)
       ldnsts.push_back(I->first); 
   }
+  // Every array is already on the device, there is nothing to map.
+  if ((vctPtMA.size() < arrays) && vctPtMA.empty() && present.empty())
+    return std::string();
   // Create data copies - Host to Devide
   if ((OMPF == OMP_CPU) || (OMPF == OMP_GPU)) {
     result += "#pragma omp target data ";
@@ -1313,6 +1348,7 @@ std::string RecoverCode::getDataPragmaRegion (
   }
   if (ldnsts.size() != 0)
     result += ")";
+  result += present;
   result += "\n";
   return result;
 }
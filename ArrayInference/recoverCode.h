@@ -25,6 +25,8 @@
 #include "llvm/Analysis/LoopInfo.h"
 #include <llvm/Transforms/Utils/BasicBlockUtils.h>
 
+#include <set>
+
 #include "PtrRangeAnalysis.h"
 
 #include "constantsSimplify.h"
@@ -69,6 +71,9 @@ class RecoverCode {
   bool Valid;
 
   char OMPF;
+
+  // Arrays already mapped to the device by a data region of the programmer.
+  std::set<std::string> PresentVars;
   
   Value *PointerValue;
 
@@ -186,6 +191,13 @@ class RecoverCode {
                              std::map<std::string, std::string> & vctUpper,
                              std::map<std::string, char> & vctPtMA);
 
+  // Remove the arrays in "PresentVars" from "vctPtMA", and return the clause
+  // that reuses their device copies: "present(...)" in OpenACC. OpenMP maps
+  // them again by reference count, so no clause is needed.
+  std::string getPresentClause (std::map<std::string, std::string> & vctLower,
+                                std::map<std::string, std::string> & vctUpper,
+                                std::map<std::string, char> & vctPtMA);
+
   // Generate the correct upper bound to each pointer analyzed.
   void generateCorrectUB (std::string lLimit, std::string uLimit,
                           std::string & olLimit, std::string & oSize);
@@ -218,6 +230,10 @@ class RecoverCode {
   // Set true to emit omp pragmas
   void setOMP(char omp);
 
+  // Set the arrays already mapped to the device by the programmer. They are
+  // not copied again by the data pragmas.
+  void setPresentVars (std::set<std::string> & vars);
+
   // Return the stats of isOMP variable.
   char OMPType();
 
@@ -9,8 +9,12 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include <algorithm>
+#include <cctype>
+#include <climits>
 #include <fstream>
 #include <queue>
+#include <set>
 
 #include "llvm/Analysis/RegionInfo.h"  
 #include "llvm/Analysis/AliasAnalysis.h"
@@ -18,10 +22,13 @@
 #include "llvm/Analysis/ScalarEvolution.h"
 #include "llvm/Analysis/LoopInfo.h"
 #include "llvm/IR/DIBuilder.h" 
+#include "llvm/IR/DebugInfo.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/DataTypes.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/Dwarf.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Analysis/ValueTracking.h"
 #include "llvm/ADT/Statistic.h"
@@ -35,9 +42,25 @@ using namespace lge;
 #define DEBUG_TYPE "recoverExpressions"
 #define ERROR_VALUE -1
 
+STATISTIC(numTA, "Number of tasks with affinity clauses");
+STATISTIC(numTC, "Number of calls merged into the task of the previous call");
+STATISTIC(numTW, "Number of taskwait directives");
+STATISTIC(numRT, "Number of recursive calls written as tasks");
+
 static cl::opt<bool> ClRegionTask("Region-Task",
 cl::Hidden, cl::desc("Annotate regions in the source file."));
 
+static cl::opt<bool> ClTaskAffinity("Task-Affinity",
+cl::Hidden, cl::desc("Add OpenMP 5 affinity clauses to the tasks."));
+
+static cl::opt<unsigned> ClTaskCutoff("Task-Cutoff",
+cl::Hidden, cl::init(4096), cl::desc("Run the recursive calls that touch "
+"fewer bytes than this, and the calls inside them, without new tasks."));
+
+static cl::opt<unsigned> ClTaskGrain("Task-Grain",
+cl::Hidden, cl::init(50), cl::desc("Merge consecutive calls in one task "
+"while their instructions are fewer than this (0 disables it)."));
+
 int RecoverExpressions::getIndex() {
   return this->index;
 }
@@ -46,6 +69,76 @@ int RecoverExpressions::getNewIndex() {
   return (++(this->index));
 }
 
+void RecoverExpressions::addAffinityLocator(std::string ptr) {
+  size_t first = ptr.find_first_not_of(" ");
+  if (first == std::string::npos)
+    return;
+  ptr = ptr.substr(first, ptr.find_last_not_of(" ") - first + 1);
+  if (!isalpha(ptr[0]) && (ptr[0] != '_'))
+    return;
+
+  // A pointer variable stands for the memory it points to, not for itself.
+  size_t name = 0;
+  while ((name < ptr.size()) && (isalnum(ptr[name]) || (ptr[name] == '_')))
+    name++;
+  if (name == ptr.size())
+    ptr += "[0]";
+  else if ((ptr[name] != '[') || (ptr[ptr.size() - 1] != ']'))
+    return;
+
+  for (unsigned int i = 0, ie = affinity.size(); i != ie; i++)
+    if (affinity[i] == ptr)
+      return;
+  affinity.push_back(ptr);
+}
+
+bool RecoverExpressions::isDataPointer(CallInst *CI, unsigned int arg) {
+  PointerType *PT = dyn_cast<PointerType>(CI->getArgOperand(arg)->getType());
+  if (!PT)
+    return false;
+
+  // "void *" is lowered to "i8 *", as "char *": only the debug type of the
+  // parameter tells them apart.
+  bool byte = PT->getElementType()->isIntegerTy(8);
+  Function *F = CI->getCalledFunction();
+  DISubprogram *SP = F ? getDISubprogram(F) : nullptr;
+  DISubroutineType *FT = SP ? SP->getType() : nullptr;
+  if (!FT || ((arg + 1) >= FT->getTypeArray().size()))
+    return !byte;
+  DIType *T = resolveType(FT->getTypeArray()[arg + 1],
+                          ptrRa->TypeIdentifierMap);
+  while (DIDerivedType *DT = dyn_cast_or_null<DIDerivedType>(T)) {
+    unsigned tag = DT->getTag();
+    if (tag == dwarf::DW_TAG_pointer_type) {
+      // The pointee of "void *" has no type, even under qualifiers.
+      Metadata *Pointee = DT->getBaseType();
+      while (DIDerivedType *Q = dyn_cast_or_null<DIDerivedType>(Pointee)) {
+        if ((Q->getTag() != dwarf::DW_TAG_const_type) &&
+            (Q->getTag() != dwarf::DW_TAG_volatile_type))
+          break;
+        Pointee = Q->getBaseType();
+      }
+      return Pointee != nullptr;
+    }
+    if ((tag != dwarf::DW_TAG_typedef) && (tag != dwarf::DW_TAG_const_type) &&
+        (tag != dwarf::DW_TAG_volatile_type) &&
+        (tag != dwarf::DW_TAG_restrict_type))
+      return false;
+    T = resolveType(DT->getBaseType(), ptrRa->TypeIdentifierMap);
+  }
+  return false;
+}
+
+std::string RecoverExpressions::getAffinityClause() {
+  if (!ClTaskAffinity || affinity.empty())
+    return std::string();
+  std::string clause = " affinity(";
+  for (unsigned int i = 0, ie = affinity.size(); i != ie; i++)
+    clause += (i ? "," : "") + affinity[i];
+  numTA++;
+  return clause + ")";
+}
+
 void RecoverExpressions::addCommentToLine (std::string Comment,
                                          unsigned int Line) {     
   if (Comments.count(Line) == 0)
@@ -130,12 +223,16 @@ std::string RecoverExpressions::analyzeCallInst(CallInst *CI,
   if (output == std::string()) {
     return std::string();
   }
+  if (isDataPointer(CI, 0))
+    addAffinityLocator(output);
   for (unsigned int i = 1; i < CI->getNumArgOperands(); i++) {
     std::string str = analyzeValue(CI->getArgOperand(i), DT, RC);
     if (str == std::string()) {
       return std::string();
     }
       output += "," + str;
+    if (isDataPointer(CI, i))
+      addAffinityLocator(str);
   }
   return output;
 }
@@ -257,6 +354,289 @@ void RecoverExpressions::annotateExternalLoop(Instruction *I) {
   addCommentToLine(output, line);
 }
 
+std::vector<std::string> RecoverExpressions::splitList(std::string list) {
+  std::vector<std::string> items;
+  std::string item = std::string();
+  int depth = 0;
+  for (unsigned int i = 0, ie = list.size(); i != ie; i++) {
+    if ((list[i] == '(') || (list[i] == '['))
+      depth++;
+    if ((list[i] == ')') || (list[i] == ']'))
+      depth--;
+    if ((list[i] == ',') && (depth == 0)) {
+      items.push_back(item);
+      item = std::string();
+      continue;
+    }
+    item += list[i];
+  }
+  items.push_back(item);
+  return items;
+}
+
+unsigned int RecoverExpressions::getTaskWork(Function *F) {
+  unsigned int work = 0;
+  std::set<BasicBlock*> visited;
+  for (auto BB = F->begin(), BE = F->end(); BB != BE; BB++) {
+    visited.insert(&(*BB));
+    // A branch back to a block already seen closes a loop.
+    TerminatorInst *TI = BB->getTerminator();
+    for (unsigned int i = 0, ie = TI->getNumSuccessors(); i != ie; i++)
+      if (visited.count(TI->getSuccessor(i)))
+        return UINT_MAX;
+    for (auto I = BB->begin(), IE = BB->end(); I != IE; I++) {
+      if (isa<CallInst>(I) && !isa<DbgInfoIntrinsic>(I))
+        return UINT_MAX;
+      work++;
+    }
+  }
+  return work;
+}
+
+bool RecoverExpressions::isSingleLineCall(CallInst *CI) {
+  DebugLoc DL = CI->getDebugLoc();
+  if (!DL)
+    return false;
+  std::string file = DL->getFilename();
+  std::string dir = DL->getDirectory();
+  if (!file.empty() && (file[0] != '/') && !dir.empty())
+    file = dir + "/" + file;
+
+  if (!SourceLines.count(file)) {
+    std::vector<std::string> & content = SourceLines[file];
+    std::ifstream Infile(file.c_str());
+    std::string Line;
+    while (std::getline(Infile, Line))
+      content.push_back(Line);
+  }
+  std::vector<std::string> & content = SourceLines[file];
+  unsigned int line = DL.getLine();
+  if ((line == 0) || (line > content.size()))
+    return false;
+
+  // The arguments of the call may be wrapped over several lines.
+  std::string text = content[line - 1];
+  int depth = 0;
+  for (unsigned int i = 0, ie = text.size(); i != ie; i++) {
+    if (text[i] == '(')
+      depth++;
+    if (text[i] == ')')
+      depth--;
+  }
+  size_t end = text.find_last_not_of(" \t\r");
+  return (depth == 0) && (end != std::string::npos) && (text[end] == ';');
+}
+
+bool RecoverExpressions::canMergeTasks(CallTask & task, CallTask & next) {
+  CallInst *last = task.calls.back();
+  CallInst *first = next.calls.front();
+  if ((last->getParent() != first->getParent()) ||
+      (next.line != (task.lastLine + 1)) || !next.prologue.empty())
+    return false;
+  // The merged task is closed after the line of its last call.
+  if (!isSingleLineCall(last) || !isSingleLineCall(first))
+    return false;
+  if ((task.work >= ClTaskGrain) || (next.work >= ClTaskGrain) ||
+      ((task.work + next.work) >= ClTaskGrain))
+    return false;
+
+  std::set<std::string> taskItems(task.items.begin(), task.items.end());
+  std::set<std::string> nextItems(next.items.begin(), next.items.end());
+  return (std::includes(taskItems.begin(), taskItems.end(),
+                        nextItems.begin(), nextItems.end()) ||
+          std::includes(nextItems.begin(), nextItems.end(),
+                        taskItems.begin(), taskItems.end()));
+}
+
+void RecoverExpressions::placeTaskwait(CallTask & task,
+                                       std::vector<CallTask> & tasks,
+                                       std::set<CallInst*> & taskCalls) {
+  // Outside loops, the task ends with the "single" construct around it.
+  Loop *L = li->getLoopFor(task.calls.front()->getParent());
+  if (!L)
+    return;
+  while (L->getParentLoop())
+    L = L->getParentLoop();
+
+  std::vector<Value*> pointers;
+  for (unsigned int i = 0, ie = task.calls.size(); i != ie; i++)
+    for (unsigned int j = 0, je = task.calls[i]->getNumArgOperands(); j != je;
+         j++)
+      if (task.calls[i]->getArgOperand(j)->getType()->isPointerTy())
+        pointers.push_back(task.calls[i]->getArgOperand(j));
+  if (pointers.empty())
+    return;
+
+  // Walk the loop from the task to its end, and then from its start to the
+  // task, as the next iteration runs the first part again.
+  std::vector<Instruction*> after, before;
+  bool found = false;
+  Function *F = L->getHeader()->getParent();
+  for (auto BB = F->begin(), BE = F->end(); BB != BE; BB++) {
+    if (!L->contains(&(*BB)))
+      continue;
+    for (auto I = BB->begin(), IE = BB->end(); I != IE; I++) {
+      if (&(*I) == task.calls.back()) {
+        found = true;
+        continue;
+      }
+      if (found)
+        after.push_back(&(*I));
+      else
+        before.push_back(&(*I));
+    }
+  }
+  after.insert(after.end(), before.begin(), before.end());
+
+  int loopLine = getLineNo(L->getHeader()->getTerminator());
+  if (L->getStartLoc())
+    loopLine = L->getStartLoc().getLine();
+  for (unsigned int i = 0, ie = after.size(); i != ie; i++) {
+    Instruction *I = after[i];
+    if (isa<DbgInfoIntrinsic>(I) || taskCalls.count(dyn_cast<CallInst>(I)))
+      continue;
+    std::vector<Value*> uses;
+    if (Value *Ptr = getPointerOperand(I))
+      if (!isa<GetElementPtrInst>(I))
+        uses.push_back(Ptr);
+    if (CallInst *CI = dyn_cast<CallInst>(I))
+      for (unsigned int j = 0, je = CI->getNumArgOperands(); j != je; j++)
+        if (CI->getArgOperand(j)->getType()->isPointerTy())
+          uses.push_back(CI->getArgOperand(j));
+
+    bool used = false;
+    for (unsigned int j = 0, je = uses.size(); (j != je) && !used; j++)
+      for (unsigned int k = 0, ke = pointers.size(); (k != ke) && !used; k++)
+        used = (aa->alias(uses[j], MemoryLocation::UnknownSize, pointers[k],
+                          MemoryLocation::UnknownSize) != NoAlias);
+    if (!used)
+      continue;
+
+    // The directive cannot be written before the loop that holds the
+    // "single" construct.
+    int line = getLineNo(I);
+    if ((line == ERROR_VALUE) || (line == loopLine))
+      return;
+    std::string taskwait = "#pragma omp taskwait\n";
+    for (unsigned int j = 0, je = tasks.size(); j != je; j++) {
+      if ((line < tasks[j].line) || (line > tasks[j].lastLine))
+        continue;
+      size_t pos = Comments[tasks[j].line].find(tasks[j].pragma);
+      if (pos == std::string::npos)
+        return;
+      if (Comments[tasks[j].line].rfind(taskwait, pos) !=
+          (pos - taskwait.size()))
+        Comments[tasks[j].line].insert(pos, taskwait);
+      numTW++;
+      return;
+    }
+    addCommentToLine(taskwait, line);
+    numTW++;
+    return;
+  }
+}
+
+bool RecoverExpressions::getSourceExpression(LinearExpr & expr,
+                                             std::string & str) {
+  str = std::string();
+  for (auto I = expr.terms.begin(), IE = expr.terms.end(); I != IE; I++) {
+    std::string name = rn->getNameofValue(I->first).nameInFile;
+    if (name.empty())
+      return false;
+    int64_t k = I->second;
+    if (!str.empty())
+      str += (k < 0) ? " - " : " + ";
+    else if (k < 0)
+      str += "-";
+    k = (k < 0) ? -k : k;
+    str += ((k == 1) ? std::string() : (std::to_string(k) + " * ")) + name;
+  }
+  if (str.empty())
+    str = std::to_string(expr.constant);
+  else if (expr.constant != 0)
+    str += ((expr.constant < 0) ? " - " : " + ") +
+           std::to_string((expr.constant < 0) ? -expr.constant :
+                                                expr.constant);
+  str = "(" + str + ")";
+  return true;
+}
+
+int RecoverExpressions::getNextStatementLine(CallInst *CI) {
+  int line = getLineNo(CI);
+  BasicBlock *BB = CI->getParent();
+  auto I = BasicBlock::iterator(CI);
+  for (I++; I != BB->end(); I++)
+    if (getLineNo(I) > line)
+      return getLineNo(I);
+  if (BB->getTerminator()->getNumSuccessors() != 1)
+    return ERROR_VALUE;
+  BasicBlock *Next = BB->getTerminator()->getSuccessor(0);
+  for (auto J = Next->begin(), JE = Next->end(); J != JE; J++)
+    if (getLineNo(J) > line)
+      return getLineNo(J);
+  return ERROR_VALUE;
+}
+
+void RecoverExpressions::annotateRecursiveCalls(Function *F,
+                                                std::set<CallInst*> & calls) {
+  summary.setAnalyses(se, dt, li);
+  if (!summary.summarize(F))
+    return;
+
+  for (auto BB = F->begin(), BE = F->end(); BB != BE; BB++) {
+    // Sibling calls follow each other, with nothing touching memory between
+    // them, and their results are not used.
+    std::vector<CallInst*> siblings;
+    for (auto I = BB->begin(), IE = BB->end(); I != IE; I++) {
+      CallInst *CI = dyn_cast<CallInst>(I);
+      if (CI && (CI->getCalledFunction() == F) && CI->use_empty() &&
+          (getLineNo(CI) != ERROR_VALUE) && isUniqueinLine(CI)) {
+        siblings.push_back(CI);
+        continue;
+      }
+      if (siblings.empty() || isa<DbgInfoIntrinsic>(I) ||
+          !I->mayReadOrWriteMemory())
+        continue;
+      if (siblings.size() > 1)
+        break;
+      siblings.clear();
+    }
+    if (siblings.size() < 2)
+      continue;
+
+    bool disjoint = true;
+    for (unsigned int i = 0, ie = siblings.size(); i != ie; i++)
+      for (unsigned int j = i + 1; j != ie; j++)
+        disjoint = disjoint && summary.areDisjoint(siblings[i], siblings[j]);
+    int waitLine = getNextStatementLine(siblings.back());
+    if (!disjoint || (waitLine == ERROR_VALUE))
+      continue;
+
+    // Small calls run with their whole recursion in the task that reaches
+    // them, through "final".
+    std::vector<std::string> pragmas;
+    for (unsigned int i = 0, ie = siblings.size(); i != ie; i++) {
+      LinearExpr bytes;
+      std::string size;
+      if (!summary.getCallSize(siblings[i], bytes) ||
+          !getSourceExpression(bytes, size))
+        break;
+      pragmas.push_back("#pragma omp task final(" + size + " < " +
+                        std::to_string(ClTaskCutoff) + ")\n");
+    }
+    if (pragmas.size() != siblings.size())
+      continue;
+
+    for (unsigned int i = 0, ie = siblings.size(); i != ie; i++) {
+      addCommentToLine(pragmas[i], getLineNo(siblings[i]));
+      calls.insert(siblings[i]);
+      numRT++;
+    }
+    addCommentToLine("#pragma omp taskwait\n", waitLine);
+    numTW++;
+  }
+}
+
 void RecoverExpressions::analyzeFunction(Function *F) {
   const DataLayout DT = F->getParent()->getDataLayout();
   RecoverCode RC;
@@ -265,13 +645,19 @@ void RecoverExpressions::analyzeFunction(Function *F) {
   RC.setRecoverNames(rn);
   RC.initializeNewVars();
 
-  std::map<Loop*, bool> loops;
+  std::set<CallInst*> recursive;
+  annotateRecursiveCalls(F, recursive);
+
+  // Collect the calls that become tasks, merging the consecutive ones that
+  // are too small to pay for a task of their own.
+  std::vector<CallTask> tasks;
   for (auto BB = F->begin(), BE = F->end(); BB != BE; BB++) {
     for (auto I = BB->begin(), IE = BB->end(); I != IE; I++) {
-      if (isa<CallInst>(I)) {
+      if (isa<CallInst>(I) && !recursive.count(cast<CallInst>(I))) {
         valid = true;
         computationName = "TM" + std::to_string(getNewIndex());
         RC.setNAME(computationName);
+        affinity.clear();
         std::string result = analyzeValue(I, &DT, &RC);
         if (result != std::string()) {
           std::string output = std::string();
@@ -284,22 +670,67 @@ void RecoverExpressions::analyzeFunction(Function *F) {
                continue;
             }
           }
-          output += "#pragma omp task depend(inout:" + result + ")\n";
           Region *R = rp->getRegionInfo().getRegionFor(BB);
-          int line = getLineNo(I);
-          Loop *L = this->li->getLoopFor(I->getParent());
-          if (!isUniqueinLine(I))
+          if (!isUniqueinLine(I) || !st->isSafetlyRegionLoops(R))
+            continue;
+          CallTask task;
+          task.calls.push_back(cast<CallInst>(I));
+          task.line = task.lastLine = getLineNo(I);
+          task.prologue = output;
+          task.items = splitList(result);
+          task.affinity = affinity;
+          task.work = getTaskWork(cast<CallInst>(I)->getCalledFunction());
+          if (!tasks.empty() && canMergeTasks(tasks.back(), task)) {
+            CallTask & prev = tasks.back();
+            prev.calls.push_back(task.calls.front());
+            prev.lastLine = task.line;
+            prev.work += task.work;
+            if (task.items.size() > prev.items.size())
+              prev.items = task.items;
+            for (unsigned int i = 0, ie = task.affinity.size(); i != ie; i++)
+              if (std::find(prev.affinity.begin(), prev.affinity.end(),
+                            task.affinity[i]) == prev.affinity.end())
+                prev.affinity.push_back(task.affinity[i]);
+            numTC++;
             continue;
-          if (!loops.count(L)) {
-            annotateExternalLoop(I);
-            loops[L] = true;
           }
-          if(st->isSafetlyRegionLoops(R))
-            addCommentToLine(output, line);
+          tasks.push_back(task);
         }
       }
     }
   }
+
+  std::set<CallInst*> taskCalls;
+  for (unsigned int i = 0, ie = tasks.size(); i != ie; i++)
+    taskCalls.insert(tasks[i].calls.begin(), tasks[i].calls.end());
+
+  std::map<Loop*, bool> loops;
+  for (unsigned int i = 0, ie = tasks.size(); i != ie; i++) {
+    CallTask & task = tasks[i];
+    std::string output = task.prologue;
+    output += "#pragma omp task depend(inout:";
+    for (unsigned int j = 0, je = task.items.size(); j != je; j++)
+      output += (j ? "," : "") + task.items[j];
+    affinity = task.affinity;
+    output += ")" + getAffinityClause() + "\n";
+    if (task.lastLine != task.line) {
+      output += "{\n";
+      addCommentToLine("}\n", task.lastLine + 1);
+    }
+    Instruction *I = task.calls.front();
+    Loop *L = this->li->getLoopFor(I->getParent());
+    if (!loops.count(L)) {
+      annotateExternalLoop(I);
+      loops[L] = true;
+    }
+    task.pragma = output;
+    addCommentToLine(output, task.line);
+  }
+
+  // Tasks only wait for the others at the end of the "single" construct, so
+  // the host code that uses their memory before it must wait for them.
+  for (unsigned int i = 0, ie = tasks.size(); i != ie; i++)
+    placeTaskwait(tasks[i], tasks, taskCalls);
 }
 
 Value *RecoverExpressions::getPointerOperand(Instruction *Inst) {
@@ -325,6 +756,7 @@ std::string RecoverExpressions::extractDataPragma(Region *R) {
   RC.setNAME(computationName);
   RC.setRecoverNames(rn);
   RC.initializeNewVars();
+  affinity.clear();
 
   for (BasicBlock *BB : R->blocks())
     for (auto I = BB->begin(), E = --BB->end(); I != E; ++I) {
@@ -339,6 +771,8 @@ std::string RecoverExpressions::extractDataPragma(Region *R) {
         int var = -1;
         std::string name = RC.getAccessString(BasePtrV, "", &var, &DT);
         pointers[name] = this->ptrRa->getPointerAcessType(R, BasePtrV);
+        if (BasePtrV->getType()->isPointerTy() && pointers[name])
+          addAffinityLocator(name);
         if (pointers[name] == 1)
           hasLOAD = true;
         if (pointers[name] == 3)
@@ -379,7 +813,7 @@ std::string RecoverExpressions::extractDataPragma(Region *R) {
   }
 
   if(hasLOAD || hasLOADSTORE)
-    pragma += ")\n{\n";
+    pragma += ")" + getAffinityClause() + "\n{\n";
 
   return pragma; 
 }
@@ -25,6 +25,8 @@
 #include "PtrRangeAnalysis.h"
 #endif
 
+#include "accessSummary.h"
+
 using namespace lge;
 
 namespace llvm {
@@ -54,6 +56,30 @@ class RecoverExpressions : public FunctionPass {
   std::string NAME;
 
   int index;
+
+  // Pointer arguments of the task being analyzed, used as the locators of its
+  // "affinity" clause.
+  std::vector<std::string> affinity;
+
+  // Lines of each source file already read.
+  std::map<std::string, std::vector<std::string> > SourceLines;
+
+  // Memory touched by the calls of each function analyzed.
+  AccessSummary summary;
+
+  // A task with one or more consecutive calls, in the lines [line, lastLine].
+  // "prologue" computes the expressions of its "depend" clause, and "pragma"
+  // is all the code written before its first line.
+  typedef struct CallTask {
+    std::vector<CallInst*> calls;
+    int line;
+    int lastLine;
+    std::string prologue;
+    std::string pragma;
+    std::vector<std::string> items;
+    std::vector<std::string> affinity;
+    unsigned int work;
+  } CallTask;
   //===---------------------------------------------------------------------===
 
   // Methods to manage the correct computation auxiliar names.
@@ -73,6 +99,41 @@ class RecoverExpressions : public FunctionPass {
   // Find and delimitate the expressions in a function.
   void analyzeFunction(Function *F);
 
+  // Split the list "list", separated by commas, in its items.
+  std::vector<std::string> splitList(std::string list);
+
+  // Estimate the number of instructions run by a call to F. Functions with
+  // loops or calls are estimated as too large to be merged with others.
+  unsigned int getTaskWork(Function *F);
+
+  // Returns true if "task" and "next" are consecutive calls, in the same
+  // block, whose dependences are the same or nested, and their work put
+  // together is still below the grain of the tasks.
+  bool canMergeTasks(CallTask & task, CallTask & next);
+
+  // Returns true if the statement of the call CI ends in the line where it
+  // starts, so a task around it can be closed in the next line.
+  bool isSingleLineCall(CallInst *CI);
+
+  // Write the sibling recursive calls of F that touch disjoint memory as
+  // tasks, with a "taskwait" after them. The calls written are added to
+  // "calls".
+  void annotateRecursiveCalls(Function *F, std::set<CallInst*> & calls);
+
+  // Write the expression "expr" with the names of the source file. Returns
+  // false if a value has no name.
+  bool getSourceExpression(LinearExpr & expr, std::string & str);
+
+  // Returns the line of the first instruction after CI, in its block or in
+  // its only successor, that is written after the line of CI.
+  int getNextStatementLine(CallInst *CI);
+
+  // Write the "taskwait" before the first instruction, in the loop of the
+  // task, that uses the memory passed to it out of the task. A use in the
+  // arguments of a task waits before the code of that task.
+  void placeTaskwait(CallTask & task, std::vector<CallTask> & tasks,
+                     std::set<CallInst*> & taskCalls);
+
   // Annotate the pragmas before a loop, case necessary.
   void annotateExternalLoop(Instruction *I);
 
@@ -96,6 +157,18 @@ class RecoverExpressions : public FunctionPass {
   // Extract a pragma with ( in / out ) data transference. 
   std::string extractDataPragma(Region *R);
 
+  // Adds the memory pointed by the expression "ptr" to the locators of the
+  // "affinity" clause, if it can be written as an array element.
+  void addAffinityLocator(std::string ptr);
+
+  // Returns true if the argument "arg" of the call CI points to data that
+  // can be a locator, i.e. it is a pointer, but not "void *".
+  bool isDataPointer(CallInst *CI, unsigned int arg);
+
+  // Returns the "affinity" clause for the locators collected, or an empty
+  // string.
+  std::string getAffinityClause();
+
   // Return the value with the pointer operand.
   Value *getPointerOperand(Instruction *Inst);
 
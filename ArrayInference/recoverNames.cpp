@@ -98,6 +98,37 @@ const Function *RecoverNames::findEnclosingFunc(const Value *V) {
 }
 
 const DILocalVariable *RecoverNames::findVar(const Value *V, const Function *F) {
+  // The debug intrinsics refer to V through metadata, so they are users of the
+  // value that wraps it, and V does not need to be searched in F.
+  ValueAsMetadata *VM = ValueAsMetadata::getIfExists(const_cast<Value*>(V));
+  if (!VM)
+    return NULL;
+  MetadataAsValue *MV = MetadataAsValue::getIfExists(V->getContext(), VM);
+  if (!MV)
+    return NULL;
+
+  const DILocalVariable *Var = NULL;
+  unsigned int found = 0;
+  for (const User *U : MV->users()) {
+    const Instruction *I = dyn_cast<Instruction>(U);
+    if (!I || (I->getParent()->getParent() != F))
+      continue;
+    if (const DbgDeclareInst *DbgDeclare = dyn_cast<DbgDeclareInst>(I)) {
+      if (DbgDeclare->getAddress() == V) {
+        Var = DbgDeclare->getVariable();
+        found++;
+      }
+    }
+    else if (const DbgValueInst *DbgValue = dyn_cast<DbgValueInst>(I))
+      if (DbgValue->getValue() == V) {
+        Var = DbgValue->getVariable();
+        found++;
+      }
+  }
+  if (found <= 1)
+    return Var;
+
+  // V keeps several variables: the first one in F names it.
   for (auto Iter = inst_begin(F), End = inst_end(F); Iter != End; ++Iter) {
     const Instruction *I = &*Iter;
     if (const DbgDeclareInst *DbgDeclare = dyn_cast<DbgDeclareInst>(I)) {
@@ -162,29 +193,11 @@ bool RecoverNames::addVarName(RegionVars *list, VarNames var) {
   return true;
 }
 
-bool RecoverNames::haveListLocation(Region *region) {
-  unsigned int loc = 0;
-  if (varsList.empty())
-    return false;
-
-  while (varsList[loc].region != region) {
-    loc++;
-    if (loc == varsList.size())
-      return false;
-  }
-  return true;
-}
-
 unsigned int RecoverNames::getListLocation(Region *region) {
-  if (varsList.empty())
-    return INT_MAX;
-  unsigned int loc = 0;
-  while (varsList[loc].region != region) {
-    loc++;
-    if (loc == varsList.size())
-      break;
-  }
-  return loc;
+  for (unsigned int loc = 0, e = varsList.size(); loc < e; loc++)
+    if (varsList[loc].region == region)
+      return loc;
+  return findRegionAdress(region);
 }
 
 // This void copy one list of Variables of Analyzed region
@@ -268,14 +281,16 @@ void RecoverNames::initializeRegionVars(RegionVars *list, Region *region,
   list->regionName = region->getNameStr();
 }
 
-void RecoverNames::findRegionAdress(Region *region, Region *regionParent,
-                                    int *id) {
+unsigned int RecoverNames::findRegionAdress(Region *region) {
   RegionVars list;
+  Region *regionParent = region->getParent();
   // Insert in list the data of analized region.
-  if (*id != 0)
-    initializeRegionVars(&list, region, regionParent, false, true, *id);
+  if (regionParent)
+    initializeRegionVars(&list, region, regionParent, false, true,
+                         regionGlobalIndex++);
   else
-    initializeRegionVars(&list, region, regionParent, true, false, *id);
+    initializeRegionVars(&list, region, region, true, false,
+                         regionGlobalIndex++);
 
   // Try find a name of variables for each instruction in a basic block.
   for (Region::block_iterator B = region->block_begin(),
@@ -284,34 +299,25 @@ void RecoverNames::findRegionAdress(Region *region, Region *regionParent,
     for (auto I = B->begin(), J = B->begin(), IEnd = B->end(); I != IEnd; ++I) {
       getPtrMetadata(&list, J, I, region);
       J = I;
-      VarNames var;
-      var = getNameofValue(I);
     }
 
   // Copy the parant variables
-  if (haveListLocation(region))
-    copyList(&list, getListLocation(region));
+  if (regionParent)
+    copyList(&list, getListLocation(regionParent));
 
   // Insert this region, now analized, in the set of regions
   varsList.push_back(list);
-
-  // For each sub region, try find your variable names
-  for (auto SR = region->begin(), SRE = region->end(); SR != SRE; ++SR) {
-    Region *r = &(**SR);
-    *id++;
-    findRegionAdress(r, region, id);
-  }
+  return varsList.size() - 1;
 }
 
 RecoverNames::RegionVars RecoverNames::findRegionVariables(Region *R) {
-  for (unsigned int i = 0, e = varsList.size(); i < e; i++)
-    if (varsList[i].region == R)
-      return varsList[i];
-
-  RegionVars list;
-  initializeRegionVars(&list, R, R, false, false, -1);
-  list.regionName = "This region variables not found.\n";
-  return list;
+  if (!R) {
+    RegionVars list;
+    list.region = nullptr;
+    list.regionName = "This region variables not found.\n";
+    return list;
+  }
+  return varsList[getListLocation(R)];
 }
 
 RecoverNames::VarNames RecoverNames::getName(Instruction *I) {
@@ -353,6 +359,15 @@ void RecoverNames::searchGlobalVariables(Module *M) {
 }
 
 RecoverNames::VarNames RecoverNames::getNameofValue(Value *V) {
+  auto Cached = nameCache.find(V);
+  if (Cached != nameCache.end())
+    return Cached->second;
+  VarNames var = findNameofValue(V);
+  nameCache[V] = var;
+  return var;
+}
+
+RecoverNames::VarNames RecoverNames::findNameofValue(Value *V) {
   VarNames var;
   var.nameInFile = "";
   if (isa<Argument>(V) || isa<PHINode>(V)) {
@@ -396,11 +411,8 @@ RecoverNames::VarNames RecoverNames::getNameofValue(Value *V) {
     }
 
     BasicBlock *bb = I->getParent();
-    Function *F = bb->getParent();
     Region *r = rp->getRegionInfo().getRegionFor(bb);
-    RegionVars rv = findRegionVariables(r);
     Value *v = getBasePtrValue(I, r);
-    Module *M = F->getParent();
 
     if (isa<Argument>(v)) {
       var.nameInFile = getOriginalName(v);
@@ -455,12 +467,11 @@ bool RecoverNames::runOnFunction(Function &F) {
   Module *M = F.getParent();
   searchGlobalVariables(M);
 
-  int index = 0;
-
-  // For top region in the function, call the void findRegionAdress:
-  Region *topRegion = rp->getRegionInfo().getRegionFor(&F.getEntryBlock());
-
-  findRegionAdress(topRegion, topRegion, &index);
+  // The names and the lists of the regions are only recovered when they are
+  // requested.
+  varsList.clear();
+  nameCache.clear();
+  regionGlobalIndex = 0;
 
   return true;
 }
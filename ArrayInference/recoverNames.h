@@ -12,6 +12,11 @@
 // in source file.
 // But, if is a memory access instruction, return the name in source file.
 // The result is the name per region.
+//
+// Names are recovered on demand: the debug intrinsics of a value are found
+// through its uses, and the name of each value queried is cached until the
+// next function. The lists of names per region are only built when a region
+// is requested.
 // 
 // To use this pass please use the flag "-writeExpressions", see the example
 // available below:
@@ -26,6 +31,7 @@
 #include <vector>
 
 #include "llvm/IR/DIBuilder.h"
+#include "llvm/IR/ValueMap.h"
 
 // Start of llvm's namespace.
 namespace llvm {
@@ -89,8 +95,8 @@ class RecoverNames : public FunctionPass {
 
   explicit RecoverNames() : FunctionPass(ID) {};
 
-  // This method return the set of variables of the region R. If not found,
-  // return a empty Set, but the regionName attribute is a message.
+  // This method return the set of variables of the region R, with the
+  // variables of its parents. The set is built in the first request.
   RegionVars findRegionVariables(Region *R);
 
   // Return the varNames for instruction I, case was analyzed.
@@ -113,6 +119,10 @@ class RecoverNames : public FunctionPass {
   // allocated.
   Value* getPointerFnCall (CallInst *CI);
 
+  // This method return a MDNode just if some instructions have a address or
+  // value is equal to the value v.
+  const DILocalVariable* findVar(const Value* V,const Function* F);
+
   private:
 
   // Return if some instruction is invariant in a region.
@@ -137,11 +147,8 @@ class RecoverNames : public FunctionPass {
   // Add variable var in a list, return true if it's added.
   bool addVarName(RegionVars *list,VarNames var);
 
-  // Return if some region was analyzed before by pass.
-  // This method return true if one region is not Analyzed.  
-  bool haveListLocation(Region *region);
-
-  // Return the position in vector varsList for Region "region".
+  // Return the position in vector varsList for Region "region", building its
+  // list if it was not requested before.
   unsigned int getListLocation(Region *region);
 
   /// Initialize VarNames with default values.
@@ -150,9 +157,9 @@ class RecoverNames : public FunctionPass {
   // Set the type of operation for instruction I in variable var.
   void typeVarNames(VarNames *var, Instruction *I);
 
-  // This pass is a function pass. For this, each Region  is analyzed by pass
-  // in its  function. The idea is do a liveness analyses.
-  void findRegionAdress(Region *region,Region *regionParent,int *idRegion);
+  // Build the list of variables of "region", after the list of its parent.
+  // Returns its position in varsList.
+  unsigned int findRegionAdress(Region *region);
 
   // getPtrMetadata void is used to insert in the list of "regionVars"
   // the name of variables.
@@ -162,16 +169,15 @@ class RecoverNames : public FunctionPass {
   // Return the Function of the value v.
   const Function* findEnclosingFunc(const Value* V);
   
-  // This method return a MDNode just if some instructions have a address or
-  // value is equal to the value v.
-  const DILocalVariable* findVar(const Value* V,const Function* F);
-
   // Return the name of the variable if it is interesting to analyze.  
   StringRef getOriginalName(const Value* V);
 
   // Search in the Module the Global Variables.
   void searchGlobalVariables(Module *M);
 
+  // Recover the name of V, without looking at the cache of getNameofValue.
+  VarNames findNameofValue(Value *V);
+
   // Global data structs used.
   std::vector <RegionVars> varsList;
 
@@ -180,6 +186,13 @@ class RecoverNames : public FunctionPass {
   int regionGlobalIndex = 0;
 
   std::map<Value*, bool> arrays; 
+
+  // Names already recovered by getNameofValue. Entries of deleted values are
+  // dropped, and values replaced by others keep their own entries.
+  struct NameCacheConfig : ValueMapConfig<Value*> {
+    enum { FollowRAUW = false };
+  };
+  ValueMap<Value*, VarNames, NameCacheConfig> nameCache;
   // End of global data structs used.
 
   // Passes used.
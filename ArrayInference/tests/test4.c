@@ -0,0 +1,5 @@
+void func(int *n, int b, int k){
+  for (int i = 0; i < b; i++) {
+  	  n[i+k] = n[i] + 1;
+  }
+}
@@ -27,6 +27,9 @@
 // 
 //===----------------------------------------------------------------------===//
 
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
 #include <fstream>
 #include <queue>
 
@@ -36,15 +39,21 @@
 #include "llvm/Analysis/ScalarEvolution.h"
 #include "llvm/Analysis/LoopInfo.h"
 #include "llvm/IR/DIBuilder.h" 
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/DebugInfo.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/DataTypes.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/Dwarf.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Analysis/ValueTracking.h"
 #include "llvm/ADT/Statistic.h"
 
 #include "PtrRangeAnalysis.h"
+#include "../DepBasedParallelLoopAnalysis/SplitIteration.h"
 
 #include "writeExpressions.h"
 
@@ -57,11 +66,31 @@ using namespace lge;
 #define ACC '0'
 #define OMP_GPU '1'
 #define OMP_CPU '2'
+#define USER_PARALLEL 1
+#define USER_ATTACHED 2
+#define NT_NONE 0
+#define NT_PRAGMA 1
+#define NT_REWRITE 2
+#define MIN_TILE 8
+#define MAX_TILE 512
 
 STATISTIC(numL , "Number of loops");
 STATISTIC(numAL , "Number of analyzable loops");
 STATISTIC(numWL , "Number of annotated loops"); 
 STATISTIC(numFLC , "Number of safe call instructions inside loops");
+STATISTIC(numPL , "Number of annotated loops after peeling iterations");
+STATISTIC(numTL , "Number of tiled loop nests");
+STATISTIC(numDL , "Number of distributed loops");
+STATISTIC(numRC , "Number of annotated loops with runtime dependence checks");
+STATISTIC(numSL , "Number of annotated loops after splitting them");
+STATISTIC(numUP , "Number of loops left to parallel directives of the user");
+STATISTIC(numNP , "Number of annotated loops inside other parallel loops");
+STATISTIC(numWH , "Number of annotated while loops rewritten as for loops");
+STATISTIC(numSA , "Number of offloaded loops using one array per struct field");
+STATISTIC(numRD , "Number of loops dispatched at runtime");
+STATISTIC(numDS , "Number of serial loops kept on the device in data regions");
+STATISTIC(numPF , "Number of loops with prefetched indirect accesses");
+STATISTIC(numNT , "Number of loops with nontemporal stores");
 
 static cl::opt<bool> ClEmitParallel("Emit-Parallel",
     cl::Hidden, cl::desc("Use Loop Parallel Analysis to anotate."));
@@ -78,116 +107,1983 @@ static cl::opt<bool> ClDivergent("Discard-Divergent",
 static cl::opt<bool> ClCoalescing("Memory-Coalescing", 
     cl::desc("Annotate Pragmas using data coallesing."));
 
+static cl::opt<bool> ClTiling("Loop-Tiling", cl::Hidden,
+    cl::desc("Tile perfect loop nests for the cache (OpenMP CPU only)."));
+
+static cl::opt<unsigned> ClCacheSize("Cache-Size", cl::Hidden, cl::init(32),
+    cl::desc("Size of the cache, in KB, used to choose the tile sizes."));
+
+static cl::opt<bool> ClDistribution("Loop-Distribution", cl::Hidden,
+    cl::desc("Split serial loops in parallel and serial loops (OpenMP CPU "
+             "only)."));
+
+static cl::opt<std::string> ClNestedReport("Nested-Report", cl::Hidden,
+    cl::desc("Write in this file the parallel loops found in functions called "
+             "from other parallel loops."));
+
+static cl::opt<std::string> ClStructArrays("SoA-Struct", cl::Hidden,
+    cl::desc("Offload the arrays of this struct type as one array per field "
+             "(OpenACC and OpenMP GPU only)."));
+
+static cl::opt<bool> ClDispatch("Runtime-Dispatch", cl::Hidden,
+    cl::desc("Choose at runtime between the offloaded, the OpenMP parallel "
+             "and the serial version of each loop (OpenACC and OpenMP GPU "
+             "only)."));
+
+static cl::opt<bool> ClDeviceSerial("Device-Serial", cl::Hidden,
+    cl::desc("Run short serial loops of coalesced regions as single-thread "
+             "device code (OpenACC and OpenMP GPU only)."));
+
+static cl::opt<std::string> ClSerialReport("Device-Serial-Report", cl::Hidden,
+    cl::desc("Write in this file the transfers saved by -Device-Serial."));
+
+static cl::opt<bool> ClPrefetch("Prefetch-Gathers", cl::Hidden,
+    cl::desc("Prefetch indirect accesses such as x[col[i]] some iterations "
+             "ahead (OpenMP CPU only)."));
+
+static cl::opt<unsigned> ClPrefetchLatency("Prefetch-Latency", cl::Hidden,
+    cl::init(200), cl::desc("Latency of memory, in cycles, used to choose "
+                            "the distance of the prefetches."));
+
+static cl::opt<bool> ClNontemporal("Nontemporal-Stores", cl::Hidden,
+    cl::desc("Write large write-only arrays of parallel loops with "
+             "nontemporal stores (OpenMP CPU only)."));
+
+static cl::opt<unsigned> ClNontemporalSize("Nontemporal-Size", cl::Hidden,
+    cl::init(32768), cl::desc("Size, in KB, above which the arrays written "
+                              "by a loop bypass the cache."));
+
+namespace {
+// Looks for values loaded from memory in a SCEV expression.
+struct FindLoads {
+  bool Found;
+  FindLoads() : Found(false) {}
+  bool follow(const SCEV *S) {
+    if (const SCEVUnknown *U = dyn_cast<SCEVUnknown>(S))
+      Found = Found || isa<LoadInst>(U->getValue());
+    return !Found;
+  }
+  bool isDone() const { return Found; }
+};
+
+// Splits the directive "#pragma standard name clause(arguments) ..." in its
+// standard ("omp" or "acc") and its words, each one with its arguments.
+void parseDirective (std::string text, std::string & standard,
+                     std::vector<std::pair<std::string, std::string> > & words) {
+  size_t pos = text.find("pragma");
+  if (pos == std::string::npos)
+    return;
+  for (pos += 6; pos < text.size();) {
+    if (isalnum(text[pos]) || (text[pos] == '_')) {
+      size_t end = pos;
+      while ((end < text.size()) && (isalnum(text[end]) || (text[end] == '_')))
+        end++;
+      words.push_back(std::make_pair(text.substr(pos, end - pos),
+                                     std::string()));
+      pos = end;
+      continue;
+    }
+    if (text[pos] == '(') {
+      int depth = 0;
+      size_t end = pos;
+      for (; end < text.size(); end++) {
+        if (text[end] == '(')
+          depth++;
+        if ((text[end] == ')') && (--depth == 0))
+          break;
+      }
+      if (!words.empty())
+        words.back().second = text.substr(pos + 1, end - pos - 1);
+      pos = end + 1;
+      continue;
+    }
+    pos++;
+  }
+  if (words.empty())
+    return;
+  standard = words[0].first;
+  words.erase(words.begin());
+}
+
+// Returns true if the directive creates or shares work of a parallel region.
+bool isComputeDirective (std::string & standard,
+                 std::vector<std::pair<std::string, std::string> > & words) {
+  if (words.empty())
+    return false;
+  std::string name = words[0].first;
+  if (standard == "acc")
+    return ((name == "parallel") || (name == "kernels") ||
+            (name == "serial") || (name == "loop"));
+  if (standard != "omp")
+    return false;
+  if (name == "target") {
+    if (words.size() == 1)
+      return true;
+    std::string next = words[1].first;
+    return ((next != "data") && (next != "update") && (next != "enter") &&
+            (next != "exit"));
+  }
+  const char *names[] = {"parallel", "for", "simd", "teams", "distribute",
+                         "task", "taskloop", "sections", "section", "single",
+                         "master", "critical", "ordered", "atomic"};
+  for (unsigned int i = 0; i < (sizeof(names) / sizeof(char*)); i++)
+    if (name == names[i])
+      return true;
+  return false;
+}
+
+// Adds to "mapped" the arrays that a data region maps to the device.
+void getMappedArrays (std::string & standard,
+                      std::vector<std::pair<std::string, std::string> > & words,
+                      std::set<std::string> & mapped) {
+  if (words.empty())
+    return;
+  if (!((standard == "acc") && (words[0].first == "data")) &&
+      !((standard == "omp") && (words[0].first == "target") &&
+        (words.size() > 1) && (words[1].first == "data")))
+    return;
+  const char *clauses[] = {"map", "copy", "copyin", "copyout", "create",
+                           "present", "pcopy", "pcopyin", "pcopyout",
+                           "pcreate", "present_or_copy", "present_or_copyin",
+                           "present_or_copyout", "present_or_create",
+                           "deviceptr"};
+  for (unsigned int i = 0, ie = words.size(); i != ie; i++) {
+    bool isClause = false;
+    for (unsigned int j = 0; j < (sizeof(clauses) / sizeof(char*)); j++)
+      isClause = isClause || (words[i].first == clauses[j]);
+    if (!isClause)
+      continue;
+    // Drop the map type, as in "map(to: a[0:n])".
+    std::string list = words[i].second;
+    size_t colon = list.find(':');
+    if ((colon != std::string::npos) &&
+        (list.find('[') > colon))
+      list = list.substr(colon + 1);
+    int depth = 0;
+    std::string item = std::string();
+    for (size_t pos = 0; pos <= list.size(); pos++) {
+      if ((pos == list.size()) || ((list[pos] == ',') && (depth == 0))) {
+        item = item.substr(0, item.find('['));
+        size_t first = item.find_first_not_of(" ");
+        if (first != std::string::npos)
+          mapped.insert(item.substr(first, item.find_last_not_of(" ") -
+                                    first + 1));
+        item = std::string();
+        continue;
+      }
+      if ((list[pos] == '[') || (list[pos] == '('))
+        depth++;
+      if ((list[pos] == ']') || (list[pos] == ')'))
+        depth--;
+      item += list[pos];
+    }
+  }
+}
+}
+
 void WriteExpressions::analyzeCalls (Loop *L) {
   if (!isLoopAnalyzable(L))
     return;
   for (auto BB = L->block_begin(), BE = L->block_end(); BB != BE; BB++)
     for (auto I = (*BB)->begin(), IE = (*BB)->end(); I != IE; I++)
-      if (CallInst *CI = dyn_cast<CallInst>(I))
-        if (CI->getName() != std::string())  
-          numFLC++;
+      if (CallInst *CI = dyn_cast<CallInst>(I))
+        if (CI->getName() != std::string())  
+          numFLC++;
+}
+
+void WriteExpressions::readParallelLoops () {
+  fstream Infile(ClInput.c_str());
+  if (!Infile) {
+    errs() << "[PARALLEL-FILE] ERROR: cannot read " << ClInput << "\n";
+    return;
+  }
+  std::string Line;
+  while (std::getline(Infile, Line)) {
+    size_t first = Line.find_first_not_of(" \t\r");
+    if ((first == std::string::npos) || (Line[first] == '#'))
+      continue;
+    Line = Line.substr(first);
+    Line = Line.substr(0, Line.find_last_not_of(" \t\r") + 1);
+    std::string File = std::string();
+    size_t pos = Line.rfind(':');
+    if (pos != std::string::npos) {
+      File = Line.substr(0, pos);
+      Line = Line.substr(pos + 1);
+    }
+    if (Line.empty() || (Line.find_first_not_of("0123456789") !=
+                         std::string::npos))
+      continue;
+    // Paths are compared without a leading "./".
+    if (File.compare(0, 2, "./") == 0)
+      File = File.substr(2);
+    ExternParallel.insert(std::make_pair(std::atoi(Line.c_str()), File));
+  }
+}
+
+bool WriteExpressions::isParallelInFile (Loop *L) {
+  DebugLoc DL = L->getStartLoc();
+  if (ExternParallel.empty() || !DL)
+    return false;
+  std::string File = DL->getFilename();
+  if (File.compare(0, 2, "./") == 0)
+    File = File.substr(2);
+  auto Range = ExternParallel.equal_range(DL.getLine());
+  for (auto I = Range.first; I != Range.second; I++) {
+    std::string Other = I->second;
+    if (Other.empty() || (Other == File))
+      return true;
+    // One of the paths may be relative to the other.
+    std::string Longer = (Other.size() > File.size()) ? Other : File;
+    std::string Shorter = (Other.size() > File.size()) ? File : Other;
+    if ((Longer.size() > Shorter.size()) &&
+        (Longer.compare(Longer.size() - Shorter.size(), Shorter.size(),
+                        Shorter) == 0) &&
+        (Longer[Longer.size() - Shorter.size() - 1] == '/'))
+      return true;
+  }
+  return false;
+}
+
+void WriteExpressions::addCommentToLine (std::string Comment,
+                                         unsigned int Line) {     
+  if (Comments.count(Line) == 0)
+    Comments[Line] = Comment;
+  else if (Comments[Line].find(Comment) == std::string::npos)
+    Comments[Line] += Comment;
+} 
+
+bool WriteExpressions::addRewrite (SourceRewrite & Rewrite,
+                                   unsigned int Line) {
+  for (auto I = Rewrites.begin(), IE = Rewrites.end(); I != IE; I++)
+    if ((I->first <= Rewrite.endLine) && (Line <= I->second.endLine))
+      return false;
+  Rewrites[Line] = Rewrite;
+  return true;
+}
+
+void WriteExpressions::copyComments (std::map <unsigned int, std::string>
+                                      CommentsIn) {
+  for (auto I = CommentsIn.begin(), E = CommentsIn.end(); I != E; ++I)
+    addCommentToLine(I->second,I->first);
+} 
+
+int WriteExpressions::getLineNo (Value *V) {
+  if (!V)
+    return ERROR_VALUE;
+  if (Instruction *I = dyn_cast<Instruction>(V))
+    if (I)
+      if (MDNode *N = I->getMetadata("dbg"))
+        if (N)
+          if (DILocation *DI = dyn_cast<DILocation>(N))
+            return DI->getLine();
+  return ERROR_VALUE;
+}
+
+void WriteExpressions::clearExpression () {
+  Expression.erase(Expression.begin(),Expression.end());
+}
+
+std::string WriteExpressions::getUniqueString () {
+  std::string result = "";
+  for (unsigned int i = 0; i < Expression.size(); i++) {
+    result += Expression[i];
+  }
+  return result;
+}
+
+bool WriteExpressions::denotateLoopParallel (Loop *L, std::string condition,
+                                             bool topLevelLoop) {
+  std::string pragma = "#pragma acc loop independent " + condition + "\n";
+  if ((ClEmitOMP == OMP_GPU) || (ClEmitOMP == OMP_CPU))
+    pragma = "#pragma omp parallel for " + condition + "\n";
+  if ((ClEmitOMP == OMP_GPU) && (topLevelLoop == true))
+    pragma = "#pragma omp target parallel for " + condition + "\n";
+  BasicBlock *BB = L->getLoopLatch();
+  MDNode *MD = nullptr;
+  MDNode *MDDivergent = nullptr;
+  if (BB == nullptr)
+    return false;
+  MD = BB->getTerminator()->getMetadata("isParallel");
+  MDDivergent = BB->getTerminator()->getMetadata("isDivergent");
+  if (ClDivergent && MDDivergent != nullptr)
+    return false;
+  if (!MD && !isParallelInFile(L))
+    return false;
+  // The programmer already runs the loop in parallel.
+  std::set<std::string> mapped;
+  if (getUserPragmas(L, mapped) & USER_PARALLEL) {
+    numUP++;
+    return false;
+  }
+  // The loop may run inside another parallel loop, through a call.
+  std::string guard;
+  pragma = getNestedPragma(L, pragma, guard);
+  bool simd = (pragma.find("omp simd") != std::string::npos);
+  // Only "for" statements take the pragma, so a "while" loop must be
+  // rewritten, and the other rewrites only handle "for" loops.
+  if (st->isWhileLoop(L)) {
+    if (getPeeledIterations(L) ||
+        ((needsSplit(L) || needsRuntimeCheck(L)) && !isParallelInFile(L)) ||
+        !rewriteWhileLoop(L, pragma))
+      return false;
+    numWH++;
+    return annotateLoop(L, pragma, true);
+  }
+  if (int peel = getPeeledIterations(L)) {
+    if (!rewritePeeledLoop(L, peel, pragma))
+      return false;
+    numPL++;
+    return annotateLoop(L, pragma, true);
+  }
+  if (needsSplit(L) && !isParallelInFile(L)) {
+    if (!rewriteSplitLoop(L, pragma))
+      return false;
+    numSL++;
+    return annotateLoop(L, pragma, true);
+  }
+  if (needsRuntimeCheck(L) && !isParallelInFile(L)) {
+    // OpenACC has no clause to run a "loop" serially, and the pragma already
+    // has its own "if" clause when a condition is given. Neither has "simd".
+    std::string check;
+    if ((ClEmitOMP == ACC) || !condition.empty() || simd ||
+        !getRuntimeCondition(L, check))
+      return false;
+    if (!check.empty() && guard.empty())
+      pragma.insert(pragma.size() - 1, " if(" + check + ")");
+    else if (!check.empty())
+      pragma.replace(pragma.find(guard), guard.size(), guard + " && " + check);
+    numRC++;
+    return annotateLoop(L, pragma, false);
+  }
+  if (ClTiling && (ClEmitOMP == OMP_CPU) && !simd &&
+      tileLoopNest(L, pragma)) {
+    numTL++;
+    return annotateLoop(L, pragma, true);
+  }
+  int nontemporal = writeNontemporal(L, pragma);
+  if (nontemporal != NT_NONE)
+    numNT++;
+  return annotateLoop(L, pragma, (nontemporal == NT_REWRITE));
+  //for (Loop *SubLoop : L->getSubLoops())
+  //  denotateLoopParallel(SubLoop, condition, false);
+}
+
+bool WriteExpressions::annotateLoop (Loop *L, std::string pragma,
+                                     bool rewritten) {
+  numWL++;
+  if (!rewritten)
+    addCommentToLine(pragma, getLoopLine(L));
+  reportNesting(L, pragma);
+  // The prefetches are written in the body of the loop, so they need their
+  // own rewrite.
+  if (!rewritten && prefetchGathers(L))
+    numPF++;
+  return true;
+}
+
+bool WriteExpressions::isLoopParallel (Loop *L) {
+  BasicBlock *BB = L->getLoopLatch();
+  MDNode *MD = nullptr;
+  MDNode *MDDivergent = nullptr;
+  if (BB == nullptr)
+    return false;
+  MD = BB->getTerminator()->getMetadata("isParallel");
+  MDDivergent = BB->getTerminator()->getMetadata("isDivergent");
+  if (!MD && !isParallelInFile(L))
+    return false;
+  if (ClDivergent && MDDivergent != nullptr)
+    return false;
+  return true;
+}
+
+bool WriteExpressions::needsRuntimeCheck (Loop *L) {
+  BasicBlock *BB = L->getLoopLatch();
+  if (BB == nullptr)
+    return false;
+  return BB->getTerminator()->getMetadata("runtimeCheck") != nullptr;
+}
+
+// Returns the C type of an integer of "bits" bits, or an empty string.
+static std::string getIntegerType (unsigned bits, bool isSigned) {
+  std::string type = std::string();
+  if (bits == 8)
+    type = isSigned ? "signed char" : "unsigned char";
+  else if (bits == 16)
+    type = isSigned ? "short" : "unsigned short";
+  else if (bits == 32)
+    type = isSigned ? "int" : "unsigned int";
+  else if (bits == 64)
+    type = isSigned ? "long long int" : "unsigned long long int";
+  return type;
+}
+
+bool WriteExpressions::getSourceExpression (const SCEV *S,
+                                            std::string & str) {
+  if (const SCEVConstant *C = dyn_cast<SCEVConstant>(S)) {
+    str = std::to_string(C->getValue()->getSExtValue());
+    if (str[0] == '-')
+      str = "(" + str + ")";
+    return true;
+  }
+  if (const SCEVUnknown *U = dyn_cast<SCEVUnknown>(S)) {
+    str = rn->getNameofValue(U->getValue()).nameInFile;
+    return !str.empty();
+  }
+  // An extension reads the operand with its own width and sign, and the
+  // result always fits in a "long long". A truncation depends on how its
+  // result is read, so it is not written.
+  if (isa<SCEVZeroExtendExpr>(S) || isa<SCEVSignExtendExpr>(S)) {
+    const SCEVCastExpr *C = cast<SCEVCastExpr>(S);
+    unsigned bits = se->getTypeSizeInBits(C->getOperand()->getType());
+    std::string type = getIntegerType(bits, isa<SCEVSignExtendExpr>(S));
+    if (type.empty() || ((bits == 64) && isa<SCEVZeroExtendExpr>(S)) ||
+        !getSourceExpression(C->getOperand(), str))
+      return false;
+    str = "((long long int)(" + type + ")" + str + ")";
+    return true;
+  }
+  if (const SCEVUDivExpr *D = dyn_cast<SCEVUDivExpr>(S)) {
+    std::string lhs, rhs;
+    if (!getSourceExpression(D->getLHS(), lhs) ||
+        !getSourceExpression(D->getRHS(), rhs))
+      return false;
+    str = "(" + lhs + " / " + rhs + ")";
+    return true;
+  }
+  if (isa<SCEVAddExpr>(S) || isa<SCEVMulExpr>(S) || isa<SCEVSMaxExpr>(S) ||
+      isa<SCEVUMaxExpr>(S)) {
+    const SCEVNAryExpr *N = cast<SCEVNAryExpr>(S);
+    for (unsigned i = 0, ie = N->getNumOperands(); i != ie; i++) {
+      std::string op;
+      if (!getSourceExpression(N->getOperand(i), op))
+        return false;
+      if (i == 0)
+        str = op;
+      else if (isa<SCEVAddExpr>(S))
+        str = "(" + str + " + " + op + ")";
+      else if (isa<SCEVMulExpr>(S))
+        str = "(" + str + " * " + op + ")";
+      else if (isa<SCEVSMaxExpr>(S))
+        str = "(" + str + " > " + op + " ? " + str + " : " + op + ")";
+      else
+        str = "((unsigned long long int)" + str +
+              " > (unsigned long long int)" + op + " ? " + str + " : " + op +
+              ")";
+    }
+    return true;
+  }
+  return false;
+}
+
+bool WriteExpressions::getRuntimeCondition (Loop *L, std::string & condition) {
+  // The backedge count is an unsigned value of its own width, so it is read
+  // with that type before the comparisons, which are done in "long long".
+  // Counts of 64 bits only fit when they are known to be non-negative.
+  const SCEV *BECount = se->getBackedgeTakenCount(L);
+  if (isa<SCEVCouldNotCompute>(BECount))
+    return false;
+  unsigned bits = se->getTypeSizeInBits(BECount->getType());
+  std::string type = getIntegerType(bits, (bits == 64));
+  std::string count;
+  if (type.empty() || ((bits == 64) && !se->isKnownNonNegative(BECount)) ||
+      !getSourceExpression(BECount, count))
+    return false;
+  count = "(long long int)(" + type + ")" + count;
+
+  std::vector<Instruction*> accesses;
+  for (auto BB = L->block_begin(), BE = L->block_end(); BB != BE; BB++)
+    for (auto I = (*BB)->begin(), IE = (*BB)->end(); I != IE; I++)
+      if (I->mayReadFromMemory() || I->mayWriteToMemory())
+        accesses.push_back(&(*I));
+
+  // Two iterations of "L" that depend on each other are "distance" iterations
+  // apart, so there is no dependence inside the iteration space of "L" when
+  // the distance is larger than the backedge count. The distance is a signed
+  // value of its own width.
+  unsigned depth = L->getLoopDepth();
+  std::set<std::string> checks;
+  for (unsigned i = 0, ie = accesses.size(); i != ie; i++)
+    for (unsigned j = i; j != ie; j++) {
+      Instruction *Src = accesses[i], *Dst = accesses[j];
+      if (isa<LoadInst>(Src) && isa<LoadInst>(Dst))
+        continue;
+      auto D = da->depends(Src, Dst, true);
+      if (!D)
+        continue;
+      if (D->isConfused() || (D->getLevels() < depth))
+        return false;
+      const SCEV *Distance = D->getDistance(depth);
+      if (Distance && Distance->isZero())
+        continue;
+      std::string dist;
+      if (!Distance || isa<SCEVConstant>(Distance) ||
+          !se->isLoopInvariant(Distance, L) ||
+          !getSourceExpression(Distance, dist))
+        return false;
+      std::string distType =
+        getIntegerType(se->getTypeSizeInBits(Distance->getType()), true);
+      if (distType.empty())
+        return false;
+      dist = "(long long int)(" + distType + ")" + dist;
+      checks.insert("(" + dist + " > " + count + " || " + dist + " < -" +
+                    count + ")");
+    }
+
+  condition = std::string();
+  for (auto I = checks.begin(), IE = checks.end(); I != IE; I++)
+    condition += (condition.empty() ? "" : " && ") + *I;
+  return true;
+}
+
+int WriteExpressions::getPeeledIterations (Loop *L) {
+  BasicBlock *BB = L->getLoopLatch();
+  if (BB == nullptr)
+    return 0;
+  MDNode *MD = BB->getTerminator()->getMetadata("peelIterations");
+  if (!MD || (MD->getNumOperands() == 0))
+    return 0;
+  if (MDString *S = dyn_cast<MDString>(MD->getOperand(0)))
+    return std::atoi(S->getString().str().c_str());
+  return 0;
+}
+
+bool WriteExpressions::rewritePeeledLoop (Loop *L, int peel,
+                                          std::string pragma) {
+  // With memory coalescing, the peeled iterations would run on the host in the
+  // middle of a device data region.
+  if (ClCoalescing && (ClEmitOMP != OMP_CPU))
+    return false;
+
+  // A PHI that is not an induction variable only differs in the first
+  // iteration (e.g. a "first" flag). After peeling, each thread needs its own
+  // copy of it.
+  std::string privates = std::string();
+  for (auto I = L->getHeader()->begin(); isa<PHINode>(I); I++) {
+    const SCEV *S = se->getSCEV(&(*I));
+    if (isa<SCEVAddRecExpr>(S) && (cast<SCEVAddRecExpr>(S)->getLoop() == L))
+      continue;
+    std::string name = rn->getNameofValue(&(*I)).nameInFile;
+    if (name.empty() || (ClEmitOMP == ACC))
+      return false;
+    privates += (privates.empty() ? "" : ",") + name;
+  }
+  // "simd" has no "firstprivate" clause, and "private" would lose the value
+  // the peeled iteration leaves in them.
+  if (!privates.empty() && (pragma.find("omp simd") != std::string::npos))
+    return false;
+  if (!privates.empty())
+    pragma.insert(pragma.size() - 1, " firstprivate(" + privates + ")");
+
+  int startLine = 0, startColumn = 0, endLine = 0, endColumn = 0;
+  if (!st->getLoopScope(L, startLine, startColumn, endLine, endColumn))
+    return false;
+  if (!lr.loadSource(L) ||
+      !lr.parseLoop(startLine, startColumn, endLine, endColumn))
+    return false;
+
+  SourceRewrite rewrite;
+  if (!lr.peelLoop(peel, pragma, rewrite))
+    return false;
+  return addRewrite(rewrite, startLine);
+}
+
+int WriteExpressions::getLoopLine (Loop *L) {
+  int startLine = 0, startColumn = 0, endLine = 0, endColumn = 0;
+  if (st->getLoopScope(L, startLine, startColumn, endLine, endColumn))
+    return startLine;
+  return L->getStartLoc()->getLine();
+}
+
+bool WriteExpressions::rewriteWhileLoop (Loop *L, std::string pragma) {
+  if (!se->hasLoopInvariantBackedgeTakenCount(L))
+    return false;
+
+  int startLine = 0, startColumn = 0, endLine = 0, endColumn = 0;
+  if (!st->getLoopScope(L, startLine, startColumn, endLine, endColumn))
+    return false;
+  if (!lr.loadSource(L) ||
+      !lr.parseWhileLoop(startLine, startColumn, endLine, endColumn))
+    return false;
+  std::string iv = lr.getInductionVariable();
+
+  // With memory coalescing, the original "do ... while" would run on the host
+  // in the middle of a device data region.
+  if (lr.isDoWhileLoop() && ClCoalescing && (ClEmitOMP != OMP_CPU))
+    return false;
+
+  // The variable of the increment must be an integer induction variable of
+  // "L", e.g. not a pointer.
+  PHINode *IV = nullptr;
+  for (auto I = L->getHeader()->begin(); isa<PHINode>(I); I++) {
+    if (rn->getNameofValue(&(*I)).nameInFile != iv)
+      continue;
+    const SCEV *S = se->getSCEV(&(*I));
+    if (!I->getType()->isIntegerTy() ||
+        (I->getType()->getIntegerBitWidth() > 64) ||
+        !isa<SCEVAddRecExpr>(S) ||
+        (cast<SCEVAddRecExpr>(S)->getLoop() != L) ||
+        !cast<SCEVAddRecExpr>(S)->isAffine())
+      return false;
+    IV = cast<PHINode>(&(*I));
+    break;
+  }
+  if (!IV)
+    return false;
+
+  // Unlike a "for", the variable is not private to the loop in the source,
+  // so its last value must flow out of it.
+  bool usedAfter = false;
+  for (User *U : IV->users())
+    if (Instruction *I = dyn_cast<Instruction>(U))
+      usedAfter |= !L->contains(I);
+  for (unsigned int i = 0, ie = IV->getNumIncomingValues(); i != ie; i++)
+    if (L->contains(IV->getIncomingBlock(i)))
+      for (User *U : IV->getIncomingValue(i)->users())
+        if (Instruction *I = dyn_cast<Instruction>(U))
+          usedAfter |= !L->contains(I);
+  if (usedAfter && (ClEmitOMP == ACC))
+    return false;
+  if (usedAfter)
+    pragma.insert(pragma.size() - 1, " lastprivate(" + iv + ")");
+
+  SourceRewrite rewrite;
+  if (!lr.rewriteAsFor(pragma, rewrite))
+    return false;
+  return addRewrite(rewrite, startLine);
+}
+
+bool WriteExpressions::getStructFields (Value *Base, StructType *ST,
+                        const DataLayout & DL,
+                        std::map<unsigned int,
+                                 std::pair<std::string, std::string> > & fields) {
+  const Function *F = nullptr;
+  if (Argument *Arg = dyn_cast<Argument>(Base))
+    F = Arg->getParent();
+  else if (Instruction *I = dyn_cast<Instruction>(Base))
+    F = I->getParent()->getParent();
+  const DILocalVariable *Var = F ? rn->findVar(Base, F) : nullptr;
+  if (!Var)
+    return false;
+
+  // The struct may be named by its tag or by a typedef of it.
+  DIType *T = resolveType(Var->getType(), TypeIdentifierMap);
+  bool pointer = false, named = false;
+  while (DIDerivedType *DT = dyn_cast_or_null<DIDerivedType>(T)) {
+    unsigned tag = DT->getTag();
+    if (tag == dwarf::DW_TAG_pointer_type) {
+      if (pointer)
+        return false;
+      pointer = true;
+    }
+    else if (tag == dwarf::DW_TAG_typedef)
+      named |= pointer && (DT->getName() == ClStructArrays);
+    else if ((tag != dwarf::DW_TAG_const_type) &&
+             (tag != dwarf::DW_TAG_volatile_type) &&
+             (tag != dwarf::DW_TAG_restrict_type))
+      return false;
+    T = resolveType(DT->getBaseType(), TypeIdentifierMap);
+  }
+  DICompositeType *CT = dyn_cast_or_null<DICompositeType>(T);
+  if (!pointer || !CT || (CT->getTag() != dwarf::DW_TAG_structure_type) ||
+      (!named && (CT->getName() != ClStructArrays)))
+    return false;
+
+  // Fields are matched to the IR by their offsets. Bit-fields, and fields
+  // whose type has no simple name, are left out.
+  const StructLayout *SL = DL.getStructLayout(ST);
+  for (DINode *N : CT->getElements()) {
+    DIDerivedType *M = dyn_cast_or_null<DIDerivedType>(N);
+    if (!M || (M->getTag() != dwarf::DW_TAG_member))
+      continue;
+    DIType *MT = resolveType(M->getBaseType(), TypeIdentifierMap);
+    if (!MT || MT->getName().empty() ||
+        (M->getSizeInBits() != MT->getSizeInBits()) ||
+        (!isa<DIBasicType>(MT) && (MT->getTag() != dwarf::DW_TAG_typedef)))
+      continue;
+    for (unsigned int i = 0, ie = ST->getNumElements(); i != ie; i++)
+      if (SL->getElementOffsetInBits(i) == M->getOffsetInBits())
+        fields[i] = std::make_pair(M->getName().str(), MT->getName().str());
+  }
+  return true;
+}
+
+bool WriteExpressions::getFieldAccesses (Loop *L, Value *Base,
+                                         std::map<unsigned int, bool> & fields) {
+  StructType *ST = cast<StructType>(Base->getType()->getPointerElementType());
+
+  // Fields are reached as "gep Base, i, f", or as "gep (gep Base, i), 0, f".
+  std::vector<GetElementPtrInst*> accesses;
+  for (User *U : Base->users()) {
+    Instruction *I = dyn_cast<Instruction>(U);
+    if (!I || !L->contains(I))
+      continue;
+    GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(I);
+    if (!GEP || (GEP->getPointerOperand() != Base))
+      return false;
+    if (GEP->getNumIndices() == 2) {
+      accesses.push_back(GEP);
+      continue;
+    }
+    if (GEP->getNumIndices() != 1)
+      return false;
+    for (User *UU : GEP->users()) {
+      GetElementPtrInst *Field = dyn_cast<GetElementPtrInst>(UU);
+      if (!Field || (Field->getPointerOperand() != GEP) ||
+          (Field->getNumIndices() != 2) ||
+          !isa<ConstantInt>(Field->getOperand(1)) ||
+          !cast<ConstantInt>(Field->getOperand(1))->isZero())
+        return false;
+      accesses.push_back(Field);
+    }
+  }
+
+  for (unsigned int i = 0, ie = accesses.size(); i != ie; i++) {
+    ConstantInt *C = dyn_cast<ConstantInt>(accesses[i]->getOperand(2));
+    if (!C || (C->getZExtValue() >= ST->getNumElements()))
+      return false;
+    unsigned int field = C->getZExtValue();
+    Type *Ty = ST->getElementType(field);
+    if (!Ty->isIntegerTy() && !Ty->isFloatingPointTy())
+      return false;
+    bool written = fields[field];
+    for (User *U : accesses[i]->users()) {
+      if (isa<LoadInst>(U))
+        continue;
+      StoreInst *SI = dyn_cast<StoreInst>(U);
+      if (!SI || (SI->getPointerOperand() != accesses[i]))
+        return false;
+      written = true;
+    }
+    fields[field] = written;
+  }
+  return !fields.empty();
+}
+
+bool WriteExpressions::replaceArraySection (std::string & pragmas, size_t pos,
+                                  std::string name,
+                                  std::vector<std::string> & arrays,
+                                  std::string & lower, std::string & size) {
+  size_t found = std::string::npos;
+  for (size_t i = pragmas.find(name, pos); i != std::string::npos;
+       i = pragmas.find(name, i + 1)) {
+    size_t end = i + name.size();
+    if (((i > 0) && (isalnum(pragmas[i-1]) || (pragmas[i-1] == '_'))) ||
+        (end == pragmas.size()) || (pragmas[end] != '['))
+      continue;
+    if (found != std::string::npos)
+      return false;
+    found = i;
+  }
+  if (found == std::string::npos)
+    return false;
+
+  // Split "name[lower:size]" at its outermost colon.
+  size_t open = found + name.size(), close = std::string::npos, colon = 0;
+  int depth = 0;
+  for (size_t i = open, ie = pragmas.size(); i != ie; i++) {
+    if ((pragmas[i] == '[') || (pragmas[i] == '('))
+      depth++;
+    if ((pragmas[i] == ']') || (pragmas[i] == ')'))
+      depth--;
+    if ((pragmas[i] == ':') && (depth == 1) && !colon)
+      colon = i;
+    if (depth == 0) {
+      close = i;
+      break;
+    }
+  }
+  if ((close == std::string::npos) || !colon)
+    return false;
+
+  // An array already on the device keeps its layout there.
+  size_t present = pragmas.rfind("present(", found);
+  if ((present != std::string::npos) && (present >= pos) &&
+      (pragmas.find(')', present) > close))
+    return false;
+
+  lower = pragmas.substr(open + 1, colon - open - 1);
+  size = pragmas.substr(colon + 1, close - colon - 1);
+  std::string sections = std::string();
+  for (unsigned int i = 0, ie = arrays.size(); i != ie; i++)
+    sections += (i ? "," : "") + arrays[i] + "[" + lower + ":" + size + "]";
+  pragmas.replace(found, close - found + 1, sections);
+  return true;
+}
+
+bool WriteExpressions::convertStructArrays (Loop *L, int line) {
+  // With memory coalescing, the data region is not around the loop.
+  if (ClStructArrays.empty() || ClCoalescing || (ClEmitOMP == OMP_CPU) ||
+      !Comments.count(line))
+    return false;
+  std::string pragmas = Comments[line];
+  size_t pos = pragmas.find("#pragma");
+  if ((pos == std::string::npos) ||
+      ((pragmas.find("#pragma acc kernels") == std::string::npos) &&
+       (pragmas.find("#pragma omp target parallel") == std::string::npos)))
+    return false;
+
+  int startLine = 0, startColumn = 0, endLine = 0, endColumn = 0;
+  if (!st->getLoopScope(L, startLine, startColumn, endLine, endColumn) ||
+      (startLine != line))
+    return false;
+  if (!lr.loadSource(L) ||
+      !lr.parseLoop(startLine, startColumn, endLine, endColumn))
+    return false;
+  std::string text = lr.getLoopText();
+
+  std::set<Value*> bases;
+  for (auto BB = L->block_begin(), BE = L->block_end(); BB != BE; BB++)
+    for (auto I = (*BB)->begin(), IE = (*BB)->end(); I != IE; I++)
+      if (GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(I))
+        if (L->isLoopInvariant(GEP->getPointerOperand()) &&
+            GEP->getPointerOperandType()->isPointerTy() &&
+            GEP->getPointerOperandType()->getPointerElementType()->isStructTy())
+          bases.insert(GEP->getPointerOperand());
+
+  // The fields are copied to their arrays before the data region, and the
+  // fields written are copied back after it.
+  const DataLayout & DL = L->getHeader()->getParent()->getParent()->
+                          getDataLayout();
+  std::string conversion = std::string();
+  std::string copyBack = std::string();
+  std::string release = std::string();
+  for (auto I = bases.begin(), IE = bases.end(); I != IE; I++) {
+    StructType *ST = cast<StructType>((*I)->getType()->getPointerElementType());
+    std::map<unsigned int, std::pair<std::string, std::string> > members;
+    if (!getStructFields(*I, ST, DL, members))
+      continue;
+    std::map<unsigned int, bool> accessed;
+    std::set<std::string> used;
+    std::string name = rn->getNameofValue(*I).nameInFile;
+    if (name.empty() || !getFieldAccesses(L, *I, accessed) ||
+        !lr.replaceFieldAccesses(text, name, used, text) ||
+        (used.size() != accessed.size()))
+      return false;
+
+    std::vector<std::string> arrays;
+    std::string index = name + "_soa_i";
+    std::string gather = std::string(), scatter = std::string();
+    for (auto F = accessed.begin(), FE = accessed.end(); F != FE; F++) {
+      if (!members.count(F->first) || !used.count(members[F->first].first))
+        return false;
+      std::string field = members[F->first].first;
+      std::string array = name + "_" + field + "_soa";
+      arrays.push_back(array);
+      gather += array + "[" + index + "] = " + name + "[" + index + "]." +
+                field + ";\n";
+      if (F->second)
+        scatter += name + "[" + index + "]." + field + " = " + array + "[" +
+                   index + "];\n";
+    }
+    std::string lower, size;
+    if (!replaceArraySection(pragmas, pos, name, arrays, lower, size))
+      return false;
+
+    std::string elements = "(" + lower + ") + (" + size + ")";
+    std::string header = "for (long long int " + index + " = " + lower +
+                         "; " + index + " < " + elements + "; " + index +
+                         "++) {\n";
+    for (auto F = accessed.begin(), FE = accessed.end(); F != FE; F++) {
+      std::string type = members[F->first].second;
+      std::string array = name + "_" + members[F->first].first + "_soa";
+      conversion += type + " *" + array + " = (" + type + " *) malloc(sizeof(" +
+                    type + ") * (" + elements + "));\n";
+      release += "free(" + array + ");\n";
+    }
+    conversion += header + gather + "}\n";
+    if (!scatter.empty())
+      copyBack += header + scatter + "}\n";
+  }
+  if (conversion.empty())
+    return false;
+
+  SourceRewrite rewrite;
+  rewrite.endLine = endLine;
+  rewrite.prologue = "{\n";
+  rewrite.text = text + "\n" + copyBack + release + "}";
+  if (!addRewrite(rewrite, startLine))
+    return false;
+  // The bounds of the data region are computed before its pragma.
+  pragmas.insert(pos, conversion);
+  Comments[line] = pragmas;
+  usesStdlib = true;
+  numSA++;
+  return true;
+}
+
+// Returns true if "name" is an identifier of "text".
+static bool containsIdentifier (std::string & text, std::string name) {
+  for (size_t pos = text.find(name); pos != std::string::npos;
+       pos = text.find(name, pos + 1)) {
+    size_t end = pos + name.size();
+    if (((pos == 0) || (!isalnum(text[pos-1]) && (text[pos-1] != '_'))) &&
+        ((end == text.size()) || (!isalnum(text[end]) && (text[end] != '_'))))
+      return true;
+  }
+  return false;
+}
+
+bool WriteExpressions::getHoistedLoads (Loop *L, int line,
+                          std::map<unsigned int, std::string> & comments,
+                          std::vector<PtrRangeAnalysis::HoistedLoad> & loads) {
+  loads.clear();
+  BasicBlock *Preheader = L->getLoopPreheader();
+  if (!Preheader || !comments.count(line))
+    return true;
+  bool used = false;
+  for (auto I = Preheader->begin(), IE = Preheader->end(); I != IE; I++) {
+    LoadInst *LD = dyn_cast<LoadInst>(I);
+    if (!LD || !ptrRA->HoistedLoads.count(LD))
+      continue;
+    loads.push_back(ptrRA->HoistedLoads[LD]);
+    used |= containsIdentifier(comments[line], loads.back().name);
+  }
+  if (!used) {
+    loads.clear();
+    return true;
+  }
+
+  int startLine = 0, startColumn = 0, endLine = 0, endColumn = 0;
+  if (!st->getLoopScope(L, startLine, startColumn, endLine, endColumn) ||
+      (startLine != line))
+    return false;
+  if (!lr.loadSource(L) ||
+      !lr.parseLoop(startLine, startColumn, endLine, endColumn))
+    return false;
+
+  // The new variables must not be names of the loop already.
+  std::string text = lr.getLoopText();
+  for (unsigned int i = 0, ie = loads.size(); i != ie; i++) {
+    std::string declared;
+    if (!lr.replaceExpression(text, loads[i].name, "", declared) ||
+        (declared != text) ||
+        !lr.replaceExpression(text, loads[i].expression, loads[i].name, text))
+      return false;
+  }
+  return true;
+}
+
+bool WriteExpressions::declareHoistedLoads (Loop *L, int line,
+                          std::vector<PtrRangeAnalysis::HoistedLoad> & loads) {
+  if (loads.empty())
+    return true;
+  int startLine = 0, startColumn = 0, endLine = 0, endColumn = 0;
+  if (!st->getLoopScope(L, startLine, startColumn, endLine, endColumn))
+    return false;
+
+  // The loop may have been rewritten already, e.g. peeled or dispatched. Its
+  // rewrite then takes the declarations, in front of its own prologue, as the
+  // annotations printed after the prologue use them.
+  SourceRewrite rewrite;
+  bool rewritten = Rewrites.count(startLine) &&
+                   (Rewrites[startLine].endLine >= (unsigned int) endLine);
+  bool valid = true;
+  if (rewritten) {
+    rewrite = Rewrites[startLine];
+  } else {
+    rewrite.endLine = endLine;
+    rewrite.prologue = std::string();
+    valid = lr.loadSource(L) &&
+            lr.parseLoop(startLine, startColumn, endLine, endColumn);
+    rewrite.text = lr.getLoopText();
+  }
+
+  // The loads are in the order they run, so "s->a" is declared before
+  // "s->a->b".
+  std::string declarations = "{\n";
+  for (unsigned int i = 0, ie = loads.size(); valid && (i != ie); i++) {
+    valid = lr.replaceExpression(rewrite.prologue, loads[i].expression,
+                                 loads[i].name, rewrite.prologue) &&
+            lr.replaceExpression(rewrite.text, loads[i].expression,
+                                 loads[i].name, rewrite.text);
+    declarations += loads[i].type + " " + loads[i].name + " = " +
+                    loads[i].expression + ";\n";
+  }
+  rewrite.prologue = declarations + rewrite.prologue;
+  rewrite.text += "\n}";
+  if (valid && rewritten) {
+    Rewrites[startLine] = rewrite;
+    return true;
+  }
+  if (valid && addRewrite(rewrite, startLine))
+    return true;
+
+  // The annotations use the new variables, so the loop is left as it is.
+  errs() << "[PTR-LICM] WARNING: cannot declare the hoisted loads of the loop "
+            "in line " << line << ", the loop is not annotated\n";
+  Comments.erase(line);
+  if (rewritten)
+    Rewrites.erase(startLine);
+  return false;
+}
+
+bool WriteExpressions::writeDispatch (Loop *L, int line, std::string name) {
+  // With memory coalescing, the data region is not around the loop.
+  if (!ClDispatch || ClCoalescing || (ClEmitOMP == OMP_CPU) ||
+      !Comments.count(line))
+    return false;
+  std::string pragmas = Comments[line];
+  size_t pos = pragmas.find("#pragma");
+  if ((pos == std::string::npos) ||
+      ((pragmas.find("#pragma acc kernels") == std::string::npos) &&
+       (pragmas.find("#pragma omp target parallel") == std::string::npos)))
+    return false;
+
+  int startLine = 0, startColumn = 0, endLine = 0, endColumn = 0;
+  if (!st->getLoopScope(L, startLine, startColumn, endLine, endColumn) ||
+      (startLine != line))
+    return false;
+  if (!lr.loadSource(L) ||
+      !lr.parseLoop(startLine, startColumn, endLine, endColumn))
+    return false;
+  std::string text = lr.getLoopText();
+  std::string site = name + "_site";
+  std::string size = name + "_size";
+  std::string variant = name + "_variant";
+  if (containsIdentifier(text, site) || containsIdentifier(text, size) ||
+      containsIdentifier(text, variant))
+    return false;
+
+  // The bounds and the pointer disambiguation checks are computed before the
+  // choice, so the parallel version runs under the same "if" clause as the
+  // offloaded one, which also holds the runtime dependence checks.
+  std::string parallel = "#pragma omp parallel for";
+  size_t kernel = pragmas.find("#pragma acc kernels");
+  if (kernel == std::string::npos)
+    kernel = pragmas.find("#pragma omp target parallel");
+  std::string clause = pragmas.substr(kernel,
+                                      pragmas.find('\n', kernel) - kernel);
+  size_t begin = clause.find(" if(");
+  if (begin != std::string::npos) {
+    size_t end = begin + 3;
+    for (int depth = 0; end < clause.size(); end++) {
+      if (clause[end] == '(')
+        depth++;
+      else if ((clause[end] == ')') && (--depth == 0))
+        break;
+    }
+    if (end == clause.size())
+      return false;
+    parallel += clause.substr(begin, end - begin + 1);
+  }
+
+  SourceRewrite rewrite;
+  rewrite.endLine = endLine;
+  rewrite.prologue = "{\n" + pragmas.substr(0, pos) +
+                     "static DawnCCSite " + site + " = DAWNCC_SITE(" +
+                     std::to_string(line) + ");\n" +
+                     "long long int " + size + " = " + lr.getTripCount() +
+                     ";\n" +
+                     "int " + variant + " = dawncc_dispatch_begin(&" + site +
+                     ", " + size + ");\n" +
+                     "if (" + variant + " == DAWNCC_OFFLOAD) {\n";
+  rewrite.text = text + "\n} else if (" + variant + " == DAWNCC_PARALLEL) {\n" +
+                 parallel + "\n" + text + "\n} else {\n" + text + "\n}\n" +
+                 "dawncc_dispatch_end(&" + site + ", " + size + ", " + variant +
+                 ");\n}";
+  if (!addRewrite(rewrite, startLine))
+    return false;
+  Comments[line] = pragmas.substr(pos);
+  usesDispatch = true;
+  numRD++;
+  return true;
+}
+
+bool WriteExpressions::needsSplit (Loop *L) {
+  BasicBlock *BB = L->getLoopLatch();
+  if (BB == nullptr)
+    return false;
+  return BB->getTerminator()->getMetadata("splitLoop") != nullptr;
+}
+
+bool WriteExpressions::getLoopSplitPoint (Loop *L, std::string & point,
+                                          bool & isolate) {
+  std::vector<Instruction*> accesses;
+  for (auto BB = L->block_begin(), BE = L->block_end(); BB != BE; BB++)
+    for (auto I = (*BB)->begin(), IE = (*BB)->end(); I != IE; I++)
+      if (I->mayReadFromMemory() || I->mayWriteToMemory())
+        accesses.push_back(&(*I));
+
+  // Every dependence carried by "L" must be broken by the same split.
+  unsigned depth = L->getLoopDepth();
+  const SCEV *Point = nullptr;
+  unsigned Kind = 0;
+  for (unsigned i = 0, ie = accesses.size(); i != ie; i++)
+    for (unsigned j = i; j != ie; j++) {
+      Instruction *Src = accesses[i], *Dst = accesses[j];
+      if (isa<LoadInst>(Src) && isa<LoadInst>(Dst))
+        continue;
+      auto D = da->depends(Src, Dst, true);
+      if (!D)
+        continue;
+      if (D->isConfused() || (D->getLevels() < depth))
+        return false;
+      const SCEV *Distance = D->getDistance(depth);
+      if (Distance && Distance->isZero())
+        continue;
+      unsigned DKind = 0;
+      const SCEV *DPoint = getSplitPoint(da, se, L, *D, depth, Src, Dst,
+                                         DKind);
+      if (!DPoint || (Point && ((Point != DPoint) || (Kind != DKind))))
+        return false;
+      Point = DPoint;
+      Kind = DKind;
+    }
+
+  if (!Point || !getSourceExpression(Point, point))
+    return false;
+  isolate = (Kind == SPLIT_ISOLATE);
+  return true;
+}
+
+bool WriteExpressions::rewriteSplitLoop (Loop *L, std::string pragma) {
+  std::string point;
+  bool isolate = false;
+  if (!getLoopSplitPoint(L, point, isolate))
+    return false;
+
+  // The isolated iteration runs on the host. In the GPU modes, the data pragma
+  // of the loop covers all the pieces, so its writes would be overwritten by
+  // the device copies at the end of the data region.
+  if (isolate && (ClEmitOMP != OMP_CPU))
+    return false;
+
+  int startLine = 0, startColumn = 0, endLine = 0, endColumn = 0;
+  if (!st->getLoopScope(L, startLine, startColumn, endLine, endColumn))
+    return false;
+  if (!lr.loadSource(L) ||
+      !lr.parseLoop(startLine, startColumn, endLine, endColumn))
+    return false;
+
+  SourceRewrite rewrite;
+  if (!lr.splitLoop(point, isolate, pragma, rewrite))
+    return false;
+  return addRewrite(rewrite, startLine);
+}
+
+bool WriteExpressions::getPerfectNest (Loop *L, std::vector<Loop*> & nest) {
+  nest.clear();
+  nest.push_back(L);
+  Loop *Inner = L;
+  while (Inner->getSubLoops().size() == 1) {
+    Inner = Inner->getSubLoops()[0];
+    nest.push_back(Inner);
+  }
+  if ((nest.size() < 2) || !Inner->getSubLoops().empty())
+    return false;
+
+  // Only the innermost loop may access memory, and calls are not allowed.
+  for (auto BB = L->block_begin(), BE = L->block_end(); BB != BE; BB++)
+    for (auto I = (*BB)->begin(), IE = (*BB)->end(); I != IE; I++) {
+      if (!I->mayReadFromMemory() && !I->mayWriteToMemory())
+        continue;
+      if (!isa<LoadInst>(I) && !isa<StoreInst>(I))
+        return false;
+      if (li->getLoopFor(*BB) != Inner)
+        return false;
+    }
+
+  // The iteration space must be rectangular: the start and the trip count of
+  // each loop do not change along the nest.
+  for (unsigned int i = 0, ie = nest.size(); i != ie; i++) {
+    const SCEV *BTC = se->getBackedgeTakenCount(nest[i]);
+    if (isa<SCEVCouldNotCompute>(BTC) || !se->isLoopInvariant(BTC, L))
+      return false;
+    for (auto I = nest[i]->getHeader()->begin(); isa<PHINode>(I); I++) {
+      const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(se->getSCEV(&(*I)));
+      if (!AR || (AR->getLoop() != nest[i]) ||
+          !se->isLoopInvariant(AR->getStart(), L))
+        return false;
+    }
+  }
+  return true;
+}
+
+bool WriteExpressions::isFullyPermutable (std::vector<Loop*> & nest) {
+  Loop *Inner = nest.back();
+  std::vector<Instruction*> accesses;
+  for (auto BB = Inner->block_begin(), BE = Inner->block_end(); BB != BE; BB++)
+    for (auto I = (*BB)->begin(), IE = (*BB)->end(); I != IE; I++)
+      if (isa<LoadInst>(I) || isa<StoreInst>(I))
+        accesses.push_back(&(*I));
+
+  unsigned int firstLevel = nest.front()->getLoopDepth();
+  unsigned int lastLevel = Inner->getLoopDepth();
+  for (unsigned int i = 0, ie = accesses.size(); i != ie; i++)
+    for (unsigned int j = i; j != ie; j++) {
+      if (isa<LoadInst>(accesses[i]) && isa<LoadInst>(accesses[j]))
+        continue;
+      auto D = da->depends(accesses[i], accesses[j], true);
+      if (!D)
+        continue;
+      if (D->isConfused())
+        return false;
+      // The first non-equal direction gives the sense of the dependence. Any
+      // later direction in the opposite sense forbids interchanging loops.
+      int sense = 0;
+      for (unsigned int level = firstLevel;
+           (level <= lastLevel) && (level <= D->getLevels()); level++) {
+        unsigned int dir = D->getDirection(level);
+        bool lt = dir & Dependence::DVEntry::LT;
+        bool gt = dir & Dependence::DVEntry::GT;
+        if (!lt && !gt)
+          continue;
+        if (sense == 0) {
+          if (lt && gt)
+            return false;
+          sense = lt ? 1 : -1;
+          continue;
+        }
+        if (((sense > 0) && gt) || ((sense < 0) && lt))
+          return false;
+      }
+    }
+  return true;
+}
+
+void WriteExpressions::getAccessStrides (const SCEV *S,
+                               std::map<const Loop*, const SCEV*> & strides) {
+  if (const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(S)) {
+    strides[AR->getLoop()] = AR->getStepRecurrence(*se);
+    getAccessStrides(AR->getStart(), strides);
+    return;
+  }
+  if (const SCEVAddExpr *Add = dyn_cast<SCEVAddExpr>(S)) {
+    for (unsigned int i = 0, ie = Add->getNumOperands(); i != ie; i++)
+      getAccessStrides(Add->getOperand(i), strides);
+    return;
+  }
+
+  // Below casts, products and divisions the strides are not in bytes: we only
+  // keep the loops where the pointer varies.
+  std::map<const Loop*, const SCEV*> scaled;
+  if (const SCEVNAryExpr *NAry = dyn_cast<SCEVNAryExpr>(S))
+    for (unsigned int i = 0, ie = NAry->getNumOperands(); i != ie; i++)
+      getAccessStrides(NAry->getOperand(i), scaled);
+  if (const SCEVCastExpr *Cast = dyn_cast<SCEVCastExpr>(S))
+    getAccessStrides(Cast->getOperand(), scaled);
+  if (const SCEVUDivExpr *Div = dyn_cast<SCEVUDivExpr>(S)) {
+    getAccessStrides(Div->getLHS(), scaled);
+    getAccessStrides(Div->getRHS(), scaled);
+  }
+  for (auto I = scaled.begin(), IE = scaled.end(); I != IE; I++)
+    if (strides.count(I->first) == 0)
+      strides[I->first] = nullptr;
+}
+
+long long int WriteExpressions::getTileSize (std::vector<Loop*> & nest) {
+  Loop *Inner = nest.back();
+  const DataLayout & DL = Inner->getHeader()->getParent()->getParent()->
+                          getDataLayout();
+
+  // Size of the elements of each distinct access of the nest.
+  std::map<const SCEV*, uint64_t> accesses;
+  for (auto BB = Inner->block_begin(), BE = Inner->block_end(); BB != BE; BB++)
+    for (auto I = (*BB)->begin(), IE = (*BB)->end(); I != IE; I++) {
+      if (LoadInst *LD = dyn_cast<LoadInst>(I))
+        accesses[se->getSCEV(LD->getPointerOperand())] =
+          DL.getTypeStoreSize(LD->getType());
+      if (StoreInst *SI = dyn_cast<StoreInst>(I))
+        accesses[se->getSCEV(SI->getPointerOperand())] =
+          DL.getTypeStoreSize(SI->getValueOperand()->getType());
+    }
+
+  // For each access, the number of loops of the nest where it varies: one
+  // tile touches tile^dims of its elements.
+  std::vector<std::pair<unsigned int, uint64_t> > footprint;
+  bool reuse = false;
+  for (auto I = accesses.begin(), IE = accesses.end(); I != IE; I++) {
+    std::map<const Loop*, const SCEV*> strides;
+    getAccessStrides(I->first, strides);
+    unsigned int dims = 0;
+    bool outerUnit = false, innerUnit = false;
+    for (unsigned int i = 0, ie = nest.size(); i != ie; i++) {
+      bool innermost = ((i + 1) == ie);
+      if (strides.count(nest[i]) == 0) {
+        // Temporal reuse: every iteration of an outer loop uses the same
+        // elements.
+        if (!innermost)
+          reuse = true;
+        continue;
+      }
+      dims++;
+      const SCEVConstant *C = dyn_cast_or_null<SCEVConstant>(strides[nest[i]]);
+      bool unit = C && ((uint64_t)std::abs(C->getValue()->getSExtValue()) ==
+                        I->second);
+      if (innermost)
+        innerUnit = unit;
+      else
+        outerUnit = outerUnit || unit;
+    }
+    // Spatial reuse: the innermost loop jumps through memory, while an outer
+    // loop walks through contiguous elements.
+    if (outerUnit && !innerUnit && strides.count(Inner))
+      reuse = true;
+    footprint.push_back(std::make_pair(dims, I->second));
+  }
+  if (!reuse)
+    return 0;
+
+  uint64_t cache = (uint64_t)ClCacheSize * 1024;
+  for (long long int tile = MAX_TILE; tile >= MIN_TILE; tile /= 2) {
+    uint64_t bytes = 0;
+    for (auto F = footprint.begin(), FE = footprint.end(); F != FE; F++) {
+      uint64_t elements = 1;
+      for (unsigned int i = 0; i < F->first; i++)
+        elements *= tile;
+      bytes += elements * F->second;
+    }
+    if (bytes <= cache)
+      return tile;
+  }
+  return 0;
+}
+
+bool WriteExpressions::tileLoopNest (Loop *L, std::string pragma) {
+  std::vector<Loop*> nest;
+  if (!getPerfectNest(L, nest) || !isFullyPermutable(nest))
+    return false;
+  long long int tile = getTileSize(nest);
+  if (tile == 0)
+    return false;
+
+  // Tiling does not pay off when every loop already fits in one tile.
+  bool small = true;
+  for (unsigned int i = 0, ie = nest.size(); i != ie; i++) {
+    unsigned int tripCount = se->getSmallConstantTripCount(nest[i]);
+    if ((tripCount == 0) || (tripCount > tile))
+      small = false;
+  }
+  if (small)
+    return false;
+
+  int startLine = 0, startColumn = 0, endLine = 0, endColumn = 0;
+  if (!st->getLoopScope(L, startLine, startColumn, endLine, endColumn))
+    return false;
+  if (!lr.loadSource(L) ||
+      !lr.parseLoop(startLine, startColumn, endLine, endColumn))
+    return false;
+
+  SourceRewrite rewrite;
+  if (!lr.tileLoop(nest.size(), tile, pragma, rewrite))
+    return false;
+  return addRewrite(rewrite, startLine);
+}
+
+bool WriteExpressions::distributeLoop (Loop *L, std::string pragma) {
+  if (!L->getSubLoops().empty() || !L->getLoopLatch() ||
+      !L->getLoopPreheader())
+    return false;
+
+  // Only the induction variable may be carried through registers, and no value
+  // may be used after the loop.
+  for (auto I = L->getHeader()->begin(); isa<PHINode>(I); I++) {
+    const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(se->getSCEV(&(*I)));
+    if (!AR || (AR->getLoop() != L))
+      return false;
+    // Each new loop evaluates the bounds again: they cannot be read from
+    // memory, which the loops may change.
+    FindLoads Start;
+    visitAll(AR->getStart(), Start);
+    if (Start.Found)
+      return false;
+  }
+  SmallVector<BasicBlock*, 4> exitBlocks;
+  L->getExitBlocks(exitBlocks);
+  for (BasicBlock *exit : exitBlocks)
+    if (isa<PHINode>(exit->begin()))
+      return false;
+  const SCEV *BTC = se->getBackedgeTakenCount(L);
+  if (isa<SCEVCouldNotCompute>(BTC))
+    return false;
+  FindLoads Bound;
+  visitAll(BTC, Bound);
+  if (Bound.Found)
+    return false;
+
+  int startLine = 0, startColumn = 0, endLine = 0, endColumn = 0;
+  if (!st->getLoopScope(L, startLine, startColumn, endLine, endColumn))
+    return false;
+  if (!lr.loadSource(L) ||
+      !lr.parseLoop(startLine, startColumn, endLine, endColumn))
+    return false;
+  std::vector<std::pair<unsigned int, unsigned int> > lines;
+  if (!lr.splitBody(lines) || (lines.size() < 2))
+    return false;
+
+  // Each statement needs its own lines, to be found by the debug information.
+  int headerEnd = lr.getHeaderEndLine();
+  if ((int)lines[0].first <= headerEnd)
+    return false;
+  for (unsigned int i = 1, ie = lines.size(); i != ie; i++)
+    if (lines[i].first <= lines[i - 1].second)
+      return false;
+
+  // Find the statement of each instruction. The loop control is marked with
+  // -1.
+  std::map<Instruction*, int> statementOf;
+  std::vector<Instruction*> accesses;
+  for (auto BB = L->block_begin(), BE = L->block_end(); BB != BE; BB++)
+    for (auto I = (*BB)->begin(), IE = (*BB)->end(); I != IE; I++) {
+      if (isa<DbgInfoIntrinsic>(I))
+        continue;
+      if (isa<PHINode>(I)) {
+        if (*BB != L->getHeader())
+          return false;
+        statementOf[I] = -1;
+        continue;
+      }
+      bool access = isa<LoadInst>(I) || isa<StoreInst>(I);
+      if ((I->mayReadFromMemory() || I->mayWriteToMemory()) && !access)
+        return false;
+      int line = getLineNo(I);
+      if (line == ERROR_VALUE) {
+        if (!isa<TerminatorInst>(I))
+          return false;
+        statementOf[I] = -1;
+        continue;
+      }
+      int stmt = -1;
+      for (unsigned int i = 0, ie = lines.size(); i != ie; i++)
+        if (((int)lines[i].first <= line) && (line <= (int)lines[i].second))
+          stmt = i;
+      if ((stmt == -1) && ((line < startLine) || (line > headerEnd)))
+        return false;
+      if ((stmt == -1) && access)
+        return false;
+      statementOf[I] = stmt;
+      if (access)
+        accesses.push_back(I);
+    }
+
+  unsigned int n = lines.size();
+  std::vector<std::vector<bool> > edge(n, std::vector<bool>(n, false));
+  std::vector<std::vector<bool> > carried(n, std::vector<bool>(n, false));
+  std::vector<std::vector<bool> > flow(n, std::vector<bool>(n, false));
+
+  // Scalars computed by one statement and used by another.
+  for (auto I = statementOf.begin(), IE = statementOf.end(); I != IE; I++)
+    for (unsigned int i = 0, ie = I->first->getNumOperands(); i != ie; i++) {
+      Instruction *Op = dyn_cast<Instruction>(I->first->getOperand(i));
+      if (!Op || !statementOf.count(Op) || (statementOf[Op] == -1) ||
+          (statementOf[Op] == I->second) || isa<PHINode>(I->first))
+        continue;
+      // The loop control cannot depend on the statements.
+      if ((I->second == -1) || (statementOf[Op] > I->second))
+        return false;
+      edge[statementOf[Op]][I->second] = true;
+      flow[statementOf[Op]][I->second] = true;
+    }
+
+  // Memory dependences, using the direction in the level of "L". Dependences
+  // carried by outer loops do not matter here.
+  unsigned int depth = L->getLoopDepth();
+  for (unsigned int i = 0, ie = accesses.size(); i != ie; i++)
+    for (unsigned int j = i; j != ie; j++) {
+      if (isa<LoadInst>(accesses[i]) && isa<LoadInst>(accesses[j]))
+        continue;
+      auto D = da->depends(accesses[i], accesses[j], true);
+      if (!D)
+        continue;
+      unsigned int dir = Dependence::DVEntry::ALL;
+      if (!D->isConfused()) {
+        bool outer = false;
+        for (unsigned int level = 1;
+             (level < depth) && (level <= D->getLevels()); level++)
+          if (!(D->getDirection(level) & Dependence::DVEntry::EQ))
+            outer = true;
+        if (outer)
+          continue;
+        if (D->getLevels() >= depth)
+          dir = D->getDirection(depth);
+      }
+      int src = statementOf[accesses[i]], dst = statementOf[accesses[j]];
+      if ((dir & Dependence::DVEntry::EQ) && (src != dst))
+        edge[std::min(src, dst)][std::max(src, dst)] = true;
+      if (dir & Dependence::DVEntry::LT)
+        edge[src][dst] = carried[src][dst] = true;
+      if (dir & Dependence::DVEntry::GT)
+        edge[dst][src] = carried[dst][src] = true;
+    }
+
+  // A scalar can only be split from its uses if its declaration can be
+  // turned into a temporary array. Otherwise, keep them together.
+  std::string type, name, value;
+  for (unsigned int i = 0; i < n; i++)
+    for (unsigned int j = 0; j < n; j++)
+      if (flow[i][j] && !lr.getScalarDeclaration(i, type, name, value))
+        edge[j][i] = true;
+
+  // Strongly connected components of the statements.
+  std::vector<std::vector<bool> > reach = edge;
+  for (unsigned int k = 0; k < n; k++)
+    for (unsigned int i = 0; i < n; i++)
+      for (unsigned int j = 0; j < n; j++)
+        if (reach[i][k] && reach[k][j])
+          reach[i][j] = true;
+  std::vector<int> component(n, -1);
+  unsigned int numComponents = 0;
+  for (unsigned int i = 0; i < n; i++) {
+    if (component[i] != -1)
+      continue;
+    for (unsigned int j = i; j < n; j++)
+      if ((j == i) || (reach[i][j] && reach[j][i]))
+        component[j] = numComponents;
+    numComponents++;
+  }
+
+  // A component is serial if it carries a dependence.
+  std::vector<bool> serial(numComponents, false);
+  std::vector<std::vector<bool> > order(numComponents,
+                                  std::vector<bool>(numComponents, false));
+  for (unsigned int i = 0; i < n; i++)
+    for (unsigned int j = 0; j < n; j++) {
+      if (carried[i][j] && (component[i] == component[j]))
+        serial[component[i]] = true;
+      if (edge[i][j] && (component[i] != component[j]))
+        order[component[i]][component[j]] = true;
+    }
+
+  // Topological order of the components, keeping the original order when
+  // possible. Adjacent components of the same kind are fused in one loop,
+  // unless a dependence between them would make the fused loop serial.
+  std::vector<std::vector<unsigned int> > groups;
+  std::vector<bool> parallel;
+  std::vector<int> groupOf(numComponents, -1);
+  std::vector<bool> done(numComponents, false);
+  for (unsigned int k = 0; k < numComponents; k++) {
+    int next = -1;
+    for (unsigned int c = 0; (c < numComponents) && (next == -1); c++) {
+      if (done[c])
+        continue;
+      bool ready = true;
+      for (unsigned int p = 0; p < numComponents; p++)
+        if (!done[p] && (p != c) && order[p][c])
+          ready = false;
+      if (ready)
+        next = c;
+    }
+    if (next == -1)
+      return false;
+    done[next] = true;
+
+    bool fuse = !groups.empty() && (parallel.back() == !serial[next]);
+    if (fuse && parallel.back())
+      for (unsigned int i = 0; i < n; i++)
+        for (unsigned int j = 0; j < n; j++)
+          if ((carried[i][j] || carried[j][i]) &&
+              (component[i] == next) && (groupOf[component[j]] ==
+                                         (int)(groups.size() - 1)))
+            fuse = false;
+    if (!fuse) {
+      groups.push_back(std::vector<unsigned int>());
+      parallel.push_back(!serial[next]);
+    }
+    groupOf[next] = groups.size() - 1;
+    for (unsigned int i = 0; i < n; i++)
+      if (component[i] == (int)next)
+        groups.back().push_back(i);
+  }
+  if (groups.size() < 2)
+    return false;
+  bool hasParallel = false;
+  for (unsigned int i = 0, ie = parallel.size(); i != ie; i++)
+    hasParallel = hasParallel || parallel[i];
+  if (!hasParallel)
+    return false;
+
+  // Scalars that flow between different loops are expanded.
+  std::set<unsigned int> expand;
+  for (unsigned int i = 0; i < n; i++)
+    for (unsigned int j = 0; j < n; j++)
+      if (flow[i][j] && (groupOf[component[i]] != groupOf[component[j]]))
+        expand.insert(i);
+
+  SourceRewrite rewrite;
+  if (!lr.distributeLoop(groups, parallel, expand, pragma, rewrite) ||
+      !addRewrite(rewrite, startLine))
+    return false;
+  // The expanded scalars are allocated with "malloc".
+  if (!expand.empty())
+    usesStdlib = true;
+  return true;
+}
+
+void WriteExpressions::getGathers (Loop *L,
+                std::vector<std::pair<std::string, std::string> > & gathers) {
+  // Arrays written by the loop: their elements may not be read ahead.
+  std::set<const SCEV*> written;
+  for (auto BB = L->block_begin(), BE = L->block_end(); BB != BE; BB++)
+    for (auto I = (*BB)->begin(), IE = (*BB)->end(); I != IE; I++)
+      if (StoreInst *SI = dyn_cast<StoreInst>(I))
+        written.insert(se->getPointerBase(se->getSCEV(
+                                          SI->getPointerOperand())));
+
+  for (auto BB = L->block_begin(), BE = L->block_end(); BB != BE; BB++)
+    for (auto I = (*BB)->begin(), IE = (*BB)->end(); I != IE; I++) {
+      Value *Ptr = nullptr;
+      if (LoadInst *LD = dyn_cast<LoadInst>(I))
+        Ptr = LD->getPointerOperand();
+      if (StoreInst *SI = dyn_cast<StoreInst>(I))
+        Ptr = SI->getPointerOperand();
+      GetElementPtrInst *GEP = dyn_cast_or_null<GetElementPtrInst>(Ptr);
+      if (!GEP || !L->isLoopInvariant(GEP->getPointerOperand()))
+        continue;
+      bool constant = true;
+      for (unsigned int i = 1, ie = GEP->getNumOperands() - 1; i < ie; i++)
+        constant = constant && isa<ConstantInt>(GEP->getOperand(i));
+      if (!constant)
+        continue;
+
+      // The position is loaded from an array walked by the loop.
+      Value *Index = GEP->getOperand(GEP->getNumOperands() - 1);
+      while (CastInst *C = dyn_cast<CastInst>(Index))
+        Index = C->getOperand(0);
+      LoadInst *IndexLoad = dyn_cast<LoadInst>(Index);
+      if (!IndexLoad || !L->contains(IndexLoad))
+        continue;
+      const SCEV *IndexPtr = se->getSCEV(IndexLoad->getPointerOperand());
+      const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(IndexPtr);
+      if (!AR || (AR->getLoop() != L) || !AR->isAffine())
+        continue;
+      const SCEVUnknown *IndexBase =
+        dyn_cast<SCEVUnknown>(se->getPointerBase(IndexPtr));
+      if (!IndexBase || written.count(IndexBase))
+        continue;
+
+      std::string array =
+        rn->getNameofValue(GEP->getPointerOperand()).nameInFile;
+      std::string index = rn->getNameofValue(IndexBase->getValue()).nameInFile;
+      if (array.empty() || index.empty())
+        continue;
+      std::pair<std::string, std::string> gather(array, index);
+      if (std::find(gathers.begin(), gathers.end(), gather) == gathers.end())
+        gathers.push_back(gather);
+    }
 }
 
-void WriteExpressions::readParallelLoops () {
-  fstream Infile(ClInput.c_str());
-  std::string Line;
-  while (!Infile.eof()) {
-    Line = std::string(); 
-    std::getline(Infile, Line);
-    unsigned int nLine = 0;
-    for (unsigned int i = 0, ie = Line.size(); i != ie; i++) {
-      nLine *= 10;
-      nLine += (Line[i] - '0');
+long long int WriteExpressions::getPrefetchDistance (Loop *L) {
+  unsigned int instructions = 0;
+  for (auto BB = L->block_begin(), BE = L->block_end(); BB != BE; BB++)
+    for (auto I = (*BB)->begin(), IE = (*BB)->end(); I != IE; I++)
+      if (!isa<DbgInfoIntrinsic>(I) && !isa<PHINode>(I))
+        instructions++;
+  if (instructions == 0)
+    return 0;
+  long long int distance = (ClPrefetchLatency + instructions - 1) /
+                           instructions;
+  return std::min(std::max(distance, 1LL), 64LL);
+}
+
+int WriteExpressions::writeNontemporal (Loop *L, std::string & pragma) {
+  if (!ClNontemporal || (ClEmitOMP != OMP_CPU) || !L->empty())
+    return NT_NONE;
+  size_t simd = pragma.find("omp simd");
+  size_t parallel = pragma.find("omp parallel for");
+  if ((simd == std::string::npos) && (parallel == std::string::npos))
+    return NT_NONE;
+
+  // Arrays written with unit stride, and never read, by the loop. Calls may
+  // read any of them.
+  const DataLayout & DL = L->getHeader()->getParent()->getParent()->
+                          getDataLayout();
+  std::map<Value*, uint64_t> stored;
+  std::set<Value*> discarded;
+  for (auto BB = L->block_begin(), BE = L->block_end(); BB != BE; BB++)
+    for (auto I = (*BB)->begin(), IE = (*BB)->end(); I != IE; I++) {
+      if (isa<CallInst>(I) && !isa<DbgInfoIntrinsic>(I))
+        return NT_NONE;
+      Value *Ptr = nullptr;
+      if (LoadInst *LD = dyn_cast<LoadInst>(I))
+        Ptr = LD->getPointerOperand();
+      if (StoreInst *SI = dyn_cast<StoreInst>(I))
+        Ptr = SI->getPointerOperand();
+      if (!Ptr)
+        continue;
+      const SCEV *S = se->getSCEV(Ptr);
+      const SCEVUnknown *Base = dyn_cast<SCEVUnknown>(se->getPointerBase(S));
+      if (!Base)
+        continue;
+      StoreInst *SI = dyn_cast<StoreInst>(I);
+      if (!SI) {
+        discarded.insert(Base->getValue());
+        continue;
+      }
+      uint64_t size = DL.getTypeStoreSize(SI->getValueOperand()->getType());
+      const SCEVAddRecExpr *AR = dyn_cast<SCEVAddRecExpr>(S);
+      const SCEVConstant *Step = AR ? dyn_cast<SCEVConstant>(
+                                        AR->getStepRecurrence(*se)) : nullptr;
+      if (!AR || (AR->getLoop() != L) || !Step ||
+          (Step->getValue()->getSExtValue() != (int64_t)size) ||
+          !L->isLoopInvariant(Base->getValue()) ||
+          (stored.count(Base->getValue()) &&
+           (stored[Base->getValue()] != size)))
+        discarded.insert(Base->getValue());
+      stored[Base->getValue()] = size;
+    }
+
+  // Footprint of each stream: one element per iteration.
+  uint64_t threshold = (uint64_t)ClNontemporalSize * 1024;
+  unsigned int tripCount = se->getSmallConstantTripCount(L);
+  std::string streams = std::string();
+  std::string smallest = std::string();
+  uint64_t smallestSize = 0;
+  for (auto I = stored.begin(), IE = stored.end(); I != IE; I++) {
+    std::string name = rn->getNameofValue(I->first).nameInFile;
+    if (discarded.count(I->first) || name.empty() ||
+        (tripCount && (((uint64_t)tripCount * I->second) < threshold)))
+      continue;
+    streams += (streams.empty() ? "" : ",") + name;
+    if (smallest.empty() || (I->second < smallestSize)) {
+      smallest = name;
+      smallestSize = I->second;
     }
-    std::string pragma = "#pragma acc loop independent\n";
-    if ((ClEmitOMP == OMP_GPU) || (ClEmitOMP == OMP_CPU))
-      pragma = "#pragma omp parallel for\n";
-    addCommentToLine (pragma, nLine);
   }
-}
+  if (streams.empty())
+    return NT_NONE;
 
-void WriteExpressions::addCommentToLine (std::string Comment,
-                                         unsigned int Line) {     
-  if (Comments.count(Line) == 0)
-    Comments[Line] = Comment;
-  else if (Comments[Line].find(Comment) == std::string::npos)
-    Comments[Line] += Comment;
-} 
+  // "nontemporal" is only accepted by "simd" constructs (OpenMP 5.0).
+  std::string streaming = pragma;
+  if (simd != std::string::npos)
+    streaming.insert(simd + 8, " nontemporal(" + streams + ")");
+  else
+    streaming.insert(parallel + 16, " simd nontemporal(" + streams + ")");
 
-void WriteExpressions::copyComments (std::map <unsigned int, std::string>
-                                      CommentsIn) {
-  for (auto I = CommentsIn.begin(), E = CommentsIn.end(); I != E; ++I)
-    addCommentToLine(I->second,I->first);
-} 
+  // The footprint is known: only the pragma changes.
+  if (tripCount) {
+    pragma = streaming;
+    return NT_PRAGMA;
+  }
 
-int WriteExpressions::getLineNo (Value *V) {
-  if (!V)
-    return ERROR_VALUE;
-  if (Instruction *I = dyn_cast<Instruction>(V))
-    if (I)
-      if (MDNode *N = I->getMetadata("dbg"))
-        if (N)
-          if (DILocation *DI = dyn_cast<DILocation>(N))
-            return DI->getLine();
-  return ERROR_VALUE;
+  // Otherwise, the size of the smallest stream chooses at runtime between
+  // the loop with nontemporal stores and the original one.
+  int startLine = 0, startColumn = 0, endLine = 0, endColumn = 0;
+  if (!st->getLoopScope(L, startLine, startColumn, endLine, endColumn))
+    return NT_NONE;
+  if (!lr.loadSource(L) ||
+      !lr.parseLoop(startLine, startColumn, endLine, endColumn))
+    return NT_NONE;
+
+  std::string loop = lr.getLoopText();
+  SourceRewrite rewrite;
+  rewrite.endLine = endLine;
+  rewrite.prologue = std::string();
+  rewrite.text = "if ((" + lr.getTripCount() + ") * sizeof(" + smallest +
+                 "[0]) >= " + std::to_string(threshold) + "ULL) {\n" +
+                 streaming + loop + "\n} else {\n" + pragma + loop + "\n}";
+  return addRewrite(rewrite, startLine) ? NT_REWRITE : NT_NONE;
 }
 
-void WriteExpressions::clearExpression () {
-  Expression.erase(Expression.begin(),Expression.end());
+bool WriteExpressions::prefetchGathers (Loop *L) {
+  if (!ClPrefetch || (ClEmitOMP != OMP_CPU) || (ClPrefetchLatency == 0))
+    return false;
+
+  bool changed = false;
+  for (Loop *SubLoop : L->getSubLoops())
+    changed |= prefetchGathers(SubLoop);
+  if (!L->empty())
+    return changed;
+
+  std::vector<std::pair<std::string, std::string> > gathers;
+  getGathers(L, gathers);
+  long long int distance = getPrefetchDistance(L);
+  if (gathers.empty() || (distance == 0))
+    return changed;
+
+  int startLine = 0, startColumn = 0, endLine = 0, endColumn = 0;
+  if (!st->getLoopScope(L, startLine, startColumn, endLine, endColumn) ||
+      st->isWhileLoop(L))
+    return changed;
+  if (!lr.loadSource(L) ||
+      !lr.parseLoop(startLine, startColumn, endLine, endColumn))
+    return changed;
+
+  SourceRewrite rewrite;
+  if (!lr.prefetchGathers(gathers, distance, rewrite))
+    return changed;
+  return addRewrite(rewrite, startLine) || changed;
 }
 
-std::string WriteExpressions::getUniqueString () {
-  std::string result = "";
-  for (unsigned int i = 0; i < Expression.size(); i++) {
-    result += Expression[i];
+void WriteExpressions::findNestedFunctions (Module &M) {
+  NestedFunctions.clear();
+  SerialFunctions.clear();
+
+  // The functions called by each function, with the location of the
+  // outermost parallel loop around each call, or an empty string.
+  std::map<Function*, std::vector<std::pair<Function*, std::string> > > calls;
+  std::queue<Function*> serial;
+  for (auto F = M.begin(), FE = M.end(); F != FE; F++) {
+    if (F->isDeclaration())
+      continue;
+    // Functions seen outside the module may be called from serial code.
+    if (!F->hasLocalLinkage() || F->hasAddressTaken()) {
+      SerialFunctions.insert(F);
+      serial.push(F);
+    }
+    DominatorTree DT;
+    DT.recalculate(*F);
+    LoopInfo LI;
+    LI.analyze(DT);
+    for (auto BB = F->begin(), BE = F->end(); BB != BE; BB++)
+      for (auto I = BB->begin(), IE = BB->end(); I != IE; I++) {
+        CallInst *CI = dyn_cast<CallInst>(I);
+        if (!CI || !CI->getCalledFunction() ||
+            CI->getCalledFunction()->isDeclaration())
+          continue;
+        std::string origin = std::string();
+        for (Loop *L = LI.getLoopFor(BB); L; L = L->getParentLoop()) {
+          if (!isLoopParallel(L))
+            continue;
+          DebugLoc DL = L->getStartLoc();
+          origin = F->getName();
+          if (DL)
+            origin = DL->getFilename().str() + ":" +
+                     std::to_string(DL.getLine());
+        }
+        calls[F].push_back(std::make_pair(CI->getCalledFunction(), origin));
+      }
+  }
+
+  // Calls from serial code outside parallel loops stay serial, the others
+  // reach their callees inside a parallel loop.
+  std::queue<Function*> nested;
+  while (!serial.empty()) {
+    Function *F = serial.front();
+    serial.pop();
+    for (unsigned int i = 0, ie = calls[F].size(); i != ie; i++) {
+      Function *Callee = calls[F][i].first;
+      if (calls[F][i].second.empty()) {
+        if (SerialFunctions.insert(Callee).second)
+          serial.push(Callee);
+      }
+      else if (!NestedFunctions.count(Callee)) {
+        NestedFunctions[Callee] = calls[F][i].second;
+        nested.push(Callee);
+      }
+    }
+  }
+  while (!nested.empty()) {
+    Function *F = nested.front();
+    nested.pop();
+    for (unsigned int i = 0, ie = calls[F].size(); i != ie; i++) {
+      Function *Callee = calls[F][i].first;
+      if (NestedFunctions.count(Callee))
+        continue;
+      NestedFunctions[Callee] = NestedFunctions[F];
+      nested.push(Callee);
+    }
   }
-  return result;
 }
 
-void WriteExpressions::denotateLoopParallel (Loop *L, std::string condition, bool topLevelLoop) {
-  std::string pragma = "#pragma acc loop independent " + condition + "\n";
-  if ((ClEmitOMP == OMP_GPU) || (ClEmitOMP == OMP_CPU))
-    pragma = "#pragma omp parallel for " + condition + "\n";
-  if ((ClEmitOMP == OMP_GPU) && (topLevelLoop == true))
-    pragma = "#pragma omp target parallel for " + condition + "\n";
-  BasicBlock *BB = L->getLoopLatch();
-  MDNode *MD = nullptr;
-  MDNode *MDDivergent = nullptr;
-  if (BB == nullptr)
-    return;
-  MD = BB->getTerminator()->getMetadata("isParallel");
-  MDDivergent = BB->getTerminator()->getMetadata("isDivergent");
-  if (ClDivergent && MDDivergent != nullptr)
-    return;
-  if (!MD)
+std::string WriteExpressions::getNestedPragma (Loop *L, std::string pragma,
+                                               std::string & guard) {
+  Function *F = L->getHeader()->getParent();
+  if ((ClEmitOMP != OMP_CPU) || !NestedFunctions.count(F))
+    return pragma;
+  // Only the threads of the outer loop run the function: use the vector
+  // units instead of opening a parallel region with a single thread.
+  if (!SerialFunctions.count(F))
+    return "#pragma omp simd\n";
+  guard = "!omp_in_parallel()";
+  usesOmpRuntime = true;
+  pragma.insert(pragma.size() - 1, " if(" + guard + ")");
+  return pragma;
+}
+
+void WriteExpressions::reportNesting (Loop *L, std::string pragma) {
+  Function *F = L->getHeader()->getParent();
+  if (!NestedFunctions.count(F))
     return;
-  int line = L->getStartLoc()->getLine();
-  numWL++;
-  addCommentToLine(pragma, line);
-  //for (Loop *SubLoop : L->getSubLoops())
-  //  denotateLoopParallel(SubLoop, condition, false);
+  numNP++;
+  DebugLoc DL = L->getStartLoc();
+  std::string location = F->getName();
+  if (DL)
+    location = DL->getFilename().str() + ":" + std::to_string(DL.getLine());
+  pragma = pragma.substr(0, pragma.find('\n'));
+  NestingReport.push_back(location + ": loop in " + F->getName().str() +
+                          " runs inside the parallel loop at " +
+                          NestedFunctions[F] + ": " + pragma);
 }
 
-bool WriteExpressions::isLoopParallel (Loop *L) {
-  BasicBlock *BB = L->getLoopLatch();
-  MDNode *MD = nullptr;
-  MDNode *MDDivergent = nullptr;
-  if (BB == nullptr)
-    return false;
-  MD = BB->getTerminator()->getMetadata("isParallel");
-  MDDivergent = BB->getTerminator()->getMetadata("isDivergent");
-  if (!MD)
-    return false;
-  if (ClDivergent && MDDivergent != nullptr)
-    return false;
-  return true;
+int WriteExpressions::classifyUserPragmas (
+                           std::vector<ScopeTree::UserPragma> & pragmas,
+                           int line, std::set<std::string> & mapped) {
+  int kind = 0;
+  for (unsigned int i = 0, ie = pragmas.size(); i != ie; i++) {
+    std::string standard = std::string();
+    std::vector<std::pair<std::string, std::string> > words;
+    parseDirective(pragmas[i].directive, standard, words);
+    if ((pragmas[i].startLine == line) && (pragmas[i].line < line))
+      kind |= USER_ATTACHED;
+    if (isComputeDirective(standard, words))
+      kind |= USER_PARALLEL;
+    else
+      getMappedArrays(standard, words, mapped);
+  }
+  return kind;
+}
+
+int WriteExpressions::getUserPragmas (Loop *L, std::set<std::string> & mapped) {
+  std::vector<ScopeTree::UserPragma> pragmas;
+  st->getUserPragmas(L, pragmas);
+  if (pragmas.empty())
+    return 0;
+  int startLine = L->getStartLoc().getLine(), startColumn, endLine, endColumn;
+  st->getLoopScope(L, startLine, startColumn, endLine, endColumn);
+  return classifyUserPragmas(pragmas, startLine, mapped);
+}
+
+int WriteExpressions::getUserPragmas (Region *R,
+                                      std::set<std::string> & mapped) {
+  std::vector<ScopeTree::UserPragma> pragmas;
+  st->getUserPragmas(R, pragmas);
+  if (pragmas.empty())
+    return 0;
+  return classifyUserPragmas(pragmas, st->getStartRegionLoops(R).first,
+                             mapped);
+}
+
+bool WriteExpressions::hasUserParallelLoop (Region *R) {
+  std::set<Loop*> loops;
+  std::set<std::string> mapped;
+  for (auto BB = R->block_begin(), BE = R->block_end(); BB != BE; BB++) {
+    Loop *L = li->getLoopFor(*BB);
+    if (!L || !loops.insert(L).second)
+      continue;
+    if (getUserPragmas(L, mapped) & USER_PARALLEL)
+      return true;
+  }
+  return false;
+}
+
+void WriteExpressions::findDistributableLoops (Loop *L) {
+  // Loops inside a parallel loop would create nested parallel regions.
+  std::set<std::string> mapped;
+  if (isLoopParallel(L) || (getUserPragmas(L, mapped) & USER_PARALLEL))
+    return;
+  if (L->getSubLoops().empty()) {
+    std::string guard;
+    std::string pragma = getNestedPragma(L, "#pragma omp parallel for\n",
+                                         guard);
+    if (distributeLoop(L, pragma)) {
+      numDL++;
+      reportNesting(L, pragma);
+    }
+    return;
+  }
+  for (Loop *SubLoop : L->getSubLoops())
+    findDistributableLoops(SubLoop);
 }
 
 bool WriteExpressions::hasLoopParallel (Region *R) {
   for (Region::block_iterator B = R->block_begin(), BE = R->block_end();
-       B != BE; B++)
+       B != BE; B++) {
     if (B->getTerminator()->getMetadata("isParallel"))
       return true;
+    Loop *L = li->getLoopFor(*B);
+    if (L && isParallelInFile(L))
+      return true;
+  }
   return false;
 }
 
@@ -267,7 +2163,17 @@ void WriteExpressions::regionIdentify (Region *R) {
     return;
   }
 
-  if (!isLoopAnalyzable(l) || !st->isSafetlyRegionLoops(R)) {
+  // Nothing is written inside the parallel constructs of the programmer, nor
+  // between one of their directives and the loop it applies to.
+  std::set<std::string> mapped;
+  int user = getUserPragmas(l, mapped);
+  if (user & USER_PARALLEL) {
+    numUP++;
+    return;
+  }
+
+  if (!isLoopAnalyzable(l) || !st->isSafetlyRegionLoops(R) ||
+      (user & USER_ATTACHED)) {
     for (auto SR = R->begin(), SRE = R->end(); SR != SRE; ++SR)
       regionIdentify(&(**SR));
     return;
@@ -275,7 +2181,7 @@ void WriteExpressions::regionIdentify (Region *R) {
 
   marknumAL(l);
 
-  int line = l->getStartLoc().getLine();
+  int line = getLoopLine(l);
   if (line == ERROR_VALUE)
     return;
 
@@ -287,11 +2193,20 @@ void WriteExpressions::regionIdentify (Region *R) {
   RC.setRecoverNames(rn);
   RC.initializeNewVars();
   RC.setOMP(ClEmitOMP); 
+  RC.setPresentVars(mapped);
 
   // Variable to know the if the restrict pragma exists.
   // Case exists, use to add the test on pragmas.
   std::string test;
   if (RC.analyzeLoop(l, line, ERROR_VALUE, ptrRA, rp, aa, se, li, dt, test)) {
+
+    // The base pointers and bounds may use loads moved before the loop.
+    std::vector<PtrRangeAnalysis::HoistedLoad> loads;
+    if (!getHoistedLoads(l, line, RC.Comments, loads)) {
+      for (auto SR = R->begin(), SRE = R->end(); SR != SRE; ++SR)
+        regionIdentify(&(**SR));
+      return;
+    }
   
     std::map<std::string, bool> m;
     for (auto BB = l->block_begin(), BE = l->block_end(); BB != BE; BB++) {
@@ -309,14 +2224,17 @@ void WriteExpressions::regionIdentify (Region *R) {
     clearExpression();
 
     if (ClEmitParallel) {
-      if (ClEmitOMP == OMP_GPU)
-        denotateLoopParallel(l, test, true);
-      else
-        denotateLoopParallel(l, test, false);
+      bool annotated = denotateLoopParallel(l, test, (ClEmitOMP == OMP_GPU));
+      // Only annotated loops have a parallel host version to dispatch to.
+      if (!convertStructArrays(l, line) && annotated)
+        writeDispatch(l, line, computationName);
+      declareHoistedLoads(l, line, loads);
       return;
     }
     
     marknumWL(l);
+    convertStructArrays(l, line);
+    declareHoistedLoads(l, line, loads);
   }
 }
 bool WriteExpressions::isSafeMemoryCoalescing (Region *R) {
@@ -325,6 +2243,7 @@ bool WriteExpressions::isSafeMemoryCoalescing (Region *R) {
   if (!ClEmitParallel)
     return true;
   std::map<Loop*, bool> loops;
+  bool hasParallel = false, hasSerial = false;
   // Find all loops present in the same 
   for (auto BB = R->block_begin(), BE = R->block_end(); BB != BE; BB++) {
     Loop *l = li->getLoopFor(*BB);
@@ -334,11 +2253,113 @@ bool WriteExpressions::isSafeMemoryCoalescing (Region *R) {
       for (Loop *subLoop : l->getSubLoops())
         loops[subLoop] = true;
     }
-    if (!isLoopParallel(l))
+    if (isLoopParallel(l))
+      hasParallel = true;
+    else if (isDeviceSerialLoop(l, R))
+      hasSerial = true;
+    else
       return false;
     }
+  // Serial loops only stay on the device to keep data there for the parallel
+  // ones.
+  return !hasSerial || hasParallel;
+}
+
+bool WriteExpressions::isDeviceSerialLoop (Loop *L, Region *R) {
+  if (!ClDeviceSerial || (ClEmitOMP == OMP_CPU) || !L->empty() ||
+      !R->contains(L) || (L->getParentLoop() && R->contains(L->getParentLoop())))
+    return false;
+
+  std::set<Instruction*> covered;
+  auto &BasePtrsData = ptrRA->RegionsRangeData[R].BasePtrsData;
+  for (auto I = BasePtrsData.begin(), IE = BasePtrsData.end(); I != IE; I++) {
+    // Pointers created inside the region are not mapped by its data pragma.
+    Instruction *Base = dyn_cast<Instruction>(I->second.BasePtr);
+    if (Base && R->contains(Base))
+      continue;
+    covered.insert(I->second.AccessInstructions.begin(),
+                   I->second.AccessInstructions.end());
+  }
+
+  for (auto BB = L->block_begin(), BE = L->block_end(); BB != BE; BB++)
+    for (auto I = (*BB)->begin(), IE = (*BB)->end(); I != IE; I++) {
+      if (isa<DbgInfoIntrinsic>(I))
+        continue;
+      if (isa<CallInst>(I) || isa<InvokeInst>(I))
+        return false;
+      if ((isa<LoadInst>(I) || isa<StoreInst>(I)) && !covered.count(&*I))
+        return false;
+      // Scalars are firstprivate in the device code: values computed by the
+      // loop, e.g. a sum or its induction variable, never reach the host.
+      for (User *U : I->users())
+        if (Instruction *UI = dyn_cast<Instruction>(U))
+          if (!L->contains(UI))
+            return false;
+    }
   return true;
 }
+
+void WriteExpressions::writeSerialKernel (Loop *L, std::string NAME,
+                                          bool restric) {
+  std::string flag = std::string();
+  if (restric)
+    flag = " if(!RST_" + NAME + ")";
+
+  std::set<std::string> mapped;
+  if (getUserPragmas(L, mapped) & USER_PARALLEL) {
+    numUP++;
+    return;
+  }
+
+  // The "if" clause runs the loop on the host when the checks fail, as the
+  // data region is not created then.
+  std::string pragma = "#pragma acc serial" + flag + "\n";
+  if (ClEmitOMP == OMP_GPU)
+    pragma = "#pragma omp target" + flag + "\n";
+  addCommentToLine(pragma, getLoopLine(L));
+  numDS++;
+}
+
+void WriteExpressions::reportDeviceSerial (Loop *L, Region *R,
+                                           std::string pragmas) {
+  size_t pos = pragmas.find("#pragma");
+  if (ClSerialReport.empty() || (pos == std::string::npos))
+    return;
+  DebugLoc DL = L->getStartLoc();
+  std::string location = L->getHeader()->getParent()->getName();
+  if (DL)
+    location = DL->getFilename().str() + ":" + std::to_string(DL.getLine());
+
+  // Without the serial loop on the device, the region is split around it, and
+  // each array it accesses leaves the device before it and comes back after.
+  std::set<std::string> names;
+  auto &BasePtrsData = ptrRA->RegionsRangeData[R].BasePtrsData;
+  for (auto I = BasePtrsData.begin(), IE = BasePtrsData.end(); I != IE; I++)
+    for (unsigned int i = 0, ie = I->second.AccessInstructions.size(); i != ie;
+         i++)
+      if (L->contains(I->second.AccessInstructions[i])) {
+        names.insert(rn->getNameofValue(I->second.BasePtr).nameInFile);
+        break;
+      }
+
+  std::string saved = std::string();
+  std::string bytes = std::string();
+  for (auto N = names.begin(), NE = names.end(); N != NE; N++) {
+    std::vector<std::string> arrays(1, *N);
+    std::string lower, size;
+    if (N->empty() ||
+        !replaceArraySection(pragmas, pos, *N, arrays, lower, size))
+      continue;
+    saved += (saved.empty() ? "" : ", ") + *N + "[" + lower + ":" + size + "]";
+    bytes += (bytes.empty() ? "" : " + ") + std::string("2 * (") + size +
+             ") * sizeof(" + *N + "[0])";
+  }
+  if (saved.empty())
+    return;
+  SerialReport.push_back(location + ": serial loop kept on the device, saves "
+                         "the transfers of " + saved + " (" + bytes +
+                         " bytes)");
+}
  
 void WriteExpressions::writeKernels (Loop *L, std::string NAME, bool restric) {
   if (!L)
@@ -347,7 +2368,13 @@ void WriteExpressions::writeKernels (Loop *L, std::string NAME, bool restric) {
   if (restric)
     flag = " if(!RST_" + NAME + ")";
 
-  int line = L->getStartLoc()->getLine();
+  std::set<std::string> mapped;
+  if (getUserPragmas(L, mapped) & USER_PARALLEL) {
+    numUP++;
+    return;
+  }
+
+  int line = getLoopLine(L);
   std::string pragma = "#pragma acc kernels" + flag + "\n";
   if (!ClEmitParallel && (ClEmitOMP == ACC)) {
     addCommentToLine(pragma, line);
@@ -362,7 +2389,7 @@ void WriteExpressions::writeKernels (Loop *L, std::string NAME, bool restric) {
   //MDDivergent = BB->getTerminator()->getMetadata("isDivergent");
   //if (ClDivergent && MDDivergent != nullptr)
   //  return;
-  if (!MD)
+  if (!MD && !isParallelInFile(L))
     return;
   numWL++;
   if (ClEmitOMP == ACC)
@@ -390,7 +2417,10 @@ bool WriteExpressions::annotateAccKernels (Region *R, std::string NAME,
       continue;
     if (loops.count(l) == 0) {
       loops[l] = true;
-      writeKernels(l, NAME, restric);
+      if (!isLoopParallel(l) && isDeviceSerialLoop(l, R))
+        writeSerialKernel(l, NAME, restric);
+      else
+        writeKernels(l, NAME, restric);
     }
     std::queue<Loop*> q;
     q.push(l);
@@ -415,11 +2445,25 @@ void WriteExpressions::writeComputation (int line, int lineEnd,
   RC.initializeNewVars();
   RC.setOMP(ClEmitOMP); 
 
+  // Arrays the programmer already mapped around the region are not copied
+  // again.
+  std::set<std::string> mapped;
+  getUserPragmas(R, mapped);
+  RC.setPresentVars(mapped);
+
   // Variable to know the if the restrict pragma exists.
   // Case exists, use to add the test on pragmas.
   std::string test;
   if (RC.analyzeRegion(R, line, ERROR_VALUE, ptrRA, rp, aa, se, li, dt, test)) {
 
+    // Loads moved before their loops are only declared around a single loop.
+    Function *F = R->getEntry()->getParent();
+    for (auto I = ptrRA->HoistedLoads.begin(), IE = ptrRA->HoistedLoads.end();
+         I != IE; I++)
+      if ((I->first->getParent()->getParent() == F) &&
+          containsIdentifier(RC.Comments[line], I->second.name))
+        return;
+
     std::map<std::string, bool> m;
     for (auto BB = R->block_begin(), BE = R->block_end(); BB != BE; BB++) {
       for (auto I = (*BB)->begin(), IE = (*BB)->end(); I != IE; I++) {
@@ -434,6 +2478,15 @@ void WriteExpressions::writeComputation (int line, int lineEnd,
     copyComments(RC.Comments);
     clearExpression();
     annotateAccKernels(R, computationName, RC.restric);
+    std::set<Loop*> serial;
+    for (auto BB = R->block_begin(), BE = R->block_end(); BB != BE; BB++) {
+      Loop *l = li->getLoopFor(*BB);
+      if (l && !serial.count(l) && !isLoopParallel(l) &&
+          isDeviceSerialLoop(l, R)) {
+        serial.insert(l);
+        reportDeviceSerial(l, R, RC.Comments[line]);
+      }
+    }
     std::string pragma = "}\n";
     addCommentToLine(pragma, lineEnd);
   }
@@ -444,7 +2497,9 @@ void WriteExpressions::regionIdentifyCoalescing (Region *R) {
   // the data transference pragma.
   int line = st->getStartRegionLoops(R).first;
   int lineEnd = st->getEndRegionLoops(R).first + 1;
-  if (!isSafeMemoryCoalescing(R) || !st->isSafetlyRegionLoops(R)) {
+  std::set<std::string> mapped;
+  if (!isSafeMemoryCoalescing(R) || !st->isSafetlyRegionLoops(R) ||
+      hasUserParallelLoop(R) || (getUserPragmas(R, mapped) & USER_ATTACHED)) {
     for (auto SR = R->begin(), SRE = R->end(); SR != SRE; ++SR)
       regionIdentifyCoalescing(&(**SR));
     return;
@@ -490,6 +2545,15 @@ void WriteExpressions::functionIdentify (Function *F) {
     }
   }
   
+  // A parallel region in a function called from the kernel of a parallel
+  // loop would be nested inside it, and the device has no nested regions.
+  if ((ClEmitOMP != OMP_CPU) && NestedFunctions.count(F)) {
+    NestingReport.push_back(F->getName().str() + ": runs inside the parallel "
+                            "loop at " + NestedFunctions[F] +
+                            ": not annotated");
+    return;
+  }
+
   // Indetify the top region.
   Region *region = rp->getRegionInfo().getRegionFor(F->begin()); 
   Region *topRegion = region;
@@ -503,6 +2567,11 @@ void WriteExpressions::functionIdentify (Function *F) {
     regionIdentifyCoalescing(topRegion);
   else
    regionIdentify(topRegion);
+
+  // Loops that were not annotated may still have parallel statements.
+  if (ClDistribution && ClEmitParallel && (ClEmitOMP == OMP_CPU))
+    for (auto L = li->begin(), LE = li->end(); L != LE; L++)
+      findDistributableLoops(*L);
 }
 
 Region* WriteExpressions::regionofBasicBlock(BasicBlock *bb) {
@@ -543,6 +2612,44 @@ bool WriteExpressions::isLoopAnalyzable (Loop *L){
   return true;
 }
 
+bool WriteExpressions::doInitialization(Module &M) {
+  ExternParallel.erase(ExternParallel.begin(), ExternParallel.end());
+  if (!ClInput.empty())
+    readParallelLoops();
+  if (ClEmitParallel)
+    findNestedFunctions(M);
+  NestingReport.clear();
+  SerialReport.clear();
+  TypeIdentifierMap.clear();
+  if (NamedMDNode *CUNodes = M.getNamedMetadata("llvm.dbg.cu"))
+    TypeIdentifierMap = generateDITypeIdentifierMap(CUNodes);
+  return false;
+}
+
+bool WriteExpressions::doFinalization(Module &M) {
+  if (!ClSerialReport.empty()) {
+    std::error_code EC;
+    raw_fd_ostream Report(ClSerialReport, EC, sys::fs::F_Text);
+    if (EC)
+      errs() << "[SERIAL-REPORT] ERROR: cannot write " << ClSerialReport <<
+        "\n";
+    else
+      for (unsigned int i = 0, ie = SerialReport.size(); i != ie; i++)
+        Report << SerialReport[i] << "\n";
+  }
+  if (ClNestedReport.empty())
+    return false;
+  std::error_code EC;
+  raw_fd_ostream Report(ClNestedReport, EC, sys::fs::F_Text);
+  if (EC) {
+    errs() << "[NESTED-REPORT] ERROR: cannot write " << ClNestedReport << "\n";
+    return false;
+  }
+  for (unsigned int i = 0, ie = NestingReport.size(); i != ie; i++)
+    Report << NestingReport[i] << "\n";
+  return false;
+}
+
 bool WriteExpressions::runOnFunction(Function &F) {
   this->li = &getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
   this->rp = &getAnalysis<RegionInfoPass>();
@@ -553,11 +2660,16 @@ bool WriteExpressions::runOnFunction(Function &F) {
   this->rn = &getAnalysis<RecoverNames>();
   this->rr = &getAnalysis<RegionReconstructor>();
   this->st = &getAnalysis<ScopeTree>();
+  this->da = &getAnalysis<DependenceAnalysis>();
 
   NewVars = 0;
   
   Comments.erase(Comments.begin(), Comments.end());
+  Rewrites.erase(Rewrites.begin(), Rewrites.end());
   isknowedLoop.erase(isknowedLoop.begin(), isknowedLoop.end());
+  usesOmpRuntime = false;
+  usesStdlib = false;
+  usesDispatch = false;
 
   // In this step, the "functionIdentify" find the top level loop
   // to apply our techinic.
@@ -36,6 +36,7 @@
 #include "llvm/Analysis/ScalarEvolutionExpressions.h"
 #include "llvm/Analysis/ScalarEvolution.h"
 #include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/DependenceAnalysis.h"
 
 #ifndef myutils
 #define myutils
@@ -43,6 +44,8 @@
 #include "../ScopeTree/ScopeTree.h"
 #endif
 
+#include "loopRewriter.h"
+
 using namespace lge;
 
 namespace llvm {
@@ -74,11 +77,54 @@ class WriteExpressions : public FunctionPass {
   std::vector<std::string> Expression;
 
   std::map<Loop*, bool> isknowedLoop;
+
+  // Rewrites "for" statements of the source file.
+  LoopRewriter lr;
+
+  // Lines (and source files) of the loops marked as parallel by the file
+  // provided in -Parallel-File.
+  std::multimap<unsigned int, std::string> ExternParallel;
+
+  // Functions called, directly or not, from the body of a parallel loop, with
+  // the location of that loop.
+  std::map<Function*, std::string> NestedFunctions;
+
+  // Functions also called from serial code.
+  std::set<Function*> SerialFunctions;
+
+  // Lines of the report written in -Nested-Report.
+  std::vector<std::string> NestingReport;
+
+  // Lines of the report written in -Device-Serial-Report.
+  std::vector<std::string> SerialReport;
+
+  // Debug types of the module identified by strings (C++ programs).
+  DITypeIdentifierMap TypeIdentifierMap;
   //===---------------------------------------------------------------------===
 
-  // Find the lines to parallelize in standard input file.
+  // Read the loops marked as parallel in the file provided in -Parallel-File.
+  // Each line has "file:line", or only the line of the loop. Lines starting
+  // with "#" are ignored.
   void readParallelLoops ();
 
+  // Returns true if the loop "L" is marked as parallel in -Parallel-File.
+  bool isParallelInFile (Loop *L);
+
+  // Find the functions called from the body of a parallel loop, where
+  // another parallel loop would create a nested parallel region.
+  void findNestedFunctions (Module &M);
+
+  // Returns the pragma of the parallel loop "L": in functions called from
+  // parallel loops, "#pragma omp simd" if the function only runs inside them,
+  // or "pragma" guarded by "if(!omp_in_parallel())", set in "guard", if it
+  // also runs in serial code.
+  std::string getNestedPragma (Loop *L, std::string pragma,
+                               std::string & guard);
+
+  // Writes in the report the pragma used for the parallel loop "L", if it
+  // runs inside another parallel loop.
+  void reportNesting (Loop *L, std::string pragma);
+
   // Analyze loops and count valid call instructions inside them.
   void analyzeCalls (Loop *L);
 
@@ -123,6 +169,21 @@ class WriteExpressions : public FunctionPass {
 
   // Identify the region case it is safe to do memory coalescing.
   bool isSafeMemoryCoalescing (Region *R);
+
+  // Returns true if "L", a loop of the coalesced region "R" that is not
+  // parallel, can run as single-thread code on the device (-Device-Serial):
+  // it is a single loop without calls, outermost in "R", and every memory
+  // access it does has range info in "R", so the data pragma of the region
+  // maps its footprint. No value computed by the loop may be used after it.
+  bool isDeviceSerialLoop (Loop *L, Region *R);
+
+  // Write the pragma that runs the serial loop "L" as single-thread code on
+  // the device: "acc serial" or "omp target".
+  void writeSerialKernel (Loop *L, std::string NAME, bool restric);
+
+  // Adds to the -Device-Serial report the transfers saved by keeping the
+  // serial loop "L" inside the data region of "R", written in "pragmas".
+  void reportDeviceSerial (Loop *L, Region *R, std::string pragmas);
  
   // Search for every sub region in region R, trying to identify the best region
   // to agrupate memory data transferences..
@@ -131,12 +192,186 @@ class WriteExpressions : public FunctionPass {
   // This void calls regionIdentify for the top level region in function F.
   void functionIdentify(Function *F);
 
-  // Use the metadata to validate insertion of "loop independent" pragmas
-  void denotateLoopParallel (Loop *L, std::string condition, bool topLevelLoop);
+  // Use the metadata to validate insertion of "loop independent" pragmas.
+  // Returns true if the loop "L" was annotated.
+  bool denotateLoopParallel (Loop *L, std::string condition, bool topLevelLoop);
+
+  // Count the loop "L" as annotated with "pragma" and report its nesting.
+  // Unless the loop was "rewritten" with the pragma, the pragma is added to
+  // its line, and the loop may prefetch its gathers. Returns true.
+  bool annotateLoop (Loop *L, std::string pragma, bool rewritten);
 
   // Return true if the loop "L" has isParallel metadata, and false case not.
   bool isLoopParallel (Loop *L);
 
+  // Return the iterations (PEEL_FIRST | PEEL_LAST) that must be peeled so the
+  // loop "L" is parallel, using the peelIterations metadata.
+  int getPeeledIterations (Loop *L);
+
+  // Return true if the loop "L" has splitLoop metadata, i.e. it is only
+  // parallel after splitting its iteration space.
+  bool needsSplit (Loop *L);
+
+  // Find, in "point", the iteration where "L" must be split so its pieces are
+  // parallel. "isolate" is set if that iteration must run alone. Returns
+  // false if the dependences of "L" are not broken by a single split.
+  bool getLoopSplitPoint (Loop *L, std::string & point, bool & isolate);
+
+  // Write the loop "L" split in pieces, annotating the parallel ones with
+  // "pragma". Returns false if the loop cannot be rewritten.
+  bool rewriteSplitLoop (Loop *L, std::string pragma);
+
+  // Return true if the loop "L" has runtimeCheck metadata, i.e. it is only
+  // parallel when its dependence distances are not smaller than its trip
+  // count.
+  bool needsRuntimeCheck (Loop *L);
+
+  // Write the expression "S" in the source code, in "str", using the names of
+  // the variables. Returns false if it cannot be written.
+  bool getSourceExpression (const SCEV *S, std::string & str);
+
+  // Build, in "condition", the test that makes the iterations of the loop "L"
+  // independent, e.g. "(k > n - 1 || k < -(n - 1))", compared as "long long"
+  // values. Returns false if a dependence of "L" cannot be checked at runtime.
+  bool getRuntimeCondition (Loop *L, std::string & condition);
+
+  // Write the loop "L" without its boundary iterations, annotating the
+  // remaining loop with "pragma". Returns false if the loop cannot be
+  // rewritten.
+  bool rewritePeeledLoop (Loop *L, int peel, std::string pragma);
+
+  // Write the "while" or "do ... while" loop "L" as a "for" loop annotated
+  // with "pragma". Returns false if "L" has no canonical induction variable
+  // or no computable trip count.
+  bool rewriteWhileLoop (Loop *L, std::string pragma);
+
+  // Returns the first line of the statement of loop "L", where its
+  // annotations are written.
+  int getLoopLine (Loop *L);
+
+  // Collects in "nest" the perfect nest of loops that starts with "L": each
+  // loop has exactly one subloop, memory is only accessed by the innermost
+  // loop, and the bounds of every loop do not depend on the others.
+  bool getPerfectNest (Loop *L, std::vector<Loop*> & nest);
+
+  // Returns true if every dependence inside the nest has no negative
+  // component, i.e. the loops of the nest can be freely interchanged.
+  bool isFullyPermutable (std::vector<Loop*> & nest);
+
+  // Finds the loops where the pointer "S" varies, and the stride in each one.
+  void getAccessStrides (const SCEV *S,
+                         std::map<const Loop*, const SCEV*> & strides);
+
+  // Returns the tile size for the nest, such that the data touched by one tile
+  // fits in the cache. Returns 0 if the nest has no reuse to exploit.
+  long long int getTileSize (std::vector<Loop*> & nest);
+
+  // Write the nest starting at "L" tiled for the cache, annotating the loop
+  // over the tiles of "L" with "pragma". Returns false if the nest cannot be
+  // tiled.
+  bool tileLoopNest (Loop *L, std::string pragma);
+
+  // Split the loop "L" in parallel loops and serial loops, one for each group
+  // of statements of its body that depend on each other. Returns false if
+  // the loop cannot be distributed, or no parallel loop would be found.
+  bool distributeLoop (Loop *L, std::string pragma);
+
+  // Add "nontemporal" to the "simd" pragma of the innermost parallel loop
+  // "L" for the arrays it only writes, one element per iteration, that are
+  // larger than -Nontemporal-Size (-Nontemporal-Stores). If the size is known
+  // at compile time, only "pragma" changes, and NT_PRAGMA is returned.
+  // Otherwise, returns NT_REWRITE if the loop was written in two versions,
+  // chosen at runtime by the size, or NT_NONE if nothing was written.
+  int writeNontemporal (Loop *L, std::string & pragma);
+
+  // Collects in "gathers" the pairs (array, index) of the indirect accesses
+  // "array[index[expr]]" of the innermost loop "L", where "index" is walked
+  // by the loop and not written in it.
+  void getGathers (Loop *L,
+                   std::vector<std::pair<std::string, std::string> > & gathers);
+
+  // Returns how many iterations of "L" run in the latency of memory given by
+  // -Prefetch-Latency, taking one cycle per instruction of the body.
+  long long int getPrefetchDistance (Loop *L);
+
+  // Prefetch the indirect accesses of the innermost loops nested in "L" (or
+  // of "L" itself) that many iterations ahead (-Prefetch-Gathers). Returns
+  // true if any loop was rewritten.
+  bool prefetchGathers (Loop *L);
+
+  // Classify the directives written by the programmer in "pragmas", for the
+  // code that starts in line "line": USER_PARALLEL if it runs inside one of
+  // their parallel constructs, USER_ATTACHED if a directive applies right to
+  // its statement, so nothing can be written between them. Arrays mapped by
+  // their data regions are added to "mapped".
+  int classifyUserPragmas (std::vector<ScopeTree::UserPragma> & pragmas,
+                           int line, std::set<std::string> & mapped);
+
+  // Classify the directives written by the programmer around loop "L".
+  int getUserPragmas (Loop *L, std::set<std::string> & mapped);
+
+  // Classify the directives written by the programmer around the loops of
+  // region "R".
+  int getUserPragmas (Region *R, std::set<std::string> & mapped);
+
+  // Returns true if any loop of region "R" runs inside a parallel construct
+  // written by the programmer.
+  bool hasUserParallelLoop (Region *R);
+
+  // Returns, in "fields", the name and the C type of the scalar fields of
+  // "ST", by their position, if the debug type of "Base" is a pointer to the
+  // struct given in -SoA-Struct.
+  bool getStructFields (Value *Base, StructType *ST, const DataLayout & DL,
+                        std::map<unsigned int,
+                                 std::pair<std::string, std::string> > & fields);
+
+  // Collects in "fields" the fields of the array of structs "Base" accessed
+  // by "L", marking the ones written. Returns false if "L" uses "Base" for
+  // anything other than loading and storing scalar fields of its elements.
+  bool getFieldAccesses (Loop *L, Value *Base,
+                         std::map<unsigned int, bool> & fields);
+
+  // Replace the section "name[lower:size]" in the data clauses of "pragmas",
+  // after the position "pos", by the same section of each one of "arrays".
+  // Returns false if "name" is not transferred by exactly one clause.
+  bool replaceArraySection (std::string & pragmas, size_t pos,
+                            std::string name, std::vector<std::string> & arrays,
+                            std::string & lower, std::string & size);
+
+  // Write the offloaded loop "L", annotated in "line", using one array per
+  // field for its arrays of structs, copied from and back to the structs
+  // around the data region. Returns false if the loop is not rewritten.
+  bool convertStructArrays (Loop *L, int line);
+
+  // Collect, in "loads", the loads moved to the preheader of the loop "L",
+  // annotated in "line", by -Ptr-licm that its annotations in "comments" use.
+  // Returns false if the loop cannot be rewritten to declare them.
+  bool getHoistedLoads (Loop *L, int line,
+                        std::map<unsigned int, std::string> & comments,
+                        std::vector<PtrRangeAnalysis::HoistedLoad> & loads);
+
+  // Declare "loads" before the loop "L" annotated in "line", e.g.
+  // "double *s_data = s->data;", and use them in the loop instead of the
+  // expressions they keep. A rewrite of the loop written before, e.g. a peeled
+  // or split loop, keeps the declarations. Returns false, removing the
+  // annotations of the loop, if it cannot be rewritten.
+  bool declareHoistedLoads (Loop *L, int line,
+                            std::vector<PtrRangeAnalysis::HoistedLoad> & loads);
+
+  // Write the offloaded loop "L", annotated in "line", as three versions: the
+  // offloaded loop, an OpenMP "parallel for" and the serial loop. The runtime
+  // dispatcher of "dawncc_dispatch.h" chooses one for each execution, by the
+  // number of iterations. "name" prefixes the new variables. Returns false if
+  // the loop is not rewritten.
+  bool writeDispatch (Loop *L, int line, std::string name);
+
+  // Try to distribute the innermost loops inside "L" that are not parallel.
+  void findDistributableLoops (Loop *L);
+
+  // Adds a rewrite of the lines starting at "Line". Returns false if it
+  // overlaps another rewrite.
+  bool addRewrite (SourceRewrite & Rewrite, unsigned int Line);
+
   // Returns true if the region R has any loop annotated as parallel. 
   bool hasLoopParallel (Region *R);
 
@@ -165,16 +400,35 @@ class WriteExpressions : public FunctionPass {
   //===---------------------------------------------------------------------===
   std::map<unsigned int, std::string> Comments;
 
+  std::map<unsigned int, SourceRewrite> Rewrites;
+
   std::map<std::string, bool> routines;
+
+  // True if the pragmas call the OpenMP runtime, so <omp.h> is needed.
+  bool usesOmpRuntime;
+
+  // True if the code written allocates memory, so <stdlib.h> is needed.
+  bool usesStdlib;
+
+  // True if loops call the runtime dispatcher, so "dawncc_dispatch.h" is
+  // needed.
+  bool usesDispatch;
   //===---------------------------------------------------------------------===
 
   static char ID;
 
-  WriteExpressions() : FunctionPass(ID) {};
+  WriteExpressions() : FunctionPass(ID), usesOmpRuntime(false),
+                       usesStdlib(false), usesDispatch(false) {};
   
+  // Reads the loops marked as parallel by other tools.
+  virtual bool doInitialization(Module &M) override;
+
   // We need to insert the Instructions for each source file.
   virtual bool runOnFunction(Function &F) override;
 
+  // Writes the report of the loops inside other parallel loops.
+  virtual bool doFinalization(Module &M) override;
+
   virtual void getAnalysisUsage(AnalysisUsage &AU) const {
       AU.addRequired<RegionInfoPass>();
       AU.addRequired<AliasAnalysis>();
@@ -185,6 +439,7 @@ class WriteExpressions : public FunctionPass {
       AU.addRequired<DominatorTreeWrapperPass>();
       AU.addRequired<RegionReconstructor>(); 
       AU.addRequired<ScopeTree>();
+      AU.addRequired<DependenceAnalysis>();
       AU.setPreservesAll();
   }
 
@@ -197,6 +452,7 @@ class WriteExpressions : public FunctionPass {
   DominatorTree *dt;
   RegionReconstructor *rr;
   ScopeTree *st;
+  DependenceAnalysis *da;
 };
 
 }
@@ -30,7 +30,10 @@
 // 
 //===----------------------------------------------------------------------===//
 #include <fstream>
+#include <sstream>
 
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/DIBuilder.h"
 #include "llvm/Support/CommandLine.h"
@@ -38,6 +41,7 @@
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
 #include <climits>
 
 #include "writeInFile.h" 
@@ -50,12 +54,17 @@ using namespace lge;
 
 #define DEBUG_TYPE "writeInFile"
 
+STATISTIC(numUnchanged, "Number of output files left untouched");
+
 static cl::opt<bool> ClEmitGPU("Emit-GPU",
 cl::Hidden, cl::desc("Analyse just 'GPU__' functions."));
 
 static cl::opt<bool> ClRun("Run-Mode",
 cl::Hidden, cl::desc("Annotate parallel loops or tasks"));
 
+static cl::opt<bool> ClDepFile("Dep-File",
+cl::Hidden, cl::desc("Write a Make style depfile for each output file."));
+
 StringRef WriteInFile::getFileName(Instruction *I) {
   MDNode *Var = I->getMetadata("dbg");
   if (Var)
@@ -122,26 +131,39 @@ if (!Infile){
   errs() << "\nError. File " << Input << " has not found.\n";
   return;
 }
+validateRewrites();
 std::string Line = std::string();
-std::error_code EC; 
-sys::fs::OpenFlags Flags = sys::fs::F_RW;
-raw_fd_ostream File(Output.c_str(), EC, Flags);
-errs() << "\nWriting output to file " << Output << "\n";
+std::string Content;
+raw_string_ostream File(Content);
 
 unsigned LineNo = 1;
+unsigned SkipUntil = 0;
 while (!Infile.eof()) {
   Line = std::string();
   std::getline(Infile, Line);
+  // Lines replaced by a rewrite.
+  if (LineNo <= SkipUntil) {
+    LineNo++;
+    continue;
+  }
+  std::string Start;
+  // Gather all the blanks and tabs.
+  for (std::string::iterator It = Line.begin(), E = Line.end(); It != E;
+  ++It)
+    if (*It == ' ' || *It == '\t')
+      Start += *It;
+    else
+      break;
+
+  if (Rewrites.count(LineNo)) {
+    std::string &Prologue = Rewrites[LineNo].prologue;
+    for (unsigned i = 0, ie = Prologue.size(); i != ie; ++i){
+      if (i == 0 || Prologue[i-1] == '\n')
+        File << Start;
+      File << Prologue[i];
+    }
+  }
   if (Comments.count(LineNo)) {
-    std::string Start;
-    // Gather all the blanks and tabs.
-    for (std::string::iterator It = Line.begin(), E = Line.end(); It != E;
-    ++It)
-      if (*It == ' ' || *It == '\t')
-        Start += *It;
-      else
-        break;
-
     // Emit the comments.
     if (Comments[LineNo].size() > 0)
       File << Start << Comments[LineNo][0];
@@ -151,6 +173,12 @@ while (!Infile.eof()) {
       File << Comments[LineNo][i];
     }
   }
+  if (Rewrites.count(LineNo)) {
+    File << Start << Rewrites[LineNo].text << "\n";
+    SkipUntil = Rewrites[LineNo].endLine;
+    LineNo++;
+    continue;
+  }
   // Try identify if console has add a Carriage Return character in the
   // end of the string.
   if (Line[Line.size() - 1] == CarriageReturn)
@@ -160,14 +188,12 @@ while (!Infile.eof()) {
   File << Line;
   LineNo++;
 }
-File.close();
+writeIfChanged(Output, File.str());
 }
 
 void WriteInFile::printPragToFile(std::string Output) {
-std::error_code EC; 
-sys::fs::OpenFlags Flags = sys::fs::F_RW;
-raw_fd_ostream File(Output.c_str(), EC, Flags);
-errs() << "\nWriting output to file " << Output << "\n";
+std::string Content;
+raw_string_ostream File(Content);
 
 for (auto I = Comments.begin(), IE = Comments.end(); I != IE; I++) {
   File << std::to_string(I->first-1) << "a" << std::to_string(I->first) << "\n";
@@ -175,7 +201,135 @@ for (auto I = Comments.begin(), IE = Comments.end(); I != IE; I++) {
      File << Comments[I->first][i];
   }
 }
+for (auto I = Rewrites.begin(), IE = Rewrites.end(); I != IE; I++) {
+  File << std::to_string(I->first) << "," << std::to_string(I->second.endLine)
+       << "c" << std::to_string(I->first) << "\n";
+  File << I->second.prologue << I->second.text << "\n";
+}
+writeIfChanged(Output, File.str());
+}
+
+bool WriteInFile::writeIfChanged(std::string Output, std::string Content) {
+std::ifstream Old(Output.c_str(), std::ios::in | std::ios::binary);
+if (Old) {
+  std::stringstream Buffer;
+  Buffer << Old.rdbuf();
+  if (Buffer.str() == Content) {
+    errs() << "\nOutput file " << Output << " is up to date\n";
+    ++numUnchanged;
+    return false;
+  }
+  Old.close();
+}
+
+std::error_code EC;
+sys::fs::OpenFlags Flags = sys::fs::F_RW;
+raw_fd_ostream File(Output.c_str(), EC, Flags);
+if (EC) {
+  errs() << "\nError. File " << Output << " could not be written: "
+         << EC.message() << "\n";
+  return false;
+}
+errs() << "\nWriting output to file " << Output << "\n";
+File << Content;
 File.close();
+return true;
+}
+
+std::string WriteInFile::escapeDepPath(std::string Path) {
+std::string Escaped;
+for (unsigned i = 0, ie = Path.size(); i != ie; ++i) {
+  if (Path[i] == ' ' || Path[i] == '#')
+    Escaped += '\\';
+  else if (Path[i] == '$')
+    Escaped += '$';
+  Escaped += Path[i];
+}
+return Escaped;
+}
+
+void WriteInFile::addDependency(StringRef Dir, StringRef File) {
+if (File.empty())
+  return;
+SmallString<256> Path;
+if (!sys::path::is_absolute(File) && !Dir.empty())
+  Path = Dir;
+sys::path::append(Path, File);
+if (sys::fs::exists(Path.str()))
+  Dependencies.insert(Path.str());
+}
+
+void WriteInFile::collectIncludes(std::string Input,
+                                  std::set<std::string> & Deps) {
+std::fstream Infile(Input.c_str(), std::ios::in);
+if (!Infile)
+  return;
+StringRef Dir = sys::path::parent_path(Input);
+while (!Infile.eof()) {
+  std::string Line = std::string();
+  std::getline(Infile, Line);
+  // Look for the directives #include "file". The system headers, written as
+  // <file>, come from the debug information.
+  size_t Pos = Line.find_first_not_of(" \t");
+  if (Pos == std::string::npos || Line[Pos] != '#')
+    continue;
+  Pos = Line.find_first_not_of(" \t", Pos + 1);
+  if (Pos == std::string::npos || Line.compare(Pos, 7, "include") != 0)
+    continue;
+  Pos = Line.find_first_not_of(" \t", Pos + 7);
+  if (Pos == std::string::npos || Line[Pos] != '"')
+    continue;
+  size_t End = Line.find('"', Pos + 1);
+  if (End == std::string::npos)
+    continue;
+  SmallString<256> Path(Dir);
+  sys::path::append(Path, Line.substr(Pos + 1, End - Pos - 1));
+  if (!sys::fs::exists(Path.str()) || Deps.count(Path.str()))
+    continue;
+  Deps.insert(Path.str());
+  collectIncludes(Path.str(), Deps);
+}
+}
+
+void WriteInFile::findDependencies(Module &M) {
+Dependencies.clear();
+DebugInfoFinder Finder;
+Finder.processModule(M);
+for (DICompileUnit *CU : Finder.compile_units())
+  addDependency(CU->getDirectory(), CU->getFilename());
+for (DISubprogram *S : Finder.subprograms())
+  addDependency(S->getDirectory(), S->getFilename());
+for (DIType *T : Finder.types())
+  addDependency(T->getDirectory(), T->getFilename());
+for (auto F = M.begin(), FE = M.end(); F != FE; ++F)
+  for (auto B = F->begin(), BE = F->end(); B != BE; ++B)
+    for (auto I = B->begin(), IE = B->end(); I != IE; ++I)
+      if (MDNode *N = I->getMetadata("dbg"))
+        if (DILocation *DL = dyn_cast<DILocation>(N))
+          addDependency(DL->getDirectory(), DL->getFilename());
+}
+
+void WriteInFile::printDepFile(std::string Input) {
+std::set<std::string> Deps = Dependencies;
+collectIncludes(Input, Deps);
+// The source is listed first. The scope tree and the directives read by the
+// pass are removed by run.sh, so they cannot be prerequisites.
+Deps.erase(Input);
+Deps.erase(Input + "_scope.dot");
+Deps.erase(Input + "_pragmas.txt");
+
+std::string Content;
+raw_string_ostream File(Content);
+File << escapeDepPath(generateOutputName(Input)) << " "
+     << escapeDepPath(generatePragOutputName(Input)) << ": "
+     << escapeDepPath(Input);
+for (auto I = Deps.begin(), IE = Deps.end(); I != IE; ++I)
+  File << " \\\n  " << escapeDepPath(*I);
+File << "\n";
+// As with -MP, a removed header does not break the build.
+for (auto I = Deps.begin(), IE = Deps.end(); I != IE; ++I)
+  File << "\n" << escapeDepPath(*I) << ":\n";
+writeIfChanged(generateDepOutputName(Input), File.str());
 }
 
 void WriteInFile::copyComments(std::map <unsigned int, std::string> CommentsIn){
@@ -183,6 +337,27 @@ for(auto I = CommentsIn.begin(), E = CommentsIn.end(); I != E; ++I)
    addCommentToLine(I->second,I->first);
 }
 
+void WriteInFile::copyRewrites(std::map<unsigned int, SourceRewrite> RewritesIn){
+for (auto I = RewritesIn.begin(), E = RewritesIn.end(); I != E; ++I)
+  Rewrites[I->first] = I->second;
+}
+
+void WriteInFile::validateRewrites() {
+for (auto I = Rewrites.begin(); I != Rewrites.end();) {
+  bool valid = true;
+  for (unsigned Line = I->first + 1; Line <= I->second.endLine; Line++)
+    if (Comments.count(Line))
+      valid = false;
+  if (valid) {
+    I++;
+    continue;
+  }
+  errs() << "[REWRITE] WARNING: lines " << I->first << "-" <<
+    I->second.endLine << " have annotations, keeping the original code.\n";
+  Rewrites.erase(I++);
+}
+}
+
 void WriteInFile::addComments (Instruction *I, std::string comment) {
 int Line = getLineNo(I);
 string Comment;
@@ -204,6 +379,10 @@ std::string WriteInFile::generatePragOutputName (std::string fileName) {
   return fileName + ".patch";
 }
 
+std::string WriteInFile::generateDepOutputName (std::string fileName) {
+  return generateOutputName(fileName) + ".d";
+}
+
 bool WriteInFile::findModuleFileName (Module &M) {
 for (auto F = M.begin(), FE = M.end(); F != FE; ++F)
   for (auto B = F->begin(), BE = F->end(); B != BE; ++B)
@@ -229,6 +408,9 @@ bool WriteInFile::runOnModule (Module &M) {
 if (!findModuleFileName(M))
   return true;
 
+if (ClDepFile)
+  findDependencies(M);
+
 std::string lInputFile = InputFile;
 for (Module::iterator F = M.begin(), FE = M.end(); F != FE; ++F) { 
   if (ClEmitGPU) {
@@ -251,8 +433,11 @@ for (Module::iterator F = M.begin(), FE = M.end(); F != FE; ++F) {
   if (lInputFile != InputFile) {
     printToFile(lInputFile, generateOutputName(lInputFile));
     printPragToFile(generatePragOutputName(lInputFile));
+    if (ClDepFile)
+      printDepFile(lInputFile);
     lInputFile = InputFile;
     Comments.erase(Comments.begin(), Comments.end());
+    Rewrites.erase(Rewrites.begin(), Rewrites.end());
   }
 
   if (ClRun == true) {
@@ -262,6 +447,22 @@ for (Module::iterator F = M.begin(), FE = M.end(); F != FE; ++F) {
   else {
     this->we = &getAnalysis<WriteExpressions>(*F);
     copyComments(this->we->Comments);
+    copyRewrites(this->we->Rewrites);
+    // The pragmas call the OpenMP runtime: declare it before the first line.
+    std::string Header = "#include <omp.h>\n";
+    if (this->we->usesOmpRuntime &&
+        (Comments[1].find(Header) == std::string::npos))
+      Comments[1] = Header + Comments[1];
+    // The arrays of struct fields are allocated in the heap.
+    Header = "#include <stdlib.h>\n";
+    if (this->we->usesStdlib &&
+        (Comments[1].find(Header) == std::string::npos))
+      Comments[1] = Header + Comments[1];
+    // Loops dispatched at runtime call the dispatcher.
+    Header = "#include \"dawncc_dispatch.h\"\n";
+    if (this->we->usesDispatch &&
+        (Comments[1].find(Header) == std::string::npos))
+      Comments[1] = Header + Comments[1];
     int line = getSmallerLineNo(&M);
     for (auto I = this->we->routines.begin(), IE = this->we->routines.end();
            I != IE; I++) {
@@ -280,6 +481,8 @@ for (Module::iterator F = M.begin(), FE = M.end(); F != FE; ++F) {
 
 printToFile(InputFile, generateOutputName(InputFile));
 printPragToFile(generatePragOutputName(lInputFile));
+if (ClDepFile)
+  printDepFile(InputFile);
 return false;
 }
 
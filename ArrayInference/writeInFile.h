@@ -41,6 +41,8 @@
 #include "llvm/Analysis/ScalarEvolution.h"
 #include "llvm/Analysis/LoopInfo.h"
 
+#include <set>
+
 #include "writeExpressions.h"
 #include "recoverExpressions.h"
 
@@ -69,7 +71,14 @@ class WriteInFile : public ModulePass {
   //===---------------------------------------------------------------------===
   std::map<unsigned int, std::string > Comments;
 
+  // Rewrites of source lines, indexed by their first line.
+  std::map<unsigned int, SourceRewrite> Rewrites;
+
   std::string InputFile;
+
+  // Files the module was built from: sources and headers found in the
+  // debug information.
+  std::set<std::string> Dependencies;
   //===---------------------------------------------------------------------===
 
   // getFilename
@@ -99,8 +108,35 @@ class WriteInFile : public ModulePass {
   // To generate a patch file.
   void printPragToFile(std::string Output);
 
+  // Write "Content" to the file "Output", unless the file already has it, so
+  // its timestamp is kept. Returns true if the file has been written.
+  bool writeIfChanged(std::string Output, std::string Content);
+
+  // To generate a Make style depfile for the outputs of source "Input".
+  void printDepFile(std::string Input);
+
+  // Fill "Dependencies" with the files referenced by the debug information.
+  void findDependencies(Module &M);
+
+  // Add the file "File", in directory "Dir", to "Dependencies".
+  void addDependency(StringRef Dir, StringRef File);
+
+  // Add to "Deps" the headers included with #include "..." by "Input",
+  // recursively.
+  void collectIncludes(std::string Input, std::set<std::string> & Deps);
+
+  // Escape the characters of "Path" that are special in a Makefile.
+  std::string escapeDepPath(std::string Path);
+
   // To copy the comments to local "Comments".
   void copyComments(std::map<unsigned int,std::string > CommentsIn);
+
+  // To copy the rewrites to local "Rewrites".
+  void copyRewrites(std::map<unsigned int, SourceRewrite> RewritesIn);
+
+  // Drop the rewrites whose replaced lines have comments, as those comments
+  // would be lost.
+  void validateRewrites();
   
   // Create a new name to write the output file.
   std::string generateOutputName (std::string fileName);
@@ -108,6 +144,9 @@ class WriteInFile : public ModulePass {
   // Create a new name to write the pragmas inserted.
   std::string generatePragOutputName (std::string fileName);
 
+  // Create a new name to write the dependencies of the outputs.
+  std::string generateDepOutputName (std::string fileName);
+
   // Find the name of source file for Module M.
   // Return the first name of file found.
   bool findModuleFileName(Module &M);
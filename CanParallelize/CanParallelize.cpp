@@ -22,6 +22,19 @@ void CanParallelize::visit(Loop *L) {
     OutFile << std::to_string(L->getStartLoc().getLine()) << ";";
     Parallel=true;
   }
+  else if (unsigned Peel = ParLoops->getPeeledIterations(L)) {
+    PeelFile << std::to_string(L->getStartLoc().getLine()) << ";" <<
+      std::to_string(Peel) << ";";
+    Peeled=true;
+  }
+  else if (ParLoops->needsRuntimeCheck(L)) {
+    RuntimeFile << std::to_string(L->getStartLoc().getLine()) << ";";
+    Runtime=true;
+  }
+  else if (ParLoops->needsSplit(L)) {
+    SplitFile << std::to_string(L->getStartLoc().getLine()) << ";";
+    Split=true;
+  }
 
   const std::vector<Loop *> &subLoops = L->getSubLoops();
 
@@ -35,17 +48,29 @@ bool CanParallelize::runOnFunction(llvm::Function &F) {
   
   LoopCounter=0;
   Parallel=0;
+  Peeled=0;
+  Runtime=0;
+  Split=0;
   
   if(FirstFunction){
     OutFile.open("out_pl.log", std::ios_base::out);
+    PeelFile.open("out_peel.log", std::ios_base::out);
+    RuntimeFile.open("out_rt.log", std::ios_base::out);
+    SplitFile.open("out_split.log", std::ios_base::out);
     FirstFunction=false;
   }
   else{
     OutFile.open("out_pl.log", std::ios_base::app);
+    PeelFile.open("out_peel.log", std::ios_base::app);
+    RuntimeFile.open("out_rt.log", std::ios_base::app);
+    SplitFile.open("out_split.log", std::ios_base::app);
   }
   
   std::string name = F.getName();
   OutFile << name <<";";
+  PeelFile << name <<";";
+  RuntimeFile << name <<";";
+  SplitFile << name <<";";
 
   for (auto I = LI->begin(), E = LI->end(); I != E; ++I) {
     visit(*I);
@@ -56,6 +81,24 @@ bool CanParallelize::runOnFunction(llvm::Function &F) {
   OutFile << "\n";
   OutFile.close();
 
+  if (!Peeled)
+    PeelFile << "-1;";
+
+  PeelFile << "\n";
+  PeelFile.close();
+
+  if (!Runtime)
+    RuntimeFile << "-1;";
+
+  RuntimeFile << "\n";
+  RuntimeFile.close();
+
+  if (!Split)
+    SplitFile << "-1;";
+
+  SplitFile << "\n";
+  SplitFile.close();
+
   return false;
 }
 
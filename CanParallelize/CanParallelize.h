@@ -11,6 +11,11 @@
 //
 // This pass identify what loop can be parallelized and inserts into a 
 // file which loop can parallelize. To do so, it uses ParallelLoopAnalysis.
+// Loops that are parallel only after peeling their first and/or last
+// iteration are written, with the iterations to peel, into "out_peel.log".
+// Loops that are parallel only if a symbolic dependence distance is not
+// smaller than their trip count are written into "out_rt.log", and loops that
+// are parallel once their iteration space is split into "out_split.log".
 //
 //===--------------------------------------------------------------------------===//
 
@@ -34,7 +39,13 @@ class CanParallelize : public FunctionPass {
   size_t LoopCounter;
   bool FirstFunction=true;
   bool Parallel=false;
+  bool Peeled=false;
+  bool Runtime=false;
+  bool Split=false;
   std::ofstream OutFile;
+  std::ofstream PeelFile;
+  std::ofstream RuntimeFile;
+  std::ofstream SplitFile;
   //OutFile.open("/tmp/out_pl.log", std::ios_base::out);
   //OutFile << "function;how many loops;parallelLoop1;parallelLoop2;end;\n";
   //OutFile.close();  
@@ -1,8 +1,10 @@
 // Author: Pericles Alves [periclesrafael@dcc.ufmg.br]
 
 #include "ParallelLoopAnalysis.h"
+#include "SplitIteration.h"
 
 #include <llvm/Analysis/LoopInfo.h>
+#include <llvm/IR/Dominators.h>
 #include <llvm/IR/InstIterator.h>
 #include <llvm/IR/LegacyPassManager.h>
 #include <llvm/Support/CommandLine.h>
@@ -14,8 +16,154 @@
 using namespace llvm;
 using namespace lge;
 
+static cl::opt<bool> PeelBoundaryIterations(
+    "parloops-peel",
+    cl::desc("Ignore dependences removed by peeling boundary iterations"),
+    cl::init(false), cl::ZeroOrMore);
+
+static cl::opt<bool> RuntimeDistanceChecks(
+    "parloops-runtime",
+    cl::desc("Check symbolic dependence distances at runtime"),
+    cl::init(false), cl::ZeroOrMore);
+
+static cl::opt<bool> SplitIterationSpace(
+    "parloops-split",
+    cl::desc("Ignore dependences removed by splitting the iteration space"),
+    cl::init(false), cl::ZeroOrMore);
+
+bool ParallelLoopAnalysis::isConditional(const llvm::Loop* L) {
+  return (PeelIterations.count(L) != 0) || (RuntimeDistances.count(L) != 0) ||
+         (SplitPoints.count(L) != 0);
+}
+
 bool ParallelLoopAnalysis::canParallelize(llvm::Loop* L) {
-  return (CantParallelize.count(L) == 0);
+  return (CantParallelize.count(L) == 0) && !isConditional(L);
+}
+
+unsigned ParallelLoopAnalysis::getPeeledIterations(const llvm::Loop* L) {
+  // Loops that also need another transformation are not parallel.
+  if (CantParallelize.count(L) || !PeelIterations.count(L) ||
+      RuntimeDistances.count(L) || SplitPoints.count(L))
+    return 0;
+  return PeelIterations[L];
+}
+
+bool ParallelLoopAnalysis::needsRuntimeCheck(const llvm::Loop* L) {
+  return (CantParallelize.count(L) == 0) && (PeelIterations.count(L) == 0) &&
+         (RuntimeDistances.count(L) != 0) && (SplitPoints.count(L) == 0);
+}
+
+bool ParallelLoopAnalysis::needsSplit(const llvm::Loop* L) {
+  return (CantParallelize.count(L) == 0) && (PeelIterations.count(L) == 0) &&
+         (RuntimeDistances.count(L) == 0) && (SplitPoints.count(L) != 0);
+}
+
+bool ParallelLoopAnalysis::registerRuntimeDistance(const Loop *L,
+  const SCEV *Distance) {
+  // The check compares the distance against the trip count of L, so both
+  // must be known before the loop starts.
+  if (!RuntimeDistanceChecks || !Distance || isa<SCEVConstant>(Distance) ||
+      !SE->isLoopInvariant(Distance, L) ||
+      isa<SCEVCouldNotCompute>(SE->getBackedgeTakenCount(L)))
+    return false;
+
+  RuntimeDistances[L].insert(Distance);
+  return true;
+}
+
+bool ParallelLoopAnalysis::registerSplit(const Loop *L, Dependence &D,
+  unsigned Level, Instruction &Src, Instruction &Dst) {
+  if (!SplitIterationSpace)
+    return false;
+
+  unsigned Kind = 0;
+  const SCEV *Point = getSplitPoint(DA, SE, L, D, Level, &Src, &Dst, Kind);
+  if (!Point)
+    return false;
+
+  // The loop is only split at one point.
+  auto It = SplitPoints.find(L);
+  if ((It != SplitPoints.end()) &&
+      ((It->second.first != Point) || (It->second.second != Kind)))
+    return false;
+
+  SplitPoints[L] = std::make_pair(Point, Kind);
+  return true;
+}
+
+unsigned ParallelLoopAnalysis::getBoundaryKind(const Loop *L, ICmpInst *Cmp) {
+  for (unsigned Op = 0; Op != 2; ++Op) {
+    auto *IV = dyn_cast<SCEVAddRecExpr>(SE->getSCEV(Cmp->getOperand(Op)));
+    Value *Other = Cmp->getOperand(1 - Op);
+
+    if (!IV || IV->getLoop() != L || !IV->isAffine() ||
+        !L->isLoopInvariant(Other))
+      continue;
+
+    const SCEV *Bound = SE->getSCEV(Other);
+    if (Bound == IV->getStart())
+      return PEEL_FIRST;
+
+    const SCEV *BECount = SE->getBackedgeTakenCount(L);
+    if (isa<SCEVCouldNotCompute>(BECount))
+      continue;
+
+    BECount = SE->getTruncateOrZeroExtend(BECount, IV->getType());
+    if (Bound == IV->evaluateAtIteration(BECount, *SE))
+      return PEEL_LAST;
+  }
+
+  return 0;
+}
+
+unsigned ParallelLoopAnalysis::getBoundaryIteration(const Loop *L,
+  Instruction &I) {
+  // Walk up the dominator tree looking for a block that can only be reached
+  // through the "true" edge of an "i == boundary" test. As that block is inside
+  // the loop but is not its header, every instruction it dominates runs in the
+  // same iteration as the test.
+  for (DomTreeNode *Node = DT->getNode(I.getParent());
+       Node && L->contains(Node->getBlock()); Node = Node->getIDom()) {
+    BasicBlock *Guarded = Node->getBlock();
+    BasicBlock *Pred = Guarded->getSinglePredecessor();
+
+    if (!Pred || !L->contains(Pred))
+      continue;
+
+    BranchInst *Br = dyn_cast<BranchInst>(Pred->getTerminator());
+    if (!Br || !Br->isConditional() ||
+        (Br->getSuccessor(0) == Br->getSuccessor(1)))
+      continue;
+
+    ICmpInst *Cmp = dyn_cast<ICmpInst>(Br->getCondition());
+    if (!Cmp)
+      continue;
+
+    bool OnTrueEdge = (Br->getSuccessor(0) == Guarded);
+    if ((Cmp->getPredicate() == ICmpInst::ICMP_EQ && OnTrueEdge) ||
+        (Cmp->getPredicate() == ICmpInst::ICMP_NE && !OnTrueEdge))
+      if (unsigned Kind = getBoundaryKind(L, Cmp))
+        return Kind;
+  }
+
+  return 0;
+}
+
+void ParallelLoopAnalysis::registerDependence(const Loop *L, Instruction &Src,
+  Instruction &Dst) {
+  // Every instance of a dependence that has one of its ends in a boundary
+  // iteration involves that iteration. Running it apart, before (or after) all
+  // the others, preserves the dependence.
+  if (PeelBoundaryIterations) {
+    unsigned Kind = getBoundaryIteration(L, Src) | getBoundaryIteration(L, Dst);
+
+    if (Kind) {
+      PeelIterations[L] |= Kind;
+      return;
+    }
+  }
+
+  CantParallelize.insert(L);
 }
 
 void ParallelLoopAnalysis::inspectMemoryDependence(Dependence &D,
@@ -51,7 +199,7 @@ void ParallelLoopAnalysis::inspectMemoryDependence(Dependence &D,
 
     // Register all common loops as not parallelizable.
     while (CommonDepth > 0) {
-      CantParallelize.insert(CommonLoop);
+      registerDependence(CommonLoop, Src, Dst);
       CommonLoop = CommonLoop->getParentLoop();
       --CommonDepth;
     }
@@ -76,8 +224,9 @@ void ParallelLoopAnalysis::inspectMemoryDependence(Dependence &D,
     bool DependenceFree = Distance && isa<SCEVConstant>(Distance) &&
       (cast<SCEVConstant>(Distance)->getValue()->isZero());
 
-    if (!DependenceFree)
-      CantParallelize.insert(LoopIt);
+    if (!DependenceFree && !registerRuntimeDistance(LoopIt, Distance) &&
+        !registerSplit(LoopIt, D, Level, Src, Dst))
+      registerDependence(LoopIt, Src, Dst);
 
     LoopIt = LoopIt->getParentLoop();
     --Level;
@@ -104,6 +253,16 @@ void ParallelLoopAnalysis::checkRegisterDependencies(Loop *L) {
     PHINode *PN = cast<PHINode>(I);
 
     if (!isInductionPHI(PN, SE, Step)) {
+      // A PHI whose value coming from the latch is loop invariant only differs
+      // in the first iteration, e.g. a "first" flag cleared in the body.
+      BasicBlock *Latch = L->getLoopLatch();
+      if (PeelBoundaryIterations && Latch &&
+          (PN->getBasicBlockIndex(Latch) != -1) &&
+          L->isLoopInvariant(PN->getIncomingValueForBlock(Latch))) {
+        PeelIterations[L] |= PEEL_FIRST;
+        continue;
+      }
+
       CantParallelize.insert(L);
       hasBadPHI = true;
       break;
@@ -191,8 +350,12 @@ bool ParallelLoopAnalysis::runOnFunction(llvm::Function &F) {
   DA = &getAnalysis<DependenceAnalysis>();
   LI = &getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
   SE = &getAnalysis<ScalarEvolution>();
+  DT = &getAnalysis<DominatorTreeWrapperPass>().getDomTree();
 
   CantParallelize.clear();
+  PeelIterations.clear();
+  RuntimeDistances.clear();
+  SplitPoints.clear();
 
   // Check for memory dependecies among every pair of instructions in this function.
   for (auto Src = inst_begin(F), SrcE = inst_end(F); Src != SrcE; ++Src)
@@ -214,6 +377,7 @@ void ParallelLoopAnalysis::getAnalysisUsage(AnalysisUsage &AU) const {
   AU.addRequiredTransitive<DependenceAnalysis>();
   AU.addRequiredTransitive<LoopInfoWrapperPass>();
   AU.addRequired<ScalarEvolution>();
+  AU.addRequired<DominatorTreeWrapperPass>();
   AU.addRequiredID(LCSSAID);
 
   AU.setPreservesAll();
@@ -245,6 +409,7 @@ INITIALIZE_PASS_BEGIN(ParallelLoopAnalysis, "parallel-loop-analysis",
 INITIALIZE_PASS_DEPENDENCY(DependenceAnalysis);
 INITIALIZE_PASS_DEPENDENCY(LoopInfoWrapperPass);
 INITIALIZE_PASS_DEPENDENCY(ScalarEvolution);
+INITIALIZE_PASS_DEPENDENCY(DominatorTreeWrapperPass);
 INITIALIZE_PASS_DEPENDENCY(LCSSA);
 INITIALIZE_PASS_END(ParallelLoopAnalysis, "parallel-loop-analysis",
     "Run detection of parallel loops", true, true)
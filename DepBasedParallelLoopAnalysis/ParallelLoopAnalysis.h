@@ -8,6 +8,33 @@
 //   for (int i = 0; i < N; ++i)
 //     for (int j = 1; j < M; ++j)
 //       a[i][j] += a[i][j-1];
+//
+// Optionally (-parloops-peel), dependences that only involve the first or the
+// last iteration of a loop are not reported as loop-carried. The loop is then
+// parallel once those iterations are peeled, which is reported through
+// getPeeledIterations(). Example:
+//
+//   for (int i = 0; i < N; ++i) {
+//     if (i == 0)
+//       a[N-1] = 0;
+//     b[i] = a[i];
+//   }
+//
+// Optionally (-parloops-runtime), dependences whose distance is a symbolic
+// loop-invariant expression do not make the loop serial either. The loop is
+// parallel whenever the distance is not smaller than its trip count, which is
+// checked when the program runs. Those loops are reported through
+// needsRuntimeCheck(). Example:
+//
+//   for (int i = 0; i < n; ++i)
+//     a[i] = a[i + k];
+//
+// Optionally (-parloops-split), dependences that are broken by splitting the
+// iteration space at a single point (see SplitIteration.h) do not make the
+// loop serial. Those loops are reported through needsSplit(). Example:
+//
+//   for (int i = 0; i < n; ++i)
+//     a[i] = a[n - 1 - i];
 
 #ifndef PARALLEL_LOOP_ANALYSIS_H
 #define PARALLEL_LOOP_ANALYSIS_H
@@ -15,10 +42,18 @@
 #include <llvm/Analysis/DependenceAnalysis.h>
 #include <llvm/Analysis/ScalarEvolution.h>
 #include <llvm/Analysis/ScalarEvolutionExpressions.h>
+#include <map>
+#include <utility>
 #include <set>
 
+// Boundary iterations that must be peeled so a loop becomes parallel.
+#define PEEL_FIRST 1
+#define PEEL_LAST 2
+
 namespace llvm {
 class Loop;
+class DominatorTree;
+class ICmpInst;
 }
 
 namespace lge {
@@ -28,11 +63,45 @@ class ParallelLoopAnalysis : public llvm::FunctionPass {
   llvm::DependenceAnalysis *DA;
   llvm::LoopInfo *LI;
   llvm::ScalarEvolution *SE;
+  llvm::DominatorTree *DT;
   std::set<const llvm::Loop*> CantParallelize;
+  std::map<const llvm::Loop*, unsigned> PeelIterations;
+  std::map<const llvm::Loop*, std::set<const llvm::SCEV*> > RuntimeDistances;
+  std::map<const llvm::Loop*,
+           std::pair<const llvm::SCEV*, unsigned> > SplitPoints;
 
   // Registers a dependence between two instructions.
   void inspectMemoryDependence(llvm::Dependence &D, llvm::Instruction &Src,
     llvm::Instruction &Dst);
+
+  // Registers a dependence carried by loop L, unless it only involves
+  // boundary iterations that can be peeled.
+  void registerDependence(const llvm::Loop *L, llvm::Instruction &Src,
+    llvm::Instruction &Dst);
+
+  // Registers a dependence carried by loop L with a symbolic distance, which
+  // can be checked at runtime. Returns false if the distance does not allow
+  // it.
+  bool registerRuntimeDistance(const llvm::Loop *L,
+    const llvm::SCEV *Distance);
+
+  // Registers a dependence carried by loop L, at Level, that is broken by
+  // splitting the iteration space of L. Every dependence of L must agree on
+  // the split point. Returns false if splitting does not break it.
+  bool registerSplit(const llvm::Loop *L, llvm::Dependence &D, unsigned Level,
+    llvm::Instruction &Src, llvm::Instruction &Dst);
+
+  // Returns true if L is parallel only after some other transformation.
+  bool isConditional(const llvm::Loop *L);
+
+  // Returns PEEL_FIRST (PEEL_LAST) if the comparison checks that the
+  // induction variable of L is at its first (last) iteration, 0 otherwise.
+  unsigned getBoundaryKind(const llvm::Loop *L, llvm::ICmpInst *Cmp);
+
+  // Returns PEEL_FIRST (PEEL_LAST) if I only executes in the first (last)
+  // iteration of L, because it is guarded by an "i == start" ("i == last")
+  // branch. Returns 0 otherwise.
+  unsigned getBoundaryIteration(const llvm::Loop *L, llvm::Instruction &I);
   void checkRegisterDependencies(llvm::Loop *);
 
   // Find all PHINode Instructions used to index a loop.
@@ -51,9 +120,26 @@ public:
   // FunctionPass interface.
   virtual bool runOnFunction(llvm::Function &F);
   virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const;
-  void releaseMemory() { CantParallelize.clear(); }
+  void releaseMemory() {
+    CantParallelize.clear();
+    PeelIterations.clear();
+    RuntimeDistances.clear();
+    SplitPoints.clear();
+  }
 
   bool canParallelize(llvm::Loop* L);
+
+  // Returns which boundary iterations (PEEL_FIRST | PEEL_LAST) must be peeled
+  // so L can be parallelized, or 0 if peeling does not make L parallel.
+  unsigned getPeeledIterations(const llvm::Loop* L);
+
+  // Returns true if L is parallel only when the symbolic distances of its
+  // dependences are not smaller than its trip count.
+  bool needsRuntimeCheck(const llvm::Loop* L);
+
+  // Returns true if L is parallel only when its iteration space is split in
+  // pieces that run one after the other.
+  bool needsSplit(const llvm::Loop* L);
 };
 
 } // end lge namespace
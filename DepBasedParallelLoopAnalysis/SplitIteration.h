@@ -0,0 +1,167 @@
+// Helpers to find the iteration where a loop can be split so its dependences
+// only go from one piece of the iteration space to a later one. Each piece is
+// then parallel. There are two kinds of split:
+//
+//   - SPLIT_CROSSING: the dependences cross the middle of the iteration
+//     space, and are broken by splitting the loop in two pieces:
+//
+//       for (int i = 0; i < n; ++i)
+//         a[i] = a[n - 1 - i] + 1;
+//
+//   - SPLIT_ISOLATE: every iteration accesses an element that is written by a
+//     single iteration. Running that iteration alone, between the ones before
+//     and the ones after it, breaks the dependences:
+//
+//       for (int i = 0; i < n; ++i)
+//         a[i] = a[m] + 1;
+//
+// The split point is the number of the first iteration of the second piece
+// (counting from 0), or the number of the isolated iteration. These helpers
+// are header-only, so both the analysis and the source rewriter compute the
+// same point.
+
+#ifndef SPLIT_ITERATION_H
+#define SPLIT_ITERATION_H
+
+#include <llvm/Analysis/DependenceAnalysis.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/Analysis/ScalarEvolutionExpressions.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+
+#define SPLIT_CROSSING 1
+#define SPLIT_ISOLATE 2
+
+namespace lge {
+
+// Returns S / D if the division is exact for every value of the unknowns of
+// S, or nullptr otherwise.
+inline const llvm::SCEV *divideExactly(llvm::ScalarEvolution *SE,
+  const llvm::SCEV *S, int64_t D) {
+  if (D == 1)
+    return S;
+  if (D == -1)
+    return SE->getNegativeSCEV(S);
+  if (D == 0)
+    return nullptr;
+
+  if (const llvm::SCEVConstant *C = llvm::dyn_cast<llvm::SCEVConstant>(S)) {
+    int64_t Value = C->getValue()->getSExtValue();
+    if (Value % D)
+      return nullptr;
+    return SE->getConstant(S->getType(), Value / D, true);
+  }
+
+  if (const llvm::SCEVMulExpr *Mul = llvm::dyn_cast<llvm::SCEVMulExpr>(S)) {
+    const llvm::SCEV *First = divideExactly(SE, Mul->getOperand(0), D);
+    if (!First || !llvm::isa<llvm::SCEVConstant>(First))
+      return nullptr;
+    llvm::SmallVector<const llvm::SCEV*, 4> Ops;
+    Ops.push_back(First);
+    for (unsigned I = 1, E = Mul->getNumOperands(); I != E; ++I)
+      Ops.push_back(Mul->getOperand(I));
+    return SE->getMulExpr(Ops);
+  }
+
+  if (const llvm::SCEVAddExpr *Add = llvm::dyn_cast<llvm::SCEVAddExpr>(S)) {
+    llvm::SmallVector<const llvm::SCEV*, 4> Ops;
+    for (unsigned I = 0, E = Add->getNumOperands(); I != E; ++I) {
+      const llvm::SCEV *Op = divideExactly(SE, Add->getOperand(I), D);
+      if (!Op)
+        return nullptr;
+      Ops.push_back(Op);
+    }
+    return SE->getAddExpr(Ops);
+  }
+
+  return nullptr;
+}
+
+// Returns the pointer accessed by a load or a store, or nullptr.
+inline llvm::Value *getAccessPointer(llvm::Instruction *I) {
+  if (llvm::LoadInst *Load = llvm::dyn_cast<llvm::LoadInst>(I))
+    return Load->getPointerOperand();
+  if (llvm::StoreInst *Store = llvm::dyn_cast<llvm::StoreInst>(I))
+    return Store->getPointerOperand();
+  return nullptr;
+}
+
+// Returns the number of bytes accessed by a load or a store, or 0.
+inline uint64_t getAccessSize(llvm::Instruction *I) {
+  const llvm::DataLayout &DL = I->getParent()->getParent()->getParent()->
+                               getDataLayout();
+  if (llvm::LoadInst *Load = llvm::dyn_cast<llvm::LoadInst>(I))
+    return DL.getTypeStoreSize(Load->getType());
+  if (llvm::StoreInst *Store = llvm::dyn_cast<llvm::StoreInst>(I))
+    return DL.getTypeStoreSize(Store->getValueOperand()->getType());
+  return 0;
+}
+
+// If one of the accesses walks an array in L, one element per iteration, and
+// the other always accesses the same element, returns the only iteration in
+// which both access the same memory. Returns nullptr otherwise.
+inline const llvm::SCEV *getIsolatedIteration(llvm::ScalarEvolution *SE,
+  const llvm::Loop *L, llvm::Instruction *Src, llvm::Instruction *Dst) {
+  llvm::Value *SrcPtr = getAccessPointer(Src);
+  llvm::Value *DstPtr = getAccessPointer(Dst);
+  if (!SrcPtr || !DstPtr)
+    return nullptr;
+
+  const llvm::SCEV *Walk = SE->getSCEV(SrcPtr);
+  const llvm::SCEV *Fixed = SE->getSCEV(DstPtr);
+  if (SE->isLoopInvariant(Walk, L))
+    std::swap(Walk, Fixed);
+
+  const llvm::SCEVAddRecExpr *AR = llvm::dyn_cast<llvm::SCEVAddRecExpr>(Walk);
+  if (!AR || (AR->getLoop() != L) || !AR->isAffine() ||
+      !SE->isLoopInvariant(Fixed, L))
+    return nullptr;
+
+  // Both accesses must have the size of the step, so the element accessed
+  // by the fixed access overlaps exactly one iteration.
+  const llvm::SCEVConstant *Step =
+    llvm::dyn_cast<llvm::SCEVConstant>(AR->getStepRecurrence(*SE));
+  if (!Step)
+    return nullptr;
+  int64_t StepValue = Step->getValue()->getSExtValue();
+  uint64_t Size = (StepValue > 0) ? StepValue : -StepValue;
+  if ((getAccessSize(Src) != Size) || (getAccessSize(Dst) != Size))
+    return nullptr;
+
+  const llvm::SCEV *Diff = SE->getMinusSCEV(Fixed, AR->getStart());
+  if (llvm::isa<llvm::SCEVCouldNotCompute>(Diff))
+    return nullptr;
+  return divideExactly(SE, Diff, StepValue);
+}
+
+// Returns the point where L must be split to break the dependence D between
+// Src and Dst, carried at Level, setting Kind. Returns nullptr if splitting
+// does not break the dependence.
+inline const llvm::SCEV *getSplitPoint(llvm::DependenceAnalysis *DA,
+  llvm::ScalarEvolution *SE, const llvm::Loop *L, llvm::Dependence &D,
+  unsigned Level, llvm::Instruction *Src, llvm::Instruction *Dst,
+  unsigned &Kind) {
+  const llvm::SCEV *Point = nullptr;
+  if (D.isSplitable(Level)) {
+    // The analysis gives the last iteration of the first piece.
+    Point = DA->getSplitIteration(D, Level);
+    if (Point && !llvm::isa<llvm::SCEVCouldNotCompute>(Point))
+      Point = SE->getAddExpr(Point, SE->getConstant(Point->getType(), 1));
+    Kind = SPLIT_CROSSING;
+  }
+  else {
+    Point = getIsolatedIteration(SE, L, Src, Dst);
+    Kind = SPLIT_ISOLATE;
+  }
+
+  if (!Point || llvm::isa<llvm::SCEVCouldNotCompute>(Point) ||
+      !SE->isLoopInvariant(Point, L))
+    return nullptr;
+  return Point;
+}
+
+} // end lge namespace
+
+#endif
@@ -0,0 +1,167 @@
+#include "DependenceProfiler.h"
+
+#include <llvm/Analysis/ScalarEvolutionExpressions.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/raw_ostream.h>
+#include <vector>
+
+using namespace llvm;
+using namespace lge;
+
+bool DependenceProfiler::isCandidateLoop(Loop *L) {
+  // The hooks are placed in the preheader and in dedicated exit blocks.
+  if (!L->getLoopPreheader() || !L->getLoopLatch() || !L->hasDedicatedExits())
+    return false;
+
+  DebugLoc DL = L->getStartLoc();
+  if (!DL)
+    return false;
+
+  // Values carried through registers are not seen by the profiler, so only
+  // induction variables are allowed.
+  for (auto I = L->getHeader()->begin(); isa<PHINode>(I); ++I) {
+    auto *AR = dyn_cast<SCEVAddRecExpr>(SE->getSCEV(&*I));
+    if (!AR || AR->getLoop() != L)
+      return false;
+  }
+
+  for (auto BB = L->block_begin(), BE = L->block_end(); BB != BE; ++BB)
+    for (auto I = (*BB)->begin(), IE = (*BB)->end(); I != IE; ++I) {
+      // Values used after the loop depend on the order of the iterations.
+      for (User *U : I->users())
+        if (!L->contains(cast<Instruction>(U)))
+          return false;
+
+      // Memory accessed by external functions is not instrumented.
+      if (isa<DbgInfoIntrinsic>(I))
+        continue;
+      if (auto *CI = dyn_cast<CallInst>(I)) {
+        Function *Callee = CI->getCalledFunction();
+        if (!Callee || Callee->isDeclaration())
+          return false;
+      }
+      if (isa<InvokeInst>(I) || isa<AtomicRMWInst>(I) ||
+          isa<AtomicCmpXchgInst>(I) || isa<FenceInst>(I))
+        return false;
+    }
+
+  return true;
+}
+
+void DependenceProfiler::instrumentLoop(Loop *L) {
+  if (isCandidateLoop(L)) {
+    DebugLoc DL = L->getStartLoc();
+    std::string File = DL->getFilename();
+
+    IRBuilder<> Builder(L->getLoopPreheader()->getTerminator());
+    if (!FileNames.count(File))
+      FileNames[File] = Builder.CreateGlobalStringPtr(File, "dp.file");
+    Builder.CreateCall(LoopBeginFn,
+      {FileNames[File], Builder.getInt32(DL.getLine())});
+
+    Builder.SetInsertPoint(&*L->getHeader()->getFirstInsertionPt());
+    Builder.CreateCall(LoopIterationFn, {});
+
+    SmallVector<BasicBlock *, 4> ExitBlocks;
+    L->getExitBlocks(ExitBlocks);
+    for (BasicBlock *Exit : ExitBlocks) {
+      Builder.SetInsertPoint(&*Exit->getFirstInsertionPt());
+      Builder.CreateCall(LoopEndFn, {});
+    }
+  }
+
+  for (Loop *SubLoop : L->getSubLoops())
+    instrumentLoop(SubLoop);
+}
+
+void DependenceProfiler::instrumentAccesses(Function &F) {
+  const DataLayout &DL = F.getParent()->getDataLayout();
+  std::vector<Instruction *> Accesses;
+
+  for (auto BB = F.begin(), BE = F.end(); BB != BE; ++BB)
+    for (auto I = BB->begin(), IE = BB->end(); I != IE; ++I)
+      if (isa<LoadInst>(I) || isa<StoreInst>(I))
+        Accesses.push_back(&*I);
+
+  for (Instruction *I : Accesses) {
+    IRBuilder<> Builder(I);
+    Value *Ptr = nullptr;
+    Type *Ty = nullptr;
+    Constant *Hook = nullptr;
+
+    if (auto *LD = dyn_cast<LoadInst>(I)) {
+      Ptr = LD->getPointerOperand();
+      Ty = LD->getType();
+      Hook = LoadFn;
+    } else {
+      auto *ST = cast<StoreInst>(I);
+      Ptr = ST->getPointerOperand();
+      Ty = ST->getValueOperand()->getType();
+      Hook = StoreFn;
+    }
+
+    // The runtime only tracks the default address space.
+    if (Ptr->getType()->getPointerAddressSpace() != 0)
+      continue;
+
+    Value *Addr = Builder.CreatePointerCast(Ptr, Builder.getInt8PtrTy());
+    Builder.CreateCall(Hook,
+      {Addr, Builder.getInt64(DL.getTypeStoreSize(Ty))});
+  }
+}
+
+bool DependenceProfiler::doInitialization(Module &M) {
+  LLVMContext &C = M.getContext();
+  Type *VoidTy = Type::getVoidTy(C);
+  Type *Int8PtrTy = Type::getInt8PtrTy(C);
+  Type *Int32Ty = Type::getInt32Ty(C);
+  Type *Int64Ty = Type::getInt64Ty(C);
+
+  LoopBeginFn = M.getOrInsertFunction("__dawncc_dp_loop_begin", VoidTy,
+                                      Int8PtrTy, Int32Ty, nullptr);
+  LoopIterationFn = M.getOrInsertFunction("__dawncc_dp_loop_iteration",
+                                          VoidTy, nullptr);
+  LoopEndFn = M.getOrInsertFunction("__dawncc_dp_loop_end", VoidTy, nullptr);
+  LoadFn = M.getOrInsertFunction("__dawncc_dp_load", VoidTy, Int8PtrTy,
+                                 Int64Ty, nullptr);
+  StoreFn = M.getOrInsertFunction("__dawncc_dp_store", VoidTy, Int8PtrTy,
+                                  Int64Ty, nullptr);
+  FileNames.clear();
+  return true;
+}
+
+bool DependenceProfiler::runOnFunction(Function &F) {
+  if (F.isDeclaration() || F.getName().startswith("__dawncc_dp_"))
+    return false;
+
+  LI = &getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
+  SE = &getAnalysis<ScalarEvolution>();
+
+  // Loops are checked before the accesses are instrumented, as the hooks are
+  // calls to external functions.
+  std::vector<Loop *> TopLevelLoops(LI->begin(), LI->end());
+  for (Loop *L : TopLevelLoops)
+    instrumentLoop(L);
+
+  instrumentAccesses(F);
+  return true;
+}
+
+void DependenceProfiler::getAnalysisUsage(AnalysisUsage &AU) const {
+  AU.addRequired<LoopInfoWrapperPass>();
+  AU.addRequired<ScalarEvolution>();
+}
+
+char DependenceProfiler::ID = 0;
+
+INITIALIZE_PASS_BEGIN(DependenceProfiler, "dep-profiler",
+    "Instrument loops to find memory conflicts at runtime", false, false);
+INITIALIZE_PASS_DEPENDENCY(LoopInfoWrapperPass);
+INITIALIZE_PASS_DEPENDENCY(ScalarEvolution);
+INITIALIZE_PASS_END(DependenceProfiler, "dep-profiler",
+    "Instrument loops to find memory conflicts at runtime", false, false)
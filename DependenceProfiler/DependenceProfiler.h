@@ -0,0 +1,92 @@
+// This pass instruments a program to find, at runtime, loops whose iterations
+// never touch the same memory. It is used when the dependence analysis cannot
+// prove a loop parallel, e.g. with indirect indices or pointer chasing:
+//
+//   for (int i = 0; i < N; ++i)
+//     a[idx[i]] = b[i];
+//
+// Each candidate loop reports when it starts, starts a new iteration and
+// ends. Every load and store reports its address. The runtime library
+// (DependenceProfilerRT.c) keeps a shadow memory with the iterations that
+// last read and wrote each byte, and registers a conflict whenever two
+// different iterations of the same execution of a loop access a byte and one
+// of them writes it. When the program ends, the loops that ran without
+// conflicts are written to a file that -Parallel-File can read.
+//
+// Candidate loops only carry their induction variables through registers and
+// produce no values used after the loop. They only call functions defined in
+// the module, which are instrumented as well.
+//
+// Usage:
+//   opt -mem2reg -loop-rotate -loop-simplify -load DependenceProfiler.so \
+//     -dep-profiler prog.bc -o prog.prof.bc
+//   clang prog.prof.bc libDependenceProfilerRT.a -o prog.prof
+//   DAWNCC_DP_OUTPUT=out_dp.log ./prog.prof <representative input>
+
+#ifndef DEPENDENCE_PROFILER_H
+#define DEPENDENCE_PROFILER_H
+
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/ScalarEvolution.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/Pass.h>
+#include <map>
+#include <string>
+
+namespace lge {
+
+class DependenceProfiler : public llvm::FunctionPass {
+  // Analyses used.
+  llvm::LoopInfo *LI;
+  llvm::ScalarEvolution *SE;
+
+  // Runtime hooks.
+  llvm::Constant *LoopBeginFn;
+  llvm::Constant *LoopIterationFn;
+  llvm::Constant *LoopEndFn;
+  llvm::Constant *LoadFn;
+  llvm::Constant *StoreFn;
+
+  // Name of each source file, as a global string.
+  std::map<std::string, llvm::Value*> FileNames;
+
+  // Returns true if the memory accesses of L tell whether it is parallel.
+  bool isCandidateLoop(llvm::Loop *L);
+
+  // Inserts the hooks that mark the start, the iterations and the end of L
+  // and of its candidate subloops.
+  void instrumentLoop(llvm::Loop *L);
+
+  // Inserts the hooks that report the address of every load and store in F.
+  void instrumentAccesses(llvm::Function &F);
+
+public:
+  static char ID;
+  explicit DependenceProfiler() : FunctionPass(ID) {}
+
+  // FunctionPass interface.
+  virtual bool doInitialization(llvm::Module &M);
+  virtual bool runOnFunction(llvm::Function &F);
+  virtual void getAnalysisUsage(llvm::AnalysisUsage &AU) const;
+};
+
+} // end lge namespace
+
+namespace llvm {
+class PassRegistry;
+void initializeDependenceProfilerPass(llvm::PassRegistry &);
+}
+
+namespace {
+// Initialize the pass as soon as the library is loaded.
+class DepProfilerInitializer {
+public:
+  DepProfilerInitializer() {
+    llvm::PassRegistry &Registry = *llvm::PassRegistry::getPassRegistry();
+    llvm::initializeDependenceProfilerPass(Registry);
+  }
+};
+static DepProfilerInitializer DepProfilerInit;
+} // end of anonymous namespace.
+
+#endif
@@ -0,0 +1,271 @@
+// Runtime of the dependence profiler (see DependenceProfiler.h).
+//
+// The instrumented program keeps a stack with the candidate loops being
+// executed. Each memory granule has, for each level of that stack, a stamp
+// with the execution and the iteration of the loop that last wrote it, and
+// the first and the last iterations that read it. An access conflicts with
+// the loop of a level when the stamp belongs to the same execution of the
+// loop, but to another iteration, and one of the accesses is a write.
+//
+// When the program ends, the loops that ran more than one iteration without
+// conflicts are written, one "file:line" per line, into the file named by
+// the environment variable DAWNCC_DP_OUTPUT ("out_dp.log" by default). Lines
+// starting with "#" summarize the behavior of every profiled loop.
+//
+// The runtime is not thread safe: profile the serial version of the program.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Levels of nested loops tracked. Loops running deeper are not reported.
+#define DP_MAX_DEPTH 4
+
+// Accesses are tracked by granules of 2^DP_GRANULE_SHIFT bytes. Different
+// iterations touching different bytes of the same granule are reported as a
+// conflict.
+#define DP_GRANULE_SHIFT 2
+
+#define DP_LOOP_BUCKETS 1024
+#define DP_INITIAL_SHADOW (1 << 16)
+
+typedef struct DPLoop {
+  const char *file;
+  int line;
+  unsigned long long executions;
+  unsigned long long iterations;
+  int multipleIterations;
+  int conflict;
+  int untracked;
+  struct DPLoop *next;
+  struct DPLoop *nextInList;
+} DPLoop;
+
+typedef struct {
+  DPLoop *loop;
+  uint32_t instance;
+  uint32_t iteration;
+} DPFrame;
+
+typedef struct {
+  uint32_t writeInstance;
+  uint32_t writeIteration;
+  uint32_t readInstance;
+  uint32_t readFirst;
+  uint32_t readLast;
+} DPStamp;
+
+typedef struct {
+  uintptr_t granule;
+  DPStamp levels[DP_MAX_DEPTH];
+} DPEntry;
+
+static DPLoop *LoopBuckets[DP_LOOP_BUCKETS];
+static DPLoop *LoopList;
+static DPLoop **LoopListEnd = &LoopList;
+
+static DPFrame *Stack;
+static unsigned Depth;
+static unsigned StackSize;
+static uint32_t Instances;
+
+static DPEntry *Shadow;
+static size_t ShadowSize;
+static size_t ShadowUsed;
+
+static int Registered;
+
+static void dp_write_profile(void) {
+  const char *name = getenv("DAWNCC_DP_OUTPUT");
+  FILE *out;
+  DPLoop *loop;
+
+  if (!name || !*name)
+    name = "out_dp.log";
+  out = fopen(name, "w");
+  if (!out) {
+    fprintf(stderr, "[DEP-PROFILER] ERROR: cannot write %s\n", name);
+    return;
+  }
+
+  fprintf(out, "# Loops that never accessed the same memory in two "
+               "iterations.\n");
+  for (loop = LoopList; loop; loop = loop->nextInList) {
+    const char *status = "parallel";
+    if (loop->conflict)
+      status = "conflict";
+    else if (loop->untracked)
+      status = "untracked";
+    else if (!loop->multipleIterations)
+      status = "not enough iterations";
+    fprintf(out, "# %s:%d: %llu executions, %llu iterations, %s\n",
+            loop->file, loop->line, loop->executions, loop->iterations,
+            status);
+    if (!loop->conflict && !loop->untracked && loop->multipleIterations)
+      fprintf(out, "%s:%d\n", loop->file, loop->line);
+  }
+  fclose(out);
+}
+
+static DPLoop *dp_find_loop(const char *file, int line) {
+  unsigned bucket = (unsigned)(((uintptr_t)file >> 4) ^ (unsigned)line);
+  DPLoop *loop;
+
+  bucket %= DP_LOOP_BUCKETS;
+  for (loop = LoopBuckets[bucket]; loop; loop = loop->next)
+    if ((loop->line == line) &&
+        ((loop->file == file) || !strcmp(loop->file, file)))
+      return loop;
+
+  loop = (DPLoop *)calloc(1, sizeof(DPLoop));
+  if (!loop) {
+    fprintf(stderr, "[DEP-PROFILER] ERROR: out of memory\n");
+    exit(1);
+  }
+  loop->file = file;
+  loop->line = line;
+  loop->next = LoopBuckets[bucket];
+  LoopBuckets[bucket] = loop;
+  *LoopListEnd = loop;
+  LoopListEnd = &loop->nextInList;
+  return loop;
+}
+
+static size_t dp_hash(uintptr_t granule, size_t size) {
+  return (size_t)((granule * 0x9E3779B97F4A7C15ULL) >> 17) & (size - 1);
+}
+
+static void dp_grow_shadow(void) {
+  size_t oldSize = ShadowSize, i;
+  DPEntry *old = Shadow;
+
+  ShadowSize = oldSize ? (oldSize * 2) : DP_INITIAL_SHADOW;
+  Shadow = (DPEntry *)calloc(ShadowSize, sizeof(DPEntry));
+  if (!Shadow) {
+    fprintf(stderr, "[DEP-PROFILER] ERROR: out of memory\n");
+    exit(1);
+  }
+  for (i = 0; i < oldSize; i++) {
+    size_t pos;
+    if (!old[i].granule)
+      continue;
+    pos = dp_hash(old[i].granule, ShadowSize);
+    while (Shadow[pos].granule)
+      pos = (pos + 1) & (ShadowSize - 1);
+    Shadow[pos] = old[i];
+  }
+  free(old);
+}
+
+static DPEntry *dp_shadow(uintptr_t granule) {
+  size_t pos;
+
+  if ((ShadowUsed + 1) * 2 > ShadowSize)
+    dp_grow_shadow();
+  pos = dp_hash(granule, ShadowSize);
+  while (Shadow[pos].granule && (Shadow[pos].granule != granule))
+    pos = (pos + 1) & (ShadowSize - 1);
+  if (!Shadow[pos].granule) {
+    Shadow[pos].granule = granule;
+    ShadowUsed++;
+  }
+  return &Shadow[pos];
+}
+
+static void dp_access(void *addr, uint64_t size, int write) {
+  uintptr_t first, last, granule;
+  unsigned levels, k;
+
+  if (!Depth || !size)
+    return;
+  first = (uintptr_t)addr >> DP_GRANULE_SHIFT;
+  last = ((uintptr_t)addr + size - 1) >> DP_GRANULE_SHIFT;
+  levels = (Depth < DP_MAX_DEPTH) ? Depth : DP_MAX_DEPTH;
+
+  // Granule 0 marks empty entries of the shadow memory.
+  for (granule = first ? first : 1; granule <= last; granule++) {
+    DPEntry *entry = dp_shadow(granule);
+    for (k = 0; k < levels; k++) {
+      DPFrame *frame = &Stack[k];
+      DPStamp *stamp = &entry->levels[k];
+
+      // Read after write and write after write.
+      if ((stamp->writeInstance == frame->instance) &&
+          (stamp->writeIteration != frame->iteration))
+        frame->loop->conflict = 1;
+
+      if (write) {
+        // Write after read.
+        if ((stamp->readInstance == frame->instance) &&
+            ((stamp->readFirst != frame->iteration) ||
+             (stamp->readLast != frame->iteration)))
+          frame->loop->conflict = 1;
+        stamp->writeInstance = frame->instance;
+        stamp->writeIteration = frame->iteration;
+      } else if (stamp->readInstance != frame->instance) {
+        stamp->readInstance = frame->instance;
+        stamp->readFirst = frame->iteration;
+        stamp->readLast = frame->iteration;
+      } else {
+        stamp->readLast = frame->iteration;
+      }
+    }
+  }
+}
+
+void __dawncc_dp_loop_begin(const char *file, int line) {
+  DPLoop *loop;
+
+  if (!Registered) {
+    atexit(dp_write_profile);
+    Registered = 1;
+  }
+
+  if (Depth == StackSize) {
+    StackSize = StackSize ? (StackSize * 2) : 16;
+    Stack = (DPFrame *)realloc(Stack, StackSize * sizeof(DPFrame));
+    if (!Stack) {
+      fprintf(stderr, "[DEP-PROFILER] ERROR: out of memory\n");
+      exit(1);
+    }
+  }
+
+  loop = dp_find_loop(file, line);
+  loop->executions++;
+  if (Depth >= DP_MAX_DEPTH)
+    loop->untracked = 1;
+
+  // Instance 0 marks stamps that were never written.
+  if (++Instances == 0)
+    Instances = 1;
+  Stack[Depth].loop = loop;
+  Stack[Depth].instance = Instances;
+  Stack[Depth].iteration = 0;
+  Depth++;
+}
+
+void __dawncc_dp_loop_iteration(void) {
+  DPFrame *frame;
+
+  if (!Depth)
+    return;
+  frame = &Stack[Depth - 1];
+  frame->iteration++;
+  frame->loop->iterations++;
+  if (frame->iteration > 1)
+    frame->loop->multipleIterations = 1;
+}
+
+void __dawncc_dp_loop_end(void) {
+  if (Depth)
+    Depth--;
+}
+
+void __dawncc_dp_load(void *addr, uint64_t size) {
+  dp_access(addr, size, 0);
+}
+
+void __dawncc_dp_store(void *addr, uint64_t size) {
+  dp_access(addr, size, 1);
+}
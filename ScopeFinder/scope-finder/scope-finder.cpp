@@ -20,6 +20,15 @@
 //represents the tree. If the user so chooses, the DOT files can be printed to
 //PNG/PDF using tools such as Graphviz.
 //
+//The OpenMP and OpenACC directives already written in each input file are
+//also collected, along with the lines of the statement each one applies to,
+//and outputted in a "_pragmas.txt" file, one directive per line:
+//
+//  pragma line;statement start line;statement end line;directive text
+//
+//Standalone directives (barrier, update, enter data...) apply to no statement
+//and get their own line as the statement lines.
+//
 //Since it is a small self-contained plugin (not meant to be included by other
 //applications), all the code is kept within its own source file, for simplici-
 //ty's sake.
@@ -46,9 +55,12 @@
 #include "clang/Frontend/FrontendActions.h"
 #include "clang/Frontend/CompilerInstance.h"
 #include "clang/Frontend/FrontendPluginRegistry.h"
+#include "clang/Lex/PPCallbacks.h"
+#include "clang/Lex/Preprocessor.h"
 #include "clang/Rewrite/Core/Rewriter.h"
 #include <stack>
 #include <fstream>
+#include <sstream>
 
 using namespace std;
 using namespace clang;
@@ -84,6 +96,130 @@ stack <struct InputFile> FileStack;
 /*node counter, to uniquely identify nodes*/
 long long int opCount = 0;
 
+/*POD struct that represents an OpenMP/OpenACC directive written by the user.
+nextLine is the first line of code after the directive, where the statement it
+applies to must start. Standalone directives have resolved set from the start*/
+struct UserPragma {
+  string filename;
+  string text;
+  unsigned int line;
+  unsigned int nextLine;
+  unsigned int sline, eline;
+  bool resolved;
+};
+
+/*directives found by the preprocessor, in the order they appear*/
+vector <struct UserPragma> PragmaList;
+
+/*returns whether the directive applies to no statement*/
+bool isStandalonePragma(string text) {
+  const char *standalone[] = {"barrier", "taskwait", "taskyield", "flush",
+                              "threadprivate", "declare", "end", "update",
+                              "enter", "exit", "wait", "cache", "routine",
+                              "init", "shutdown", "set", "cancel",
+                              "cancellation"};
+  istringstream words(text);
+  string word;
+
+  /*skip "#pragma" and "omp"/"acc"*/
+  words >> word >> word >> word;
+
+  if (word == "target") {
+    string next;
+    words >> next;
+    if (next == "update" || next == "enter" || next == "exit") {
+      return true;
+    }
+  }
+
+  word = word.substr(0, word.find('('));
+  for (unsigned int i = 0; i < sizeof(standalone) / sizeof(char*); i++) {
+    if (word == standalone[i]) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+/*preprocessor callbacks, to find the directives the AST does not keep (clang
+drops the OpenACC ones, and the OpenMP ones when -fopenmp is not given)*/
+class PragmaFinder : public PPCallbacks {
+private:
+    SourceManager &mng;
+
+public:
+    explicit PragmaFinder(SourceManager &SM) : mng(SM) { }
+
+    /*reads the directive starting at Loc, joining continued lines*/
+    virtual void PragmaDirective(SourceLocation Loc,
+                                 PragmaIntroducerKind Introducer) {
+      struct UserPragma P;
+
+      if (Introducer != PIK_HashPragma || Loc.isMacroID() ||
+          mng.isInSystemHeader(Loc)) {
+        return;
+      }
+
+      bool invalid = false;
+      const char *C = mng.getCharacterData(Loc, &invalid);
+      if (invalid) {
+        return;
+      }
+
+      P.line = mng.getSpellingLineNumber(Loc);
+      P.nextLine = P.line + 1;
+      for (; *C && *C != '\n'; C++) {
+        if (*C == '\\' && (C[1] == '\n' || (C[1] == '\r' && C[2] == '\n'))) {
+          C += (C[1] == '\r') ? 2 : 1;
+          P.nextLine++;
+          P.text += ' ';
+          continue;
+        }
+        if (*C == '\t' || *C == '\r') {
+          P.text += ' ';
+          continue;
+        }
+        P.text += *C;
+      }
+
+      /*write the directive as "#pragma kind ...", even if it was written as
+      "# pragma kind ..."*/
+      size_t pos = P.text.find_first_not_of(' ', 1);
+      if (pos == string::npos) {
+        return;
+      }
+      P.text = "#" + P.text.substr(pos);
+
+      /*keep only the directives of the programming standards we emit*/
+      istringstream words(P.text);
+      string hash, kind;
+      words >> hash >> kind;
+      if (hash != "#pragma" || (kind != "omp" && kind != "acc")) {
+        return;
+      }
+
+      /*find the first line of code after the directive, skipping blank lines,
+      comments and other directives*/
+      for (; *C; P.nextLine++) {
+        const char *L = ++C;
+        while (*L == ' ' || *L == '\t' || *L == '\r') {
+          L++;
+        }
+        bool skip = (*L == '\n' || *L == '#' || (L[0] == '/' && L[1] == '/'));
+        for (C = L; *C && *C != '\n'; C++) {}
+        if (!skip) {
+          break;
+        }
+      }
+
+      P.filename = mng.getFilename(Loc);
+      P.sline = P.eline = P.line;
+      P.resolved = isStandalonePragma(P.text);
+      PragmaList.push_back(P);
+    }
+};
+
 /*visitor class, inherits clang's ASTVisitor to traverse specific node types in
  the program's AST and retrieve useful information*/
 class ScopeVisitor : public RecursiveASTVisitor<ScopeVisitor> {
@@ -283,10 +419,40 @@ public:
         return true;
     }
 
+    /*gives the source lines of st to the directives written right before
+    it. The AST is traversed in pre-order, so the outermost statement starting
+    in a line is the first one visited*/
+    void ResolvePragmas(Stmt *st) {
+        const SourceManager& mng = astContext->getSourceManager();
+        FullSourceLoc StartLocation = astContext->getFullLoc(st->getLocStart());
+        FullSourceLoc EndLocation = astContext->getFullLoc(st->getLocEnd());
+
+        if (!StartLocation.isValid() || !EndLocation.isValid()) {
+          return;
+        }
+
+        unsigned int sline = StartLocation.getSpellingLineNumber();
+        string filename = mng.getFilename(st->getLocStart());
+
+        for (unsigned int i = 0; i < PragmaList.size(); i++) {
+          struct UserPragma& P = PragmaList[i];
+          if (P.resolved || P.nextLine != sline || P.filename != filename) {
+            continue;
+          }
+          P.sline = sline;
+          P.eline = EndLocation.getSpellingLineNumber();
+          P.resolved = true;
+        }
+    }
+
     /*visits all nodes of type stmt*/
     virtual bool VisitStmt(Stmt *st) {
         struct Node newStmt;
 
+        if (!astContext->getSourceManager().isInSystemHeader(st->getLocStart())) {
+          ResolvePragmas(st);
+        }
+
         /*skip non-scope generating statements (returning true resumes AST
         traversal)*/
         if (!isScopeStmt(st)) {
@@ -351,6 +517,33 @@ public:
       return true;
     }
 
+    /*writes the directives of the top file of the stack as output*/
+    bool writePragmasToFile() {
+      struct InputFile& currFile = FileStack.top();
+      ofstream outfile;
+
+      if (currFile.filename.empty()) {
+        return false;
+      }
+
+      outfile.open(currFile.filename + "_pragmas.txt");
+
+      if (!outfile.is_open()) {
+        return false;
+      }
+
+      for (unsigned int i = 0; i < PragmaList.size(); i++) {
+        struct UserPragma& P = PragmaList[i];
+        if (P.filename != currFile.filename) {
+          continue;
+        }
+        outfile << P.line << ";" << P.sline << ";" << P.eline << ";";
+        outfile << P.text << "\n";
+      }
+
+      return true;
+    }
+
     /*we override HandleTranslationUnit so it calls our visitor
     after parsing each entire input file*/
     virtual void HandleTranslationUnit(ASTContext &Context) {
@@ -369,8 +562,15 @@ public:
             errs() << FileStack.top().filename << "\n";
           }
 
+          if (!writePragmasToFile()) {
+            errs() << "Failed to write pragmas file for input file: ";
+            errs() << FileStack.top().filename << "\n";
+          }
+
           FileStack.pop();
         } 
+
+        PragmaList.clear();
     }
 };
 
@@ -380,6 +580,8 @@ protected:
     Has to be unique pointer (this bit was a bitch to figure out*/
     unique_ptr<ASTConsumer> CreateASTConsumer(CompilerInstance &CI, 
                                               StringRef file) {
+        CI.getPreprocessor().addPPCallbacks(
+          make_unique<PragmaFinder>(CI.getSourceManager()));
         return make_unique<ScopeASTConsumer>(&CI);
     }
 
@@ -17,6 +17,7 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include <cstdlib>
 #include <fstream>
 #include <queue>
 #include <iostream>
@@ -44,6 +45,10 @@ using namespace std;
 
 #define DEFVAL 999999
 
+STATISTIC(numRQ, "Number of region queries to the scope tree");
+STATISTIC(numRM, "Number of regions mapped to the source file");
+STATISTIC(numRL, "Number of loops visited to map regions");
+
 StringRef ScopeTree::getFileName(Instruction *I) {
   MDNode *Var = I->getMetadata("dbg");
   if (Var)
@@ -235,6 +240,41 @@ bool ScopeTree::readFile (std::string name, Function *F) {
   return true;
 }
 
+void ScopeTree::readPragmaFile (std::string name) {
+  std::vector<UserPragma> & pragmas = userPragmas[name];
+  std::fstream Infile((name + "_pragmas.txt").c_str(), std::ios::in);
+  if (!Infile)
+    return;
+
+  // Each line is "line;startLine;endLine;directive".
+  std::string Line;
+  while (std::getline(Infile, Line)) {
+    UserPragma pragma;
+    size_t first = Line.find(';');
+    size_t second = Line.find(';', first + 1);
+    size_t third = Line.find(';', second + 1);
+    if ((first == std::string::npos) || (second == std::string::npos) ||
+        (third == std::string::npos))
+      continue;
+    pragma.line = std::atoi(Line.substr(0, first).c_str());
+    pragma.startLine = std::atoi(Line.substr(first + 1).c_str());
+    pragma.endLine = std::atoi(Line.substr(second + 1).c_str());
+    pragma.directive = Line.substr(third + 1);
+    pragmas.push_back(pragma);
+  }
+  Infile.close();
+}
+
+void ScopeTree::getUserPragmas (std::string file, int startLine, int endLine,
+                                std::vector<UserPragma> & pragmas) {
+  if (!userPragmas.count(file))
+    return;
+  std::vector<UserPragma> & list = userPragmas[file];
+  for (unsigned int i = 0, ie = list.size(); i != ie; i++)
+    if ((list[i].startLine <= startLine) && (endLine <= list[i].endLine))
+      pragmas.push_back(list[i]);
+}
+
 void ScopeTree::identifyParents (Graph *gph) {
   unsigned int id = INT_MAX;
 
@@ -276,6 +316,8 @@ bool ScopeTree::isValidLoopStatement (STnode node, int line, int column) {
 }
 
 void ScopeTree::associateLoop (Loop *L) {
+  if (!L->getStartLoc())
+    return;
   unsigned int line = L->getStartLoc()->getLine();
   unsigned int column = L->getStartLoc()->getColumn();
   Module *M = L->getHeader()->getParent()->getParent();
@@ -304,6 +346,50 @@ void ScopeTree::associateLoop (Loop *L) {
     }
 }
 
+void ScopeTree::associateLoopByLines (Loop *L,
+                                      std::set<unsigned int> & taken) {
+  Module *M = L->getHeader()->getParent()->getParent();
+  if (!info.count(M))
+    return;
+
+  std::string file = getFileName(L->getHeader()->getTerminator());
+  int firstLine = -1, lastLine = -1;
+  for (auto B = L->block_begin(), BE = L->block_end(); B != BE; B++)
+    for (auto I = (*B)->begin(), IE = (*B)->end(); I != IE; I++) {
+      int line = getLineNo(&(*I));
+      if (line <= 0)
+        continue;
+      if ((firstLine == -1) || (line < firstLine))
+        firstLine = line;
+      if (line > lastLine)
+        lastLine = line;
+    }
+  if (firstLine == -1)
+    return;
+
+  STnode *best = nullptr;
+  for (auto I = info[M].begin(), IE = info[M].end(); I != IE; I++) {
+    if (I->file != file)
+      continue;
+    for (auto J = I->list.begin(), JE = I->list.end(); J != JE; J++) {
+      STnode & node = J->second;
+      if (taken.count(node.id) ||
+          !isValidLoopStatement(node, node.startLine, node.startColumn) ||
+          (node.startLine > firstLine) || (node.endLine < lastLine))
+        continue;
+      if (!best || (node.startLine > best->startLine) ||
+          ((node.startLine == best->startLine) &&
+           (node.startColumn > best->startColumn)))
+        best = &node;
+    }
+  }
+  if (!best)
+    return;
+  best->isLoop = true;
+  loopNodes[L] = *best;
+  taken.insert(best->id);
+}
+
 void ScopeTree::associateFunction (Function *F) {
   Module *M = F->getParent();
   if (!info.count(M) || funcNodes.count(F)) {
@@ -331,10 +417,20 @@ void ScopeTree::associateIRSource (Function *F) {
     if (!L || loops.count(L))
       continue;
     loops[L] = true;
+    functionLoops.push_back(L);
   }
   
   for (auto I = loops.begin(), IE = loops.end(); I != IE; I++)
     associateLoop(I->first);
+
+  // Loops without a statement at their start location are matched by the
+  // lines of their instructions, once every exact match is known.
+  std::set<unsigned int> taken;
+  for (auto I = loopNodes.begin(), IE = loopNodes.end(); I != IE; I++)
+    taken.insert(I->second.id);
+  for (unsigned int i = 0, ie = functionLoops.size(); i != ie; i++)
+    if (!loopNodes.count(functionLoops[i]))
+      associateLoopByLines(functionLoops[i], taken);
 }
 
 void ScopeTree::printData () {
@@ -387,24 +483,35 @@ std::string ScopeTree::getFunctionNameDBG(Function *F) {
 
 void ScopeTree::associateLoopstoRegion (std::map<Loop*, STnode> & Loops,
                                         Region *R) {
-  for (auto BB = R->block_begin(), BE = R->block_end(); BB != BE; BB++) {
-    Loop *L = li->getLoopFor(*BB);
-    if (!L || Loops.count(L))
+  // Every loop has its header as a block of its own, so looking at the loops
+  // of the function is enough to find the loops of any region.
+  for (unsigned int i = 0, ie = functionLoops.size(); i != ie; i++) {
+    Loop *L = functionLoops[i];
+    numRL++;
+    if (Loops.count(L) || (R->contains(L->getHeader()) == false))
       continue;
-    if (R->contains(L->getHeader()) == false)
-      continue;
-    Loops[L] = loopNodes[L];
+    if (loopNodes.count(L))
+      Loops[L] = loopNodes[L];
+    else
+      Loops[L] = initSTnode();
   }
 }
 
-ScopeTree::Graph ScopeTree::findGraph (Region *R) {
+std::map<Loop*, ScopeTree::STnode> & ScopeTree::getRegionLoops (Region *R) {
+  numRQ++;
+  if (!regionLoops.count(R)) {
+    numRM++;
+    associateLoopstoRegion(regionLoops[R], R);
+  }
+  return regionLoops[R];
+}
+
+ScopeTree::Graph *ScopeTree::findGraph (Region *R) {
   Function *F = R->getEntry()->getParent();
   Module *M = F->getParent();
 
   // Find the Top region node to start the search, and the respective graph.
   STnode node;
-  Graph gph;
-  gph.n_nodes = -1;
   for (auto I = info[M].begin(), IE = info[M].end(); I != IE; I++) {
     for (auto J = I->list.begin(), JE = I->list.end(); J != JE; J++) {
       if (J->second.name != F->getName())
@@ -412,18 +519,39 @@ ScopeTree::Graph ScopeTree::findGraph (Region *R) {
       node = J->second;
       break;
     }
-    if (node.name == F->getName()) {
-      gph = *I;
-      break;
+    if (node.name == F->getName())
+      return &(*I);
+  }
+  return nullptr;
+}
+
+void ScopeTree::computeNodeLevels (Graph *gph, Function *F) {
+  STnode node = funcNodes[F];
+  std::queue<unsigned int> toIterate;
+  toIterate.push(node.id);
+  functionLevels.assign(gph->n_nodes, DEFVAL);
+  functionLevels[node.id] = 0; 
+ 
+  // Classify each STnode in a level, with a BFS search.
+  while (!toIterate.empty()) {
+    unsigned int id = toIterate.front();
+    toIterate.pop();
+    
+    for (unsigned int i = 0, ie = gph->nodes[id].size(); i != ie; i++) {
+      if ((functionLevels[gph->nodes[id][i]] == DEFVAL) ||
+           functionLevels[gph->nodes[id][i]] > (functionLevels[id] + 1)) {
+        functionLevels[gph->nodes[id][i]] = functionLevels[id] + 1;
+        toIterate.push(gph->nodes[id][i]);
+      }
     }
   }
-  return gph;
 }
 
 std::pair<unsigned int, unsigned int> ScopeTree::getStartRegionLoops (
      Region *R) {
-  std::map<Loop*, STnode> Loops;
-  associateLoopstoRegion (Loops, R);
+  if (regionStart.count(R))
+    return regionStart[R];
+  std::map<Loop*, STnode> & Loops = getRegionLoops(R);
   unsigned int minLine = DEFVAL;
   unsigned int minColumn = DEFVAL;
   for (auto I = Loops.begin(), IE = Loops.end(); I != IE; I++) {
@@ -436,12 +564,14 @@ std::pair<unsigned int, unsigned int> ScopeTree::getStartRegionLoops (
       minColumn = I->second.startColumn;
     }
   }
-  return std::make_pair(minLine, minColumn);
+  regionStart[R] = std::make_pair(minLine, minColumn);
+  return regionStart[R];
 }
   
 std::pair<unsigned int, unsigned int> ScopeTree::getEndRegionLoops (Region *R) {
-  std::map<Loop*, STnode> Loops;
-  associateLoopstoRegion (Loops, R);
+  if (regionEnd.count(R))
+    return regionEnd[R];
+  std::map<Loop*, STnode> & Loops = getRegionLoops(R);
   unsigned int maxLine = 0;
   unsigned int maxColumn = 0;
   for (auto I = Loops.begin(), IE = Loops.end(); I != IE; I++) {
@@ -454,41 +584,27 @@ std::pair<unsigned int, unsigned int> ScopeTree::getEndRegionLoops (Region *R) {
       maxColumn = I->second.endColumn;
     }
   }
-  return std::make_pair(maxLine, maxColumn);
+  regionEnd[R] = std::make_pair(maxLine, maxColumn);
+  return regionEnd[R];
 }
   
 bool ScopeTree::isSafetlyRegionLoops (Region *R) {
-  std::map<Loop*, STnode> Loops;
-  associateLoopstoRegion (Loops, R);
+  if (regionSafe.count(R))
+    return regionSafe[R];
+  regionSafe[R] = false;
+  std::map<Loop*, STnode> & Loops = getRegionLoops(R);
   Function *F = R->getEntry()->getParent();
-  Module *M = F->getParent();
   
   // Find the Top region node to start the search, and the respective graph.
   if (!funcNodes.count(F)) {   
     return false;
   }
-  STnode node = funcNodes[F];
-  Graph gph = findGraph(R);
-  if (gph.n_nodes == -1)
+  Graph *gph = findGraph(R);
+  if (!gph)
     return false;
-  std::queue<unsigned int> toIterate;
-  toIterate.push(node.id);
-  std::vector<unsigned int> nodeLevel(gph.n_nodes, DEFVAL);
-  nodeLevel[node.id] = 0; 
- 
-  // Classify each STnode in a level, with a BFS search.
-  while (!toIterate.empty()) {
-    unsigned int id = toIterate.front();
-    toIterate.pop();
-    
-    for (unsigned int i = 0, ie = gph.nodes[id].size(); i != ie; i++) {
-      if ((nodeLevel[gph.nodes[id][i]] == DEFVAL) ||
-           nodeLevel[gph.nodes[id][i]] > (nodeLevel[id] + 1)) {
-        nodeLevel[gph.nodes[id][i]] = nodeLevel[id] + 1;
-        toIterate.push(gph.nodes[id][i]);
-      }
-    }
-  }
+  if (functionLevels.empty())
+    computeNodeLevels(gph, F);
+  std::vector<unsigned int> & nodeLevel = functionLevels;
  
   // Find each loop's node present in this region. Compare the level, we can
   // mark as safe in two cases:
@@ -504,16 +620,13 @@ bool ScopeTree::isSafetlyRegionLoops (Region *R) {
     }
   }
 
-  // Find a parent to be used as the reference.
-  unsigned int parent = gph.parents[topLevel];
-
   bool valid = true;
   bool needCase2 = false;
   std::vector<Loop*> safety;
   for (auto I = Loops.begin(), IE = Loops.end(); I != IE; I++) {
     // Case 1
     if ((I->second.isLoop) && (nodeLevel[I->second.id] == topLevel) &&
-        (gph.parents[topLevelNode] == gph.parents[I->second.id])) {
+        (gph->parents[topLevelNode] == gph->parents[I->second.id])) {
       safety.push_back(I->first);
       continue;
     }
@@ -553,9 +666,57 @@ bool ScopeTree::isSafetlyRegionLoops (Region *R) {
       break;
     }
   }
+  regionSafe[R] = valid;
   return valid;
 }
 
+bool ScopeTree::getLoopScope (Loop *L, int & startLine, int & startColumn,
+                              int & endLine, int & endColumn) {
+  if (!loopNodes.count(L) || !loopNodes[L].isLoop)
+    return false;
+  startLine = loopNodes[L].startLine;
+  startColumn = loopNodes[L].startColumn;
+  endLine = loopNodes[L].endLine;
+  endColumn = loopNodes[L].endColumn;
+  return true;
+}
+
+bool ScopeTree::isWhileLoop (Loop *L) {
+  if (!loopNodes.count(L) || !loopNodes[L].isLoop)
+    return false;
+  return ((loopNodes[L].name.find("WhileStmt") != string::npos) ||
+          (loopNodes[L].name.find("DoStmt") != string::npos));
+}
+
+void ScopeTree::getUserPragmas (Loop *L, std::vector<UserPragma> & pragmas) {
+  if (!L->getStartLoc())
+    return;
+  int startLine = L->getStartLoc().getLine();
+  int endLine = startLine;
+  if (loopNodes.count(L) && loopNodes[L].isLoop) {
+    startLine = loopNodes[L].startLine;
+    endLine = loopNodes[L].endLine;
+  }
+  getUserPragmas(getFileName(L->getHeader()->getTerminator()), startLine,
+                 endLine, pragmas);
+}
+
+void ScopeTree::getUserPragmas (Region *R, std::vector<UserPragma> & pragmas) {
+  unsigned int startLine = getStartRegionLoops(R).first;
+  unsigned int endLine = getEndRegionLoops(R).first;
+  if ((startLine == 0) || (startLine == DEFVAL) || (endLine == 0))
+    return;
+  getUserPragmas(getFileName(R->getEntry()->getTerminator()), startLine,
+                 endLine, pragmas);
+}
+
+void ScopeTree::invalidateRegions () {
+  regionLoops.clear();
+  regionStart.clear();
+  regionEnd.clear();
+  regionSafe.clear();
+}
+
 bool ScopeTree::runOnFunction(Function &F) {
   this->li = &getAnalysis<LoopInfoWrapperPass>().getLoopInfo();
   this->rp = &getAnalysis<RegionInfoPass>();
@@ -563,9 +724,17 @@ bool ScopeTree::runOnFunction(Function &F) {
   this->se = &getAnalysis<ScalarEvolution>();
   this->dt = &getAnalysis<DominatorTreeWrapperPass>().getDomTree();
 
+  // Regions, loops and the function graph are recomputed for each function,
+  // so nothing cached for the previous one is valid anymore.
+  invalidateRegions();
+  functionLoops.clear();
+  functionLevels.clear();
+  loopNodes.clear();
+
   std::string fName = getFileName(F.begin()->getTerminator());
   if ((fName != std::string()) && !isFileRead.count(fName)) {
     isFileRead[fName] = readFile(fName, &F);
+    readPragmaFile(fName);
   }
   
   if (isFileRead[fName])
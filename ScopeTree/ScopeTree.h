@@ -23,6 +23,8 @@
 #include "llvm/Analysis/ScalarEvolution.h"
 #include "llvm/Analysis/LoopInfo.h"
 
+#include <set>
+
 namespace llvm {
 class ScalarEvolution;
 class AliasAnalysis;
@@ -38,6 +40,18 @@ class LoopInfo;
 
 class ScopeTree : public FunctionPass {
 
+  public:
+
+  // An OpenMP or OpenACC directive written by the programmer. The directive
+  // applies to the statement in the lines [startLine, endLine]; standalone
+  // directives only cover their own line.
+  typedef struct UserPragma {
+    int line;
+    int startLine;
+    int endLine;
+    std::string directive;
+  } UserPragma;
+
   private:
 
   //===---------------------------------------------------------------------===
@@ -84,6 +98,24 @@ class ScopeTree : public FunctionPass {
 
   // Provides information if is knowed the file or not.
   std::map<std::string, bool> isFileRead;
+
+  // Loops of the current function, collected once by associateIRSource.
+  std::vector<Loop*> functionLoops;
+
+  // Memoized region queries. Region pointers are only meaningful for the
+  // RegionInfo they came from, so these maps are dropped every time the
+  // regions of a function are rebuilt (see invalidateRegions).
+  std::map<Region*, std::map<Loop*, STnode> > regionLoops;
+  std::map<Region*, std::pair<unsigned int, unsigned int> > regionStart;
+  std::map<Region*, std::pair<unsigned int, unsigned int> > regionEnd;
+  std::map<Region*, bool> regionSafe;
+
+  // BFS level of each scope node, computed once for the graph of the current
+  // function.
+  std::vector<unsigned int> functionLevels;
+
+  // OpenMP and OpenACC directives written by the programmer, for each file.
+  std::map<std::string, std::vector<UserPragma> > userPragmas;
   //===---------------------------------------------------------------------===
 
   // Find the name of the file for instruction I.
@@ -113,6 +145,15 @@ class ScopeTree : public FunctionPass {
   // Read an extern file, and use the information to built the graph.
   bool readFile (std::string name, Function *F);
 
+  // Read the directives written by the programmer in file "name", if the
+  // scope finder found any.
+  void readPragmaFile (std::string name);
+
+  // Returns the directives of file "file" that apply to a statement
+  // containing the lines [startLine, endLine], from the outermost one.
+  void getUserPragmas (std::string file, int startLine, int endLine,
+                       std::vector<UserPragma> & pragmas);
+
   // Identify the parent for each node.
   void identifyParents (Graph *gph);
 
@@ -122,6 +163,11 @@ class ScopeTree : public FunctionPass {
   // Associate a loop with available information, case possible.
   void associateLoop (Loop *L);
 
+  // Associate a loop that has no statement at its start location, as the
+  // "do ... while" loops, with the innermost loop statement not associated
+  // yet ("taken") that contains the lines of its instructions.
+  void associateLoopByLines (Loop *L, std::set<unsigned int> & taken);
+
   // Return the name of the function in the source file.
   std::string getFunctionNameDBG(Function *F);
 
@@ -137,8 +183,15 @@ class ScopeTree : public FunctionPass {
   // Returns the loops present in a region R.
   void associateLoopstoRegion (std::map<Loop*, STnode> & Loops, Region *R);
 
+  // Returns the loops present in a region R, computing them only once.
+  std::map<Loop*, STnode> & getRegionLoops (Region *R);
+
   // Find a graph for region R.
-  Graph findGraph (Region *R);
+  Graph *findGraph (Region *R);
+
+  // Classify each STnode of the graph in a level, with a BFS search starting
+  // at the node of function F.
+  void computeNodeLevels (Graph *gph, Function *F);
 
   public:
 
@@ -165,6 +218,26 @@ class ScopeTree : public FunctionPass {
   // of the loops in this region (in essence, if is a unique region or not.)
   bool isSafetlyRegionLoops (Region *R);
 
+  // Returns, by reference, the source range of the statement of loop L.
+  // Returns false if the loop could not be associated with a scope.
+  bool getLoopScope (Loop *L, int & startLine, int & startColumn,
+                     int & endLine, int & endColumn);
+
+  // Returns true if the statement of loop L is a "while" or a "do ... while".
+  bool isWhileLoop (Loop *L);
+
+  // Returns, by reference, the directives written by the programmer that
+  // apply to a statement containing loop L, from the outermost one.
+  void getUserPragmas (Loop *L, std::vector<UserPragma> & pragmas);
+
+  // Returns, by reference, the directives written by the programmer that
+  // apply to a statement containing every loop of region R.
+  void getUserPragmas (Region *R, std::vector<UserPragma> & pragmas);
+
+  // Drop every cached region query. Must be called by clients that rebuild
+  // the regions of the current function.
+  void invalidateRegions ();
+
   virtual bool runOnFunction(Function &F) override;
 
   virtual void getAnalysisUsage(AnalysisUsage &AU) const {
@@ -0,0 +1,194 @@
+#!/bin/bash
+
+#You can use this script to measure the compile time of the alias instrumentation (-alias-instrumentation), which builds
+#the scoped-noalias metadata of the regions it clones (fixAliasInfo).
+#./benchAliasInfo.sh -d (DawnCC root dir - containing DawnCC and llvm-build) -p "8 16 32 64" -a "1 4"
+#
+#For each number of pointers P and accesses per pointer A, it writes a kernel with a single loop that reads and writes
+#P arrays, A times each, and runs the first opt invocation of run.sh on it, with and without the alias instrumentation.
+#The difference is the time spent by the instrumentation. With -b, the same kernels are also run with a second DawnCC
+#root (e.g. a build of an older version), and both times are printed side by side.
+
+
+#Set default parameters
+CURRENT_DIR=`pwd`
+DEFAULT_ROOT_DIR=`pwd`
+BASELINE_ROOT_DIR=""
+POINTER_COUNTS="8 16 32 64"
+ACCESS_COUNTS="1 4"
+REPETITIONS=5
+WORK_DIR=""
+KEEP_WORK_DIR_BOOL="false"
+
+#Process arguments of script
+while [ $# -gt 1 ]
+do
+    key="$1"
+
+    case $key in
+        -d|--DawnCCRoot)
+            DEFAULT_ROOT_DIR="$2" #folder containing llvm-build and DawnCC, as in run.sh
+            shift
+        ;;
+        -b|--BaselineRoot)
+            BASELINE_ROOT_DIR="$2" #second folder containing llvm-build and DawnCC, to compare with
+            shift
+        ;;
+        -p|--PointerCounts)
+            POINTER_COUNTS="$2" #numbers of arrays accessed by the kernels, e.g. "8 16 32 64"
+            shift
+        ;;
+        -a|--AccessCounts)
+            ACCESS_COUNTS="$2" #numbers of reads of each array in the loop, e.g. "1 4"
+            shift
+        ;;
+        -r|--Repetitions)
+            REPETITIONS="$2" #runs of opt timed for each kernel; the fastest one is reported
+            shift
+        ;;
+        -w|--WorkDir)
+            WORK_DIR="$2" #folder for the kernels (default: a temporary folder)
+            shift
+        ;;
+        -k|--KeepWorkDir)
+            KEEP_WORK_DIR_BOOL="$2"
+            shift
+        ;;
+        *)
+            # unknown option
+        ;;
+    esac
+    shift # past argument or value
+done
+
+if [ -z "${WORK_DIR}" ]; then
+    WORK_DIR=$(mktemp -d)
+else
+    mkdir -p "${WORK_DIR}"
+fi
+WORK_DIR=$(cd "${WORK_DIR}" && pwd)
+for ROOT_VAR in DEFAULT_ROOT_DIR BASELINE_ROOT_DIR; do
+    case "${!ROOT_VAR}" in
+        ""|/*) ;;
+        *) eval "${ROOT_VAR}=\"${CURRENT_DIR}/${!ROOT_VAR}\"" ;;
+    esac
+done
+
+#Export tools flags, as in run.sh
+export FLAGS="-mem2reg -tbaa -scoped-noalias -basicaa -functionattrs -gvn -loop-rotate
+-instcombine -licm"
+
+
+#Write the kernel with $1 pointers, read $2 times each, into file $3
+write_kernel() {
+    local P=$1 A=$2 FILE=$3 PARAMS="" k j
+    for ((k = 0; k < P; k++)); do
+        PARAMS="${PARAMS}double *p${k}, "
+    done
+
+    echo "void kernel(${PARAMS}int m) {" > "${FILE}"
+    echo "  for (int i = 0; i < m; i++) {" >> "${FILE}"
+    for ((k = 0; k < P; k++)); do
+        local BODY="p${k}[i] = p$(((k + 1) % P))[i]"
+        for ((j = 1; j < A; j++)); do
+            BODY="${BODY} + p$(((k + j + 1) % P))[i + ${j}]"
+        done
+        echo "    ${BODY};" >> "${FILE}"
+    done
+    echo "  }" >> "${FILE}"
+    echo "}" >> "${FILE}"
+}
+
+#Print the fastest time, in milliseconds, of $REPETITIONS runs of the first opt invocation of run.sh with root $1 on
+#file $2, followed by the extra flags in $3 (the alias instrumentation)
+time_opt() {
+    local ROOT=$1 FILE=$2 EXTRA=$3 BEST="" r
+    local BUILD="${ROOT}/DawnCC/lib"
+    local OPT="${ROOT}/llvm-build/bin/opt"
+    local PRA="${BUILD}/PtrRangeAnalysis/libLLVMPtrRangeAnalysis.so"
+    local AI="${BUILD}/AliasInstrumentation/libLLVMAliasInstrumentation.so"
+
+    for ((r = 0; r < REPETITIONS; r++)); do
+        local START=$(date +%s%N)
+        if ! $OPT -load $PRA -load $AI $FLAGS -ptr-ra -basicaa -scoped-noalias ${EXTRA} -S "${FILE}" \
+            -o "${FILE%.ll}_out.ll" 2>> "${FILE%.ll}.log"; then
+            echo "ERROR"
+            return
+        fi
+        local ELAPSED=$((($(date +%s%N) - START) / 1000))
+        if [ -z "${BEST}" ] || [ "${ELAPSED}" -lt "${BEST}" ]; then
+            BEST=${ELAPSED}
+        fi
+    done
+    awk -v us="${BEST}" 'BEGIN { printf("%.1f", us / 1000.0) }'
+}
+
+#Print the time of opt with the alias instrumentation with root $1 on file $2, the time spent by the instrumentation,
+#and the alias lists it built
+time_instrumentation() {
+    local ROOT=$1 FILE=$2
+    : > "${FILE%.ll}.log"
+    local BASE=$(time_opt "${ROOT}" "${FILE}" "")
+    local INSTR=$(time_opt "${ROOT}" "${FILE}" "-alias-instrumentation -region-alias-checks -alias-checks-stats")
+    if [ "${BASE}" == "ERROR" ] || [ "${INSTR}" == "ERROR" ]; then
+        echo "ERROR - -"
+        return
+    fi
+    # Older builds do not report the alias lists.
+    local NODES=$(grep -o 'alias-md-nodes: [0-9]*' "${FILE%.ll}.log" | tail -1 | sed 's/alias-md-nodes: //')
+    echo "${INSTR} $(awk -v a="${INSTR}" -v b="${BASE}" 'BEGIN { printf("%.1f", a - b) }') ${NODES:--}"
+}
+
+cd "${WORK_DIR}"
+if [ -z "${BASELINE_ROOT_DIR}" ]; then
+    printf "%-8s %-8s %-10s %-12s %-10s\n" "pointers" "accesses" "opt(ms)" "alias(ms)" "md-lists"
+else
+    printf "%-8s %-8s %-10s %-12s %-10s %-14s %-8s\n" "pointers" "accesses" "opt(ms)" "alias(ms)" "md-lists" \
+        "baseline(ms)" "speedup"
+fi
+
+for P in ${POINTER_COUNTS}; do
+    for A in ${ACCESS_COUNTS}; do
+        NAME="alias_${P}_${A}"
+
+        if [ "${P}" -lt 2 ]; then
+            echo "ERROR : kernels need at least 2 pointers (got ${P})."
+            continue
+        fi
+
+        write_kernel ${P} ${A} "${NAME}.c"
+        if ! "${DEFAULT_ROOT_DIR}/llvm-build/bin/clang" -g -S -emit-llvm "${NAME}.c" -o "${NAME}.ll" \
+            > "${NAME}.log" 2>&1; then
+            echo "ERROR : cannot compile ${NAME}.c (see ${WORK_DIR}/${NAME}.log)."
+            continue
+        fi
+
+        read TOTAL ALIAS NODES <<< "$(time_instrumentation "${DEFAULT_ROOT_DIR}" "${NAME}.ll")"
+        if [ "${TOTAL}" == "ERROR" ]; then
+            echo "ERROR : opt failed on ${NAME}.ll (see ${WORK_DIR}/${NAME}.log)."
+            continue
+        fi
+
+        if [ -z "${BASELINE_ROOT_DIR}" ]; then
+            printf "%-8s %-8s %-10s %-12s %-10s\n" "${P}" "${A}" "${TOTAL}" "${ALIAS}" "${NODES}"
+            continue
+        fi
+
+        read BASELINE_TOTAL BASELINE BASELINE_NODES <<< "$(time_instrumentation "${BASELINE_ROOT_DIR}" "${NAME}.ll")"
+        SPEEDUP="-"
+        if [ "${BASELINE_TOTAL}" != "ERROR" ]; then
+            SPEEDUP=$(awk -v a="${ALIAS}" -v b="${BASELINE}" 'BEGIN { if (a > 0 && b > 0) printf("%.2fx", b / a); else printf("-") }')
+        fi
+        printf "%-8s %-8s %-10s %-12s %-10s %-14s %-8s\n" "${P}" "${A}" "${TOTAL}" "${ALIAS}" "${NODES}" \
+            "${BASELINE}" "${SPEEDUP}"
+    done
+done
+
+cd "${CURRENT_DIR}"
+
+#If configured to remove the kernels
+if [ "${KEEP_WORK_DIR_BOOL}" == "false" ]; then
+    rm -rf "${WORK_DIR}"
+else
+    echo "Kernels kept in ${WORK_DIR}"
+fi
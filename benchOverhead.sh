@@ -0,0 +1,252 @@
+#!/bin/bash
+
+#You can use this script to measure the host code that DawnCC writes before each kernel: the computation of the bounds
+#of the arrays (AIn[] arithmetic) and the pointer disambiguation checks (RST_AIn).
+#./benchOverhead.sh -d (DawnCC root dir - containing DawnCC and llvm-build) -p "2 4 8" -e "1 2 3"
+#
+#For each number of pointers P and expression depth E, it writes a kernel that accesses P arrays in a nest of E loops,
+#with linearized indices such as "p1[(i1 * m + i2) * m + i3 + 1]", and runs DawnCC on it (through run.sh). The code
+#written before the first pragma of the kernel is then compiled alone, in a function with the same parameters, and
+#timed by the host compiler (CC, default: cc). The result is a table with the nanoseconds per invocation, with and
+#without the cost of an empty call with the same parameters.
+
+
+#Set default parameters
+CURRENT_DIR=`pwd`
+SCRIPT_DIR=$(cd "$(dirname "$0")" && pwd)
+DEFAULT_ROOT_DIR=`pwd`
+POINTER_COUNTS="2 4 8"
+EXPRESSION_DEPTHS="1 2 3"
+REPETITIONS=1000000
+LOOP_SIZE=16
+PRAGMA_STANDARD_INT=0
+MEMORY_COALESCING_BOOL="false"
+WORK_DIR=""
+KEEP_WORK_DIR_BOOL="false"
+HOST_CC="${CC:-cc}"
+
+#Process arguments of script
+while [ $# -gt 1 ]
+do
+    key="$1"
+
+    case $key in
+        -d|--DawnCCRoot)
+            DEFAULT_ROOT_DIR="$2" #folder containing llvm-build and DawnCC, as in run.sh
+            shift
+        ;;
+        -p|--PointerCounts)
+            POINTER_COUNTS="$2" #numbers of arrays accessed by the kernels, e.g. "2 4 8"
+            shift
+        ;;
+        -e|--ExpressionDepths)
+            EXPRESSION_DEPTHS="$2" #numbers of nested loops in the index expressions, e.g. "1 2 3"
+            shift
+        ;;
+        -r|--Repetitions)
+            REPETITIONS="$2" #invocations timed for each kernel
+            shift
+        ;;
+        -m|--LoopSize)
+            LOOP_SIZE="$2" #value of "m", the trip count of each loop, passed to the timed code
+            shift
+        ;;
+        -ps|--PragmaStandard)
+            PRAGMA_STANDARD_INT="$2" #0-OpenACC; 1-OpenMP GPU; 2-OpenMP CPU
+            shift
+        ;;
+        -mc|--MemoryCoalescing)
+            MEMORY_COALESCING_BOOL="$2" #true - use memory coalescing; false - one data region per loop
+            shift
+        ;;
+        -w|--WorkDir)
+            WORK_DIR="$2" #folder for the kernels and the timed code (default: a temporary folder)
+            shift
+        ;;
+        -k|--KeepWorkDir)
+            KEEP_WORK_DIR_BOOL="$2"
+            shift
+        ;;
+        *)
+            # unknown option
+        ;;
+    esac
+    shift # past argument or value
+done
+
+if [ -z "${WORK_DIR}" ]; then
+    WORK_DIR=$(mktemp -d)
+else
+    mkdir -p "${WORK_DIR}"
+fi
+WORK_DIR=$(cd "${WORK_DIR}" && pwd)
+case "${DEFAULT_ROOT_DIR}" in
+    /*) ;;
+    *) DEFAULT_ROOT_DIR="${CURRENT_DIR}/${DEFAULT_ROOT_DIR}" ;;
+esac
+
+
+#Write the parameters "double *p0, ..., int m" of a kernel with $1 pointers
+parameters() {
+    local P=$1 PARAMS="" k
+    for ((k = 0; k < P; k++)); do
+        PARAMS="${PARAMS}double *p${k}, "
+    done
+    echo "${PARAMS}int m"
+}
+
+#Write the arguments "p0, ..., m" of a call to a kernel with $1 pointers
+arguments() {
+    local P=$1 ARGS="" k
+    for ((k = 0; k < P; k++)); do
+        ARGS="${ARGS}p${k}, "
+    done
+    echo "${ARGS}m"
+}
+
+#Write the kernel with $1 pointers and depth $2 into file $3
+write_kernel() {
+    local P=$1 E=$2 FILE=$3 INDEX="i1" INDENT="  " k
+    for ((k = 2; k <= E; k++)); do
+        INDEX="(${INDEX}) * m + i${k}"
+    done
+
+    echo "void kernel($(parameters ${P})) {" > "${FILE}"
+    for ((k = 1; k <= E; k++)); do
+        echo "${INDENT}for (int i${k} = 0; i${k} < m; i${k}++)" >> "${FILE}"
+        INDENT="${INDENT}  "
+    done
+    local BODY="p0[${INDEX}] = p1[${INDEX}]"
+    for ((k = 2; k < P; k++)); do
+        BODY="${BODY} + p${k}[${INDEX} + ${k}]"
+    done
+    echo "${INDENT}${BODY};" >> "${FILE}"
+    echo "}" >> "${FILE}"
+}
+
+#Print the code written by DawnCC in the kernel of file $1 before its first pragma
+extract_prekernel() {
+    awk '
+        /^void kernel\(/ { inside = 1; next }
+        inside && /^[ \t]*#pragma/ { exit }
+        inside && /^[ \t]*for[ \t]*\(/ { exit }
+        inside { print }
+    ' "$1"
+}
+
+#Write into file $3 the timing program for the pre-kernel code in file $4, of a kernel with $1 pointers and depth $2
+write_driver() {
+    local P=$1 E=$2 FILE=$3 CODE=$4 k
+    local SIZE="m"
+    for ((k = 2; k <= E; k++)); do
+        SIZE="${SIZE} * m"
+    done
+
+    cat > "${FILE}" <<EOF
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+volatile long long bench_sink;
+
+__attribute__((noinline)) void prekernel($(parameters ${P})) {
+$(cat "${CODE}")
+EOF
+    # Keep the results alive, so the compiler does not remove the code.
+    grep -o 'long long int AI[0-9]*\[[0-9]*\]' "${CODE}" | \
+        sed 's/long long int \(AI[0-9]*\)\[\([0-9]*\)\]/  for (int bench_k = 0; bench_k < \2; bench_k++) bench_sink += \1[bench_k];/' >> "${FILE}"
+    grep -o 'char RST_AI[0-9]*' "${CODE}" | sed 's/char \(RST_AI[0-9]*\)/  bench_sink += \1;/' >> "${FILE}"
+
+    cat >> "${FILE}" <<EOF
+}
+
+__attribute__((noinline)) void emptycall($(parameters ${P})) {
+  bench_sink += m;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, char **argv) {
+  long long reps = atoll(argv[1]), r;
+  int m = atoi(argv[2]);
+  size_t size = (size_t)(${SIZE}) + ${P};
+  double start, kernel, empty;
+EOF
+    for ((k = 0; k < P; k++)); do
+        echo "  double *p${k} = (double *) calloc(size, sizeof(double));" >> "${FILE}"
+    done
+    cat >> "${FILE}" <<EOF
+
+  start = now();
+  for (r = 0; r < reps; r++)
+    prekernel($(arguments ${P}));
+  kernel = (now() - start) / reps;
+
+  start = now();
+  for (r = 0; r < reps; r++)
+    emptycall($(arguments ${P}));
+  empty = (now() - start) / reps;
+
+  printf("%.2f %.2f\n", kernel, kernel - empty);
+  return 0;
+}
+EOF
+}
+
+
+cd "${WORK_DIR}"
+printf "%-8s %-6s %-6s %-8s %-12s %-12s\n" "pointers" "depth" "lines" "checks" "ns/call" "ns/call-net"
+
+for P in ${POINTER_COUNTS}; do
+    for E in ${EXPRESSION_DEPTHS}; do
+        NAME="bench_${P}_${E}"
+
+        if [ "${P}" -lt 2 ]; then
+            echo "ERROR : kernels need at least 2 pointers (got ${P})."
+            continue
+        fi
+
+        write_kernel ${P} ${E} "${NAME}.c"
+
+        "${SCRIPT_DIR}/run.sh" -d "${DEFAULT_ROOT_DIR}" -f "${NAME}.c" -ps ${PRAGMA_STANDARD_INT} \
+            -pd true -mc ${MEMORY_COALESCING_BOOL} > "${NAME}.log" 2>&1
+
+        if [ ! -f "${NAME}_AI.c" ]; then
+            echo "ERROR : DawnCC did not write ${NAME}_AI.c (see ${WORK_DIR}/${NAME}.log)."
+            continue
+        fi
+
+        extract_prekernel "${NAME}_AI.c" > "${NAME}_pre.txt"
+        LINES=$(grep -c ';' "${NAME}_pre.txt")
+        CHECKS=$(grep -c 'RST_AI[0-9]* |=' "${NAME}_pre.txt")
+
+        if [ "${LINES}" -eq 0 ]; then
+            echo "WARNING : no code before the kernel of ${NAME}_AI.c."
+            continue
+        fi
+
+        write_driver ${P} ${E} "${NAME}_bench.c" "${NAME}_pre.txt"
+        if ! ${HOST_CC} -O2 -std=c99 "${NAME}_bench.c" -o "${NAME}_bench" >> "${NAME}.log" 2>&1; then
+            echo "ERROR : cannot compile ${NAME}_bench.c (see ${WORK_DIR}/${NAME}.log)."
+            continue
+        fi
+
+        read NS NET <<< "$(./${NAME}_bench ${REPETITIONS} ${LOOP_SIZE})"
+        printf "%-8s %-6s %-6s %-8s %-12s %-12s\n" "${P}" "${E}" "${LINES}" "${CHECKS}" "${NS}" "${NET}"
+    done
+done
+
+cd "${CURRENT_DIR}"
+
+#If configured to remove the kernels and the timed code
+if [ "${KEEP_WORK_DIR_BOOL}" == "false" ]; then
+    rm -rf "${WORK_DIR}"
+else
+    echo "Kernels and timed code kept in ${WORK_DIR}"
+fi
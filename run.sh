@@ -104,7 +104,11 @@ TEMP_FILE1="result.bc"
 TEMP_FILE2="result2.bc"
 TEMP_FILE3="result3.bc"
 LOG_FILE="out_pl.log"
+PEEL_LOG_FILE="out_peel.log"
+RUNTIME_LOG_FILE="out_rt.log"
+SPLIT_LOG_FILE="out_split.log"
 SCOPE_FILE_SUFFIX="_scope.dot"
+PRAGMAS_FILE_SUFFIX="_pragmas.txt"
 
 if [ ! -z $FILES_FOLDER ]; then
 
@@ -137,6 +141,11 @@ for f in $(find . -name '*.c' -or -name '*.cpp'); do
         if [ -f "${f}${SCOPE_FILE_SUFFIX}" ]; then
             rm "${f}${SCOPE_FILE_SUFFIX}"
         fi
+
+        #Delete file.ext_pragmas.txt if exists
+        if [ -f "${f}${PRAGMAS_FILE_SUFFIX}" ]; then
+            rm "${f}${PRAGMAS_FILE_SUFFIX}"
+        fi
     fi
 done
 fi
@@ -170,6 +179,11 @@ if [ ! -z $FILE ]; then
         if [ -f "${f}${SCOPE_FILE_SUFFIX}" ]; then
             rm "${f}${SCOPE_FILE_SUFFIX}"
         fi
+
+        #Delete file.ext_pragmas.txt if exists
+        if [ -f "${f}${PRAGMAS_FILE_SUFFIX}" ]; then
+            rm "${f}${PRAGMAS_FILE_SUFFIX}"
+        fi
     fi
 fi 
 
@@ -201,6 +215,21 @@ if [ "${KEEP_INTERMEDIARY_FILES_BOOL}" == "false" ]; then
     if [ -f "${LOG_FILE}" ]; then
         rm ${LOG_FILE}
     fi
+
+    #Delete out_peel.log
+    if [ -f "${PEEL_LOG_FILE}" ]; then
+        rm ${PEEL_LOG_FILE}
+    fi
+
+    #Delete out_rt.log
+    if [ -f "${RUNTIME_LOG_FILE}" ]; then
+        rm ${RUNTIME_LOG_FILE}
+    fi
+
+    #Delete out_split.log
+    if [ -f "${SPLIT_LOG_FILE}" ]; then
+        rm ${SPLIT_LOG_FILE}
+    fi
 fi
 
 cd ${CURRENT_DIR}